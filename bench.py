@@ -0,0 +1,217 @@
+#!/usr/bin/env python3
+
+# Benchmarks vhdl_parser and vhdl_analyzer on the synthetic corpus from
+# bench_corpus.py. Like test.py, this expects the binaries to have been built
+# and linked into the current directory (build-release.sh for numbers that
+# mean anything).
+#
+# Results are written as JSON so that runs on different commits can be
+# compared with --compare.
+
+import argparse
+import hashlib
+import json
+import math
+import os.path
+import subprocess
+import time
+
+import bench_corpus
+
+
+def percentile(sorted_values, p):
+    """Nearest-rank percentile of an already sorted list"""
+    rank = int(math.ceil(p / 100.0 * len(sorted_values)))
+    return sorted_values[max(rank, 1) - 1]
+
+
+def run_once(cmd, with_stats):
+    start = time.perf_counter()
+    subp = subprocess.run(cmd, stdout=subprocess.DEVNULL,
+                          stderr=subprocess.PIPE)
+    wall = time.perf_counter() - start
+
+    if subp.returncode != 0:
+        raise Exception("\"%s\" failed with exit code %d" %
+                        (" ".join(cmd), subp.returncode))
+    if not with_stats:
+        return wall, None
+    # --stats-json is the last thing printed to stderr
+    stats = json.loads(subp.stderr.decode('utf-8').splitlines()[-1])
+    return wall, stats
+
+
+def bench_one(cmd, path, runs, with_stats):
+    size = os.path.getsize(path)
+
+    # The first run warms up the page cache and is not counted
+    run_once(cmd, with_stats)
+    walls = []
+    in_process = []
+    peak_rss = 0
+    counters = {}
+    for i in range(runs):
+        wall, stats = run_once(cmd, with_stats)
+        walls.append(wall)
+        if not stats:
+            # Nothing is known about the time inside the process
+            in_process.append(wall)
+            continue
+        phases = stats["phases_us"]
+        in_process.append((phases.get("lex", 0) + phases.get("parse", 0) +
+                           phases.get("glr cleanup", 0)) / 1e6)
+        peak_rss = max(peak_rss, stats["peak_rss_bytes"])
+        counters = stats["counters"]
+    walls.sort()
+    in_process.sort()
+
+    median_wall = percentile(walls, 50)
+    # Rates are from the time spent in the C++ parser, so that process
+    # startup and printing the tree do not drown out small inputs
+    median_parse = max(percentile(in_process, 50), 1e-9)
+    return {
+        "bytes": size,
+        "tokens": counters.get("tokens", 0),
+        "nodes": counters.get("nodes", 0),
+        "runs": runs,
+        "wall_s": {
+            "min": walls[0],
+            "p50": median_wall,
+            "p90": percentile(walls, 90),
+            "p99": percentile(walls, 99),
+            "max": walls[-1],
+        },
+        "parse_s_p50": median_parse,
+        "mb_per_s": size / 1e6 / median_parse,
+        "tokens_per_s": counters.get("tokens", 0) / median_parse,
+        "nodes_per_s": counters.get("nodes", 0) / median_parse,
+        "peak_rss_bytes": peak_rss,
+    }
+
+
+def git_commit():
+    try:
+        subp = subprocess.run(["git", "rev-parse", "HEAD"],
+                              stdout=subprocess.PIPE,
+                              stderr=subprocess.DEVNULL)
+    except OSError:
+        return None
+    if subp.returncode != 0:
+        return None
+    return subp.stdout.decode('utf-8').strip()
+
+
+def corpus_hash(paths):
+    h = hashlib.sha256()
+    for name in sorted(paths):
+        with open(paths[name], 'rb') as f:
+            h.update(name.encode('utf-8') + b"\0" + f.read())
+    return h.hexdigest()
+
+
+def do_bench(args):
+    paths = bench_corpus.generate(args.corpus_dir, args.scale, args.seed)
+    results = {}
+    stats_args = [] if args.no_stats else ["--stats-json"]
+
+    for workload in bench_corpus.PARSER_WORKLOADS:
+        name = workload.__name__
+        print("Benchmarking vhdl_parser on \"%s\"..." % name)
+        results["vhdl_parser/" + name] = bench_one(
+            ["./vhdl_parser"] + stats_args + [paths[name]], paths[name],
+            args.runs, not args.no_stats)
+
+    for workload in bench_corpus.ANALYZER_WORKLOADS:
+        name = workload.__name__
+        print("Benchmarking vhdl_analyzer on \"%s\"..." % name)
+        results["vhdl_analyzer/" + name] = bench_one(
+            ["./vhdl_analyzer"] + stats_args + ["work", paths[name]],
+            paths[name], args.runs, not args.no_stats)
+
+    output = {
+        "commit": git_commit(),
+        "scale": args.scale,
+        "seed": args.seed,
+        "stats": not args.no_stats,
+        "corpus_sha256": corpus_hash(paths),
+        "results": results,
+    }
+    with open(args.output, 'w') as f:
+        json.dump(output, f, indent=4, sort_keys=True)
+        f.write("\n")
+
+    for key in sorted(results):
+        x = results[key]
+        print("%-32s %8.2f MB/s %12.0f tokens/s %12.0f nodes/s "
+              "p50 %7.1f ms p99 %7.1f ms %6.1f MB RSS" %
+              (key, x["mb_per_s"], x["tokens_per_s"], x["nodes_per_s"],
+               x["wall_s"]["p50"] * 1e3, x["wall_s"]["p99"] * 1e3,
+               x["peak_rss_bytes"] / 1e6))
+    print("Results written to \"%s\"" % args.output)
+
+
+# Metrics shown by --compare, and whether bigger is better
+COMPARED_METRICS = [
+    ("mb_per_s", True),
+    ("nodes_per_s", True),
+    ("wall_s.p50", False),
+    ("wall_s.p99", False),
+    ("peak_rss_bytes", False),
+    ("nodes", False),
+]
+
+
+def get_metric(result, metric):
+    for part in metric.split("."):
+        result = result[part]
+    return result
+
+
+def do_compare(old_fn, new_fn):
+    with open(old_fn) as f:
+        old = json.load(f)
+    with open(new_fn) as f:
+        new = json.load(f)
+
+    if old["corpus_sha256"] != new["corpus_sha256"]:
+        print("WARNING: the runs used different corpora")
+
+    for key in sorted(set(old["results"]) & set(new["results"])):
+        print(key)
+        for metric, bigger_is_better in COMPARED_METRICS:
+            a = get_metric(old["results"][key], metric)
+            b = get_metric(new["results"][key], metric)
+            change = (b - a) / a * 100 if a else 0.0
+            better = (change > 0) == bigger_is_better
+            print("    %-16s %14.4g -> %14.4g  %+7.1f%%%s" %
+                  (metric, a, b, change,
+                   "" if change == 0 else (" (better)" if better
+                                           else " (worse)")))
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description="Benchmark vhdl_parser and vhdl_analyzer")
+    parser.add_argument("--scale", type=int, default=4,
+                        help="size multiplier for the generated corpus")
+    parser.add_argument("--seed", type=int, default=1)
+    parser.add_argument("--runs", type=int, default=10,
+                        help="timed runs per input")
+    parser.add_argument("--corpus-dir", default="bench_corpus_out")
+    parser.add_argument("--no-stats", action="store_true",
+                        help="run without --stats-json (e.g. to see what "
+                        "the stats cost, or on builds that don't have it). "
+                        "Rates are then from the wall time.")
+    parser.add_argument("-o", "--output", default="bench_results.json")
+    parser.add_argument("--compare", nargs=2, metavar=("OLD", "NEW"),
+                        help="compare two result files instead of running")
+    args = parser.parse_args()
+
+    if args.compare:
+        do_compare(*args.compare)
+    else:
+        do_bench(args)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,214 @@
+#!/usr/bin/env python3
+
+# Generates synthetic VHDL for bench.py. The output only depends on the
+# workload, the scale and the seed, so results from different commits are
+# measured on exactly the same text.
+
+import argparse
+import os
+import os.path
+import random
+
+
+def _expr(rng, names, terms):
+    ops = ["+", "-", "and", "or", "xor", "&"]
+    ret = rng.choice(names)
+    for i in range(terms - 1):
+        if rng.randrange(8) == 0:
+            ret += " %s (%s %s %d)" % (rng.choice(ops), rng.choice(names),
+                                       rng.choice(ops), rng.randrange(256))
+        else:
+            ret += " %s %s" % (rng.choice(ops), rng.choice(names))
+    return ret
+
+
+def wide_entity(rng, scale):
+    """One entity with a very long port list, and an architecture that
+    connects all of it through component instantiations"""
+    ports = ["p%d" % i for i in range(200 * scale)]
+    out = ["library ieee;\nuse ieee.std_logic_1164.all;\n\n"]
+    out.append("entity wide is\n    generic (\n")
+    out.append(";\n".join("        G%d : integer := %d" % (i, rng.randrange(64))
+                          for i in range(16)))
+    out.append("\n    );\n    port (\n")
+    out.append(";\n".join("        %s : %s std_logic_vector(%d downto 0)" %
+                          (p, rng.choice(["in", "out", "inout"]),
+                           rng.randrange(1, 64)) for p in ports))
+    out.append("\n    );\nend entity;\n\n")
+    out.append("architecture rtl of wide is\n")
+    out.append("    component leaf is\n        port (a, b : in std_logic; "
+               "y : out std_logic);\n    end component;\nbegin\n")
+    for i in range(0, len(ports) - 2, 3):
+        out.append("    u%d : leaf port map (a => %s, b => %s, y => %s);\n" %
+                   (i, ports[i], ports[i + 1], ports[i + 2]))
+    out.append("end architecture;\n")
+    return "".join(out)
+
+
+def deep_generate(rng, scale):
+    """Generate statements nested inside each other"""
+    depth = 8 * scale
+    out = ["entity gen is\n    port (clk : in bit);\nend entity;\n\n"
+           "architecture rtl of gen is\n    signal s : bit_vector(63 downto 0);"
+           "\nbegin\n"]
+    for d in range(depth):
+        indent = "    " * (d + 1)
+        if d % 2 == 0:
+            out.append("%sg%d : for i%d in 0 to %d generate\n" %
+                       (indent, d, d, rng.randrange(1, 8)))
+        else:
+            out.append("%sg%d : if G%d > %d generate\n" %
+                       (indent, d, d, rng.randrange(16)))
+        out.append("%s    signal t%d : bit;\n%sbegin\n" % (indent, d, indent))
+        out.append("%s    t%d <= s(%d) xor clk;\n" %
+                   (indent, d, rng.randrange(64)))
+    for d in reversed(range(depth)):
+        # The parser needs the optional "end;" of the generate body to tell
+        # where the body stops
+        out.append("%send;\n%send generate;\n" %
+                   ("    " * (d + 1), "    " * (d + 1)))
+    out.append("end architecture;\n")
+    return "".join(out)
+
+
+def huge_case(rng, scale):
+    """A process with a case statement that has a very large number of
+    alternatives"""
+    alternatives = 500 * scale
+    out = ["entity decoder is\n    port (\n        sel : in integer;\n"
+           "        y : out bit_vector(31 downto 0)\n    );\nend entity;\n\n"
+           "architecture rtl of decoder is\nbegin\n"
+           "    process (sel)\n    begin\n        case sel is\n"]
+    for i in range(alternatives):
+        out.append("            when %d => y <= x\"%08X\";\n" %
+                   (i, rng.randrange(1 << 32)))
+    out.append("            when others => y <= (others => '0');\n"
+               "        end case;\n    end process;\nend architecture;\n")
+    return "".join(out)
+
+
+def big_aggregate(rng, scale):
+    """ROM contents written out as aggregates of literals"""
+    words = 1024 * scale
+    out = ["package rom_pkg is\n"
+           "    type rom_t is array (0 to %d) of bit_vector(15 downto 0);\n" %
+           (words - 1)]
+    out.append("    constant ROM : rom_t := (\n")
+    out.append(",\n".join("        x\"%04X\"" % rng.randrange(1 << 16)
+                          for i in range(words)))
+    out.append("\n    );\n")
+    out.append("    constant TABLE : integer_vector := (\n")
+    out.append(",\n".join("        %d => %d" % (i, rng.randrange(-1000, 1000))
+                          for i in range(words // 4)))
+    out.append("\n    );\nend package;\n")
+    return "".join(out)
+
+
+def many_packages(rng, scale):
+    """Lots of small packages with declarations, each using the ones before
+    it"""
+    count = 50 * scale
+    out = []
+    for p in range(count):
+        if p > 0:
+            out.append("use work.pkg%d.all;\n" % (p - 1))
+        out.append("package pkg%d is\n" % p)
+        out.append("    type state%d_t is (%s);\n" %
+                   (p, ", ".join("S%d_%d" % (p, i)
+                                 for i in range(rng.randrange(2, 12)))))
+        for c in range(rng.randrange(3, 10)):
+            out.append("    constant C%d_%d : integer := %d;\n" %
+                       (p, c, rng.randrange(1 << 16)))
+        out.append("    subtype word%d_t is bit_vector(%d downto 0);\n" %
+                   (p, rng.randrange(8, 64)))
+        out.append("    function f%d (a : integer) return integer;\n" % p)
+        out.append("end package;\n\n")
+        out.append("package body pkg%d is\n" % p)
+        out.append("    function f%d (a : integer) return integer is\n"
+                   "    begin\n        return a + C%d_0;\n    end function;\n"
+                   % (p, p))
+        out.append("end package body;\n\n")
+    return "".join(out)
+
+
+def long_expressions(rng, scale):
+    """Signal assignments with very long operator chains"""
+    names = ["a%d" % i for i in range(32)]
+    out = ["entity expr is\n    port (%s : in bit_vector(31 downto 0); "
+           "y : out bit_vector(31 downto 0));\nend entity;\n\n" %
+           ", ".join(names)]
+    out.append("architecture rtl of expr is\nbegin\n")
+    for i in range(20 * scale):
+        out.append("    y <= %s;\n" % _expr(rng, names, rng.randrange(50, 200)))
+    out.append("end architecture;\n")
+    return "".join(out)
+
+
+def analyzer_decls(rng, scale):
+    """Entities made only of the declarations that the analyzer currently
+    supports, so that vhdl_analyzer spends its time analyzing instead of
+    giving up"""
+    out = []
+    for e in range(100 * scale):
+        out.append("entity ent%d is\n" % e)
+        for t in range(rng.randrange(1, 6)):
+            literals = ["L%d" % rng.randrange(40)
+                        for i in range(rng.randrange(1, 16))]
+            out.append("    type t%d is (%s);\n" %
+                       (t, ", ".join(sorted(set(literals)))))
+            out.append("    subtype st%d is t%d;\n" % (t, t))
+            out.append("    constant c%d_a, c%d_b : t%d;\n" % (t, t, t))
+        out.append("begin end;\n\n")
+    return "".join(out)
+
+
+def many_overloads(rng, scale):
+    """One entity whose enumeration types all reuse a handful of literal
+    names, so that every name ends up with thousands of overloads"""
+    names = ["L%d" % i for i in range(8)] + ["'%s'" % c for c in "01XZ"]
+    out = ["entity overloads is\n"]
+    for t in range(2000 * scale):
+        literals = rng.sample(names, rng.randrange(1, 6))
+        out.append("    type t%d is (%s);\n" % (t, ", ".join(literals)))
+    out.append("begin end;\n")
+    return "".join(out)
+
+
+# Workloads for vhdl_parser, and the ones that also make sense for
+# vhdl_analyzer
+PARSER_WORKLOADS = [wide_entity, deep_generate, huge_case, big_aggregate,
+                    many_packages, long_expressions, analyzer_decls,
+                    many_overloads]
+ANALYZER_WORKLOADS = [analyzer_decls, many_overloads]
+
+
+def generate(out_dir, scale=1, seed=1):
+    """Writes every workload to out_dir and returns {name: path}"""
+    os.makedirs(out_dir, exist_ok=True)
+    ret = {}
+    for workload in PARSER_WORKLOADS:
+        # Each workload gets its own generator so that adding or changing
+        # one workload does not change the text of the others
+        rng = random.Random("%s/%d/%d" % (workload.__name__, scale, seed))
+        path = os.path.join(out_dir, "%s.vhd" % workload.__name__)
+        with open(path, 'w') as f:
+            f.write(workload(rng, scale))
+        ret[workload.__name__] = path
+    return ret
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description="Generate the synthetic benchmark corpus")
+    parser.add_argument("out_dir")
+    parser.add_argument("--scale", type=int, default=1)
+    parser.add_argument("--seed", type=int, default=1)
+    args = parser.parse_args()
+
+    for name, path in sorted(generate(args.out_dir, args.scale,
+                                      args.seed).items()):
+        print("%s: %s (%d bytes)" % (name, path, os.path.getsize(path)))
+
+
+if __name__ == '__main__':
+    main()
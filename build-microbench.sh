@@ -0,0 +1,23 @@
+#!/bin/bash
+
+set -xeuo pipefail
+
+# Microbenchmarks for the C++ parts of the parser (see
+# src/parser/bison/microbench.cpp). Built with the same flags as
+# build-release.sh, but in their own directory.
+mkdir -p build-microbench
+cd build-microbench
+bison -v -d -o vhdl_parser_yy.cpp ../src/parser/bison/vhdl_parser.y
+flex -o vhdl_lexer_ll.cpp ../src/parser/bison/vhdl_lexer.l
+g++ -std=c++11 -Wall -ggdb3 -O2 -c -I ../src/parser/bison -I . vhdl_parser_yy.cpp
+g++ -std=c++11 -Wall -ggdb3 -O2 -c -I ../src/parser/bison -I . vhdl_lexer_ll.cpp
+
+g++ -std=c++11 -Wall -ggdb3 -O2 -c -I ../src/parser/bison -I . ../src/parser/bison/vhdl_parse_tree.cpp
+g++ -std=c++11 -Wall -ggdb3 -O2 -c -I ../src/parser/bison -I . ../src/parser/bison/vhdl_parser_glue.cpp
+g++ -std=c++11 -Wall -ggdb3 -O2 -c -I ../src/parser/bison -I . ../src/parser/bison/util.cpp
+g++ -std=c++11 -Wall -ggdb3 -O2 -c -I ../src/parser/bison -I . ../src/parser/bison/microbench.cpp
+
+g++ -o microbench *.o
+cd ..
+
+ln -sf build-microbench/microbench
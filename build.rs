@@ -1,6 +1,7 @@
 extern crate bindgen;
 
 use std::env;
+use std::fs;
 use std::path::PathBuf;
 
 fn main() {
@@ -15,6 +16,23 @@ fn main() {
         .write_to_file(out_path.join("bindings.rs"))
         .expect("Couldn't write bindings!");
 
+    // Hash the parser sources (FNV-1a) so that the parse cache can tell
+    // trees produced by different versions of the parser apart
+    let mut parser_sources: Vec<_> = fs::read_dir("src/parser/bison")
+        .expect("Couldn't list parser sources")
+        .map(|x| x.unwrap().path())
+        .collect();
+    parser_sources.sort();
+    let mut parser_hash: u64 = 0xcbf29ce484222325;
+    for path in parser_sources {
+        println!("cargo:rerun-if-changed={}", path.display());
+        for b in fs::read(&path).expect("Couldn't read parser source") {
+            parser_hash ^= b as u64;
+            parser_hash = parser_hash.wrapping_mul(0x100000001b3);
+        }
+    }
+    println!("cargo:rustc-env=YAVHDL_PARSER_HASH={:016x}", parser_hash);
+    println!("cargo:rerun-if-changed=build.rs");
 
     println!("cargo:rustc-flags=-L build -l yavhdl_bison -l stdc++")
 }
@@ -0,0 +1,8 @@
+package test is
+    constant a : b := (x"00", x"1F", x"2a", x"FF", x"10");
+    constant c : d := ('0', '1', '1', '0');
+    constant e : f := (1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12);
+    constant g : h := (x"00", x"01", b"1", x"02");
+    constant i : j := ("ab", "cd", "ef", 16#FF#, 16#01#);
+    constant k : l := ('0', '1', m, '1');
+end;
@@ -0,0 +1,5 @@
+architecture test of e is
+begin
+    s <= f((x"00", x"01", x"02"), (x"00", x"01", 1));
+    s <= g(a(x"00", x"01"), (x"00", x"01", x"02", "11"));
+end;
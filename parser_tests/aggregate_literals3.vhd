@@ -0,0 +1,4 @@
+architecture test of e is
+begin
+    s <= (x"00", x"01", x"02")(1);
+end;
@@ -0,0 +1,8 @@
+architecture rtl of test is
+begin
+    u0 : entity work.cell port map (a => n1, b => n2, y => n3, clk => clk);
+    u1 : and2 generic map (WIDTH => W, DEPTH => D)
+        port map (A => x, B => y, Z => open, C => n4(3), D => E);
+    u2 : component or2 port map (a => n1, b => n2, y => n3, n5);
+    u3 : or2 port map (a => \ext id\, b => n2, y => n3);
+end;
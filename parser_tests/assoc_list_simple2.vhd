@@ -0,0 +1,4 @@
+architecture test of e is
+begin
+    u: c port map (a => b, c => d, e => f)(1);
+end;
@@ -0,0 +1,6 @@
+entity test is
+    constant a : b :=
+    a & b & c & d & e & f & g & h & i & j & k & l & m & n & o & p & q & r & s;
+    constant c : d := (a and b and c) and (d and e) or f or g xor h;
+    constant e : f := a + b - c + d + e + f - (g + h + i) + j;
+end;
@@ -24,6 +24,8 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 */
 
 use std::collections::HashMap;
+use std::collections::hash_map;
+use std::hash::{BuildHasher, Hash, Hasher};
 
 use analyzer::identifier::*;
 use analyzer::objpools::*;
@@ -113,9 +115,32 @@ impl ScopeItemName {
     }
 }
 
+// What two overloadable declarations with the same name must differ in
+#[derive(Clone, Eq, PartialEq, Hash, Debug)]
+pub struct ParameterResultTypeProfile {
+    pub result: Option<ObjPoolIndex<AstNode>>,
+    pub params: Vec<ObjPoolIndex<AstNode>>,
+}
+
+impl ParameterResultTypeProfile {
+    fn hash_value(&self) -> u64 {
+        let mut h = SymbolHashBuilder::default().build_hasher();
+        self.hash(&mut h);
+        h.finish()
+    }
+}
+
 #[derive(Debug)]
 pub struct Scope {
-    items: HashMap<ScopeItemName, Vec<ObjPoolIndex<AstNode>>>,
+    items: HashMap<ScopeItemName, Vec<ObjPoolIndex<AstNode>>,
+        SymbolHashBuilder>,
+    // The profile of each overloadable item, worked out once when it is added
+    profiles: HashMap<ObjPoolIndex<AstNode>, ParameterResultTypeProfile,
+        SymbolHashBuilder>,
+    // Overloadable items by name and profile hash, so that finding one with
+    // a given profile doesn't have to look at every overload of the name
+    by_profile_hash: HashMap<(ScopeItemName, u64), Vec<ObjPoolIndex<AstNode>>,
+        SymbolHashBuilder>,
 }
 
 impl Default for Scope {
@@ -126,7 +151,11 @@ impl Default for Scope {
 
 impl Scope {
     pub fn new() -> Scope {
-        Scope {items: HashMap::new()}
+        Scope {
+            items: HashMap::default(),
+            profiles: HashMap::default(),
+            by_profile_hash: HashMap::default(),
+        }
     }
 
     pub fn add(&mut self, name: ScopeItemName, item: ObjPoolIndex<AstNode>) {
@@ -139,6 +168,49 @@ impl Scope {
         self.items.insert(name, new_vec);
     }
 
+    pub fn add_overload(&mut self, name: ScopeItemName,
+        item: ObjPoolIndex<AstNode>, profile: ParameterResultTypeProfile) {
+
+        self.add(name, item);
+        self.by_profile_hash.entry((name, profile.hash_value()))
+            .or_insert_with(Vec::new).push(item);
+        self.profiles.insert(item, profile);
+    }
+
+    // Adds whatever kind of declaration node is
+    pub fn add_declaration(&mut self, name: ScopeItemName,
+        item: ObjPoolIndex<AstNode>, node: &AstNode) {
+
+        if node.is_an_overloadable_decl() {
+            self.add_overload(name, item, node.parameter_result_type_profile());
+        } else {
+            self.add(name, item);
+        }
+    }
+
+    pub fn profile(&self, item: ObjPoolIndex<AstNode>)
+        -> Option<&ParameterResultTypeProfile> {
+
+        self.profiles.get(&item)
+    }
+
+    // The overload of name with exactly this profile, if there is one
+    pub fn find_overload(&self, name: ScopeItemName,
+        profile: &ParameterResultTypeProfile) -> Option<ObjPoolIndex<AstNode>> {
+
+        match self.by_profile_hash.get(&(name, profile.hash_value())) {
+            Some(candidates) => candidates.iter().cloned()
+                .find(|x| self.profiles.get(x) == Some(profile)),
+            None => None,
+        }
+    }
+
+    pub fn iter(&self)
+        -> hash_map::Iter<ScopeItemName, Vec<ObjPoolIndex<AstNode>>> {
+
+        self.items.iter()
+    }
+
     pub fn get(&self, name: ScopeItemName)
         -> Option<&[ObjPoolIndex<AstNode>]> {
 
@@ -290,6 +362,26 @@ impl AstNode {
         }
     }
 
+    pub fn parameter_result_type_profile(&self)
+        -> ParameterResultTypeProfile {
+
+        match self {
+            &AstNode::EnumerationLitDecl {corresponding_type_decl, ..} => {
+                // Treat this as a function that takes no arguments and
+                // returns the type of the corresponding enum.
+
+                // TODO: subtypes
+
+                ParameterResultTypeProfile {
+                    result: Some(corresponding_type_decl),
+                    params: vec![],
+                }
+            }
+            _ => panic!("Don't know how to get parameter/result type \
+                         profile here!")
+        }
+    }
+
     pub fn loc(&self) -> Option<SourceLoc> {
         match self {
             &AstNode::EnumerationTypeDecl {loc, ..} => Some(loc),
@@ -570,6 +662,42 @@ mod tests {
         assert_eq!(test1_result[2], test1_node3);
     }
 
+    #[test]
+    fn scope_overload_profiles() {
+        let mut op = ObjPool::<AstNode>::new();
+
+        let mut test1_scope = Scope::new();
+        let test1_1 = ScopeItemName::CharLiteral(b'a');
+        let types: Vec<_> = (0..1000).map(|_| op.alloc()).collect();
+        let mut lits = Vec::new();
+        for (i, &t) in types.iter().enumerate() {
+            let lit = op.alloc();
+            *op.get_mut(lit) = AstNode::EnumerationLitDecl {
+                lit: EnumerationLiteral::CharLiteral(b'a'),
+                idx: i as i64,
+                corresponding_type_decl: t,
+            };
+            test1_scope.add_declaration(test1_1, lit, op.get(lit));
+            lits.push(lit);
+        }
+
+        assert_eq!(test1_scope.get(test1_1).unwrap(), &lits[..]);
+        for i in 0..1000 {
+            let profile = op.get(lits[i]).parameter_result_type_profile();
+            assert_eq!(test1_scope.profile(lits[i]), Some(&profile));
+            assert_eq!(test1_scope.find_overload(test1_1, &profile),
+                Some(lits[i]));
+            assert!(test1_scope.find_overload(
+                ScopeItemName::CharLiteral(b'b'), &profile).is_none());
+        }
+        let other_type = op.alloc();
+        assert!(test1_scope.find_overload(test1_1,
+            &ParameterResultTypeProfile {
+                result: Some(other_type),
+                params: vec![],
+            }).is_none());
+    }
+
     #[test]
     fn sourceloc_test() {
         let mut sp = StringPool::new();
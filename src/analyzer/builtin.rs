@@ -0,0 +1,73 @@
+/*
+Copyright (c) 2016-2017, Robert Ou <rqou@robertou.com>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice,
+   this list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+// The libraries that every design can use without analyzing them first (STD
+// and IEEE). They are compiled into the binary as snapshots in the compiled
+// library format (see libfile.rs), so startup only reads their indices.
+// Units are decoded when they are first looked up, and user libraries go on
+// top as usual.
+//
+// A snapshot is regenerated with
+//   vhdl_analyzer --snapshot src/analyzer/builtin/<lib>.yvl <lib> files...
+// The analyzer can't analyze packages yet, so for now the snapshots are
+// empty, and empty libraries are left out of the design database.
+
+use analyzer::core::*;
+use analyzer::design::*;
+use analyzer::identifier::*;
+use analyzer::libfile::*;
+
+static BUILTIN_LIBRARIES: &'static [(&'static str, &'static [u8])] = &[
+    ("std", include_bytes!("builtin/std.yvl")),
+    ("ieee", include_bytes!("builtin/ieee.yvl")),
+];
+
+pub fn populate_builtins(s: &mut AnalyzerCoreStateBlob) {
+    for &(name, bytes) in BUILTIN_LIBRARIES {
+        // The test below makes sure that this can't fail
+        let file = LibraryFile::from_static(name, bytes).unwrap();
+        if file.is_empty() {
+            continue;
+        }
+
+        let id = Identifier::new_unicode(&mut s.sp, name, false).unwrap();
+        let lib = s.op_l.alloc();
+        *s.op_l.get_mut(lib) = Library::new(id);
+        s.op_l.get_mut(lib).set_compiled(file);
+        s.design_db.add_library(id, lib);
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn builtin_snapshots_are_valid() {
+        for &(name, bytes) in BUILTIN_LIBRARIES {
+            assert!(LibraryFile::from_static(name, bytes).is_ok());
+        }
+    }
+}
@@ -26,12 +26,13 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 use analyzer::ast::*;
 use analyzer::design::*;
 use analyzer::identifier::*;
+use analyzer::libfile::*;
 use analyzer::objpools::*;
 use analyzer::util::*;
 
 use parser::*;
 
-use std::collections::HashSet;
+use std::collections::{HashMap, HashSet};
 use std::ffi::OsStr;
 
 pub struct AnalyzerCoreStateBlob {
@@ -53,7 +54,15 @@ pub struct AnalyzerCoreStateBlob {
     work_lib: Option<ObjPoolIndex<Library>>,
     current_file_name: Option<StringPoolIndexOsStr>,
     innermost_scope: Option<ObjPoolIndex<ScopeChainNode>>,
-    blacklisted_names: HashSet<ScopeItemName>,
+    visibility: HashMap<ObjPoolIndex<ScopeChainNode>, VisibilityTable,
+        SymbolHashBuilder>,
+    blacklisted_names: HashSet<ScopeItemName, SymbolHashBuilder>,
+
+    // Where the nodes, scopes and scope chain nodes of each design unit live
+    // (see with_unit_segment)
+    next_segment: u32,
+    unit_segments: HashMap<ObjPoolIndex<AstNode>, PoolSegment,
+        SymbolHashBuilder>,
 }
 
 impl AnalyzerCoreStateBlob {
@@ -72,11 +81,65 @@ impl AnalyzerCoreStateBlob {
             work_lib: None,
             current_file_name: None,
             innermost_scope: None,
-            blacklisted_names: HashSet::new(),
+            visibility: HashMap::default(),
+            blacklisted_names: HashSet::default(),
+
+            next_segment: 1,
+            unit_segments: HashMap::default(),
         }
     }
 }
 
+// Runs f with everything it allocates in op_n, op_s and op_sc going into a
+// segment of its own. f returns the design unit it made, if any, and the
+// segment then belongs to that unit until free_design_unit is called on it.
+// If f didn't make a unit, nothing it allocated can be reachable, so the
+// segment is freed right away.
+pub fn with_unit_segment<R, F>(s: &mut AnalyzerCoreStateBlob, f: F) -> R
+    where F: FnOnce(&mut AnalyzerCoreStateBlob)
+        -> (R, Option<ObjPoolIndex<AstNode>>) {
+
+    let segment = PoolSegment::new(s.next_segment);
+    s.next_segment += 1;
+    let prev_n = s.op_n.set_segment(segment);
+    let prev_s = s.op_s.set_segment(segment);
+    let prev_sc = s.op_sc.set_segment(segment);
+
+    let (ret, unit) = f(s);
+
+    s.op_n.set_segment(prev_n);
+    s.op_s.set_segment(prev_s);
+    s.op_sc.set_segment(prev_sc);
+    match unit {
+        Some(unit) => {
+            s.unit_segments.insert(unit, segment);
+        },
+        None => free_segment(s, segment),
+    }
+
+    ret
+}
+
+// Frees everything that was allocated for the design unit. The unit must
+// already have been taken out of its library. Indices into it that are
+// still around somewhere panic when they are used.
+pub fn free_design_unit(s: &mut AnalyzerCoreStateBlob,
+    unit: ObjPoolIndex<AstNode>) {
+
+    if let Some(segment) = s.unit_segments.remove(&unit) {
+        free_segment(s, segment);
+    }
+    // These may point into the segment
+    s.innermost_scope = None;
+    s.visibility.clear();
+}
+
+fn free_segment(s: &mut AnalyzerCoreStateBlob, segment: PoolSegment) {
+    s.op_n.free_segment(segment);
+    s.op_s.free_segment(segment);
+    s.op_sc.free_segment(segment);
+}
+
 
 fn dump_current_location(s: &mut AnalyzerCoreStateBlob, pt: &VhdlParseTreeNode,
     is_err: bool) {
@@ -118,56 +181,6 @@ fn analyze_identifier(s: &mut AnalyzerCoreStateBlob, pt: &VhdlParseTreeNode)
     }
 }
 
-#[derive(Eq)]
-struct ParameterResultTypeProfile {
-    result: Option<ObjPoolIndex<AstNode>>,
-    params: Vec<ObjPoolIndex<AstNode>>,
-}
-
-impl PartialEq for ParameterResultTypeProfile {
-    fn eq(&self, other: &ParameterResultTypeProfile) -> bool {
-        // Compare arg count
-        if self.params.len() != other.params.len() {
-            return false;
-        }
-
-        // Compare args
-        for i in 0..self.params.len() {
-            if self.params[i] != other.params[i] {
-                return false;
-            }
-        }
-
-        // Compare return type
-        if self.result != other.result {
-            return false;
-        }
-
-        true
-    }
-}
-
-fn get_parameter_result_type_profile(s: &AnalyzerCoreStateBlob,
-    node_idx: ObjPoolIndex<AstNode>) -> ParameterResultTypeProfile {
-
-    let node = s.op_n.get(node_idx);
-    match node {
-        &AstNode::EnumerationLitDecl {corresponding_type_decl, ..} => {
-            // Treat this as a function that takes no arguments and returns the
-            // type of the corresponding enum.
-
-            // TODO: subtypes
-
-            ParameterResultTypeProfile {
-                result: Some(corresponding_type_decl),
-                params: vec![],
-            }
-        }
-        _ =>
-            panic!("Don't know how to get parameter/result type profile here!")
-    }
-}
-
 fn try_add_declaration(s: &mut AnalyzerCoreStateBlob, name: ScopeItemName,
     node: ObjPoolIndex<AstNode>, scope: ObjPoolIndex<Scope>) -> bool {
 
@@ -176,7 +189,8 @@ fn try_add_declaration(s: &mut AnalyzerCoreStateBlob, name: ScopeItemName,
     let has_existing = s.op_s.get(scope).get(name).is_some();
     if !has_existing {
         // We are adding a new thing; this should always work
-        s.op_s.get_mut(scope).add(name, node);
+        s.op_s.get_mut(scope).add_declaration(name, node, s.op_n.get(node));
+        note_declaration(s, name, scope);
         true
     } else {
         let found_conflict = {
@@ -192,30 +206,27 @@ fn try_add_declaration(s: &mut AnalyzerCoreStateBlob, name: ScopeItemName,
 
             if !(existing_overloadable && this_overloadable) {
                 // Definitely fail
-                true
+                None
             } else {
                 // Both are overloadable
 
-                // Check the type profiles
+                // Check the type profiles. The scope has them indexed, so
+                // this doesn't depend on how many overloads there are.
                 let typeprof_of_new =
-                    get_parameter_result_type_profile(s, node);
-                let mut found_conflict = false;
-                for existing_i in existing {
-                    let typeprof_of_existing =
-                        get_parameter_result_type_profile(s, *existing_i);
-
-                    if typeprof_of_new == typeprof_of_existing {
-                        found_conflict = true;
-                        break;
-                    }
-                }
+                    s.op_n.get(node).parameter_result_type_profile();
+                if s.op_s.get(scope).find_overload(name, &typeprof_of_new)
+                    .is_some() {
 
-                found_conflict
+                    None
+                } else {
+                    Some(typeprof_of_new)
+                }
             }
         };
 
-        if !found_conflict {
-            s.op_s.get_mut(scope).add(name, node);
+        if let Some(typeprof_of_new) = found_conflict {
+            s.op_s.get_mut(scope).add_overload(name, node, typeprof_of_new);
+            note_declaration(s, name, scope);
             true
         } else {
             false
@@ -337,14 +348,16 @@ fn analyze_type_decl(s: &mut AnalyzerCoreStateBlob,
     true
 }
 
-fn walk_scope_chain(s: &mut AnalyzerCoreStateBlob, item: ScopeItemName)
+fn walk_scope_chain(s: &AnalyzerCoreStateBlob,
+    start: Option<ObjPoolIndex<ScopeChainNode>>, item: ScopeItemName)
     -> Option<Vec<ObjPoolIndex<AstNode>>> {
 
     let mut ret = vec![];
-    let mut cur_scope_node = s.innermost_scope;
+    let mut cur_scope_node = start;
     let mut looking_for_overloadable = false;
     let mut first_time = true;
-    let mut used_param_result_type_profiles = vec![];
+    let mut used_param_result_type_profiles =
+        HashSet::<&ParameterResultTypeProfile, SymbolHashBuilder>::default();
     while cur_scope_node.is_some() {
         let cur_scope_node_ = s.op_sc.get(cur_scope_node.unwrap());
         if let &ScopeChainNode::X{this_scope, parent} = cur_scope_node_ {
@@ -378,27 +391,15 @@ fn walk_scope_chain(s: &mut AnalyzerCoreStateBlob, item: ScopeItemName)
                     // isn't already shadowed is good
 
                     for &maybe_found_i in maybe_found_thing {
-                        let this_param_result_profile =
-                            get_parameter_result_type_profile(s,
-                                maybe_found_i);
-
-                        let mut matched = false;
-                        for other_param_result_profile in
-                            &used_param_result_type_profiles {
-
-                            if this_param_result_profile ==
-                                *other_param_result_profile {
+                        let this_param_result_profile = s.op_s.get(this_scope)
+                            .profile(maybe_found_i)
+                            .expect("overloadable item without a profile");
 
-                                matched = true;
-                                break;
-                            }
-                        }
+                        if used_param_result_type_profiles.insert(
+                            this_param_result_profile) {
 
-                        if !matched {
                             // We can add it
                             ret.push(maybe_found_i);
-                            used_param_result_type_profiles.push(
-                                this_param_result_profile);
                         }
                     }
                 }
@@ -417,6 +418,85 @@ fn walk_scope_chain(s: &mut AnalyzerCoreStateBlob, item: ScopeItemName)
     }
 }
 
+// What names mean when looked up from one declarative region, with the scope
+// chain already walked, so that finding a name again is one probe no matter
+// how deeply the region is nested. Names made visible by use clauses go in
+// the same table, since the use scope is part of the chain. A region starts
+// out with everything its parent region had already looked up, except for
+// names that its own scope hides. Declaring a name in any scope of the chain
+// drops that name from the table, so it is walked again the next time.
+struct VisibilityTable {
+    scopes: Vec<ObjPoolIndex<Scope>>,
+    names: HashMap<ScopeItemName, Option<Vec<ObjPoolIndex<AstNode>>>,
+        SymbolHashBuilder>,
+}
+
+// Makes scope the innermost declarative region
+fn enter_region(s: &mut AnalyzerCoreStateBlob, scope: ObjPoolIndex<Scope>)
+    -> ObjPoolIndex<ScopeChainNode> {
+
+    let parent = s.innermost_scope;
+    let sc = s.op_sc.alloc();
+    *s.op_sc.get_mut(sc) = ScopeChainNode::X {
+        this_scope: scope,
+        parent: parent,
+    };
+
+    let mut table = match parent {
+        Some(parent) => {
+            let parent_table = s.visibility.get(&parent)
+                .expect("region entered without a visibility table");
+            VisibilityTable {
+                scopes: parent_table.scopes.clone(),
+                names: parent_table.names.clone(),
+            }
+        },
+        None => VisibilityTable {
+            scopes: Vec::new(),
+            names: HashMap::default(),
+        },
+    };
+    table.scopes.push(scope);
+    for (name, _) in s.op_s.get(scope).iter() {
+        table.names.remove(name);
+    }
+
+    s.visibility.insert(sc, table);
+    s.innermost_scope = Some(sc);
+    sc
+}
+
+fn note_declaration(s: &mut AnalyzerCoreStateBlob, name: ScopeItemName,
+    scope: ObjPoolIndex<Scope>) {
+
+    for (_, table) in s.visibility.iter_mut() {
+        if table.scopes.contains(&scope) {
+            table.names.remove(&name);
+        }
+    }
+}
+
+fn find_visible(s: &mut AnalyzerCoreStateBlob, item: ScopeItemName)
+    -> Option<Vec<ObjPoolIndex<AstNode>>> {
+
+    let region = match s.innermost_scope {
+        Some(x) => x,
+        None => return None,
+    };
+    if let Some(known) = s.visibility.get(&region)
+        .and_then(|table| table.names.get(&item)) {
+
+        debug_assert!(*known == walk_scope_chain(s, Some(region), item));
+        return known.clone();
+    }
+
+    let ret = walk_scope_chain(s, Some(region), item);
+    if let Some(table) = s.visibility.get_mut(&region) {
+        table.names.insert(item, ret.clone());
+    }
+    ret
+}
+
 fn analyze_designator(s: &mut AnalyzerCoreStateBlob, pt: &VhdlParseTreeNode)
     -> ScopeItemName {
 
@@ -459,7 +539,7 @@ fn analyze_name(s: &mut AnalyzerCoreStateBlob, pt: &VhdlParseTreeNode)
                 return None;
             }
 
-            walk_scope_chain(s, designator)
+            find_visible(s, designator)
         },
 
         // selected_name
@@ -678,7 +758,8 @@ fn analyze_constant_decl(s: &mut AnalyzerCoreStateBlob,
 }
 
 fn analyze_interface_item(s: &mut AnalyzerCoreStateBlob,
-    pt: &VhdlParseTreeNode, used_names: &mut HashSet<Identifier>,
+    pt: &VhdlParseTreeNode,
+    used_names: &mut HashSet<Identifier, SymbolHashBuilder>,
     output_vec: &mut Vec<ObjPoolIndex<AstNode>>) -> bool {
 
     match pt.node_type {
@@ -729,7 +810,8 @@ fn analyze_interface_item(s: &mut AnalyzerCoreStateBlob,
 }
 
 fn analyze_parameter_interface_list_real(s: &mut AnalyzerCoreStateBlob,
-    pt: &VhdlParseTreeNode, used_names: &mut HashSet<Identifier>,
+    pt: &VhdlParseTreeNode,
+    used_names: &mut HashSet<Identifier, SymbolHashBuilder>,
     output_vec: &mut Vec<ObjPoolIndex<AstNode>>) -> bool{
 
     match pt.node_type {
@@ -758,7 +840,7 @@ fn analyze_parameter_interface_list(s: &mut AnalyzerCoreStateBlob,
     pt: &VhdlParseTreeNode) -> Option<Vec<ObjPoolIndex<AstNode>>> {
 
     let mut ret = vec![];
-    let mut arg_names = HashSet::new();
+    let mut arg_names = HashSet::default();
 
     if !analyze_parameter_interface_list_real(s, pt,
         &mut arg_names, &mut ret) {
@@ -804,10 +886,9 @@ fn analyze_subprogram_spec(s: &mut AnalyzerCoreStateBlob,
             let internal_name =
                 format!("__internal_anon_{}", s.internal_name_count);
             s.internal_name_count += 1;
-            let mut internal_designator_id =
+            let internal_designator_id =
                 Identifier::new_unicode(&mut s.sp, internal_name.as_str(),
-                    true).unwrap();
-            internal_designator_id.is_internal = true;
+                    true).unwrap().internal();
             let internal_designator =
                 ScopeItemName::Identifier(internal_designator_id);
 
@@ -896,11 +977,10 @@ fn analyze_declaration_list(s: &mut AnalyzerCoreStateBlob,
     }
 }
 
-fn analyze_entity(s: &mut AnalyzerCoreStateBlob, pt: &VhdlParseTreeNode,
-    tgt_scope: ObjPoolIndex<Scope>) -> bool {
-
-    // Location information
-    let loc = pt_loc(s, pt);
+// The part of analyzing an entity that depends on what else is in the
+// library. Returns the name if the entity can go on to be analyzed.
+fn check_entity_name(s: &mut AnalyzerCoreStateBlob, pt: &VhdlParseTreeNode)
+    -> Option<Identifier> {
 
     // Our name
     let id = analyze_identifier(s, &pt.pieces[0].as_ref().unwrap());
@@ -913,13 +993,14 @@ fn analyze_entity(s: &mut AnalyzerCoreStateBlob, pt: &VhdlParseTreeNode,
             dump_current_location(s, pt, true);
             s.errors +=
                 "ERROR: Name at end of entity must match name at beginning\n";
-            return false;
+            return None;
         }
     }
 
     // Check for duplicate entity
     // FIXME: Probably have to replace existing one at some point???
-    let old_node_idx = s.op_l.get(s.work_lib.unwrap()).find_design_unit(id);
+    let work_lib = s.work_lib.unwrap();
+    let old_node_idx = find_design_unit_loading(s, work_lib, id);
     if old_node_idx.is_some() {
         dump_current_location(s, pt, true);
         s.errors += &format!(
@@ -932,9 +1013,23 @@ fn analyze_entity(s: &mut AnalyzerCoreStateBlob, pt: &VhdlParseTreeNode,
                 old_loc.format_for_error(&s.sp));
         }
 
-        return false;
+        return None;
     }
 
+    Some(id)
+}
+
+fn analyze_entity(s: &mut AnalyzerCoreStateBlob, pt: &VhdlParseTreeNode,
+    tgt_scope: ObjPoolIndex<Scope>) -> bool {
+
+    // Location information
+    let loc = pt_loc(s, pt);
+
+    let id = match check_entity_name(s, pt) {
+        Some(x) => x,
+        None => return false,
+    };
+
     // Create scopes and chain them up properly.
     // FIXME: Do note that we cheat a bunch here and don't pop off scope chain
     // nodes when things fail. This is fine because the next design unit
@@ -942,23 +1037,8 @@ fn analyze_entity(s: &mut AnalyzerCoreStateBlob, pt: &VhdlParseTreeNode,
     // to remove these on success except on toplevel design units.
     let use_scope = s.op_s.alloc();
     let decl_scope = s.op_s.alloc();
-    let use_sc = s.op_sc.alloc();
-    let decl_sc = s.op_sc.alloc();
-    {
-        let use_sc_ = s.op_sc.get_mut(use_sc);
-        *use_sc_ = ScopeChainNode::X {
-            this_scope: use_scope,
-            parent: s.innermost_scope
-        };
-    }
-    {
-        let decl_sc_ = s.op_sc.get_mut(decl_sc);
-        *decl_sc_ = ScopeChainNode::X {
-            this_scope: decl_scope,
-            parent: Some(use_sc),
-        }
-    }
-    s.innermost_scope = Some(decl_sc);
+    enter_region(s, use_scope);
+    let decl_sc = enter_region(s, decl_scope);
 
     // Set up the actual entity object
     let e_ = s.op_n.alloc();
@@ -972,6 +1052,7 @@ fn analyze_entity(s: &mut AnalyzerCoreStateBlob, pt: &VhdlParseTreeNode,
         };
     }
     s.op_s.get_mut(tgt_scope).add(ScopeItemName::Identifier(id), e_);
+    note_declaration(s, ScopeItemName::Identifier(id), tgt_scope);
 
     // TODO
 
@@ -992,19 +1073,28 @@ fn analyze_entity(s: &mut AnalyzerCoreStateBlob, pt: &VhdlParseTreeNode,
 fn analyze_design_unit(s: &mut AnalyzerCoreStateBlob, pt: &VhdlParseTreeNode)
     -> bool {
 
+    with_unit_segment(s, |s| {
+        let no_errors = analyze_design_unit_contents(s, pt);
+        // On success, the unit was the last thing added to the library
+        let unit = if no_errors {
+            s.op_l.get(s.work_lib.unwrap()).design_units().last().cloned()
+        } else {
+            None
+        };
+        (no_errors, unit)
+    })
+}
+
+fn analyze_design_unit_contents(s: &mut AnalyzerCoreStateBlob,
+    pt: &VhdlParseTreeNode) -> bool {
+
     let mut no_errors = true;
     
     // Root declarative region
-    let root_decl_region = s.op_sc.alloc();
     let root_decl_region_scope = s.op_s.alloc();
-    {
-        let root_decl_region_ = s.op_sc.get_mut(root_decl_region);
-        *root_decl_region_ = ScopeChainNode::X {
-            this_scope: root_decl_region_scope,
-            parent: None,
-        };
-    }
-    s.innermost_scope = Some(root_decl_region);
+    s.innermost_scope = None;
+    s.visibility.clear();
+    enter_region(s, root_decl_region_scope);
 
     // Not implemented
     assert!(pt.pieces[1].is_none());
@@ -1021,6 +1111,19 @@ fn analyze_design_unit(s: &mut AnalyzerCoreStateBlob, pt: &VhdlParseTreeNode)
 }
 
 
+// The PT_DESIGN_UNITs of a PT_DESIGN_FILE or PT_DESIGN_UNIT, in order
+pub fn design_units_of(pt: &VhdlParseTreeNode) -> Vec<&VhdlParseTreeNode> {
+    let mut ret = Vec::new();
+    let mut pt = pt;
+    while pt.node_type == ParseTreeNodeType::PT_DESIGN_FILE {
+        ret.push(pt.pieces[1].as_ref().unwrap());
+        pt = pt.pieces[0].as_ref().unwrap();
+    }
+    ret.push(pt);
+    ret.reverse();
+    ret
+}
+
 // Analyzes PT_DESIGN_FILE or PT_DESIGN_UNIT
 fn analyze_design_file(s: &mut AnalyzerCoreStateBlob, pt: &VhdlParseTreeNode)
     -> bool {
@@ -1053,12 +1156,71 @@ fn analyze_design_file(s: &mut AnalyzerCoreStateBlob, pt: &VhdlParseTreeNode)
 pub fn vhdl_analyze_file(s: &mut AnalyzerCoreStateBlob, pt: &VhdlParseTreeNode,
     work_lib: ObjPoolIndex<Library>, file_name: &OsStr) -> bool {
 
+    begin_file(s, work_lib, file_name);
+    analyze_design_file(s, pt)
+}
+
+fn begin_file(s: &mut AnalyzerCoreStateBlob, work_lib: ObjPoolIndex<Library>,
+    file_name: &OsStr) {
+
     let fn_str_idx = s.sp.add_osstr(file_name);
     s.work_lib = Some(work_lib);
     s.current_file_name = Some(fn_str_idx);
     s.innermost_scope = None;
+    s.visibility.clear();
 
-    analyze_design_file(s, pt)
+    // Whatever this file had in it before is being replaced
+    if let Some(compiled) = s.op_l.get_mut(work_lib).compiled_mut() {
+        compiled.forget_source(file_name);
+    }
+    stamp_source(s, work_lib, file_name);
+}
+
+// The same as vhdl_analyze_file, but for one of the design units returned by
+// design_units_of. Analyzing every unit of a file in order with this gives
+// the same result as analyzing the file.
+pub fn vhdl_analyze_design_unit(s: &mut AnalyzerCoreStateBlob,
+    pt: &VhdlParseTreeNode, work_lib: ObjPoolIndex<Library>,
+    file_name: &OsStr) -> bool {
+
+    begin_file(s, work_lib, file_name);
+    analyze_design_unit(s, pt)
+}
+
+// Does only the checks of vhdl_analyze_design_unit that depend on other
+// design units in the library (i.e. that the name is not taken). If this
+// returns true, analyzing the unit against any other state gives the same
+// result as it would have here. Used to analyze files in parallel.
+pub fn vhdl_check_design_unit_name(s: &mut AnalyzerCoreStateBlob,
+    pt: &VhdlParseTreeNode, work_lib: ObjPoolIndex<Library>,
+    file_name: &OsStr) -> bool {
+
+    begin_file(s, work_lib, file_name);
+
+    // Not implemented
+    assert!(pt.pieces[1].is_none());
+
+    match pt.pieces[0].as_ref().unwrap().node_type {
+        ParseTreeNodeType::PT_ENTITY =>
+            check_entity_name(s, &pt.pieces[0].as_ref().unwrap()).is_some(),
+        _ => panic!("Don't know how to handle this parse tree node!")
+    }
+}
+
+// The name a design unit returned by design_units_of would be added to the
+// library under, whether or not it would analyze successfully
+pub fn design_unit_name(s: &mut AnalyzerCoreStateBlob, pt: &VhdlParseTreeNode)
+    -> Identifier {
+
+    // Not implemented
+    assert!(pt.pieces[1].is_none());
+
+    let unit_pt = pt.pieces[0].as_ref().unwrap();
+    match unit_pt.node_type {
+        ParseTreeNodeType::PT_ENTITY =>
+            analyze_identifier(s, &unit_pt.pieces[0].as_ref().unwrap()),
+        _ => panic!("Don't know how to handle this parse tree node!")
+    }
 }
 
 #[cfg(test)]
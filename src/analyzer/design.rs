@@ -24,9 +24,11 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 */
 
 use std::collections::HashMap;
+use std::ffi::{OsStr, OsString};
 
 use analyzer::ast::*;
 use analyzer::identifier::*;
+use analyzer::libfile::*;
 use analyzer::objpools::*;
 
 #[derive(Debug)]
@@ -35,8 +37,15 @@ pub enum Library {
     X {
         id: Identifier,
 
-        db_by_name: HashMap<Identifier, ObjPoolIndex<AstNode>>,
+        db_by_name: HashMap<Identifier, ObjPoolIndex<AstNode>,
+            SymbolHashBuilder>,
         db_by_order: Vec<ObjPoolIndex<AstNode>>,
+
+        // Units that haven't been loaded from disk yet (see libfile.rs)
+        compiled: Option<LibraryFile>,
+        // What each source file looked like when it was last analyzed or
+        // had units loaded from the compiled library
+        source_stamps: HashMap<OsString, SourceStamp>,
     }
 }
 
@@ -50,8 +59,53 @@ impl Library {
     pub fn new(id: Identifier) -> Library {
         Library::X {
             id: id,
-            db_by_name: HashMap::new(),
+            db_by_name: HashMap::default(),
             db_by_order: Vec::new(),
+            compiled: None,
+            source_stamps: HashMap::new(),
+        }
+    }
+
+    pub fn set_compiled(&mut self, file: LibraryFile) {
+        match self {
+            &mut Library::Invalid => panic!("use of Invalid library"),
+            &mut Library::X {ref mut compiled, ..} => {
+                *compiled = Some(file);
+            }
+        }
+    }
+
+    pub fn compiled_mut(&mut self) -> Option<&mut LibraryFile> {
+        match self {
+            &mut Library::Invalid => panic!("use of Invalid library"),
+            &mut Library::X {ref mut compiled, ..} => compiled.as_mut(),
+        }
+    }
+
+    pub fn source_stamp(&self, file_name: &OsStr) -> Option<SourceStamp> {
+        match self {
+            &Library::Invalid => panic!("use of Invalid library"),
+            &Library::X {ref source_stamps, ..} =>
+                source_stamps.get(file_name).cloned(),
+        }
+    }
+
+    // None forgets the stamp, e.g. because the file couldn't be read
+    pub fn set_source_stamp(&mut self, file_name: &OsStr,
+        stamp: Option<SourceStamp>) {
+
+        match self {
+            &mut Library::Invalid => panic!("use of Invalid library"),
+            &mut Library::X {ref mut source_stamps, ..} => {
+                match stamp {
+                    Some(x) => {
+                        source_stamps.insert(file_name.to_owned(), x);
+                    },
+                    None => {
+                        source_stamps.remove(file_name);
+                    },
+                }
+            }
         }
     }
 
@@ -79,6 +133,33 @@ impl Library {
         }
     }
 
+    // Takes a design unit back out, e.g. because the file it came from has
+    // changed. The node itself is left in the pool until free_design_unit.
+    pub fn remove_design_unit(&mut self, unit: ObjPoolIndex<AstNode>) {
+        match self {
+            &mut Library::Invalid => panic!("use of Invalid library"),
+            &mut Library::X {ref mut db_by_name, ref mut db_by_order, ..} => {
+                db_by_name.retain(|_, x| *x != unit);
+                db_by_order.retain(|x| *x != unit);
+            }
+        }
+    }
+
+    pub fn id(&self) -> Identifier {
+        match self {
+            &Library::Invalid => panic!("use of Invalid library"),
+            &Library::X {id, ..} => id,
+        }
+    }
+
+    // In the order they were added
+    pub fn design_units(&self) -> &[ObjPoolIndex<AstNode>] {
+        match self {
+            &Library::Invalid => panic!("use of Invalid library"),
+            &Library::X {ref db_by_order, ..} => db_by_order,
+        }
+    }
+
     pub fn debug_print(&self, sp: &StringPool, op_n: &ObjPool<AstNode>,
         op_s: &ObjPool<Scope>) -> String {
 
@@ -113,22 +194,18 @@ impl Library {
 
 #[derive(Debug)]
 pub struct DesignDatabase {
-    db_by_name: HashMap<Identifier, ObjPoolIndex<Library>>,
+    db_by_name: HashMap<Identifier, ObjPoolIndex<Library>, SymbolHashBuilder>,
     db_by_order: Vec<ObjPoolIndex<Library>>,
 }
 
 impl DesignDatabase {
     pub fn new() -> DesignDatabase {
         DesignDatabase {
-            db_by_name: HashMap::new(),
+            db_by_name: HashMap::default(),
             db_by_order: Vec::new(),
         }
     }
 
-    pub fn populate_builtins(&mut self) {
-        // TODO
-    }
-
     pub fn add_library(&mut self,
         name: Identifier, unit: ObjPoolIndex<Library>) {
 
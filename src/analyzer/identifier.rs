@@ -23,42 +23,91 @@ OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
 OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 */
 
-use std::hash::{Hash, Hasher};
+use std::hash::{BuildHasherDefault, Hash, Hasher};
 
 use analyzer::objpools::*;
-use analyzer::util::*;
 
-#[derive(Copy, Clone, Eq, Debug)]
+const EXTENDED_ID_FLAG: u32 = 1 << 31;
+const INTERNAL_FLAG: u32 = 1 << 30;
+
+#[derive(Copy, Clone, Debug)]
 pub struct Identifier {
     pub orig_name: StringPoolIndexLatin1,
-    pub canonical_name: StringPoolIndexLatin1,
-    pub is_extended_id: bool,
-    pub is_internal: bool,
+    // Symbol number of the canonical name, with the flags in the top bits (see
+    // MAX_STRING_SYMBOLS). Comparing and hashing only look at this.
+    key: u32,
 }
 
 impl PartialEq for Identifier {
     fn eq(&self, other: &Identifier) -> bool {
-        (self.is_extended_id == other.is_extended_id) &&
-        (self.canonical_name == other.canonical_name) &&
-        (self.is_internal == other.is_internal)
+        self.key == other.key
     }
 }
 
+impl Eq for Identifier { }
+
 impl Hash for Identifier {
     fn hash<H: Hasher>(&self, state: &mut H) {
-        self.canonical_name.hash(state);
-        self.is_extended_id.hash(state);
-        self.is_internal.hash(state);
+        state.write_u32(self.key);
+    }
+}
+
+// Hasher for maps keyed by Identifiers and other things that are already
+// small unique numbers. Each word is mixed in with a rotate, an xor and a
+// multiply (the same as rustc's FxHasher), so a lone Identifier costs one
+// multiply.
+#[derive(Default)]
+pub struct SymbolHasher {
+    hash: u64,
+}
+
+impl SymbolHasher {
+    fn add(&mut self, x: u64) {
+        self.hash = (self.hash.rotate_left(5) ^ x)
+            .wrapping_mul(0x517c_c1b7_2722_0a95);
+    }
+}
+
+impl Hasher for SymbolHasher {
+    fn write(&mut self, bytes: &[u8]) {
+        for &b in bytes {
+            self.add(b as u64);
+        }
+    }
+
+    fn write_u8(&mut self, x: u8) {
+        self.add(x as u64);
+    }
+
+    fn write_u32(&mut self, x: u32) {
+        self.add(x as u64);
+    }
+
+    fn write_u64(&mut self, x: u64) {
+        self.add(x);
+    }
+
+    fn write_usize(&mut self, x: usize) {
+        self.add(x as u64);
+    }
+
+    fn write_isize(&mut self, x: isize) {
+        self.add(x as u64);
+    }
+
+    fn finish(&self) -> u64 {
+        self.hash
     }
 }
 
+pub type SymbolHashBuilder = BuildHasherDefault<SymbolHasher>;
+
 impl Identifier {
     pub fn new_latin1(
         sp: &mut StringPool, name: StringPoolIndexLatin1, ext: bool)
         -> Result<Identifier, &'static str> {
 
-        let canonical_name_vec = {
-            // Borrow the name because we're going to need to look at it
+        {
             let name_ = sp.retrieve_latin1_str(name);
 
             // Validation
@@ -68,32 +117,52 @@ impl Identifier {
             if !ext && !name_.valid_for_basic_id() {
                 return Err("name is unacceptable as an identifier");
             }
+        }
 
-            // Possibly lowercase canonical name for basic identifiers
-            if ext {
-                None
-            } else {
-                let mut lcase_name = Vec::<u8>::new();
-                for c in name_.raw_name() {
-                    lcase_name.push(LATIN1_LCASE_TABLE[*c as usize]);
-                }
-                Some(lcase_name)
-            }
+        // Possibly lowercase canonical name for basic identifiers
+        let canonical_name = if ext {
+            name
+        } else {
+            sp.add_latin1_lowercase(name)
         };
 
-        // We needed to make name_ out of scope before we can actually try
-        // to add the new canonical name
-        let mut canonical_name = name;
-        if let Some(lcase_name) = canonical_name_vec {
-            canonical_name = sp.add_latin1_str(&lcase_name);
+        Ok(Identifier::from_parts(name, canonical_name, ext, false))
+    }
+
+    // Puts back together an Identifier whose parts were stored somewhere
+    // else, e.g. in a compiled library
+    pub fn from_parts(orig_name: StringPoolIndexLatin1,
+        canonical_name: StringPoolIndexLatin1, ext: bool, internal: bool)
+        -> Identifier {
+
+        Identifier {
+            orig_name: orig_name,
+            key: canonical_name.symbol() |
+                if ext {EXTENDED_ID_FLAG} else {0} |
+                if internal {INTERNAL_FLAG} else {0},
         }
+    }
+
+    pub fn canonical_name(&self) -> StringPoolIndexLatin1 {
+        StringPoolIndexLatin1::from_symbol(
+            self.key & !(EXTENDED_ID_FLAG | INTERNAL_FLAG))
+    }
 
-        Ok(Identifier {
-            orig_name: name,
-            canonical_name: canonical_name,
-            is_extended_id: ext,
-            is_internal: false,
-        })
+    pub fn is_extended_id(&self) -> bool {
+        self.key & EXTENDED_ID_FLAG != 0
+    }
+
+    pub fn is_internal(&self) -> bool {
+        self.key & INTERNAL_FLAG != 0
+    }
+
+    // The same name, but one that can never clash with anything the user
+    // wrote
+    pub fn internal(&self) -> Identifier {
+        Identifier {
+            orig_name: self.orig_name,
+            key: self.key | INTERNAL_FLAG,
+        }
     }
 
     pub fn new_unicode(sp: &mut StringPool, name: &str, ext: bool)
@@ -113,7 +182,7 @@ impl Identifier {
     }
 
     pub fn debug_print(&self, sp: &StringPool) -> String {
-        if self.is_extended_id {
+        if self.is_extended_id() {
             format!("\"\\\\{}\\\\\"", sp.retrieve_latin1_str(
                 self.orig_name).debug_escaped_name())
         } else {
@@ -126,7 +195,9 @@ impl Identifier {
 #[cfg(test)]
 mod tests {
     use super::*;
+    use std::collections::HashSet;
     use std::hash::SipHasher;
+    use std::mem;
 
     #[test]
     fn identifier_basic() {
@@ -137,20 +208,20 @@ mod tests {
         assert_eq!(sp.retrieve_latin1_str(
             test1.orig_name).raw_name(), b"foo");
         assert_eq!(sp.retrieve_latin1_str(
-            test1.canonical_name).raw_name(), b"foo");
+            test1.canonical_name()).raw_name(), b"foo");
         assert_eq!(sp.retrieve_latin1_str(
             test1.orig_name).pretty_name(), "foo");
-        assert!(!test1.is_extended_id);
+        assert!(!test1.is_extended_id());
 
         let sp_idx = sp.add_latin1_str(b"FoO");
         let test2 = Identifier::new_latin1(&mut sp, sp_idx, false).unwrap();
         assert_eq!(sp.retrieve_latin1_str(
             test2.orig_name).raw_name(), b"FoO");
         assert_eq!(sp.retrieve_latin1_str(
-            test2.canonical_name).raw_name(), b"foo");
+            test2.canonical_name()).raw_name(), b"foo");
         assert_eq!(sp.retrieve_latin1_str(
             test2.orig_name).pretty_name(), "FoO");
-        assert!(!test2.is_extended_id);
+        assert!(!test2.is_extended_id());
 
         let sp_idx = sp.add_latin1_str(b"foo_");
         let test3 = Identifier::new_latin1(&mut sp, sp_idx, false);
@@ -161,10 +232,10 @@ mod tests {
         assert_eq!(sp.retrieve_latin1_str(
             test4.orig_name).raw_name(), b"FoO");
         assert_eq!(sp.retrieve_latin1_str(
-            test4.canonical_name).raw_name(), b"FoO");
+            test4.canonical_name()).raw_name(), b"FoO");
         assert_eq!(sp.retrieve_latin1_str(
             test4.orig_name).pretty_name(), "FoO");
-        assert!(test4.is_extended_id);
+        assert!(test4.is_extended_id());
     }
 
     #[test]
@@ -176,10 +247,10 @@ mod tests {
         assert_eq!(sp.retrieve_latin1_str(
             test1.orig_name).raw_name(), b"f\xD6o");
         assert_eq!(sp.retrieve_latin1_str(
-            test1.canonical_name).raw_name(), b"f\xF6o");
+            test1.canonical_name()).raw_name(), b"f\xF6o");
         assert_eq!(sp.retrieve_latin1_str(
             test1.orig_name).pretty_name(), "fÖo");
-        assert!(!test1.is_extended_id);
+        assert!(!test1.is_extended_id());
 
         let sp_idx = sp.add_latin1_str(b"foo\xD7");
         let test2 = Identifier::new_latin1(&mut sp, sp_idx, false);
@@ -190,10 +261,10 @@ mod tests {
         assert_eq!(sp.retrieve_latin1_str(
             test3.orig_name).raw_name(), b"f\xD6o\xD7\xBC");
         assert_eq!(sp.retrieve_latin1_str(
-            test3.canonical_name).raw_name(), b"f\xD6o\xD7\xBC");
+            test3.canonical_name()).raw_name(), b"f\xD6o\xD7\xBC");
         assert_eq!(sp.retrieve_latin1_str(
             test3.orig_name).pretty_name(), "fÖo×¼");
-        assert!(test3.is_extended_id);
+        assert!(test3.is_extended_id());
     }
 
     #[test]
@@ -204,19 +275,19 @@ mod tests {
         assert_eq!(sp.retrieve_latin1_str(
             test1.orig_name).raw_name(), b"FoO");
         assert_eq!(sp.retrieve_latin1_str(
-            test1.canonical_name).raw_name(), b"foo");
+            test1.canonical_name()).raw_name(), b"foo");
         assert_eq!(sp.retrieve_latin1_str(
             test1.orig_name).pretty_name(), "FoO");
-        assert!(!test1.is_extended_id);
+        assert!(!test1.is_extended_id());
 
         let test2 = Identifier::new_unicode(&mut sp, "fÖo", false).unwrap();
         assert_eq!(sp.retrieve_latin1_str(
             test2.orig_name).raw_name(), b"f\xD6o");
         assert_eq!(sp.retrieve_latin1_str(
-            test2.canonical_name).raw_name(), b"f\xF6o");
+            test2.canonical_name()).raw_name(), b"f\xF6o");
         assert_eq!(sp.retrieve_latin1_str(
             test2.orig_name).pretty_name(), "fÖo");
-        assert!(!test2.is_extended_id);
+        assert!(!test2.is_extended_id());
 
         let test3 = Identifier::new_unicode(&mut sp, "fooĀ", false);
         assert!(test3.is_err());
@@ -254,6 +325,28 @@ mod tests {
         assert!(test1 != test2);
     }
 
+    #[test]
+    fn identifier_is_small() {
+        assert_eq!(mem::size_of::<Identifier>(), 8);
+    }
+
+    #[test]
+    fn identifier_symbol_hash() {
+        let mut sp = StringPool::new();
+
+        let test1 = Identifier::new_unicode(&mut sp, "foo", false).unwrap();
+        let test2 = Identifier::new_unicode(&mut sp, "FOO", false).unwrap();
+        let test3 = Identifier::new_unicode(&mut sp, "foo", true).unwrap();
+        let mut names = HashSet::<Identifier, SymbolHashBuilder>::default();
+        assert!(names.insert(test1));
+        assert!(!names.insert(test2));
+        assert!(names.insert(test3));
+        assert!(names.insert(test1.internal()));
+        assert_eq!(names.len(), 3);
+        assert_eq!(test3.canonical_name(), test3.orig_name);
+        assert_eq!(test2.canonical_name(), test1.orig_name);
+    }
+
     #[test]
     fn identifier_debug_print() {
         let mut sp = StringPool::new();
@@ -277,16 +370,17 @@ mod tests {
         assert_eq!(hash(&test1), hash(&test2));
         assert_eq!(test1, test2);
 
-        let mut test1 = Identifier::new_unicode(&mut sp, "foo", false).unwrap();
-        let mut test2 = Identifier::new_unicode(&mut sp, "foo", false).unwrap();
-        test1.is_internal = true;
-        test2.is_internal = true;
+        let test1 = Identifier::new_unicode(&mut sp, "foo", false).unwrap()
+            .internal();
+        let test2 = Identifier::new_unicode(&mut sp, "foo", false).unwrap()
+            .internal();
+        assert!(test1.is_internal());
         assert_eq!(hash(&test1), hash(&test2));
         assert_eq!(test1, test2);
 
-        let mut test1 = Identifier::new_unicode(&mut sp, "foo", false).unwrap();
+        let test1 = Identifier::new_unicode(&mut sp, "foo", false).unwrap()
+            .internal();
         let test2 = Identifier::new_unicode(&mut sp, "foo", false).unwrap();
-        test1.is_internal = true;
         assert!(test1 != test2);
     }
 }
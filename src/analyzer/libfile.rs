@@ -0,0 +1,1210 @@
+/*
+Copyright (c) 2016-2017, Robert Ou <rqou@robertou.com>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice,
+   this list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+// Compiled libraries: the analyzed design units of a Library saved to disk,
+// so that libraries that don't change (vendor libraries, etc.) don't need to
+// be analyzed again on every run.
+//
+// The file is memory-mapped. Opening it only reads the index. Each design
+// unit is decoded into the object pools the first time it is looked up, and
+// only if the source file it came from has not changed since it was
+// analyzed. Snapshots (see builtin.rs) are the same format compiled into the
+// binary; their units have no source file and are never stale. Everything in
+// the file is either an offset from the start of the file or an index local
+// to one unit's record, so nothing depends on where the file is mapped.
+//
+// Layout (little-endian):
+//   magic, format version (u32), unit count (u32)
+//   index, for each unit:
+//     canonical name length (u32), canonical name, identifier flags (u8),
+//     source file name length (u32), source file name,
+//     source length (u64), source mtime in ns (u64), source hash (u64),
+//     record offset (u64), record length (u64), record hash (u64)
+//   unit records, each:
+//     string count, node count, scope count, scope chain count (all u32)
+//     strings, each a length (u32) followed by the bytes
+//     nodes, scopes, scope chains (see encode_node etc.)
+// Node 0 of a record is the design unit itself.
+
+use std::collections::HashMap;
+use std::ffi::{OsStr, OsString};
+use std::fmt;
+use std::fs;
+use std::fs::File;
+use std::io;
+use std::io::Write;
+use std::os::unix::ffi::{OsStrExt, OsStringExt};
+use std::os::unix::fs::MetadataExt;
+use std::path::{Path, PathBuf};
+use std::process;
+
+use analyzer::ast::*;
+use analyzer::core::*;
+use analyzer::design::*;
+use analyzer::identifier::*;
+use analyzer::objpools::*;
+use parser::{fnv1a64, MappedFile};
+
+const LIBRARY_MAGIC: &'static [u8; 8] = b"YAVHDLLB";
+// Bump this whenever the layout or the AST changes
+const LIBRARY_FORMAT_VERSION: u32 = 1;
+
+// Stands for "None" wherever an optional index is stored
+const NO_INDEX: u32 = 0xFFFFFFFF;
+
+fn put_u8(out: &mut Vec<u8>, x: u8) {
+    out.push(x);
+}
+
+fn put_u32(out: &mut Vec<u8>, x: u32) {
+    out.extend_from_slice(&x.to_le_bytes());
+}
+
+fn put_u64(out: &mut Vec<u8>, x: u64) {
+    out.extend_from_slice(&x.to_le_bytes());
+}
+
+fn put_bytes(out: &mut Vec<u8>, x: &[u8]) {
+    put_u32(out, x.len() as u32);
+    out.extend_from_slice(x);
+}
+
+fn get_u8(buf: &[u8], pos: &mut usize) -> Option<u8> {
+    let ret = *buf.get(*pos)?;
+    *pos += 1;
+    Some(ret)
+}
+
+fn get_u32(buf: &[u8], pos: &mut usize) -> Option<u32> {
+    if buf.len() < *pos + 4 {
+        return None;
+    }
+    let mut x = [0u8; 4];
+    x.copy_from_slice(&buf[*pos..*pos + 4]);
+    *pos += 4;
+    Some(u32::from_le_bytes(x))
+}
+
+fn get_u64(buf: &[u8], pos: &mut usize) -> Option<u64> {
+    if buf.len() < *pos + 8 {
+        return None;
+    }
+    let mut x = [0u8; 8];
+    x.copy_from_slice(&buf[*pos..*pos + 8]);
+    *pos += 8;
+    Some(u64::from_le_bytes(x))
+}
+
+fn get_bytes<'a>(buf: &'a [u8], pos: &mut usize) -> Option<&'a [u8]> {
+    let len = get_u32(buf, pos)? as usize;
+    if buf.len() - *pos < len {
+        return None;
+    }
+    let ret = &buf[*pos..*pos + len];
+    *pos += len;
+    Some(ret)
+}
+
+fn id_flags(id: Identifier) -> u8 {
+    (id.is_extended_id() as u8) | ((id.is_internal() as u8) << 1)
+}
+
+// What a source file looked like when its units were analyzed
+#[derive(Copy, Clone, PartialEq, Eq, Debug)]
+pub struct SourceStamp {
+    len: u64,
+    mtime_ns: u64,
+    hash: u64,
+}
+
+fn mtime_ns(metadata: &fs::Metadata) -> u64 {
+    (metadata.mtime() as u64).wrapping_mul(1000000000)
+        .wrapping_add(metadata.mtime_nsec() as u64)
+}
+
+fn source_stamp(file_name: &OsStr) -> Option<SourceStamp> {
+    let metadata = fs::metadata(file_name).ok()?;
+    let contents = fs::read(file_name).ok()?;
+    Some(SourceStamp {
+        len: contents.len() as u64,
+        mtime_ns: mtime_ns(&metadata),
+        hash: fnv1a64(&contents),
+    })
+}
+
+// Records what a source file looks like as its analysis starts, which is what
+// its units are saved with. A file whose length and timestamp haven't changed
+// since it was last stamped keeps its stamp, the same way source_unchanged
+// trusts the timestamp, so that this costs only a stat when a file is
+// analyzed one unit at a time.
+pub fn stamp_source(s: &mut AnalyzerCoreStateBlob, lib: ObjPoolIndex<Library>,
+    file_name: &OsStr) {
+
+    let library = s.op_l.get_mut(lib);
+    if let Some(stamp) = library.source_stamp(file_name) {
+        if let Ok(metadata) = fs::metadata(file_name) {
+            if metadata.len() == stamp.len &&
+                mtime_ns(&metadata) == stamp.mtime_ns {
+
+                return;
+            }
+        }
+    }
+    library.set_source_stamp(file_name, source_stamp(file_name));
+}
+
+// Whether the source is still what it was. The hash is only checked if the
+// timestamp changed, so that merely touching a file does not make its units
+// stale but unchanged files cost only a stat.
+fn source_unchanged(file_name: &OsStr, stamp: SourceStamp) -> bool {
+    let metadata = match fs::metadata(file_name) {
+        Ok(x) => x,
+        Err(_) => return false,
+    };
+    if metadata.len() != stamp.len {
+        return false;
+    }
+    if mtime_ns(&metadata) == stamp.mtime_ns {
+        return true;
+    }
+    match fs::read(file_name) {
+        Ok(contents) => fnv1a64(&contents) == stamp.hash,
+        Err(_) => false,
+    }
+}
+
+// Turns one design unit and everything reachable from it into a record
+struct UnitEncoder<'a> {
+    sp: &'a StringPool,
+    op_n: &'a ObjPool<AstNode>,
+    op_s: &'a ObjPool<Scope>,
+    op_sc: &'a ObjPool<ScopeChainNode>,
+
+    strings: HashMap<Vec<u8>, u32>,
+    strings_out: Vec<u8>,
+    nodes: HashMap<ObjPoolIndex<AstNode>, u32>,
+    node_queue: Vec<ObjPoolIndex<AstNode>>,
+    scopes: HashMap<ObjPoolIndex<Scope>, u32>,
+    scope_queue: Vec<ObjPoolIndex<Scope>>,
+    chains: HashMap<ObjPoolIndex<ScopeChainNode>, u32>,
+    chain_queue: Vec<ObjPoolIndex<ScopeChainNode>>,
+}
+
+impl<'a> UnitEncoder<'a> {
+    fn string(&mut self, bytes: &[u8]) -> u32 {
+        if let Some(&i) = self.strings.get(bytes) {
+            return i;
+        }
+        let i = self.strings.len() as u32;
+        self.strings.insert(bytes.to_vec(), i);
+        put_bytes(&mut self.strings_out, bytes);
+        i
+    }
+
+    fn latin1(&mut self, out: &mut Vec<u8>, x: StringPoolIndexLatin1) {
+        let bytes = self.sp.retrieve_latin1_str(x).raw_name().to_vec();
+        let i = self.string(&bytes);
+        put_u32(out, i);
+    }
+
+    fn node(&mut self, out: &mut Vec<u8>, x: ObjPoolIndex<AstNode>) {
+        let i = match self.nodes.get(&x) {
+            Some(&i) => i,
+            None => {
+                let i = self.node_queue.len() as u32;
+                self.nodes.insert(x, i);
+                self.node_queue.push(x);
+                i
+            }
+        };
+        put_u32(out, i);
+    }
+
+    fn opt_node(&mut self, out: &mut Vec<u8>,
+        x: Option<ObjPoolIndex<AstNode>>) {
+
+        match x {
+            Some(x) => self.node(out, x),
+            None => put_u32(out, NO_INDEX),
+        }
+    }
+
+    fn scope(&mut self, out: &mut Vec<u8>, x: ObjPoolIndex<Scope>) {
+        let i = match self.scopes.get(&x) {
+            Some(&i) => i,
+            None => {
+                let i = self.scope_queue.len() as u32;
+                self.scopes.insert(x, i);
+                self.scope_queue.push(x);
+                i
+            }
+        };
+        put_u32(out, i);
+    }
+
+    fn chain(&mut self, out: &mut Vec<u8>,
+        x: Option<ObjPoolIndex<ScopeChainNode>>) {
+
+        let x = match x {
+            Some(x) => x,
+            None => {
+                put_u32(out, NO_INDEX);
+                return;
+            }
+        };
+        let i = match self.chains.get(&x) {
+            Some(&i) => i,
+            None => {
+                let i = self.chain_queue.len() as u32;
+                self.chains.insert(x, i);
+                self.chain_queue.push(x);
+                i
+            }
+        };
+        put_u32(out, i);
+    }
+
+    fn id(&mut self, out: &mut Vec<u8>, id: Identifier) {
+        self.latin1(out, id.orig_name);
+        self.latin1(out, id.canonical_name());
+        put_u8(out, id_flags(id));
+    }
+
+    fn loc(&mut self, out: &mut Vec<u8>, loc: SourceLoc) {
+        put_u32(out, loc.first_line as u32);
+        put_u32(out, loc.first_column as u32);
+        put_u32(out, loc.last_line as u32);
+        put_u32(out, loc.last_column as u32);
+        match loc.file_name {
+            Some(x) => {
+                let bytes = self.sp.retrieve_osstr(x).as_bytes().to_vec();
+                let i = self.string(&bytes);
+                put_u32(out, i);
+            },
+            None => put_u32(out, NO_INDEX),
+        }
+    }
+
+    fn scope_item_name(&mut self, out: &mut Vec<u8>, x: ScopeItemName) {
+        match x {
+            ScopeItemName::Identifier(id) => {
+                put_u8(out, 0);
+                self.id(out, id);
+            },
+            ScopeItemName::CharLiteral(c) => {
+                put_u8(out, 1);
+                put_u8(out, c);
+            },
+            ScopeItemName::StringLiteral(s) => {
+                put_u8(out, 2);
+                self.latin1(out, s);
+            },
+        }
+    }
+
+    fn encode_node(&mut self, out: &mut Vec<u8>, x: ObjPoolIndex<AstNode>) {
+        match self.op_n.get(x) {
+            &AstNode::Invalid => put_u8(out, 0),
+            &AstNode::EnumerationLitDecl {lit, idx, corresponding_type_decl}
+                => {
+
+                put_u8(out, 1);
+                match lit {
+                    EnumerationLiteral::Identifier(id) => {
+                        put_u8(out, 0);
+                        self.id(out, id);
+                    },
+                    EnumerationLiteral::CharLiteral(c) => {
+                        put_u8(out, 1);
+                        put_u8(out, c);
+                    },
+                }
+                put_u64(out, idx as u64);
+                self.node(out, corresponding_type_decl);
+            },
+            &AstNode::EnumerationTypeDecl {loc, id, ref literals} => {
+                put_u8(out, 2);
+                self.loc(out, loc);
+                self.id(out, id);
+                put_u32(out, literals.len() as u32);
+                for &lit in literals {
+                    self.node(out, lit);
+                }
+            },
+            &AstNode::Entity {loc, id, scope, scope_chain} => {
+                put_u8(out, 3);
+                self.loc(out, loc);
+                self.id(out, id);
+                self.scope(out, scope);
+                self.chain(out, Some(scope_chain));
+            },
+            &AstNode::SubtypeDecl {loc, id, subtype_indication} => {
+                put_u8(out, 4);
+                self.loc(out, loc);
+                self.id(out, id);
+                self.node(out, subtype_indication);
+            },
+            &AstNode::SubtypeIndication {type_mark} => {
+                put_u8(out, 5);
+                self.node(out, type_mark);
+            },
+            &AstNode::ConstantDecl {loc, id, subtype_indication, value} => {
+                put_u8(out, 6);
+                self.loc(out, loc);
+                self.id(out, id);
+                self.node(out, subtype_indication);
+                self.opt_node(out, value);
+            },
+            &AstNode::GenericFunctionDecl {loc, designator, ref args,
+                return_type, is_pure} => {
+
+                put_u8(out, 7);
+                self.loc(out, loc);
+                self.scope_item_name(out, designator);
+                put_u32(out, args.len() as u32);
+                for &arg in args {
+                    self.node(out, arg);
+                }
+                self.node(out, return_type);
+                put_u8(out, is_pure as u8);
+            },
+            &AstNode::FuncInstantiation {loc, designator, generic_func} => {
+                put_u8(out, 8);
+                self.loc(out, loc);
+                self.scope_item_name(out, designator);
+                self.node(out, generic_func);
+            },
+            &AstNode::InterfaceConstant {loc, id, subtype_indication,
+                value} => {
+
+                put_u8(out, 9);
+                self.loc(out, loc);
+                self.id(out, id);
+                self.node(out, subtype_indication);
+                self.opt_node(out, value);
+            },
+        }
+    }
+
+    fn encode_scope(&mut self, out: &mut Vec<u8>, x: ObjPoolIndex<Scope>) {
+        let scope = self.op_s.get(x);
+        put_u32(out, scope.iter().count() as u32);
+        for (&name, items) in scope.iter() {
+            self.scope_item_name(out, name);
+            put_u32(out, items.len() as u32);
+            for &item in items {
+                self.node(out, item);
+            }
+        }
+    }
+
+    fn encode_chain(&mut self, out: &mut Vec<u8>,
+        x: ObjPoolIndex<ScopeChainNode>) {
+
+        match self.op_sc.get(x) {
+            &ScopeChainNode::Invalid => put_u8(out, 0),
+            &ScopeChainNode::X {this_scope, parent} => {
+                put_u8(out, 1);
+                self.scope(out, this_scope);
+                self.chain(out, parent);
+            }
+        }
+    }
+}
+
+fn encode_unit(s: &AnalyzerCoreStateBlob, unit: ObjPoolIndex<AstNode>)
+    -> Vec<u8> {
+
+    let mut enc = UnitEncoder {
+        sp: &s.sp,
+        op_n: &s.op_n,
+        op_s: &s.op_s,
+        op_sc: &s.op_sc,
+        strings: HashMap::new(),
+        strings_out: Vec::new(),
+        nodes: HashMap::new(),
+        node_queue: Vec::new(),
+        scopes: HashMap::new(),
+        scope_queue: Vec::new(),
+        chains: HashMap::new(),
+        chain_queue: Vec::new(),
+    };
+    let mut nodes_out = Vec::new();
+    let mut scopes_out = Vec::new();
+    let mut chains_out = Vec::new();
+
+    // Encoding one kind of object can discover more of the others
+    enc.node(&mut Vec::new(), unit);
+    let (mut n, mut sc, mut ch) = (0, 0, 0);
+    while n < enc.node_queue.len() || sc < enc.scope_queue.len() ||
+        ch < enc.chain_queue.len() {
+
+        while n < enc.node_queue.len() {
+            let x = enc.node_queue[n];
+            enc.encode_node(&mut nodes_out, x);
+            n += 1;
+        }
+        while sc < enc.scope_queue.len() {
+            let x = enc.scope_queue[sc];
+            enc.encode_scope(&mut scopes_out, x);
+            sc += 1;
+        }
+        while ch < enc.chain_queue.len() {
+            let x = enc.chain_queue[ch];
+            enc.encode_chain(&mut chains_out, x);
+            ch += 1;
+        }
+    }
+
+    let mut out = Vec::with_capacity(16 + enc.strings_out.len() +
+        nodes_out.len() + scopes_out.len() + chains_out.len());
+    put_u32(&mut out, enc.strings.len() as u32);
+    put_u32(&mut out, n as u32);
+    put_u32(&mut out, sc as u32);
+    put_u32(&mut out, ch as u32);
+    out.extend_from_slice(&enc.strings_out);
+    out.extend_from_slice(&nodes_out);
+    out.extend_from_slice(&scopes_out);
+    out.extend_from_slice(&chains_out);
+    out
+}
+
+// Turns a record back into objects. Every index in the record is checked,
+// so a damaged file gives None rather than a broken AST.
+struct UnitDecoder<'a, 'b> {
+    buf: &'a [u8],
+    pos: usize,
+    strings: Vec<&'a [u8]>,
+    nodes: Vec<ObjPoolIndex<AstNode>>,
+    scopes: Vec<ObjPoolIndex<Scope>>,
+    chains: Vec<ObjPoolIndex<ScopeChainNode>>,
+    sp: &'b mut StringPool,
+}
+
+impl<'a, 'b> UnitDecoder<'a, 'b> {
+    fn u8(&mut self) -> Option<u8> {
+        get_u8(self.buf, &mut self.pos)
+    }
+
+    fn u32(&mut self) -> Option<u32> {
+        get_u32(self.buf, &mut self.pos)
+    }
+
+    fn string(&mut self) -> Option<&'a [u8]> {
+        let i = self.u32()? as usize;
+        self.strings.get(i).cloned()
+    }
+
+    fn latin1(&mut self) -> Option<StringPoolIndexLatin1> {
+        let bytes = self.string()?;
+        Some(self.sp.add_latin1_str(bytes))
+    }
+
+    fn node(&mut self) -> Option<ObjPoolIndex<AstNode>> {
+        let i = self.u32()? as usize;
+        self.nodes.get(i).cloned()
+    }
+
+    fn opt_node(&mut self) -> Option<Option<ObjPoolIndex<AstNode>>> {
+        let i = self.u32()?;
+        if i == NO_INDEX {
+            Some(None)
+        } else {
+            self.nodes.get(i as usize).cloned().map(Some)
+        }
+    }
+
+    fn scope(&mut self) -> Option<ObjPoolIndex<Scope>> {
+        let i = self.u32()? as usize;
+        self.scopes.get(i).cloned()
+    }
+
+    fn chain(&mut self) -> Option<Option<ObjPoolIndex<ScopeChainNode>>> {
+        let i = self.u32()?;
+        if i == NO_INDEX {
+            Some(None)
+        } else {
+            self.chains.get(i as usize).cloned().map(Some)
+        }
+    }
+
+    fn id(&mut self) -> Option<Identifier> {
+        let orig_name = self.latin1()?;
+        let canonical_name = self.latin1()?;
+        let flags = self.u8()?;
+        Some(Identifier::from_parts(orig_name, canonical_name, flags & 1 != 0,
+            flags & 2 != 0))
+    }
+
+    fn loc(&mut self) -> Option<SourceLoc> {
+        let first_line = self.u32()? as i32;
+        let first_column = self.u32()? as i32;
+        let last_line = self.u32()? as i32;
+        let last_column = self.u32()? as i32;
+        let file_name = match self.u32()? {
+            NO_INDEX => None,
+            i => {
+                let bytes = *self.strings.get(i as usize)?;
+                Some(self.sp.add_osstr(OsStr::from_bytes(bytes)))
+            }
+        };
+        Some(SourceLoc {
+            first_line: first_line,
+            first_column: first_column,
+            last_line: last_line,
+            last_column: last_column,
+            file_name: file_name,
+        })
+    }
+
+    fn scope_item_name(&mut self) -> Option<ScopeItemName> {
+        match self.u8()? {
+            0 => Some(ScopeItemName::Identifier(self.id()?)),
+            1 => Some(ScopeItemName::CharLiteral(self.u8()?)),
+            2 => Some(ScopeItemName::StringLiteral(self.latin1()?)),
+            _ => None,
+        }
+    }
+
+    fn node_list(&mut self) -> Option<Vec<ObjPoolIndex<AstNode>>> {
+        let count = self.u32()? as usize;
+        let mut ret = Vec::new();
+        for _ in 0..count {
+            ret.push(self.node()?);
+        }
+        Some(ret)
+    }
+
+    fn decode_node(&mut self) -> Option<AstNode> {
+        Some(match self.u8()? {
+            0 => AstNode::Invalid,
+            1 => {
+                let lit = match self.u8()? {
+                    0 => EnumerationLiteral::Identifier(self.id()?),
+                    1 => EnumerationLiteral::CharLiteral(self.u8()?),
+                    _ => return None,
+                };
+                AstNode::EnumerationLitDecl {
+                    lit: lit,
+                    idx: get_u64(self.buf, &mut self.pos)? as i64,
+                    corresponding_type_decl: self.node()?,
+                }
+            },
+            2 => AstNode::EnumerationTypeDecl {
+                loc: self.loc()?,
+                id: self.id()?,
+                literals: self.node_list()?,
+            },
+            3 => AstNode::Entity {
+                loc: self.loc()?,
+                id: self.id()?,
+                scope: self.scope()?,
+                scope_chain: self.chain()??,
+            },
+            4 => AstNode::SubtypeDecl {
+                loc: self.loc()?,
+                id: self.id()?,
+                subtype_indication: self.node()?,
+            },
+            5 => AstNode::SubtypeIndication {
+                type_mark: self.node()?,
+            },
+            6 => AstNode::ConstantDecl {
+                loc: self.loc()?,
+                id: self.id()?,
+                subtype_indication: self.node()?,
+                value: self.opt_node()?,
+            },
+            7 => AstNode::GenericFunctionDecl {
+                loc: self.loc()?,
+                designator: self.scope_item_name()?,
+                args: self.node_list()?,
+                return_type: self.node()?,
+                is_pure: self.u8()? != 0,
+            },
+            8 => AstNode::FuncInstantiation {
+                loc: self.loc()?,
+                designator: self.scope_item_name()?,
+                generic_func: self.node()?,
+            },
+            9 => AstNode::InterfaceConstant {
+                loc: self.loc()?,
+                id: self.id()?,
+                subtype_indication: self.node()?,
+                value: self.opt_node()?,
+            },
+            _ => return None,
+        })
+    }
+
+    // The nodes have to have been decoded already, because overloadable
+    // items are indexed by their profiles
+    fn decode_scope(&mut self, op_n: &ObjPool<AstNode>) -> Option<Scope> {
+        let mut scope = Scope::new();
+        let count = self.u32()?;
+        for _ in 0..count {
+            let name = self.scope_item_name()?;
+            for item in self.node_list()? {
+                scope.add_declaration(name, item, op_n.get(item));
+            }
+        }
+        Some(scope)
+    }
+
+    fn decode_chain(&mut self) -> Option<ScopeChainNode> {
+        match self.u8()? {
+            0 => Some(ScopeChainNode::Invalid),
+            1 => Some(ScopeChainNode::X {
+                this_scope: self.scope()?,
+                parent: self.chain()?,
+            }),
+            _ => None,
+        }
+    }
+}
+
+fn decode_unit(buf: &[u8], sp: &mut StringPool, op_n: &mut ObjPool<AstNode>,
+    op_s: &mut ObjPool<Scope>, op_sc: &mut ObjPool<ScopeChainNode>)
+    -> Option<ObjPoolIndex<AstNode>> {
+
+    let mut pos = 0;
+    let string_count = get_u32(buf, &mut pos)? as usize;
+    let node_count = get_u32(buf, &mut pos)? as usize;
+    let scope_count = get_u32(buf, &mut pos)? as usize;
+    let chain_count = get_u32(buf, &mut pos)? as usize;
+    // Don't let a damaged count allocate the world
+    if node_count == 0 || node_count + scope_count + chain_count > buf.len() {
+        return None;
+    }
+
+    let mut strings = Vec::new();
+    for _ in 0..string_count {
+        strings.push(get_bytes(buf, &mut pos)?);
+    }
+
+    let mut dec = UnitDecoder {
+        buf: buf,
+        pos: pos,
+        strings: strings,
+        nodes: (0..node_count).map(|_| op_n.alloc()).collect(),
+        scopes: (0..scope_count).map(|_| op_s.alloc()).collect(),
+        chains: (0..chain_count).map(|_| op_sc.alloc()).collect(),
+        sp: sp,
+    };
+
+    for i in 0..node_count {
+        *op_n.get_mut(dec.nodes[i]) = dec.decode_node()?;
+    }
+    for i in 0..scope_count {
+        *op_s.get_mut(dec.scopes[i]) = dec.decode_scope(op_n)?;
+    }
+    for i in 0..chain_count {
+        *op_sc.get_mut(dec.chains[i]) = dec.decode_chain()?;
+    }
+    if dec.pos != buf.len() {
+        return None;
+    }
+
+    Some(dec.nodes[0])
+}
+
+struct UnitEntry {
+    source: OsString,
+    stamp: SourceStamp,
+    offset: usize,
+    len: usize,
+    hash: u64,
+}
+
+enum LibraryBytes {
+    Mapped(MappedFile),
+    Static(&'static [u8]),
+}
+
+impl LibraryBytes {
+    fn bytes(&self) -> &[u8] {
+        match self {
+            &LibraryBytes::Mapped(ref x) => x.bytes(),
+            &LibraryBytes::Static(x) => x,
+        }
+    }
+}
+
+// A compiled library that has been opened, minus the units that have already
+// been loaded or forgotten
+pub struct LibraryFile {
+    path: PathBuf,
+    map: LibraryBytes,
+    // Keyed by canonical name and identifier flags
+    units: HashMap<(Vec<u8>, u8), UnitEntry>,
+}
+
+impl fmt::Debug for LibraryFile {
+    fn fmt(&self, f: &mut fmt::Formatter) -> fmt::Result {
+        write!(f, "LibraryFile({:?}, {} units left)", self.path,
+            self.units.len())
+    }
+}
+
+fn bad_library(path: &Path) -> io::Error {
+    io::Error::new(io::ErrorKind::InvalidData,
+        format!("\"{}\" is not a valid compiled library", path.display()))
+}
+
+impl LibraryFile {
+    pub fn open(path: &Path) -> io::Result<LibraryFile> {
+        let map = MappedFile::open(path)?;
+        let units = LibraryFile::read_index(map.bytes())
+            .ok_or_else(|| bad_library(path))?;
+
+        Ok(LibraryFile {
+            path: path.to_path_buf(),
+            map: LibraryBytes::Mapped(map),
+            units: units,
+        })
+    }
+
+    // For a snapshot that is part of the binary. name is only used in
+    // error messages.
+    pub fn from_static(name: &str, bytes: &'static [u8])
+        -> io::Result<LibraryFile> {
+
+        let path = PathBuf::from(name);
+        let units = LibraryFile::read_index(bytes)
+            .ok_or_else(|| bad_library(&path))?;
+
+        Ok(LibraryFile {
+            path: path,
+            map: LibraryBytes::Static(bytes),
+            units: units,
+        })
+    }
+
+    pub fn is_empty(&self) -> bool {
+        self.units.is_empty()
+    }
+
+    fn read_index(buf: &[u8]) -> Option<HashMap<(Vec<u8>, u8), UnitEntry>> {
+        let mut pos = 0;
+        if buf.get(..LIBRARY_MAGIC.len())? != LIBRARY_MAGIC {
+            return None;
+        }
+        pos += LIBRARY_MAGIC.len();
+        if get_u32(buf, &mut pos)? != LIBRARY_FORMAT_VERSION {
+            return None;
+        }
+
+        let count = get_u32(buf, &mut pos)?;
+        let mut units = HashMap::new();
+        for _ in 0..count {
+            let name = get_bytes(buf, &mut pos)?.to_vec();
+            let flags = get_u8(buf, &mut pos)?;
+            let source = OsString::from_vec(get_bytes(buf, &mut pos)?.to_vec());
+            let stamp = SourceStamp {
+                len: get_u64(buf, &mut pos)?,
+                mtime_ns: get_u64(buf, &mut pos)?,
+                hash: get_u64(buf, &mut pos)?,
+            };
+            let offset = get_u64(buf, &mut pos)? as usize;
+            let len = get_u64(buf, &mut pos)? as usize;
+            let hash = get_u64(buf, &mut pos)?;
+            if offset > buf.len() || buf.len() - offset < len {
+                return None;
+            }
+            units.insert((name, flags), UnitEntry {
+                source: source,
+                stamp: stamp,
+                offset: offset,
+                len: len,
+                hash: hash,
+            });
+        }
+
+        Some(units)
+    }
+
+    // Forgets the units that came from the given source file, because it is
+    // being analyzed again
+    pub fn forget_source(&mut self, file_name: &OsStr) {
+        self.units.retain(|_, x| x.source != file_name);
+    }
+
+    // Decodes the unit with the given name into the pools, unless it is stale
+    // or not in the file. Either way, it won't be looked at again. Also
+    // returns the unit's source file and the stamp it was saved with.
+    fn load_unit(&mut self, key: &(Vec<u8>, u8), sp: &mut StringPool,
+        op_n: &mut ObjPool<AstNode>, op_s: &mut ObjPool<Scope>,
+        op_sc: &mut ObjPool<ScopeChainNode>)
+        -> io::Result<Option<(ObjPoolIndex<AstNode>, OsString, SourceStamp)>> {
+
+        let entry = match self.units.remove(key) {
+            Some(x) => x,
+            None => return Ok(None),
+        };
+        if !entry.source.is_empty() &&
+            !source_unchanged(&entry.source, entry.stamp) {
+            return Ok(None);
+        }
+
+        let record = &self.map.bytes()[entry.offset..entry.offset + entry.len];
+        if fnv1a64(record) != entry.hash {
+            return Err(bad_library(&self.path));
+        }
+        match decode_unit(record, sp, op_n, op_s, op_sc) {
+            Some(x) => Ok(Some((x, entry.source, entry.stamp))),
+            None => Err(bad_library(&self.path)),
+        }
+    }
+}
+
+// Copies a design unit and everything it refers to from one analyzer state
+// into another (used by parallel.rs). The copy is not added to any library.
+pub fn copy_design_unit(from: &AnalyzerCoreStateBlob,
+    unit: ObjPoolIndex<AstNode>, to: &mut AnalyzerCoreStateBlob)
+    -> ObjPoolIndex<AstNode> {
+
+    let record = encode_unit(from, unit);
+    with_unit_segment(to, |to| {
+        let copy = decode_unit(&record, &mut to.sp, &mut to.op_n,
+            &mut to.op_s, &mut to.op_sc).unwrap();
+        (copy, Some(copy))
+    })
+}
+
+// Opens the compiled library at path and attaches it to lib, so that its
+// units are loaded as they are looked up. A missing file is not an error;
+// the library just starts out empty.
+pub fn open_compiled_library(s: &mut AnalyzerCoreStateBlob,
+    lib: ObjPoolIndex<Library>, path: &Path) -> io::Result<()> {
+
+    let file = match LibraryFile::open(path) {
+        Ok(x) => x,
+        Err(ref e) if e.kind() == io::ErrorKind::NotFound => return Ok(()),
+        Err(e) => return Err(e),
+    };
+    s.op_l.get_mut(lib).set_compiled(file);
+    Ok(())
+}
+
+fn load_from_compiled(s: &mut AnalyzerCoreStateBlob,
+    lib: ObjPoolIndex<Library>, key: &(Vec<u8>, u8))
+    -> Option<ObjPoolIndex<AstNode>> {
+
+    if s.op_l.get_mut(lib).compiled_mut().is_none() {
+        return None;
+    }
+    // Not in the segment of whatever unit is being analyzed right now
+    let ret = with_unit_segment(s, |s| {
+        let ret = s.op_l.get_mut(lib).compiled_mut().unwrap().load_unit(key,
+            &mut s.sp, &mut s.op_n, &mut s.op_s, &mut s.op_sc);
+        let unit = match ret {
+            Ok(Some((unit, _, _))) => Some(unit),
+            _ => None,
+        };
+        (ret, unit)
+    });
+    match ret {
+        Ok(Some((unit, source, stamp))) => {
+            let id = s.op_n.get(unit).id().unwrap();
+            let library = s.op_l.get_mut(lib);
+            library.add_design_unit(id, unit);
+            // The source hasn't changed since this stamp (or the unit would
+            // be stale), so saving the unit again can keep it
+            if !source.is_empty() && library.source_stamp(&source).is_none() {
+                library.set_source_stamp(&source, Some(stamp));
+            }
+            Some(unit)
+        },
+        Ok(None) => None,
+        Err(e) => {
+            s.warnings += &format!("WARNING: {}\n", e);
+            None
+        }
+    }
+}
+
+// Like Library::find_design_unit, but also loads the unit from the library's
+// compiled library if it hasn't been loaded yet
+pub fn find_design_unit_loading(s: &mut AnalyzerCoreStateBlob,
+    lib: ObjPoolIndex<Library>, name: Identifier)
+    -> Option<ObjPoolIndex<AstNode>> {
+
+    if let Some(x) = s.op_l.get(lib).find_design_unit(name) {
+        return Some(x);
+    }
+    let key = (s.sp.retrieve_latin1_str(name.canonical_name()).raw_name()
+        .to_vec(), id_flags(name));
+    load_from_compiled(s, lib, &key)
+}
+
+// Loads every unit of the library's compiled library that hasn't been
+// loaded yet and isn't stale
+pub fn load_compiled_units(s: &mut AnalyzerCoreStateBlob,
+    lib: ObjPoolIndex<Library>) {
+
+    let mut keys: Vec<_> = match s.op_l.get_mut(lib).compiled_mut() {
+        Some(file) => file.units.iter()
+            .map(|(k, v)| (v.offset, k.clone())).collect(),
+        None => return,
+    };
+    // In the order they were saved
+    keys.sort();
+    for (_, key) in keys {
+        load_from_compiled(s, lib, &key);
+    }
+}
+
+// Writes every design unit of lib that has been loaded or analyzed to path.
+// Units still in the library's compiled library are loaded first so that
+// they aren't lost.
+pub fn save_compiled_library(s: &mut AnalyzerCoreStateBlob,
+    lib: ObjPoolIndex<Library>, path: &Path) -> io::Result<()> {
+
+    write_library(s, lib, path, false)
+}
+
+// Like save_compiled_library, but without recording where the units came
+// from, so that they are never considered stale. For builtin.rs.
+pub fn save_library_snapshot(s: &mut AnalyzerCoreStateBlob,
+    lib: ObjPoolIndex<Library>, path: &Path) -> io::Result<()> {
+
+    write_library(s, lib, path, true)
+}
+
+fn write_library(s: &mut AnalyzerCoreStateBlob, lib: ObjPoolIndex<Library>,
+    path: &Path, snapshot: bool) -> io::Result<()> {
+
+    load_compiled_units(s, lib);
+
+    struct Saved {
+        id: Identifier,
+        source: OsString,
+        stamp: SourceStamp,
+        record: Vec<u8>,
+    }
+    let mut saved = Vec::new();
+    for &unit in s.op_l.get(lib).design_units() {
+        let node = s.op_n.get(unit);
+        if snapshot {
+            saved.push(Saved {
+                id: node.id().unwrap(),
+                source: OsString::new(),
+                stamp: SourceStamp {len: 0, mtime_ns: 0, hash: 0},
+                record: encode_unit(s, unit),
+            });
+            continue;
+        }
+        let source = match node.loc().and_then(|x| x.file_name) {
+            Some(x) => s.sp.retrieve_osstr(x).to_owned(),
+            // Can't be checked later, so can't be trusted later either
+            None => continue,
+        };
+        // Taken when the file was analyzed (see stamp_source), not now,
+        // since the file may have been changed since
+        let stamp = match s.op_l.get(lib).source_stamp(&source) {
+            Some(x) => x,
+            None => continue,
+        };
+
+        saved.push(Saved {
+            id: node.id().unwrap(),
+            source: source,
+            stamp: stamp,
+            record: encode_unit(s, unit),
+        });
+    }
+
+    let mut index = Vec::new();
+    for unit in &saved {
+        put_bytes(&mut index,
+            s.sp.retrieve_latin1_str(unit.id.canonical_name()).raw_name());
+        put_u8(&mut index, id_flags(unit.id));
+        put_bytes(&mut index, unit.source.as_bytes());
+        put_u64(&mut index, unit.stamp.len);
+        put_u64(&mut index, unit.stamp.mtime_ns);
+        put_u64(&mut index, unit.stamp.hash);
+        // Offsets are filled in once the size of the index is known
+        put_u64(&mut index, 0);
+        put_u64(&mut index, unit.record.len() as u64);
+        put_u64(&mut index, fnv1a64(&unit.record));
+    }
+
+    let mut out = Vec::new();
+    out.extend_from_slice(LIBRARY_MAGIC);
+    put_u32(&mut out, LIBRARY_FORMAT_VERSION);
+    put_u32(&mut out, saved.len() as u32);
+    let index_start = out.len();
+    out.extend_from_slice(&index);
+
+    let mut index_pos = index_start;
+    for unit in &saved {
+        // Skip to this entry's offset field
+        index_pos += 4 + s.sp.retrieve_latin1_str(unit.id.canonical_name())
+            .raw_name().len() + 1 + 4 + unit.source.len() + 24;
+        let offset = out.len() as u64;
+        out[index_pos..index_pos + 8].copy_from_slice(&offset.to_le_bytes());
+        index_pos += 24;
+        out.extend_from_slice(&unit.record);
+    }
+
+    // Written to the side and renamed into place so that a reader never
+    // sees half a library
+    let mut tmp_name = path.as_os_str().to_owned();
+    tmp_name.push(format!(".tmp.{}", process::id()));
+    let tmp_path = PathBuf::from(tmp_name);
+    let ret = File::create(&tmp_path)
+        .and_then(|mut f| f.write_all(&out))
+        .and_then(|_| fs::rename(&tmp_path, path));
+    if ret.is_err() {
+        let _ = fs::remove_file(&tmp_path);
+    }
+    ret
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use std::env;
+    use json;
+    use parser;
+
+    fn analyze(s: &mut AnalyzerCoreStateBlob, lib_dir: &Path,
+        files: &[&Path]) -> ObjPoolIndex<Library> {
+
+        let lib_id = Identifier::new_unicode(&mut s.sp, "work", false)
+            .unwrap();
+        let lib = s.op_l.alloc();
+        *s.op_l.get_mut(lib) = Library::new(lib_id);
+        s.design_db.add_library(lib_id, lib);
+        open_compiled_library(s, lib, &lib_dir.join("work.yvl")).unwrap();
+
+        for file in files {
+            let (pt, _) = parser::parse_file(file.as_os_str());
+            assert!(vhdl_analyze_file(s, &pt.unwrap(), lib,
+                file.as_os_str()));
+        }
+        lib
+    }
+
+    #[test]
+    fn compiled_library_round_trip() {
+        let dir = env::temp_dir().join(
+            format!("yavhdl-libfile-test-{}", process::id()));
+        fs::create_dir_all(&dir).unwrap();
+        let lib_path = dir.join("work.yvl");
+        let a = dir.join("a.vhd");
+        let b = dir.join("b.vhd");
+        fs::write(&a, "entity a is\n    type t is (x, 'y');\n    \
+                       constant c : t;\nbegin end;\n").unwrap();
+        fs::write(&b, "entity b is\nbegin end;\n").unwrap();
+
+        let mut s1 = AnalyzerCoreStateBlob::new();
+        let lib1 = analyze(&mut s1, &dir, &[&a, &b]);
+        save_compiled_library(&mut s1, lib1, &lib_path).unwrap();
+
+        // Loaded only when asked for
+        let mut s2 = AnalyzerCoreStateBlob::new();
+        let lib2 = analyze(&mut s2, &dir, &[]);
+        assert_eq!(s2.op_l.get(lib2).design_units().len(), 0);
+        let a_id = Identifier::new_unicode(&mut s2.sp, "A", false).unwrap();
+        let a2 = find_design_unit_loading(&mut s2, lib2, a_id).unwrap();
+        assert_eq!(s2.op_l.get(lib2).design_units().len(), 1);
+        let a_id = Identifier::new_unicode(&mut s1.sp, "a", false).unwrap();
+        let a1 = s1.op_l.get(lib1).find_design_unit(a_id).unwrap();
+        // The declarations are a set, so their order can differ
+        let print = |s: &AnalyzerCoreStateBlob, unit| json::parse(
+            &s.op_n.get(unit).debug_print(&s.sp, &s.op_n, &s.op_s))
+            .unwrap().sort_sets();
+        assert_eq!(print(&s1, a1), print(&s2, a2));
+
+        // Analyzing a file again replaces what it had before
+        let mut s3 = AnalyzerCoreStateBlob::new();
+        let lib3 = analyze(&mut s3, &dir, &[&b]);
+        load_compiled_units(&mut s3, lib3);
+        assert_eq!(s3.op_l.get(lib3).design_units().len(), 2);
+
+        // A damaged file is noticed
+        let good = fs::read(&lib_path).unwrap();
+        let mut contents = good.clone();
+        let last = contents.len() - 1;
+        contents[last] ^= 0xFF;
+        fs::write(&lib_path, &contents).unwrap();
+        let mut s5 = AnalyzerCoreStateBlob::new();
+        let lib5 = analyze(&mut s5, &dir, &[]);
+        load_compiled_units(&mut s5, lib5);
+        assert!(s5.warnings.contains("not a valid compiled library"));
+
+        fs::write(&lib_path, &good).unwrap();
+
+        // Snapshots don't care about the source
+        let snapshot_path = dir.join("snapshot.yvl");
+        save_library_snapshot(&mut s3, lib3, &snapshot_path).unwrap();
+        let snapshot: &'static [u8] =
+            Box::leak(fs::read(&snapshot_path).unwrap().into_boxed_slice());
+
+        // A changed source makes its units stale
+        fs::write(&b, "entity b is\n\nbegin end;\n").unwrap();
+        let mut s4 = AnalyzerCoreStateBlob::new();
+        let lib4 = analyze(&mut s4, &dir, &[]);
+        load_compiled_units(&mut s4, lib4);
+        assert_eq!(s4.op_l.get(lib4).design_units().len(), 1);
+        let mut s5 = AnalyzerCoreStateBlob::new();
+        let lib5 = analyze(&mut s5, &dir, &[]);
+        s5.op_l.get_mut(lib5).set_compiled(
+            LibraryFile::from_static("snapshot", snapshot).unwrap());
+        load_compiled_units(&mut s5, lib5);
+        assert_eq!(s5.op_l.get(lib5).design_units().len(), 2);
+
+        fs::remove_dir_all(&dir).unwrap();
+    }
+
+    #[test]
+    fn source_changed_before_save_is_stale() {
+        let dir = env::temp_dir().join(
+            format!("yavhdl-libfile-stamp-test-{}", process::id()));
+        fs::create_dir_all(&dir).unwrap();
+        let lib_path = dir.join("work.yvl");
+        let a = dir.join("a.vhd");
+        fs::write(&a, "entity a is
+begin end;
+").unwrap();
+
+        let mut s1 = AnalyzerCoreStateBlob::new();
+        let lib1 = analyze(&mut s1, &dir, &[&a]);
+        // The saved unit is still the one from the old text
+        fs::write(&a, "entity a is
+
+begin end;
+").unwrap();
+        save_compiled_library(&mut s1, lib1, &lib_path).unwrap();
+
+        let mut s2 = AnalyzerCoreStateBlob::new();
+        let lib2 = analyze(&mut s2, &dir, &[]);
+        load_compiled_units(&mut s2, lib2);
+        assert_eq!(s2.op_l.get(lib2).design_units().len(), 0);
+
+        fs::remove_dir_all(&dir).unwrap();
+    }
+}
@@ -24,12 +24,20 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 */
 
 mod ast;
+mod builtin;
 mod core;
 mod design;
 mod identifier;
+mod libfile;
 mod objpools;
+mod parallel;
+mod server;
 mod util;
 
+pub use self::builtin::*;
 pub use self::core::*;
 pub use self::identifier::*;
 pub use self::design::*;
+pub use self::libfile::*;
+pub use self::parallel::*;
+pub use self::server::*;
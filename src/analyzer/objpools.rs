@@ -25,107 +25,227 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 use std::collections::HashMap;
 use std::ffi::OsStr;
+use std::hash::{Hash, Hasher};
+use std::mem;
 use std::os::unix::ffi::OsStrExt;
 use std::marker::PhantomData;
 
 use analyzer::util::*;
+use parser::fnv1a64;
 
 // We need this because the Vec can be reallocated around, but we want to keep
 // around some kind of reference into the storage that can keep working after
 // the reallocation happens. We need the internal one specifically so that
 // we can ensure different types of strings don't get mixed up.
+//
+// An index is the symbol number of the string: every distinct string gets the
+// next number when it is first added. Because strings are interned, two
+// indices are equal exactly when the strings are.
 
 #[derive(Copy, Clone, Eq, PartialEq, Hash, Debug)]
 struct StringPoolIndexInternal {
-    start: usize,
-    end: usize,
+    sym: u32,
 }
 
 #[derive(Copy, Clone, Eq, PartialEq, Hash, Debug)]
 pub struct StringPoolIndexLatin1 {
-    start: usize,
-    end: usize,
+    sym: u32,
 }
 
 #[derive(Copy, Clone, Eq, PartialEq, Hash, Debug)]
 pub struct StringPoolIndexOsStr {
-    start: usize,
-    end: usize,
+    sym: u32,
+}
+
+// Symbol numbers stay below this, which leaves the top two bits free for
+// Identifier's flags
+pub const MAX_STRING_SYMBOLS: u32 = 1 << 30;
+
+impl StringPoolIndexLatin1 {
+    pub fn symbol(&self) -> u32 {
+        self.sym
+    }
+
+    // Only meaningful for a number that came from symbol() on the same pool
+    pub fn from_symbol(sym: u32) -> StringPoolIndexLatin1 {
+        StringPoolIndexLatin1 {sym: sym}
+    }
+}
+
+#[derive(Copy, Clone)]
+struct StringSpan {
+    start: u32,
+    end: u32,
+}
+
+// One entry of the interning table. The hash is kept next to the symbol so
+// that growing the table doesn't have to rehash anything, and so that most
+// mismatches don't have to look at the bytes.
+#[derive(Copy, Clone)]
+struct StringPoolSlot {
+    hash: u32,
+    sym: u32,
+}
+
+// sym of a slot with nothing in it
+const EMPTY_SLOT: u32 = !0;
+
+fn string_hash(inp: &[u8]) -> u32 {
+    let h = fnv1a64(inp);
+    (h ^ (h >> 32)) as u32
 }
 
 pub struct StringPool {
     storage: Vec<u8>,
-    hashtable: HashMap<Vec<u8>, StringPoolIndexInternal>,
+    // Where each symbol is in storage
+    spans: Vec<StringSpan>,
+    // Open addressing with linear probing; the size is always a power of two.
+    // The table only holds symbol numbers, so each string is kept once.
+    table: Vec<StringPoolSlot>,
 }
 
 impl<'a> StringPool {
     pub fn new() -> StringPool {
         StringPool {
             storage: Vec::new(),
-            hashtable: HashMap::new(),
+            spans: Vec::new(),
+            table: Vec::new(),
         }
     }
 
-    // TODO: Do we care about freeing things?
-    fn add_internal_str(&mut self, inp: &[u8]) -> StringPoolIndexInternal {
+    fn bytes(&self, sym: u32) -> &[u8] {
+        let span = self.spans[sym as usize];
+        &self.storage[span.start as usize..span.end as usize]
+    }
+
+    fn grow_table(&mut self) {
+        let new_size = (self.table.len() * 2).max(64);
+        let old_table = mem::replace(&mut self.table,
+            vec![StringPoolSlot {hash: 0, sym: EMPTY_SLOT}; new_size]);
+        let mask = new_size - 1;
+        for slot in old_table {
+            if slot.sym == EMPTY_SLOT {
+                continue;
+            }
+            let mut i = slot.hash as usize & mask;
+            while self.table[i].sym != EMPTY_SLOT {
+                i = (i + 1) & mask;
+            }
+            self.table[i] = slot;
+        }
+    }
+
+    // Returns the symbol for inp if there is one, and otherwise the free slot
+    // where it should go
+    fn probe(&self, inp: &[u8], hash: u32) -> Result<u32, usize> {
+        let mask = self.table.len() - 1;
+        let mut i = hash as usize & mask;
+        loop {
+            let slot = self.table[i];
+            if slot.sym == EMPTY_SLOT {
+                return Err(i);
+            }
+            if slot.hash == hash && self.bytes(slot.sym) == inp {
+                return Ok(slot.sym);
+            }
+            i = (i + 1) & mask;
+        }
+    }
+
+    // Interns the bytes from start to the end of storage, which have just been
+    // appended. If they are already in the pool, they are taken off again.
+    fn intern_tail(&mut self, start: usize) -> StringPoolIndexInternal {
         // We now need to intern the string because we need to ensure that
         // we always can compare string pool indices. This is needed so that
         // Identifiers can be compared without having to drag the string
         // pool around, which is in turn needed so that Identifiers can be
         // properly hashed.
-        if let Some(existing_idx) = self.hashtable.get(inp) {
-            return StringPoolIndexInternal {
-                start: existing_idx.start,
-                end: existing_idx.end,
-            };
+        if (self.spans.len() + 1) * 4 > self.table.len() * 3 {
+            self.grow_table();
         }
 
-        let addition_begin = self.storage.len();
-        let addition_end = addition_begin + inp.len();
+        let (hash, found) = {
+            let inp = &self.storage[start..];
+            let hash = string_hash(inp);
+            (hash, self.probe(inp, hash))
+        };
+        let slot = match found {
+            Ok(sym) => {
+                self.storage.truncate(start);
+                return StringPoolIndexInternal {sym: sym};
+            },
+            Err(slot) => slot,
+        };
 
-        self.storage.extend(inp.iter().cloned());
+        if self.storage.len() > u32::max_value() as usize ||
+            self.spans.len() >= MAX_STRING_SYMBOLS as usize {
+            panic!("string pool is full");
+        }
 
-        let new_idx = StringPoolIndexInternal {
-            start: addition_begin,
-            end: addition_end
-        };
+        let sym = self.spans.len() as u32;
+        self.spans.push(StringSpan {
+            start: start as u32,
+            end: self.storage.len() as u32,
+        });
+        self.table[slot] = StringPoolSlot {hash: hash, sym: sym};
 
-        self.hashtable.insert(inp.to_vec(), new_idx);
+        StringPoolIndexInternal {sym: sym}
+    }
 
-        new_idx
+    // TODO: Do we care about freeing things?
+    fn add_internal_str(&mut self, inp: &[u8]) -> StringPoolIndexInternal {
+        let start = self.storage.len();
+        self.storage.extend_from_slice(inp);
+        self.intern_tail(start)
     }
 
     pub fn add_latin1_str(&mut self, inp: &[u8]) -> StringPoolIndexLatin1 {
         let int_idx = self.add_internal_str(inp);
-        StringPoolIndexLatin1 {
-            start: int_idx.start,
-            end: int_idx.end,
+        StringPoolIndexLatin1 {sym: int_idx.sym}
+    }
+
+    // The string with every character put through LATIN1_LCASE_TABLE, without
+    // copying it anywhere else first
+    pub fn add_latin1_lowercase(&mut self, i: StringPoolIndexLatin1)
+        -> StringPoolIndexLatin1 {
+
+        let span = self.spans[i.sym as usize];
+        let already_lowercase = self.bytes(i.sym).iter()
+            .all(|&c| LATIN1_LCASE_TABLE[c as usize] == c);
+        if already_lowercase {
+            return i;
         }
+
+        let start = self.storage.len();
+        for j in span.start as usize..span.end as usize {
+            let c = LATIN1_LCASE_TABLE[self.storage[j] as usize];
+            self.storage.push(c);
+        }
+        StringPoolIndexLatin1 {sym: self.intern_tail(start).sym}
     }
 
     pub fn retrieve_latin1_str(&self, i: StringPoolIndexLatin1) -> Latin1Str {
-        let the_slice = &self.storage[i.start..i.end];
-        Latin1Str::new(the_slice)
+        Latin1Str::new(self.bytes(i.sym))
     }
 
     pub fn add_osstr(&mut self, inp: &OsStr) -> StringPoolIndexOsStr {
         let int_idx = self.add_internal_str(inp.as_bytes());
-        StringPoolIndexOsStr {
-            start: int_idx.start,
-            end: int_idx.end,
-        }
+        StringPoolIndexOsStr {sym: int_idx.sym}
     }
 
     pub fn retrieve_osstr(&self, i: StringPoolIndexOsStr) -> &OsStr {
-        let the_slice = &self.storage[i.start..i.end];
-        OsStr::from_bytes(the_slice)
+        OsStr::from_bytes(self.bytes(i.sym))
     }
 }
 
 
-#[derive(Hash, Debug)]
+// An index is a slot number plus the generation of the slot when the object
+// was allocated. Freeing a slot bumps its generation, so an index that outlived
+// its object is caught instead of silently reading whatever took its place.
+#[derive(Debug)]
 pub struct ObjPoolIndex<T> {
-    i: usize,
+    i: u32,
+    gen: u32,
     type_marker: PhantomData<T>
 }
 
@@ -139,36 +259,125 @@ impl<T> Clone for ObjPoolIndex<T> {
 
 impl<T> PartialEq for ObjPoolIndex<T> {
     fn eq(&self, other: &ObjPoolIndex<T>) -> bool {
-        self.i == other.i
+        self.i == other.i && self.gen == other.gen
     }
 }
 
 impl<T> Eq for ObjPoolIndex<T> { }
 
+// Not derived, because that would require T: Hash
+impl<T> Hash for ObjPoolIndex<T> {
+    fn hash<H: Hasher>(&self, state: &mut H) {
+        state.write_u64(((self.gen as u64) << 32) | self.i as u64);
+    }
+}
+
+// Objects are allocated into the pool's current segment, and a whole segment
+// can be freed at once. The analyzer gives every design unit its own segment
+// (see AnalyzerCoreStateBlob::free_design_unit). Segment 0 is never freed.
+#[derive(Copy, Clone, Eq, PartialEq, Hash, Debug)]
+pub struct PoolSegment {
+    id: u32,
+}
+
+pub const PERMANENT_SEGMENT: PoolSegment = PoolSegment {id: 0};
+
+impl PoolSegment {
+    pub fn new(id: u32) -> PoolSegment {
+        PoolSegment {id: id}
+    }
+}
+
+struct ObjPoolSlot<T> {
+    gen: u32,
+    obj: T,
+}
+
 pub struct ObjPool<T> {
-    storage: Vec<T>
+    storage: Vec<ObjPoolSlot<T>>,
+    free_slots: Vec<u32>,
+    segment: PoolSegment,
+    // The slots of every segment other than the permanent one
+    segments: HashMap<PoolSegment, Vec<u32>>,
 }
 
 impl<T: Default> ObjPool<T> {
     pub fn new() -> ObjPool<T> {
-        ObjPool {storage: Vec::new()}
+        ObjPool {
+            storage: Vec::new(),
+            free_slots: Vec::new(),
+            segment: PERMANENT_SEGMENT,
+            segments: HashMap::new(),
+        }
     }
 
     pub fn alloc(&mut self) -> ObjPoolIndex<T> {
-        let i = self.storage.len();
-        let o = T::default();
-
-        self.storage.push(o);
+        let i = match self.free_slots.pop() {
+            Some(i) => i,
+            None => {
+                if self.storage.len() >= u32::max_value() as usize {
+                    panic!("object pool is full");
+                }
+                self.storage.push(ObjPoolSlot {gen: 0, obj: T::default()});
+                (self.storage.len() - 1) as u32
+            }
+        };
+        if self.segment != PERMANENT_SEGMENT {
+            self.segments.entry(self.segment).or_insert_with(Vec::new)
+                .push(i);
+        }
 
-        ObjPoolIndex::<T> {i: i, type_marker: PhantomData}
+        ObjPoolIndex::<T> {
+            i: i,
+            gen: self.storage[i as usize].gen,
+            type_marker: PhantomData
+        }
     }
 
     pub fn get(&self, i: ObjPoolIndex<T>) -> &T {
-        &self.storage[i.i]
+        let slot = &self.storage[i.i as usize];
+        if slot.gen != i.gen {
+            panic!("use of a freed pool object");
+        }
+        &slot.obj
     }
 
     pub fn get_mut(&mut self, i: ObjPoolIndex<T>) -> &mut T {
-        &mut self.storage[i.i]
+        let slot = &mut self.storage[i.i as usize];
+        if slot.gen != i.gen {
+            panic!("use of a freed pool object");
+        }
+        &mut slot.obj
+    }
+
+    pub fn is_live(&self, i: ObjPoolIndex<T>) -> bool {
+        self.storage[i.i as usize].gen == i.gen
+    }
+
+    // Where alloc puts things from now on. Returns the previous segment.
+    pub fn set_segment(&mut self, segment: PoolSegment) -> PoolSegment {
+        let prev = self.segment;
+        self.segment = segment;
+        prev
+    }
+
+    // Drops every object in the segment. Their slots are reused by later
+    // allocations.
+    pub fn free_segment(&mut self, segment: PoolSegment) {
+        assert!(segment != PERMANENT_SEGMENT);
+        if let Some(slots) = self.segments.remove(&segment) {
+            for i in slots {
+                let slot = &mut self.storage[i as usize];
+                slot.obj = T::default();
+                slot.gen = slot.gen.wrapping_add(1);
+                self.free_slots.push(i);
+            }
+        }
+    }
+
+    // Number of slots, live or free
+    pub fn slot_count(&self) -> usize {
+        self.storage.len()
     }
 }
 
@@ -204,6 +413,41 @@ mod tests {
         assert_eq!(sp.storage, b"test1");
     }
 
+    #[test]
+    fn stringpool_grows() {
+        let mut sp = StringPool::new();
+        let empty = sp.add_latin1_str(b"");
+        let mut indices = Vec::new();
+        for i in 0..1000 {
+            indices.push(sp.add_latin1_str(format!("s{}", i).as_bytes()));
+        }
+        assert_eq!(sp.spans.len(), 1001);
+        assert!(sp.table.len().is_power_of_two());
+        assert!(sp.spans.len() * 4 <= sp.table.len() * 3);
+        for i in 0..1000 {
+            let s = format!("s{}", i);
+            assert_eq!(sp.add_latin1_str(s.as_bytes()), indices[i]);
+            assert_eq!(sp.retrieve_latin1_str(indices[i]).raw_name(),
+                s.as_bytes());
+        }
+        assert_eq!(sp.add_latin1_str(b""), empty);
+        assert_eq!(sp.spans.len(), 1001);
+    }
+
+    #[test]
+    fn stringpool_lowercase() {
+        let mut sp = StringPool::new();
+        let lower = sp.add_latin1_str(b"foo\xF6");
+        assert_eq!(sp.add_latin1_lowercase(lower), lower);
+        let upper = sp.add_latin1_str(b"FoO\xD6");
+        assert_eq!(sp.add_latin1_lowercase(upper), lower);
+        assert_eq!(sp.storage, b"foo\xF6FoO\xD6");
+        let other = sp.add_latin1_str(b"BAR");
+        let other_lower = sp.add_latin1_lowercase(other);
+        assert_eq!(sp.retrieve_latin1_str(other_lower).raw_name(), b"bar");
+        assert_eq!(sp.storage, b"foo\xF6FoO\xD6BARbar");
+    }
+
     #[derive(Default)]
     struct ObjPoolTestObject {
         foo: u32
@@ -227,4 +471,38 @@ mod tests {
         assert_eq!(ox.foo, 123);
         assert_eq!(oy.foo, 456);
     }
+
+    #[test]
+    fn objpool_segments() {
+        let mut pool = ObjPool::<ObjPoolTestObject>::new();
+        let x = pool.alloc();
+        pool.set_segment(PoolSegment::new(1));
+        let y = pool.alloc();
+        let z = pool.alloc();
+        pool.set_segment(PERMANENT_SEGMENT);
+        pool.get_mut(y).foo = 456;
+
+        pool.free_segment(PoolSegment::new(1));
+        assert!(pool.is_live(x));
+        assert!(!pool.is_live(y));
+        assert!(!pool.is_live(z));
+
+        // The slots are reused, but the old indices stay dead
+        let w = pool.alloc();
+        assert!(w != y && w != z);
+        assert_eq!(pool.get(w).foo, 0);
+        assert!(!pool.is_live(y));
+        assert_eq!(pool.slot_count(), 3);
+    }
+
+    #[test]
+    #[should_panic(expected = "use of a freed pool object")]
+    fn objpool_catches_stale_index() {
+        let mut pool = ObjPool::<ObjPoolTestObject>::new();
+        pool.set_segment(PoolSegment::new(1));
+        let x = pool.alloc();
+        pool.free_segment(PoolSegment::new(1));
+        pool.alloc();
+        pool.get(x);
+    }
 }
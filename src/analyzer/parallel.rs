@@ -0,0 +1,324 @@
+/*
+Copyright (c) 2016-2017, Robert Ou <rqou@robertou.com>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice,
+   this list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+// Analyzing many files on several threads, for vhdl_analyzer --jobs.
+//
+// Each worker parses a file and analyzes it into an analyzer state of its
+// own, holding only that file. Design units can't refer to each other yet,
+// so the only thing a unit's analysis depends on outside its own file is
+// whether its name is already taken in the library. The results are then
+// merged into the real state one file at a time, in the order the files
+// were given: that check is done again against the real state, and units
+// that pass are copied over. Errors, warnings and the library end up the
+// same as if the files had been analyzed one after another (declarations in
+// a scope can be printed in another order, but they are a set anyway).
+//
+// Once units can depend on each other, a unit will also have to wait for
+// the units it depends on before it can be merged; the merge order then
+// becomes a topological order of that graph rather than the file order.
+
+use std::any::Any;
+use std::collections::BTreeMap;
+use std::ffi::OsString;
+use std::panic;
+use std::sync::Arc;
+use std::sync::atomic::{AtomicUsize, Ordering};
+use std::sync::mpsc;
+use std::thread;
+use std::time::{Duration, Instant};
+
+use analyzer::ast::*;
+use analyzer::builtin::*;
+use analyzer::core::*;
+use analyzer::design::*;
+use analyzer::identifier::*;
+use analyzer::libfile::*;
+use analyzer::objpools::*;
+use parser;
+use stats::RunStats;
+
+// What happened to one file, as vhdl_analyzer would print it
+pub struct FileAnalysis {
+    pub parsed: bool,
+    pub parse_messages: String,
+    pub ok: bool,
+    pub errors: String,
+    pub warnings: String,
+}
+
+struct UnitOutcome {
+    ok: bool,
+    errors: String,
+    warnings: String,
+    unit: Option<ObjPoolIndex<AstNode>>,
+}
+
+struct WorkerFile {
+    parse_messages: String,
+    pt: Option<parser::VhdlParseTreeNode>,
+    // A panic in the analyzer is passed on when the file is merged, which
+    // is when analyzing serially would have hit it
+    analysis: Option<Result<(AnalyzerCoreStateBlob, Vec<UnitOutcome>),
+        Box<Any + Send>>>,
+    // Only measured if stats are on
+    analysis_time: Duration,
+}
+
+fn analyze_alone(lib_name: &[u8], lib_was_ext_id: bool,
+    pt: &parser::VhdlParseTreeNode, file_name: &OsString)
+    -> (AnalyzerCoreStateBlob, Vec<UnitOutcome>) {
+
+    let mut s = AnalyzerCoreStateBlob::new();
+    let sp_idx = s.sp.add_latin1_str(lib_name);
+    let lib_id = Identifier::new_latin1(&mut s.sp, sp_idx, lib_was_ext_id)
+        .unwrap();
+    populate_builtins(&mut s);
+    let lib = s.op_l.alloc();
+    *s.op_l.get_mut(lib) = Library::new(lib_id);
+    s.design_db.add_library(lib_id, lib);
+
+    let mut outcomes = Vec::new();
+    for unit_pt in design_units_of(pt) {
+        s.errors.clear();
+        s.warnings.clear();
+        let units_before = s.op_l.get(lib).design_units().len();
+        let ok = vhdl_analyze_design_unit(&mut s, unit_pt, lib, file_name);
+        let units = s.op_l.get(lib).design_units();
+        outcomes.push(UnitOutcome {
+            ok: ok,
+            errors: s.errors.clone(),
+            warnings: s.warnings.clone(),
+            unit: if units.len() > units_before {
+                Some(units[units.len() - 1])
+            } else {
+                None
+            },
+        });
+    }
+
+    (s, outcomes)
+}
+
+fn merge_file(s: &mut AnalyzerCoreStateBlob, work_lib: ObjPoolIndex<Library>,
+    file_name: &OsString, file: WorkerFile) -> FileAnalysis {
+
+    let mut ret = FileAnalysis {
+        parsed: file.pt.is_some(),
+        parse_messages: file.parse_messages,
+        ok: true,
+        errors: String::new(),
+        warnings: String::new(),
+    };
+    let (alone, outcomes) = match file.analysis {
+        Some(Ok(x)) => x,
+        Some(Err(e)) => panic::resume_unwind(e),
+        None => {
+            ret.ok = false;
+            return ret;
+        }
+    };
+
+    let pt = file.pt.unwrap();
+    for (unit_pt, outcome) in design_units_of(&pt).into_iter()
+        .zip(outcomes) {
+
+        s.errors.clear();
+        s.warnings.clear();
+        if !vhdl_check_design_unit_name(s, unit_pt, work_lib, file_name) {
+            ret.ok = false;
+            ret.errors += &s.errors;
+            continue;
+        }
+
+        ret.ok &= outcome.ok;
+        ret.errors += &outcome.errors;
+        ret.warnings += &outcome.warnings;
+        if let Some(unit) = outcome.unit {
+            let copy = copy_design_unit(&alone, unit, s);
+            let id = s.op_n.get(copy).id().unwrap();
+            s.op_l.get_mut(work_lib).add_design_unit(id, copy);
+        }
+    }
+
+    ret
+}
+
+// Parses and analyzes the files into work_lib on the given number of threads.
+// report is called for each file, in order, as soon as that file and all
+// the ones before it are done. If stats are on, each worker's parse stats
+// are added to them, and "analysis" gets the time spent analyzing files on
+// all the workers plus the time spent merging them.
+pub fn analyze_files_parallel<F>(s: &mut AnalyzerCoreStateBlob,
+    work_lib: ObjPoolIndex<Library>, files: &[OsString], jobs: usize,
+    run_stats: &mut RunStats, mut report: F)
+    where F: FnMut(usize, &FileAnalysis) {
+
+    let lib_id = s.op_l.get(work_lib).id();
+    let lib_name = Arc::new(s.sp.retrieve_latin1_str(lib_id.orig_name)
+        .raw_name().to_vec());
+    let lib_was_ext_id = lib_id.is_extended_id();
+
+    // Workers take the next file that nobody has started on yet, like
+    // vhdl_parser --batch
+    let files_ = Arc::new(files.to_vec());
+    let next_file = Arc::new(AtomicUsize::new(0));
+    let (tx, rx) = mpsc::channel();
+    let mut workers = Vec::new();
+    let stats = run_stats.enabled();
+    for _ in 0..jobs.max(1).min(files.len()) {
+        let files = files_.clone();
+        let next_file = next_file.clone();
+        let lib_name = lib_name.clone();
+        let tx = tx.clone();
+        workers.push(thread::spawn(move || {
+            let mut session = parser::ParseSession::new(false);
+            if stats {
+                session.enable_stats();
+            }
+            loop {
+                let i = next_file.fetch_add(1, Ordering::SeqCst);
+                if i >= files.len() {
+                    break;
+                }
+                let (pt, diagnostics) = session.parse_file(&files[i],
+                    i as i32);
+                let start = if stats {Some(Instant::now())} else {None};
+                let analysis = pt.as_ref().map(|pt| panic::catch_unwind(
+                    panic::AssertUnwindSafe(|| analyze_alone(&lib_name,
+                        lib_was_ext_id, pt, &files[i]))));
+                let file = WorkerFile {
+                    parse_messages: parser::format_diagnostics(&diagnostics),
+                    pt: pt,
+                    analysis: analysis,
+                    analysis_time: start.map_or(Duration::new(0, 0),
+                        |x| x.elapsed()),
+                };
+                if tx.send((i, file)).is_err() {
+                    break;
+                }
+            }
+            session.stats()
+        }));
+    }
+    drop(tx);
+
+    let mut pending = BTreeMap::new();
+    let mut next_merge = 0;
+    for (i, file) in rx {
+        pending.insert(i, file);
+        while let Some(file) = pending.remove(&next_merge) {
+            run_stats.add_time("analysis", file.analysis_time);
+            let result = run_stats.time("analysis",
+                || merge_file(s, work_lib, &files[next_merge], file));
+            report(next_merge, &result);
+            next_merge += 1;
+        }
+    }
+    for worker in workers {
+        let parse_stats = worker.join().expect("Analyzer thread panicked");
+        run_stats.add_parse_stats(&parse_stats);
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use std::env;
+    use std::fs;
+    use std::process;
+    use json;
+
+    fn new_state() -> (AnalyzerCoreStateBlob, ObjPoolIndex<Library>) {
+        let mut s = AnalyzerCoreStateBlob::new();
+        let lib_id = Identifier::new_unicode(&mut s.sp, "work", false)
+            .unwrap();
+        populate_builtins(&mut s);
+        let lib = s.op_l.alloc();
+        *s.op_l.get_mut(lib) = Library::new(lib_id);
+        s.design_db.add_library(lib_id, lib);
+        (s, lib)
+    }
+
+    #[test]
+    fn parallel_matches_serial() {
+        let dir = env::temp_dir().join(
+            format!("yavhdl-parallel-test-{}", process::id()));
+        fs::create_dir_all(&dir).unwrap();
+        let mut files = Vec::new();
+        for i in 0..24 {
+            let path = dir.join(format!("f{}.vhd", i));
+            // Some names clash with other files, some within the same file,
+            // and some files have errors of their own
+            let text = match i % 6 {
+                0 => format!("entity e{} is\n    type t is (a, b);\n\
+                              begin end;\nentity x{} is begin end;\n",
+                    i, i % 4),
+                1 => format!("entity e{} is\n    type t is (a, a);\n\
+                              begin end;\n", i),
+                2 => format!("entity x{} is begin end;\n\
+                              entity x{} is begin end;\n", i % 4, i % 4),
+                3 => format!("entity e{} is begin end e{};\n", i, i + 1),
+                4 => format!("entity e{} is\n    constant c : t;\n\
+                              begin end;\n", i),
+                _ => format!("entity e{} is begin end;\n", i % 5),
+            };
+            fs::write(&path, text).unwrap();
+            files.push(path.into_os_string());
+        }
+
+        let (mut serial, serial_lib) = new_state();
+        let mut serial_results = Vec::new();
+        for file in &files {
+            let (pt, _) = parser::parse_file(file);
+            serial.errors.clear();
+            serial.warnings.clear();
+            let ok = vhdl_analyze_file(&mut serial, &pt.unwrap(), serial_lib,
+                file);
+            serial_results.push((ok, serial.errors.clone(),
+                serial.warnings.clone()));
+        }
+
+        let (mut parallel, parallel_lib) = new_state();
+        let mut parallel_results = Vec::new();
+        analyze_files_parallel(&mut parallel, parallel_lib, &files, 4,
+            &mut RunStats::new(false), |i, result| {
+                assert_eq!(i, parallel_results.len());
+                assert!(result.parsed);
+                parallel_results.push((result.ok, result.errors.clone(),
+                    result.warnings.clone()));
+            });
+        fs::remove_dir_all(&dir).unwrap();
+
+        assert_eq!(serial_results, parallel_results);
+        assert!(serial_results.iter().any(|x| x.0));
+        assert!(serial_results.iter().any(|x| !x.0));
+        let print = |s: &AnalyzerCoreStateBlob| {
+            // The declarations are a set, so their order can differ
+            json::parse(&s.design_db.debug_print(&s.sp, &s.op_l, &s.op_n,
+                &s.op_s)).unwrap().sort_sets()
+        };
+        assert_eq!(print(&serial), print(&parallel));
+    }
+}
@@ -0,0 +1,848 @@
+/*
+Copyright (c) 2016-2017, Robert Ou <rqou@robertou.com>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice,
+   this list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+// The long-running mode of vhdl_analyzer (--server). One analyzer state is
+// kept warm across requests, which arrive as JSON-RPC 2.0, one message per
+// line, on stdin or on a Unix socket. Responses go out the same way.
+//
+// Methods:
+//   parse {file}                 Parses (or reuses the tree of) one file
+//   analyze {files}              Adds files to the project, in order, and
+//                                brings the analysis up to date
+//   query {unit?, extended?}     The analyzed design unit with that name, or
+//                                the whole design database
+//   invalidate {file}            Forgets everything about one file
+//   cancel {id}                  Cancels a request that has not finished
+//   shutdown                     Stops the server
+// Any request can have a deadline_ms parameter. Time is counted from when
+// the request was read, so time spent waiting behind other requests counts.
+//
+// Parse trees are kept per file and reused until the file's size or
+// modification time changes. When a file changes, the design units it added
+// are taken back out of the library and only that file is analyzed again.
+// Design units can't refer to each other yet, so nothing else depends on
+// it, except through the names they take. Files which failed before are
+// redone in case they failed because of a name that clashed with the changed
+// file. Before a file is analyzed again, any later file with a design unit of
+// the same name is taken out and redone after it. This gives the same result
+// as analyzing every file again in order. vhdl_analyzer --watch uses the same
+// state.
+
+use std::collections::{HashMap, HashSet};
+use std::ffi::{OsStr, OsString};
+use std::fs;
+use std::io;
+use std::io::{BufRead, Write};
+use std::os::unix::fs::MetadataExt;
+use std::panic;
+use std::sync::{Arc, Mutex};
+use std::sync::mpsc;
+use std::thread;
+use std::time::{Duration, Instant};
+
+use analyzer::ast::*;
+use analyzer::builtin::*;
+use analyzer::core::*;
+use analyzer::design::*;
+use analyzer::identifier::*;
+use analyzer::objpools::*;
+use json;
+use json::Json;
+use parser;
+
+// JSON-RPC error codes
+const PARSE_ERROR: i32 = -32700;
+const INVALID_REQUEST: i32 = -32600;
+const METHOD_NOT_FOUND: i32 = -32601;
+const INVALID_PARAMS: i32 = -32602;
+const INTERNAL_ERROR: i32 = -32603;
+const REQUEST_CANCELLED: i32 = -32800;
+const DEADLINE_EXCEEDED: i32 = -32001;
+
+pub struct RequestError {
+    pub code: i32,
+    pub message: String,
+}
+
+fn request_error(code: i32, message: &str) -> RequestError {
+    RequestError {
+        code: code,
+        message: message.to_owned(),
+    }
+}
+
+// Lets a long request check whether it should stop. Requests only stop
+// between files, so the state is never left half-updated.
+pub struct RequestControl {
+    id: Option<String>,
+    deadline: Option<Instant>,
+    cancelled: Arc<Mutex<HashSet<String>>>,
+}
+
+impl RequestControl {
+    // For requests that can't be cancelled and have no deadline
+    pub fn none() -> RequestControl {
+        RequestControl {
+            id: None,
+            deadline: None,
+            cancelled: Arc::new(Mutex::new(HashSet::new())),
+        }
+    }
+
+    pub fn check(&self) -> Result<(), RequestError> {
+        if let Some(ref id) = self.id {
+            if self.cancelled.lock().unwrap().contains(id) {
+                return Err(request_error(REQUEST_CANCELLED,
+                    "Request cancelled"));
+            }
+        }
+        if let Some(deadline) = self.deadline {
+            if Instant::now() >= deadline {
+                return Err(request_error(DEADLINE_EXCEEDED,
+                    "Deadline exceeded"));
+            }
+        }
+        Ok(())
+    }
+}
+
+// What a file looked like when it was parsed
+#[derive(PartialEq, Eq, Clone, Copy)]
+struct FileStamp {
+    len: u64,
+    mtime: i64,
+    mtime_nsec: i64,
+}
+
+fn file_stamp(filename: &OsStr) -> Option<FileStamp> {
+    fs::metadata(filename).ok().map(|x| FileStamp {
+        len: x.len(),
+        mtime: x.mtime(),
+        mtime_nsec: x.mtime_nsec(),
+    })
+}
+
+struct ParsedFile {
+    stamp: Option<FileStamp>,
+    pt: Option<parser::VhdlParseTreeNode>,
+    diagnostics: Vec<parser::Diagnostic>,
+}
+
+struct FileResult {
+    ok: bool,
+    errors: String,
+    warnings: String,
+    // Design units the file added to the library
+    units: Vec<ObjPoolIndex<AstNode>>,
+    // Names of all of the file's design units, including ones that failed
+    names: Vec<Identifier>,
+}
+
+struct AnalysisState {
+    s: AnalyzerCoreStateBlob,
+    work_lib: ObjPoolIndex<Library>,
+    // Indexed like AnalysisServer::files. None if the file needs to be
+    // analyzed (again).
+    results: Vec<Option<FileResult>>,
+}
+
+impl AnalysisState {
+    // Takes out everything file i added, and marks it to be redone
+    fn forget(&mut self, i: usize) {
+        if let Some(Some(result)) = self.results.get_mut(i).map(|x| x.take()) {
+            for unit in result.units {
+                self.s.op_l.get_mut(self.work_lib).remove_design_unit(unit);
+                free_design_unit(&mut self.s, unit);
+            }
+        }
+    }
+
+    fn forget_failed(&mut self) {
+        for i in 0..self.results.len() {
+            let failed = match self.results[i] {
+                Some(ref x) => !x.ok,
+                None => false,
+            };
+            if failed {
+                self.forget(i);
+            }
+        }
+    }
+
+    // File i is about to be analyzed (again) and has design units with these
+    // names. Later files that were analyzed before it and share a name with
+    // it would have had the name taken from them, so they have to be redone.
+    fn forget_clashing(&mut self, i: usize, names: &[Identifier]) {
+        for j in i + 1..self.results.len() {
+            let clashes = match self.results[j] {
+                Some(ref x) => x.names.iter().any(|n| names.contains(n)),
+                None => false,
+            };
+            if clashes {
+                self.forget(j);
+            }
+        }
+    }
+}
+
+// What rebuild() did
+pub struct Rebuild {
+    pub reparsed: usize,
+    pub reanalyzed: Vec<OsString>,
+}
+
+pub struct AnalysisServer {
+    lib_name: OsString,
+    lib_was_ext_id: bool,
+    parse_session: parser::ParseSession,
+    // Files in analysis order
+    files: Vec<OsString>,
+    trees: HashMap<OsString, ParsedFile>,
+    // None if analysis needs to start over
+    analysis: Option<AnalysisState>,
+}
+
+fn new_analysis_state(lib_name: &OsStr, lib_was_ext_id: bool)
+    -> Option<AnalysisState> {
+
+    let mut s = AnalyzerCoreStateBlob::new();
+
+    // Same as in vhdl_analyzer
+    let lib_id = match lib_name.to_str() {
+        Some(name_unicode) =>
+            Identifier::new_unicode(&mut s.sp, name_unicode, lib_was_ext_id),
+        None => {
+            use std::os::unix::ffi::OsStrExt;
+            let sp_idx = s.sp.add_latin1_str(lib_name.as_bytes());
+            Identifier::new_latin1(&mut s.sp, sp_idx, lib_was_ext_id)
+        }
+    }.ok()?;
+
+    populate_builtins(&mut s);
+    let work_lib = s.op_l.alloc();
+    *s.op_l.get_mut(work_lib) = Library::new(lib_id);
+    s.design_db.add_library(lib_id, work_lib);
+
+    Some(AnalysisState {
+        s: s,
+        work_lib: work_lib,
+        results: Vec::new(),
+    })
+}
+
+fn param_str<'a>(params: &'a Json, name: &str)
+    -> Result<&'a str, RequestError> {
+
+    params.get(name).and_then(|x| x.as_str()).ok_or_else(|| request_error(
+        INVALID_PARAMS, &format!("Missing string parameter \"{}\"", name)))
+}
+
+fn file_json(filename: &OsStr) -> String {
+    json::quote(&filename.to_string_lossy())
+}
+
+impl AnalysisServer {
+    pub fn new(lib_name: &OsStr, lib_was_ext_id: bool)
+        -> Option<AnalysisServer> {
+
+        // Make sure the name is usable before anything is asked of us
+        new_analysis_state(lib_name, lib_was_ext_id)?;
+
+        Some(AnalysisServer {
+            lib_name: lib_name.to_owned(),
+            lib_was_ext_id: lib_was_ext_id,
+            parse_session: parser::ParseSession::new(false),
+            files: Vec::new(),
+            trees: HashMap::new(),
+            analysis: None,
+        })
+    }
+
+    // Forgets the file's tree and takes its design units out of the library.
+    // Both are redone by the next rebuild.
+    pub fn invalidate(&mut self, filename: &OsStr) -> bool {
+        let known = self.trees.remove(filename).is_some();
+        if let Some(ref mut analysis) = self.analysis {
+            if let Some(i) = self.files.iter().position(|x| x == filename) {
+                analysis.forget(i);
+                analysis.forget_failed();
+            }
+        }
+        known
+    }
+
+    // Files are analyzed in the order they were first added
+    pub fn add_files(&mut self, files: &[OsString]) {
+        for filename in files {
+            if !self.files.contains(filename) {
+                self.files.push(filename.clone());
+            }
+        }
+    }
+
+    // Parses the file unless the kept tree is still current. Returns whether
+    // it was parsed.
+    fn ensure_parsed(&mut self, filename: &OsStr) -> bool {
+        let stamp = file_stamp(filename);
+        if let Some(parsed) = self.trees.get(filename) {
+            if parsed.stamp.is_some() && parsed.stamp == stamp {
+                return false;
+            }
+        }
+
+        if self.trees.contains_key(filename) {
+            self.invalidate(filename);
+        }
+        let (pt, diagnostics) = self.parse_session.parse_file(filename, 0);
+        self.trees.insert(filename.to_owned(), ParsedFile {
+            stamp: stamp,
+            pt: pt,
+            diagnostics: diagnostics,
+        });
+        true
+    }
+
+    pub fn parse(&mut self, filename: &OsStr) -> String {
+        let reparsed = self.ensure_parsed(filename);
+        let parsed = &self.trees[filename];
+        let mut s = format!("{{\"file\": {}, \"ok\": {}, \"reparsed\": {}, \
+                             \"diagnostics\": [",
+            file_json(filename), parsed.pt.is_some(), reparsed);
+        for (i, diag) in parsed.diagnostics.iter().enumerate() {
+            if i != 0 {
+                s.push_str(", ");
+            }
+            s.push_str(&parser::diagnostic_json(diag));
+        }
+        s.push_str("]}");
+        s
+    }
+
+    fn file_result_json(&self, i: usize) -> String {
+        let filename = &self.files[i];
+        let parsed = &self.trees[filename];
+        let mut s = format!("{{\"file\": {}, \"parsed\": {}, \
+                             \"parse_diagnostics\": [",
+            file_json(filename), parsed.pt.is_some());
+        for (i, diag) in parsed.diagnostics.iter().enumerate() {
+            if i != 0 {
+                s.push_str(", ");
+            }
+            s.push_str(&parser::diagnostic_json(diag));
+        }
+        s.push(']');
+        if let Some(ref analysis) = self.analysis {
+            if let Some(&Some(ref result)) = analysis.results.get(i) {
+                s += &format!(", \"analyzed\": {}, \"errors\": {}, \
+                               \"warnings\": {}",
+                    result.ok, json::quote(&result.errors),
+                    json::quote(&result.warnings));
+            }
+        }
+        s.push('}');
+        s
+    }
+
+    // Messages for one file, as vhdl_analyzer would print them
+    pub fn messages(&self, filename: &OsStr) -> String {
+        let i = match self.files.iter().position(|x| x == filename) {
+            Some(x) => x,
+            None => return String::new(),
+        };
+        let parsed = match self.trees.get(filename) {
+            Some(x) => x,
+            None => return String::new(),
+        };
+        if parsed.pt.is_none() {
+            return parser::format_diagnostics(&parsed.diagnostics);
+        }
+        match self.analysis {
+            Some(ref analysis) => match analysis.results.get(i) {
+                Some(&Some(ref result)) if !result.ok => format!(
+                    "{}ERRORS occurred during analysis!\n{}",
+                    result.warnings, result.errors),
+                Some(&Some(ref result)) => result.warnings.clone(),
+                _ => String::new(),
+            },
+            None => String::new(),
+        }
+    }
+
+    // Brings every file up to date: parses the ones that changed on disk and
+    // analyzes everything that isn't analyzed
+    pub fn rebuild(&mut self, ctl: &RequestControl)
+        -> Result<Rebuild, RequestError> {
+
+        if self.analysis.is_none() {
+            self.analysis = new_analysis_state(&self.lib_name,
+                self.lib_was_ext_id);
+        }
+
+        // Changed files have to be found before any analysis is done
+        let mut reparsed = 0;
+        for i in 0..self.files.len() {
+            ctl.check()?;
+            let filename = self.files[i].clone();
+            if self.ensure_parsed(&filename) {
+                reparsed += 1;
+            }
+        }
+
+        let mut reanalyzed = Vec::new();
+        {
+            let analysis = self.analysis.as_mut().unwrap();
+            let n = self.files.len();
+            analysis.results.resize_with(n, || None);
+        }
+        for i in 0..self.files.len() {
+            if self.analysis.as_ref().unwrap().results[i].is_some() {
+                continue;
+            }
+            ctl.check()?;
+
+            let analysis = self.analysis.as_mut().unwrap();
+            let filename = &self.files[i];
+            let result = match self.trees[filename].pt {
+                Some(ref pt) => {
+                    // The analyzer panics on things it doesn't support yet.
+                    // That can't be allowed to take the server down.
+                    let result = panic::catch_unwind(panic::AssertUnwindSafe(
+                        || {
+                            let names: Vec<_> = design_units_of(pt)
+                                .into_iter()
+                                .map(|x| design_unit_name(&mut analysis.s, x))
+                                .collect();
+                            analysis.forget_clashing(i, &names);
+
+                            let s = &mut analysis.s;
+                            let work_lib = analysis.work_lib;
+                            let units_before = s.op_l.get(work_lib)
+                                .design_units().len();
+                            s.errors.clear();
+                            s.warnings.clear();
+                            let ok = vhdl_analyze_file(s, pt, work_lib,
+                                filename);
+                            FileResult {
+                                ok: ok,
+                                errors: s.errors.clone(),
+                                warnings: s.warnings.clone(),
+                                units: s.op_l.get(work_lib)
+                                    .design_units()[units_before..].to_vec(),
+                                names: names,
+                            }
+                        }));
+                    match result {
+                        Ok(result) => result,
+                        Err(_) => {
+                            // Nothing is known about the state any more
+                            self.analysis = None;
+                            return Err(request_error(INTERNAL_ERROR,
+                                &format!("The analyzer crashed on \"{}\"",
+                                    filename.to_string_lossy())));
+                        }
+                    }
+                },
+                None => FileResult {
+                    ok: false,
+                    errors: String::new(),
+                    warnings: String::new(),
+                    units: Vec::new(),
+                    names: Vec::new(),
+                },
+            };
+            analysis.results[i] = Some(result);
+            reanalyzed.push(filename.clone());
+        }
+
+        Ok(Rebuild {
+            reparsed: reparsed,
+            reanalyzed: reanalyzed,
+        })
+    }
+
+    pub fn analyze(&mut self, files: &[OsString], ctl: &RequestControl)
+        -> Result<String, RequestError> {
+
+        self.add_files(files);
+        let rebuild = self.rebuild(ctl)?;
+
+        let mut s = format!("{{\"reparsed\": {}, \"reanalyzed\": {}, \
+                             \"files\": [",
+            rebuild.reparsed, rebuild.reanalyzed.len());
+        let mut first = true;
+        for filename in files {
+            let i = self.files.iter().position(|x| x == filename).unwrap();
+            if !first {
+                s.push_str(", ");
+            }
+            first = false;
+            s.push_str(&self.file_result_json(i));
+        }
+        s.push_str("]}");
+        Ok(s)
+    }
+
+    pub fn query(&mut self, unit: Option<&str>, extended: bool)
+        -> Result<String, RequestError> {
+
+        let analysis = match self.analysis {
+            Some(ref mut x) => x,
+            None => return Ok("null".to_owned()),
+        };
+        let s = &mut analysis.s;
+
+        match unit {
+            None => Ok(s.design_db.debug_print(&s.sp, &s.op_l, &s.op_n,
+                &s.op_s)),
+            Some(name) => {
+                let id = Identifier::new_unicode(&mut s.sp, name, extended)
+                    .map_err(|e| request_error(INVALID_PARAMS, e))?;
+                match s.op_l.get(analysis.work_lib).find_design_unit(id) {
+                    Some(x) => Ok(s.op_n.get(x).debug_print(&s.sp, &s.op_n,
+                        &s.op_s)),
+                    None => Ok("null".to_owned()),
+                }
+            },
+        }
+    }
+
+    // Runs one request, returning the result as JSON text
+    pub fn handle(&mut self, method: &str, params: &Json,
+        ctl: &RequestControl) -> Result<String, RequestError> {
+
+        ctl.check()?;
+        match method {
+            "parse" => {
+                let filename = OsString::from(param_str(params, "file")?);
+                Ok(self.parse(&filename))
+            },
+            "analyze" => {
+                let files = params.get("files").and_then(|x| x.as_array())
+                    .ok_or_else(|| request_error(INVALID_PARAMS,
+                        "Missing array parameter \"files\""))?;
+                let mut filenames = Vec::new();
+                for x in files {
+                    match x.as_str() {
+                        Some(x) => filenames.push(OsString::from(x)),
+                        None => return Err(request_error(INVALID_PARAMS,
+                            "File names must be strings")),
+                    }
+                }
+                self.analyze(&filenames, ctl)
+            },
+            "query" => {
+                let unit = match params.get("unit") {
+                    None | Some(&Json::Null) => None,
+                    Some(x) => Some(x.as_str().ok_or_else(|| request_error(
+                        INVALID_PARAMS, "\"unit\" must be a string"))?),
+                };
+                let extended = params.get("extended") ==
+                    Some(&Json::Bool(true));
+                self.query(unit, extended)
+            },
+            "invalidate" => {
+                let filename = OsString::from(param_str(params, "file")?);
+                Ok(if self.invalidate(&filename) {"true"} else {"false"}
+                    .to_owned())
+            },
+            _ => Err(request_error(METHOD_NOT_FOUND,
+                &format!("Unknown method \"{}\"", method))),
+        }
+    }
+}
+
+fn response(id: &Json, result: Result<String, RequestError>) -> String {
+    match result {
+        Ok(result) => format!("{{\"jsonrpc\": \"2.0\", \"id\": {}, \
+                               \"result\": {}}}", id.to_string(), result),
+        Err(e) => format!("{{\"jsonrpc\": \"2.0\", \"id\": {}, \"error\": \
+                           {{\"code\": {}, \"message\": {}}}}}",
+            id.to_string(), e.code, json::quote(&e.message)),
+    }
+}
+
+// A request as read by the reader thread
+struct Incoming {
+    message: Result<Json, RequestError>,
+    received: Instant,
+}
+
+// Serves requests from input until it ends or a shutdown request comes in.
+// Returns true if it was a shutdown. Cancellations are picked up by a
+// separate thread so that they can arrive while a request is running.
+pub fn serve<R, W>(server: &mut AnalysisServer, input: R, out: &mut W)
+    -> io::Result<bool>
+    where R: BufRead + Send + 'static, W: Write {
+
+    let cancelled = Arc::new(Mutex::new(HashSet::new()));
+    let (tx, rx) = mpsc::channel();
+    {
+        let cancelled = cancelled.clone();
+        thread::spawn(move || {
+            for line in input.lines() {
+                let line = match line {
+                    Ok(x) => x,
+                    Err(_) => break,
+                };
+                if line.trim().is_empty() {
+                    continue;
+                }
+                let message = json::parse(&line).ok_or_else(
+                    || request_error(PARSE_ERROR, "Could not parse message"));
+                if let Ok(ref msg) = message {
+                    if msg.get("method").and_then(|x| x.as_str()) ==
+                        Some("cancel") {
+
+                        if let Some(id) = msg.get("params")
+                            .and_then(|x| x.get("id")) {
+                            cancelled.lock().unwrap().insert(id.to_string());
+                        }
+                    }
+                }
+                let incoming = Incoming {
+                    message: message,
+                    received: Instant::now(),
+                };
+                if tx.send(incoming).is_err() {
+                    break;
+                }
+            }
+        });
+    }
+
+    for incoming in rx {
+        let received = incoming.received;
+        let msg = match incoming.message {
+            Ok(x) => x,
+            Err(e) => {
+                writeln!(out, "{}", response(&Json::Null, Err(e)))?;
+                out.flush()?;
+                continue;
+            },
+        };
+        let id = msg.get("id").cloned();
+        let method = match msg.get("method").and_then(|x| x.as_str()) {
+            Some(x) => x.to_owned(),
+            None => {
+                writeln!(out, "{}", response(&id.unwrap_or(Json::Null),
+                    Err(request_error(INVALID_REQUEST, "Missing method"))))?;
+                out.flush()?;
+                continue;
+            },
+        };
+        let params = msg.get("params").cloned()
+            .unwrap_or(Json::Object(Vec::new()));
+
+        let result = match method.as_str() {
+            "cancel" => Ok("null".to_owned()),
+            "shutdown" => Ok("null".to_owned()),
+            _ => {
+                let ctl = RequestControl {
+                    id: id.as_ref().map(|x| x.to_string()),
+                    deadline: params.get("deadline_ms")
+                        .and_then(|x| x.as_f64())
+                        .map(|ms| received + Duration::from_micros(
+                            (ms.max(0.0) * 1000.0) as u64)),
+                    cancelled: cancelled.clone(),
+                };
+                server.handle(&method, &params, &ctl)
+            },
+        };
+
+        // Notifications (no id) get no response
+        if let Some(ref id) = id {
+            cancelled.lock().unwrap().remove(&id.to_string());
+            writeln!(out, "{}", response(id, result))?;
+            out.flush()?;
+        }
+        if method == "shutdown" {
+            return Ok(true);
+        }
+    }
+
+    Ok(false)
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use std::env;
+    use std::process;
+
+    #[test]
+    fn server_keeps_state_warm() {
+        let dir = env::temp_dir().join(
+            format!("yavhdl-server-test-{}", process::id()));
+        fs::create_dir_all(&dir).unwrap();
+        let a = dir.join("a.vhd");
+        let b = dir.join("b.vhd");
+        fs::write(&a, "entity a is\n    type t is (x, y);\nbegin end;\n")
+            .unwrap();
+        fs::write(&b, "entity b is\nbegin end;\n").unwrap();
+        let a_json = json::quote(&a.to_string_lossy());
+        let b_json = json::quote(&b.to_string_lossy());
+
+        let requests = format!(
+            "{{\"jsonrpc\": \"2.0\", \"id\": 1, \"method\": \"analyze\", \
+              \"params\": {{\"files\": [{}, {}]}}}}\n\
+             {{\"jsonrpc\": \"2.0\", \"id\": 2, \"method\": \"analyze\", \
+              \"params\": {{\"files\": [{}]}}}}\n\
+             {{\"jsonrpc\": \"2.0\", \"id\": 3, \"method\": \"query\", \
+              \"params\": {{\"unit\": \"A\"}}}}\n\
+             {{\"jsonrpc\": \"2.0\", \"id\": 4, \"method\": \"invalidate\", \
+              \"params\": {{\"file\": {}}}}}\n\
+             {{\"jsonrpc\": \"2.0\", \"id\": 5, \"method\": \"analyze\", \
+              \"params\": {{\"files\": [{}], \"deadline_ms\": 0}}}}\n\
+             {{\"jsonrpc\": \"2.0\", \"id\": 6, \"method\": \"analyze\", \
+              \"params\": {{\"files\": [{}]}}}}\n\
+             {{\"jsonrpc\": \"2.0\", \"id\": 7, \"method\": \"frob\"}}\n\
+             not json\n\
+             {{\"jsonrpc\": \"2.0\", \"id\": 8, \"method\": \"shutdown\"}}\n\
+             {{\"jsonrpc\": \"2.0\", \"id\": 9, \"method\": \"query\"}}\n",
+            a_json, b_json, a_json, a_json, b_json, b_json);
+
+        let mut server = AnalysisServer::new(OsStr::new("work"), false)
+            .unwrap();
+        let mut out = Vec::new();
+        let shutdown = serve(&mut server, io::Cursor::new(requests), &mut out)
+            .unwrap();
+        fs::remove_dir_all(&dir).unwrap();
+        assert!(shutdown);
+
+        let out = String::from_utf8(out).unwrap();
+        let lines: Vec<_> = out.lines().map(|x| json::parse(x).unwrap())
+            .collect();
+        assert_eq!(lines.len(), 9);
+        let result = |i: usize| lines[i].get("result").unwrap();
+        let error_code = |i: usize| lines[i].get("error").unwrap()
+            .get("code").unwrap().as_f64().unwrap() as i32;
+
+        assert_eq!(result(0).get("reanalyzed"), Some(&Json::Number(2.0)));
+        assert_eq!(result(0).get("files").unwrap().as_array().unwrap()[0]
+            .get("analyzed"), Some(&Json::Bool(true)));
+        // Nothing changed, so nothing is done again
+        assert_eq!(result(1).get("reparsed"), Some(&Json::Number(0.0)));
+        assert_eq!(result(1).get("reanalyzed"), Some(&Json::Number(0.0)));
+        assert_eq!(result(2).get("type").unwrap().as_str(), Some("Entity"));
+        assert_eq!(result(3), &Json::Bool(true));
+        assert_eq!(error_code(4), DEADLINE_EXCEEDED);
+        // Only a.vhd is done again
+        assert_eq!(result(5).get("reparsed"), Some(&Json::Number(1.0)));
+        assert_eq!(result(5).get("reanalyzed"), Some(&Json::Number(1.0)));
+        assert_eq!(error_code(6), METHOD_NOT_FOUND);
+        assert_eq!(error_code(7), PARSE_ERROR);
+        assert_eq!(lines[8].get("id"), Some(&Json::Number(8.0)));
+    }
+
+    #[test]
+    fn server_frees_reanalyzed_units() {
+        let dir = env::temp_dir().join(
+            format!("yavhdl-server-free-test-{}", process::id()));
+        fs::create_dir_all(&dir).unwrap();
+        let a = dir.join("a.vhd");
+        fs::write(&a, "entity a is\n    type t is (x, y);\nbegin end;\n\
+                       entity a is\nbegin end;\n").unwrap();
+        let files = vec![a.into_os_string()];
+
+        let mut server = AnalysisServer::new(OsStr::new("work"), false)
+            .unwrap();
+        assert!(server.analyze(&files, &RequestControl::none()).is_ok());
+        let slots = |server: &AnalysisServer| {
+            let s = &server.analysis.as_ref().unwrap().s;
+            (s.op_n.slot_count(), s.op_s.slot_count(), s.op_sc.slot_count())
+        };
+        let first_slots = slots(&server);
+        let first_unit = server.analysis.as_ref().unwrap().results[0]
+            .as_ref().unwrap().units[0];
+
+        for _ in 0..50 {
+            server.invalidate(&files[0]);
+            assert!(server.analyze(&files, &RequestControl::none())
+                .is_ok());
+        }
+        fs::remove_dir_all(&dir).unwrap();
+
+        // Everything went back into the same slots, and the unit from the
+        // first round is known to be gone
+        assert_eq!(slots(&server), first_slots);
+        let analysis = server.analysis.as_ref().unwrap();
+        assert!(!analysis.s.op_n.is_live(first_unit));
+        let unit = analysis.results[0].as_ref().unwrap().units[0];
+        assert!(analysis.s.op_n.is_live(unit));
+    }
+
+    #[test]
+    fn server_matches_analysis_from_scratch() {
+        let dir = env::temp_dir().join(
+            format!("yavhdl-server-scratch-test-{}", process::id()));
+        fs::create_dir_all(&dir).unwrap();
+        let a = dir.join("a.vhd");
+        let b = dir.join("b.vhd");
+        let c = dir.join("c.vhd");
+        fs::write(&a, "entity a is\nbegin end;\nentity is\n").unwrap();
+        fs::write(&b, "entity x is\nbegin end;\n").unwrap();
+        fs::write(&c, "entity c is\nbegin end;\n").unwrap();
+        let files = vec![a.clone().into_os_string(), b.into_os_string(),
+            c.into_os_string()];
+
+        let mut server = AnalysisServer::new(OsStr::new("work"), false)
+            .unwrap();
+        assert!(server.analyze(&files, &RequestControl::none()).is_ok());
+
+        // a.vhd is fixed, and now takes the name b.vhd had
+        fs::write(&a, "entity a is\nbegin end;\nentity x is\nbegin end;\n")
+            .unwrap();
+        server.invalidate(&files[0]);
+        let rebuild = server.rebuild(&RequestControl::none()).ok().unwrap();
+        assert_eq!(rebuild.reanalyzed, &files[..2]);
+
+        let mut s = AnalyzerCoreStateBlob::new();
+        populate_builtins(&mut s);
+        let lib_id = Identifier::new_unicode(&mut s.sp, "work", false)
+            .unwrap();
+        let work_lib = s.op_l.alloc();
+        *s.op_l.get_mut(work_lib) = Library::new(lib_id);
+        s.design_db.add_library(lib_id, work_lib);
+        let mut session = parser::ParseSession::new(false);
+        for (i, filename) in files.iter().enumerate() {
+            let pt = session.parse_file(filename, 0).0.unwrap();
+            s.errors.clear();
+            s.warnings.clear();
+            let ok = vhdl_analyze_file(&mut s, &pt, work_lib, filename);
+
+            let analysis = server.analysis.as_ref().unwrap();
+            let result = analysis.results[i].as_ref().unwrap();
+            assert_eq!(result.ok, ok);
+            assert_eq!(result.errors, s.errors);
+            assert_eq!(result.warnings, s.warnings);
+        }
+        fs::remove_dir_all(&dir).unwrap();
+
+        // a.vhd has x now, so b.vhd failed
+        let analysis = server.analysis.as_ref().unwrap();
+        assert!(analysis.results[0].as_ref().unwrap().ok);
+        assert!(!analysis.results[1].as_ref().unwrap().ok);
+    }
+}
@@ -24,30 +24,273 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 */
 
 use std::env;
+use std::ffi::{OsStr, OsString};
+use std::io;
+use std::io::{BufReader, Write};
 use std::os::unix::ffi::OsStrExt;
+use std::os::unix::net::UnixListener;
+use std::path::Path;
 use std::process;
+use std::time::{Duration, Instant};
 
 extern crate yavhdl;
 use yavhdl::analyzer::*;
 use yavhdl::parser;
+use yavhdl::stats::RunStats;
+use yavhdl::watch::FileWatcher;
+
+fn usage(argv0: &str) -> ! {
+    println!("Usage: {} [--cache-dir dir] [--cache-size bytes] \
+              [--cache-stats] [--stats | --stats-json] [--lib-dir dir] \
+              [--snapshot file] [--jobs n] [-e] work_lib_name file1.vhd, \
+              file2.vhd, ...\n       \
+              {} --server [--socket path] [-e] work_lib_name\n       \
+              {} --watch [--debounce ms] [-e] work_lib_name \
+              file1.vhd, file2.vhd, ...",
+        argv0, argv0, argv0);
+    process::exit(-1);
+}
+
+// Keeps the analyzer running, taking JSON-RPC requests on stdin or on a Unix
+// socket (see analyzer/server.rs)
+fn server_main(argv0: &str, socket: Option<&OsStr>, lib_name: &OsStr,
+    lib_was_ext_id: bool) -> ! {
+
+    let mut server = match AnalysisServer::new(lib_name, lib_was_ext_id) {
+        Some(x) => x,
+        None => usage(argv0),
+    };
+
+    match socket {
+        None => {
+            let stdout = io::stdout();
+            let mut out = stdout.lock();
+            if let Err(e) = serve(&mut server,
+                BufReader::new(io::stdin()), &mut out) {
+                eprintln!("Server error: {}", e);
+                process::exit(1);
+            }
+        },
+        Some(path) => {
+            let listener = match UnixListener::bind(path) {
+                Ok(x) => x,
+                Err(e) => {
+                    eprintln!("Could not listen on \"{}\": {}",
+                        path.to_string_lossy(), e);
+                    process::exit(1);
+                }
+            };
+            // Connections are served one at a time, all with the same state
+            for stream in listener.incoming() {
+                let stream = match stream {
+                    Ok(x) => x,
+                    Err(_) => continue,
+                };
+                let reader = match stream.try_clone() {
+                    Ok(x) => BufReader::new(x),
+                    Err(_) => continue,
+                };
+                let mut writer = stream;
+                match serve(&mut server, reader, &mut writer) {
+                    Ok(true) => break,
+                    Ok(false) => {},
+                    Err(e) => eprintln!("Connection error: {}", e),
+                }
+                let _ = writer.flush();
+            }
+            let _ = std::fs::remove_file(path);
+        },
+    }
+    process::exit(0);
+}
+
+fn ms(d: Duration) -> f64 {
+    d.as_secs() as f64 * 1e3 + d.subsec_nanos() as f64 / 1e6
+}
+
+// Analyzes the files, then analyzes them again as they change. Only changed
+// files are parsed and analyzed again (see analyzer/server.rs).
+fn watch_main(argv0: &str, lib_name: &OsStr, lib_was_ext_id: bool,
+    files: &[OsString], debounce: Duration) -> ! {
+
+    let mut server = match AnalysisServer::new(lib_name, lib_was_ext_id) {
+        Some(x) => x,
+        None => usage(argv0),
+    };
+    let mut watcher = match FileWatcher::new(files) {
+        Ok(x) => x,
+        Err(e) => {
+            println!("Could not watch files: {}", e);
+            process::exit(1);
+        }
+    };
+
+    server.add_files(files);
+    let mut first_change = None;
+    loop {
+        let start = Instant::now();
+        let rebuild = match server.rebuild(&RequestControl::none()) {
+            Ok(x) => x,
+            Err(e) => {
+                // Only happens if the analyzer crashed. The next change
+                // starts over.
+                println!("{}", e.message);
+                first_change = Some(watcher_wait(&mut watcher, debounce));
+                continue;
+            }
+        };
+        let elapsed = start.elapsed();
+
+        for filename in &rebuild.reanalyzed {
+            println!("Analyzed file \"{}\"", filename.to_string_lossy());
+            print!("{}", server.messages(filename));
+        }
+        match first_change {
+            Some(first_change) => println!("Rebuilt in {:.1} ms \
+                ({:.1} ms after the first change): {} parsed, {} analyzed",
+                ms(elapsed), ms(first_change.elapsed()), rebuild.reparsed,
+                rebuild.reanalyzed.len()),
+            None => println!("Built in {:.1} ms: {} parsed, {} analyzed",
+                ms(elapsed), rebuild.reparsed, rebuild.reanalyzed.len()),
+        }
+        println!("Watching for changes...");
+
+        first_change = Some(watcher_wait(&mut watcher, debounce));
+    }
+}
+
+fn watcher_wait(watcher: &mut FileWatcher, debounce: Duration) -> Instant {
+    match watcher.wait(debounce) {
+        Ok((_, first_change)) => first_change,
+        Err(e) => {
+            println!("Error while watching files: {}", e);
+            process::exit(1);
+        }
+    }
+}
 
 fn main() {
     let args: Vec<_> = env::args_os().collect();
-    if args.len() < 3 {
-        println!("Usage: {} [-e] work_lib_name file1.vhd, file2.vhd, ...",
-            args[0].to_string_lossy());
-        process::exit(-1);
+    let argv0 = args[0].to_string_lossy().into_owned();
+
+    // Options that come before the library name
+    let mut cache_dir = None;
+    let mut lib_dir = None;
+    let mut snapshot = None;
+    let mut cache_size = parser::DEFAULT_CACHE_MAX_BYTES;
+    let mut cache_stats = false;
+    let mut stats = false;
+    let mut stats_json = false;
+    let mut server = false;
+    let mut socket = None;
+    let mut watch = false;
+    let mut debounce = Duration::from_millis(50);
+    let mut jobs = 1;
+    let mut argi = 1;
+    while argi < args.len() {
+        if &args[argi] == "--cache-dir" && argi + 1 < args.len() {
+            cache_dir = Some(Path::new(&args[argi + 1]));
+            argi += 2;
+        } else if &args[argi] == "--lib-dir" && argi + 1 < args.len() {
+            lib_dir = Some(Path::new(&args[argi + 1]));
+            argi += 2;
+        } else if &args[argi] == "--snapshot" && argi + 1 < args.len() {
+            snapshot = Some(Path::new(&args[argi + 1]));
+            argi += 2;
+        } else if &args[argi] == "--cache-size" && argi + 1 < args.len() {
+            cache_size = match args[argi + 1].to_str()
+                .and_then(|x| x.parse().ok()) {
+                Some(x) => x,
+                None => usage(&argv0),
+            };
+            argi += 2;
+        } else if &args[argi] == "--cache-stats" {
+            cache_stats = true;
+            argi += 1;
+        } else if &args[argi] == "--stats" {
+            stats = true;
+            argi += 1;
+        } else if &args[argi] == "--stats-json" {
+            stats_json = true;
+            argi += 1;
+        } else if &args[argi] == "--server" {
+            server = true;
+            argi += 1;
+        } else if &args[argi] == "--socket" && argi + 1 < args.len() {
+            socket = Some(args[argi + 1].as_os_str());
+            argi += 2;
+        } else if &args[argi] == "--watch" {
+            watch = true;
+            argi += 1;
+        } else if &args[argi] == "--debounce" && argi + 1 < args.len() {
+            debounce = match args[argi + 1].to_str()
+                .and_then(|x| x.parse().ok()) {
+                Some(x) => Duration::from_millis(x),
+                None => usage(&argv0),
+            };
+            argi += 2;
+        } else if &args[argi] == "--jobs" && argi + 1 < args.len() {
+            jobs = match args[argi + 1].to_str()
+                .and_then(|x| x.parse().ok()) {
+                Some(x) if x > 0 => x,
+                _ => usage(&argv0),
+            };
+            argi += 2;
+        } else {
+            break;
+        }
+    }
+    if server {
+        let lib_was_ext_id = argi < args.len() && &args[argi] == "-e";
+        let lib_argi = argi + if lib_was_ext_id {1} else {0};
+        if lib_argi + 1 != args.len() || cache_dir.is_some() {
+            usage(&argv0);
+        }
+        server_main(&argv0, socket, &args[lib_argi], lib_was_ext_id);
+    } else if socket.is_some() {
+        usage(&argv0);
+    }
+    // With a compiled library, there may be nothing new to analyze
+    if args.len() < argi +
+        if lib_dir.is_some() || snapshot.is_some() {1} else {2} {
+        usage(&argv0);
+    }
+    if watch {
+        let lib_was_ext_id = &args[argi] == "-e";
+        let files_argi = argi + if lib_was_ext_id {2} else {1};
+        if files_argi >= args.len() || cache_dir.is_some() {
+            usage(&argv0);
+        }
+        watch_main(&argv0, &args[files_argi - 1], lib_was_ext_id,
+            &args[files_argi..], debounce);
     }
 
+    // Each thread has its own scanner, so there's no cache to share
+    if jobs > 1 && cache_dir.is_some() {
+        usage(&argv0);
+    }
+
+    let mut cache = cache_dir.map(|dir|
+        match parser::ParseCache::new(dir, cache_size) {
+            Ok(x) => x,
+            Err(e) => {
+                println!("Could not open parse cache: {}", e);
+                process::exit(-1);
+            }
+        });
+
     // Construct the state blob
     let mut s = AnalyzerCoreStateBlob::new();
 
     // Parse the given identifier
-    let lib_was_ext_id = &args[1] == "-e";
+    let lib_was_ext_id = &args[argi] == "-e";
+    if lib_was_ext_id && args.len() < argi + 2 {
+        usage(&argv0);
+    }
     let lib_name = if lib_was_ext_id {
-        &args[2]
+        &args[argi + 1]
     } else {
-        &args[1]
+        &args[argi]
     };
 
     // If the name parses as UTF-8, treat it as such. Otherwise treat it as
@@ -62,7 +305,7 @@ fn main() {
     }.unwrap();
 
     // Create design database (ultimate container for everything)
-    s.design_db.populate_builtins();
+    populate_builtins(&mut s);
 
     // Create the library
     let work_lib_idx = s.op_l.alloc();
@@ -72,25 +315,112 @@ fn main() {
     }
     s.design_db.add_library(lib_id, work_lib_idx);
 
-    // Parse each file
-    for i in (if lib_was_ext_id {3} else {2})..args.len() {
-        println!("Parsing file \"{}\"...", args[i].to_string_lossy());
-        let (parse_output, parse_messages) = parser::parse_file(&args[i]);
-        if let Some(pt) = parse_output {
-            println!("Analyzing file \"{}\"...", args[i].to_string_lossy());
-            s.errors.clear();
-            s.warnings.clear();
-            let ret = vhdl_analyze_file(&mut s, &pt, work_lib_idx, &args[i]);
-            print!("{}", s.warnings);
-            if !ret {
-                // An error occurred
-                println!("ERRORS occurred during analysis!");
-                print!("{}", s.errors);
+    // Units analyzed by earlier runs are loaded from here as they are needed
+    let lib_path = lib_dir.map(|dir| {
+        let mut file_name = OsStr::from_bytes(
+            s.sp.retrieve_latin1_str(lib_id.canonical_name()).raw_name())
+            .to_owned();
+        file_name.push(".yvl");
+        dir.join(file_name)
+    });
+    if let Some(ref lib_path) = lib_path {
+        if let Err(e) = open_compiled_library(&mut s, work_lib_idx, lib_path) {
+            // It will be overwritten with whatever is analyzed now
+            println!("Could not open compiled library: {}", e);
+        }
+    }
+
+    // Parse each file. The scanner is kept around between files.
+    let mut run_stats = RunStats::new(stats || stats_json);
+    let mut parse_session = parser::ParseSession::new(false);
+    if run_stats.enabled() {
+        parse_session.enable_stats();
+    }
+    let files_argi = argi + if lib_was_ext_id {2} else {1};
+    if jobs > 1 {
+        // Same output as below, but the files are parsed and analyzed on
+        // several threads (see analyzer/parallel.rs)
+        let files = &args[files_argi..];
+        // Parsing and analysis overlap, so their own times (summed over the
+        // threads) don't say how long this took
+        let start = if run_stats.enabled() {Some(Instant::now())} else {None};
+        analyze_files_parallel(&mut s, work_lib_idx, files, jobs,
+            &mut run_stats, |i, result| {
+                println!("Parsing file \"{}\"...", files[i].to_string_lossy());
+                if result.parsed {
+                    println!("Analyzing file \"{}\"...",
+                        files[i].to_string_lossy());
+                    print!("{}", result.warnings);
+                    if !result.ok {
+                        println!("ERRORS occurred during analysis!");
+                        print!("{}", result.errors);
+                    }
+                } else {
+                    print!("{}", result.parse_messages);
+                }
+            });
+        if let Some(start) = start {
+            run_stats.add_time("parallel wall", start.elapsed());
+        }
+    } else {
+        for i in files_argi..args.len() {
+            println!("Parsing file \"{}\"...", args[i].to_string_lossy());
+            let (parse_output, parse_messages) = match cache {
+                Some(ref mut cache) => run_stats.time("cached parse",
+                    || parser::parse_file_cached(&args[i], cache)),
+                None => {
+                    let (pt, diagnostics) =
+                        parse_session.parse_file(&args[i], i as i32);
+                    (pt, parser::format_diagnostics(&diagnostics))
+                },
+            };
+            if let Some(pt) = parse_output {
+                println!("Analyzing file \"{}\"...",
+                    args[i].to_string_lossy());
+                s.errors.clear();
+                s.warnings.clear();
+                let ret = run_stats.time("analysis",
+                    || vhdl_analyze_file(&mut s, &pt, work_lib_idx, &args[i]));
+                print!("{}", s.warnings);
+                if !ret {
+                    // An error occurred
+                    println!("ERRORS occurred during analysis!");
+                    print!("{}", s.errors);
+                }
+            } else {
+                print!("{}", parse_messages);
             }
-        } else {
-            print!("{}", parse_messages);
+        }
+        run_stats.add_parse_stats(&parse_session.stats());
+    }
+
+    run_stats.add_count("files", (args.len() - files_argi) as u64);
+    if let Some(ref lib_path) = lib_path {
+        s.warnings.clear();
+        let ret = run_stats.time("save library",
+            || save_compiled_library(&mut s, work_lib_idx, lib_path));
+        print!("{}", s.warnings);
+        if let Err(e) = ret {
+            println!("Could not save compiled library: {}", e);
+        }
+    }
+    if let Some(snapshot) = snapshot {
+        if let Err(e) = save_library_snapshot(&mut s, work_lib_idx, snapshot) {
+            println!("Could not write snapshot: {}", e);
         }
     }
+    run_stats.time("print", || println!("{}",
+        s.design_db.debug_print(&s.sp, &s.op_l, &s.op_n, &s.op_s)));
 
-    println!("{}", s.design_db.debug_print(&s.sp, &s.op_l, &s.op_n, &s.op_s));
+    if cache_stats {
+        if let Some(ref cache) = cache {
+            eprint!("{}", cache.stats.report());
+        }
+    }
+    if stats {
+        eprint!("{}", run_stats.report());
+    }
+    if stats_json {
+        eprint!("{}", run_stats.report_json());
+    }
 }
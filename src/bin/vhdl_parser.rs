@@ -24,23 +24,298 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 */
 
 use std::env;
+use std::ffi::{OsStr, OsString};
+use std::fs::File;
+use std::io;
+use std::io::{BufRead, BufReader, Write};
+use std::os::unix::ffi::{OsStrExt, OsStringExt};
+use std::path::Path;
 use std::process;
+use std::time::{Duration, Instant};
 
 extern crate yavhdl;
 use yavhdl::parser;
+use yavhdl::stats::RunStats;
+
+fn usage(argv0: &str) -> ! {
+    println!("Usage: {} [--cache-dir dir] [--cache-size bytes] \
+              [--cache-stats] [--round-trip] [--timing] [--intern] \
+              [--stats | --stats-json] [--memory-stats] file.vhd", argv0);
+    println!("       {} --batch [--jobs n] [--tree] \
+              [file.vhd | @listfile]...", argv0);
+    println!("       (with no files, the list is read from stdin)");
+    process::exit(-1);
+}
+
+// One file name per line
+fn read_file_list<R: BufRead>(list: R) -> io::Result<Vec<OsString>> {
+    let mut ret = Vec::new();
+    for line in list.split(b'\n') {
+        let mut line = line?;
+        if line.last() == Some(&b'\r') {
+            line.pop();
+        }
+        if !line.is_empty() {
+            ret.push(OsString::from_vec(line));
+        }
+    }
+    Ok(ret)
+}
+
+// vhdl_parser --batch: prints one line of JSON per file
+fn batch_main(args: &[OsString], argv0: &str) -> ! {
+    let mut options = parser::BatchOptions {
+        jobs: 1,
+        trees: false,
+    };
+    let mut files = Vec::new();
+    let mut list_given = false;
+    let mut i = 0;
+    while i < args.len() {
+        if &args[i] == "--jobs" && i + 1 < args.len() {
+            options.jobs = match args[i + 1].to_str()
+                .and_then(|x| x.parse().ok()) {
+                Some(x) if x > 0 => x,
+                _ => usage(argv0),
+            };
+            i += 2;
+            continue;
+        } else if &args[i] == "--tree" {
+            options.trees = true;
+        } else if args[i].as_bytes().first() == Some(&b'@') {
+            let listfile = OsStr::from_bytes(&args[i].as_bytes()[1..]);
+            let list = File::open(listfile)
+                .and_then(|f| read_file_list(BufReader::new(f)));
+            match list {
+                Ok(x) => files.extend(x),
+                Err(e) => {
+                    println!("Could not read file list \"{}\": {}",
+                        listfile.to_string_lossy(), e);
+                    process::exit(-1);
+                }
+            }
+            list_given = true;
+        } else {
+            files.push(args[i].clone());
+            list_given = true;
+        }
+        i += 1;
+    }
+    if !list_given {
+        let stdin = io::stdin();
+        files = match read_file_list(stdin.lock()) {
+            Ok(x) => x,
+            Err(e) => {
+                println!("Could not read file list from stdin: {}", e);
+                process::exit(-1);
+            }
+        };
+    }
+
+    let stdout = io::stdout();
+    let mut out = io::BufWriter::new(stdout.lock());
+    let ret = parser::parse_batch(&files, &options, &mut out)
+        .and_then(|x| out.flush().map(|_| x));
+    match ret {
+        Ok(0) => process::exit(0),
+        Ok(_) => process::exit(1),
+        // Most likely the other end of a pipe went away
+        Err(_) => process::exit(-1),
+    }
+}
+
+fn duration_us(d: Duration) -> f64 {
+    d.as_secs() as f64 * 1e6 + d.subsec_nanos() as f64 / 1e3
+}
+
+fn count_packed_nodes(node: parser::PackedNode) -> u32 {
+    let mut count = 1;
+    for i in 0..parser::NUM_FIXED_PIECES as usize {
+        if let Some(child) = node.piece(i) {
+            count += count_packed_nodes(child);
+        }
+    }
+    count
+}
+
+// Sends the tree through the packed format and back, checking the in-place
+// reader along the way. Prints the tree that comes back out.
+fn round_trip(pt: parser::VhdlParseTreeNode, parse_time: Duration,
+    timing: bool) -> parser::VhdlParseTreeNode {
+
+    let pack_start = Instant::now();
+    let packed = pt.serialize();
+    let pack_time = pack_start.elapsed();
+
+    let open_start = Instant::now();
+    let tree = match parser::PackedTree::new(&packed) {
+        Some(x) => x,
+        None => {
+            println!("Packed tree failed validation!");
+            process::exit(1);
+        }
+    };
+    let open_time = open_start.elapsed();
+
+    let walk_start = Instant::now();
+    let walked_nodes = count_packed_nodes(tree.root());
+    let walk_time = walk_start.elapsed();
+
+    if walked_nodes != tree.node_count() || !tree.root().matches(&pt) {
+        println!("Packed tree does not match the parsed tree!");
+        process::exit(1);
+    }
+
+    let thaw_start = Instant::now();
+    let thawed = match parser::deserialize(&packed) {
+        Some(x) => x,
+        None => {
+            println!("Packed tree could not be unpacked!");
+            process::exit(1);
+        }
+    };
+    let thaw_time = thaw_start.elapsed();
+
+    if timing {
+        eprintln!("{} nodes, {} bytes packed", tree.node_count(),
+            packed.len());
+        eprintln!("parse: {:.1} us", duration_us(parse_time));
+        eprintln!("pack: {:.1} us", duration_us(pack_time));
+        eprintln!("open packed: {:.1} us", duration_us(open_time));
+        eprintln!("walk packed in place: {:.1} us", duration_us(walk_time));
+        eprintln!("unpack to tree: {:.1} us", duration_us(thaw_time));
+    }
+
+    thawed
+}
 
 fn main() {
     let args: Vec<_> = env::args_os().collect();
-    if args.len() < 2 {
-        println!("Usage: {} file.vhd", args[0].to_string_lossy());
-        process::exit(-1);
+    let argv0 = args[0].to_string_lossy().into_owned();
+
+    if args.len() > 1 && &args[1] == "--batch" {
+        batch_main(&args[2..], &argv0);
+    }
+
+    let mut cache_dir = None;
+    let mut cache_size = parser::DEFAULT_CACHE_MAX_BYTES;
+    let mut cache_stats = false;
+    let mut do_round_trip = false;
+    let mut timing = false;
+    let mut intern = false;
+    let mut stats = false;
+    let mut stats_json = false;
+    let mut memory_stats = false;
+    let mut i = 1;
+    while i < args.len() {
+        if &args[i] == "--cache-dir" && i + 1 < args.len() {
+            cache_dir = Some(Path::new(&args[i + 1]));
+            i += 2;
+        } else if &args[i] == "--cache-size" && i + 1 < args.len() {
+            cache_size = match args[i + 1].to_str()
+                .and_then(|x| x.parse().ok()) {
+                Some(x) => x,
+                None => usage(&argv0),
+            };
+            i += 2;
+        } else if &args[i] == "--cache-stats" {
+            cache_stats = true;
+            i += 1;
+        } else if &args[i] == "--round-trip" {
+            do_round_trip = true;
+            i += 1;
+        } else if &args[i] == "--timing" {
+            timing = true;
+            i += 1;
+        } else if &args[i] == "--intern" {
+            intern = true;
+            i += 1;
+        } else if &args[i] == "--stats" {
+            stats = true;
+            i += 1;
+        } else if &args[i] == "--stats-json" {
+            stats_json = true;
+            i += 1;
+        } else if &args[i] == "--memory-stats" {
+            memory_stats = true;
+            i += 1;
+        } else {
+            break;
+        }
+    }
+    // Cached trees are loaded from the packed format rather than parsed, so
+    // there is nothing to intern or account for
+    if i + 1 != args.len() ||
+        ((intern || memory_stats) && cache_dir.is_some()) {
+        usage(&argv0);
+    }
+
+    let mut cache = cache_dir.map(|dir|
+        match parser::ParseCache::new(dir, cache_size) {
+            Ok(x) => x,
+            Err(e) => {
+                println!("Could not open parse cache: {}", e);
+                process::exit(-1);
+            }
+        });
+
+    let mut run_stats = RunStats::new(stats || stats_json);
+    let mut intern_stats = parser::InternStats::default();
+    let parse_start = Instant::now();
+    let (parse_output, parse_messages) = match cache {
+        // Hits are not parsed at all, so there is nothing to break down
+        Some(ref mut cache) => run_stats.time("cached parse",
+            || parser::parse_file_cached(&args[i], cache)),
+        None => {
+            let mut session = parser::ParseSession::new(intern);
+            if run_stats.enabled() {
+                session.enable_stats();
+            }
+            if memory_stats {
+                session.enable_memory_stats();
+            }
+            let (pt, diagnostics) = session.parse_file(&args[i], 0);
+            intern_stats = session.intern_stats();
+            run_stats.add_parse_stats(&session.stats());
+            if memory_stats {
+                eprint!("{}", parser::memory_report(&session.memory_stats()));
+            }
+            (pt, parser::format_diagnostics(&diagnostics))
+        },
+    };
+    let parse_time = parse_start.elapsed();
+    if intern {
+        eprint!("{}", intern_stats.report());
+    }
+    if cache_stats {
+        if let Some(ref cache) = cache {
+            eprint!("{}", cache.stats.report());
+        }
+    }
+    if timing && !do_round_trip {
+        eprintln!("parse: {:.1} us", duration_us(parse_time));
     }
 
-    let (parse_output, parse_messages) = parser::parse_file(&args[1]);
-    if let Some(pt) = parse_output {
-        pt.debug_print();
+    let ok = if let Some(pt) = parse_output {
+        let pt = if do_round_trip {
+            run_stats.time("round trip", || round_trip(pt, parse_time, timing))
+        } else {
+            pt
+        };
+        run_stats.time("print", || pt.debug_print());
+        true
     } else {
         println!("{}", parse_messages);
+        false
+    };
+
+    if stats {
+        eprint!("{}", run_stats.report());
+    }
+    if stats_json {
+        eprint!("{}", run_stats.report_json());
+    }
+    if !ok {
         process::exit(1);
     }
 }
@@ -0,0 +1,364 @@
+/*
+Copyright (c) 2016-2017, Robert Ou <rqou@robertou.com>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice,
+   this list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+// Just enough JSON for the line-based protocols of the binaries (see
+// vhdl_parser --batch and vhdl_analyzer --server) and for comparing
+// debug_print output in tests. Output is otherwise built by hand, like
+// debug_print does.
+
+use std::fmt::Write;
+
+#[derive(Debug, Clone, PartialEq)]
+pub enum Json {
+    Null,
+    Bool(bool),
+    Number(f64),
+    String(String),
+    Array(Vec<Json>),
+    // Kept in the order the keys appeared
+    Object(Vec<(String, Json)>),
+}
+
+impl Json {
+    pub fn get(&self, key: &str) -> Option<&Json> {
+        match self {
+            &Json::Object(ref items) =>
+                items.iter().find(|x| x.0 == key).map(|x| &x.1),
+            _ => None,
+        }
+    }
+
+    pub fn as_str(&self) -> Option<&str> {
+        match self {
+            &Json::String(ref s) => Some(s),
+            _ => None,
+        }
+    }
+
+    pub fn as_f64(&self) -> Option<f64> {
+        match self {
+            &Json::Number(x) => Some(x),
+            _ => None,
+        }
+    }
+
+    pub fn as_array(&self) -> Option<&[Json]> {
+        match self {
+            &Json::Array(ref x) => Some(x),
+            _ => None,
+        }
+    }
+
+    // Sorts the items of every array that debug_print marks as a set (its
+    // first item is "__is_a_set"), so that two values holding the same sets
+    // compare equal, the same as test.py does
+    pub fn sort_sets(self) -> Json {
+        match self {
+            Json::Array(items) => {
+                let is_a_set = items.first() ==
+                    Some(&Json::String(String::from("__is_a_set")));
+                let mut items: Vec<Json> = items.into_iter()
+                    .map(|x| x.sort_sets()).collect();
+                if is_a_set {
+                    items.sort_by_key(|x| x.to_string());
+                }
+                Json::Array(items)
+            },
+            Json::Object(items) => Json::Object(items.into_iter()
+                .map(|(k, v)| (k, v.sort_sets())).collect()),
+            x => x,
+        }
+    }
+
+    // Writes the value back out (on one line)
+    pub fn to_string(&self) -> String {
+        let mut s = String::new();
+        self.write_to(&mut s);
+        s
+    }
+
+    fn write_to(&self, s: &mut String) {
+        match self {
+            &Json::Null => s.push_str("null"),
+            &Json::Bool(x) => s.push_str(if x {"true"} else {"false"}),
+            &Json::Number(x) => {
+                if x == x.trunc() && x.abs() < 1e15 {
+                    write!(s, "{}", x as i64).unwrap();
+                } else {
+                    write!(s, "{}", x).unwrap();
+                }
+            },
+            &Json::String(ref x) => s.push_str(&quote(x)),
+            &Json::Array(ref items) => {
+                s.push('[');
+                for (i, x) in items.iter().enumerate() {
+                    if i != 0 {
+                        s.push_str(", ");
+                    }
+                    x.write_to(s);
+                }
+                s.push(']');
+            },
+            &Json::Object(ref items) => {
+                s.push('{');
+                for (i, &(ref k, ref v)) in items.iter().enumerate() {
+                    if i != 0 {
+                        s.push_str(", ");
+                    }
+                    s.push_str(&quote(k));
+                    s.push_str(": ");
+                    v.write_to(s);
+                }
+                s.push('}');
+            },
+        }
+    }
+}
+
+// s as a JSON string, including the quotes
+pub fn quote(s: &str) -> String {
+    let mut ret = String::with_capacity(s.len() + 2);
+    ret.push('"');
+    for c in s.chars() {
+        match c {
+            '"' => ret.push_str("\\\""),
+            '\\' => ret.push_str("\\\\"),
+            '\n' => ret.push_str("\\n"),
+            c if (c as u32) < 0x20 =>
+                write!(ret, "\\u{:04x}", c as u32).unwrap(),
+            c => ret.push(c),
+        }
+    }
+    ret.push('"');
+    ret
+}
+
+struct Parser<'a> {
+    text: &'a [u8],
+    pos: usize,
+}
+
+impl<'a> Parser<'a> {
+    fn skip_whitespace(&mut self) {
+        while self.pos < self.text.len() &&
+            (self.text[self.pos] as char).is_ascii_whitespace() {
+            self.pos += 1;
+        }
+    }
+
+    fn eat(&mut self, c: u8) -> bool {
+        self.skip_whitespace();
+        if self.text.get(self.pos) == Some(&c) {
+            self.pos += 1;
+            true
+        } else {
+            false
+        }
+    }
+
+    fn eat_word(&mut self, word: &str) -> bool {
+        if self.text[self.pos..].starts_with(word.as_bytes()) {
+            self.pos += word.len();
+            true
+        } else {
+            false
+        }
+    }
+
+    fn parse_value(&mut self, depth: u32) -> Option<Json> {
+        // Requests are small, so anything this deep is garbage
+        if depth > 64 {
+            return None;
+        }
+
+        self.skip_whitespace();
+        match *self.text.get(self.pos)? {
+            b'n' => if self.eat_word("null") {Some(Json::Null)} else {None},
+            b't' => if self.eat_word("true") {Some(Json::Bool(true))}
+                    else {None},
+            b'f' => if self.eat_word("false") {Some(Json::Bool(false))}
+                    else {None},
+            b'"' => self.parse_string().map(Json::String),
+            b'[' => {
+                self.pos += 1;
+                let mut items = Vec::new();
+                if self.eat(b']') {
+                    return Some(Json::Array(items));
+                }
+                loop {
+                    items.push(self.parse_value(depth + 1)?);
+                    if self.eat(b']') {
+                        return Some(Json::Array(items));
+                    }
+                    if !self.eat(b',') {
+                        return None;
+                    }
+                }
+            },
+            b'{' => {
+                self.pos += 1;
+                let mut items = Vec::new();
+                if self.eat(b'}') {
+                    return Some(Json::Object(items));
+                }
+                loop {
+                    self.skip_whitespace();
+                    let key = self.parse_string()?;
+                    if !self.eat(b':') {
+                        return None;
+                    }
+                    items.push((key, self.parse_value(depth + 1)?));
+                    if self.eat(b'}') {
+                        return Some(Json::Object(items));
+                    }
+                    if !self.eat(b',') {
+                        return None;
+                    }
+                }
+            },
+            _ => self.parse_number(),
+        }
+    }
+
+    fn parse_number(&mut self) -> Option<Json> {
+        let start = self.pos;
+        while self.pos < self.text.len() &&
+            b"+-0123456789.eE".contains(&self.text[self.pos]) {
+            self.pos += 1;
+        }
+        let text = ::std::str::from_utf8(&self.text[start..self.pos]).ok()?;
+        text.parse().ok().map(Json::Number)
+    }
+
+    fn parse_hex4(&mut self) -> Option<u32> {
+        let text = self.text.get(self.pos..self.pos + 4)?;
+        self.pos += 4;
+        u32::from_str_radix(::std::str::from_utf8(text).ok()?, 16).ok()
+    }
+
+    fn parse_string(&mut self) -> Option<String> {
+        if self.text.get(self.pos) != Some(&b'"') {
+            return None;
+        }
+        self.pos += 1;
+
+        let mut bytes = Vec::new();
+        loop {
+            let c = *self.text.get(self.pos)?;
+            self.pos += 1;
+            match c {
+                b'"' => break,
+                b'\\' => {
+                    let c = *self.text.get(self.pos)?;
+                    self.pos += 1;
+                    let unescaped = match c {
+                        b'"' => '"',
+                        b'\\' => '\\',
+                        b'/' => '/',
+                        b'b' => '\x08',
+                        b'f' => '\x0c',
+                        b'n' => '\n',
+                        b'r' => '\r',
+                        b't' => '\t',
+                        b'u' => {
+                            let mut x = self.parse_hex4()?;
+                            // Surrogate pair
+                            if x >= 0xd800 && x < 0xdc00 {
+                                if !self.eat_word("\\u") {
+                                    return None;
+                                }
+                                let y = self.parse_hex4()?;
+                                if y < 0xdc00 || y >= 0xe000 {
+                                    return None;
+                                }
+                                x = 0x10000 + ((x - 0xd800) << 10) +
+                                    (y - 0xdc00);
+                            }
+                            ::std::char::from_u32(x)?
+                        },
+                        _ => return None,
+                    };
+                    let mut buf = [0; 4];
+                    bytes.extend_from_slice(
+                        unescaped.encode_utf8(&mut buf).as_bytes());
+                },
+                _ => bytes.push(c),
+            }
+        }
+        String::from_utf8(bytes).ok()
+    }
+}
+
+// Returns None unless text is exactly one JSON value
+pub fn parse(text: &str) -> Option<Json> {
+    let mut parser = Parser {
+        text: text.as_bytes(),
+        pos: 0,
+    };
+    let ret = parser.parse_value(0)?;
+    parser.skip_whitespace();
+    if parser.pos != parser.text.len() {
+        return None;
+    }
+    Some(ret)
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn json_round_trip() {
+        let text = "{\"jsonrpc\": \"2.0\", \"id\": 3, \"params\": \
+                    {\"files\": [\"a.vhd\", \"b\\\"\\u00e9\\n.vhd\"], \
+                    \"deadline_ms\": 2.5, \"x\": [true, false, null, []]}}";
+        let x = parse(text).unwrap();
+        assert_eq!(x.get("id"), Some(&Json::Number(3.0)));
+        let params = x.get("params").unwrap();
+        assert_eq!(params.get("files").unwrap().as_array().unwrap()[1]
+            .as_str(), Some("b\"\u{e9}\n.vhd"));
+        assert_eq!(params.get("deadline_ms").unwrap().as_f64(), Some(2.5));
+        assert_eq!(parse(&x.to_string()), Some(x));
+
+        assert_eq!(parse("[1, 2"), None);
+        assert_eq!(parse("{\"a\": 1} x"), None);
+        assert_eq!(parse("\"\\ud800\""), None);
+    }
+
+    #[test]
+    fn sorted_sets_compare_equal() {
+        let a = parse("{\"decls\": [\"__is_a_set\", {\"id\": \"x\"}, \
+                       {\"id\": [\"__is_a_set\", 2, 1]}], \"l\": [2, 1]}")
+            .unwrap();
+        let b = parse("{\"decls\": [\"__is_a_set\", {\"id\": [\"__is_a_set\", \
+                       1, 2]}, {\"id\": \"x\"}], \"l\": [2, 1]}").unwrap();
+        let c = parse("{\"decls\": [\"__is_a_set\", {\"id\": \"x\"}, \
+                       {\"id\": [\"__is_a_set\", 2, 1]}], \"l\": [1, 2]}")
+            .unwrap();
+        assert_eq!(a.clone().sort_sets(), b.sort_sets());
+        // Other arrays keep their order
+        assert!(a.sort_sets() != c.sort_sets());
+    }
+}
@@ -25,3 +25,6 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 pub mod parser;
 pub mod analyzer;
+pub mod json;
+pub mod stats;
+pub mod watch;
@@ -0,0 +1,224 @@
+/*
+Copyright (c) 2016-2017, Robert Ou <rqou@robertou.com>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice,
+   this list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+// Parsing many files in one process, for vhdl_parser --batch. Every file
+// gives one line of JSON, in the same order as the files were given, even
+// when the files are parsed on several threads.
+
+use std::collections::BTreeMap;
+use std::ffi::OsString;
+use std::fmt::Write as FmtWrite;
+use std::io;
+use std::io::Write;
+use std::sync::Arc;
+use std::sync::atomic::{AtomicUsize, Ordering};
+use std::sync::mpsc;
+use std::thread;
+
+use json;
+use super::*;
+
+pub struct BatchOptions {
+    // Number of threads parsing at once. 1 parses on the calling thread.
+    pub jobs: usize,
+    // Whether to include the whole tree in each line
+    pub trees: bool,
+}
+
+// One diagnostic as a JSON object
+pub fn diagnostic_json(diag: &Diagnostic) -> String {
+    let mut s = String::new();
+    write!(s, "{{\"severity\": \"{}\", \"code\": \"{}\", \"message\": {}, \
+               \"line\": {}, \"bytes\": ",
+        match diag.severity {
+            VhdlDiagnosticSeverity::DIAG_ERROR => "error",
+            VhdlDiagnosticSeverity::DIAG_WARNING => "warning",
+        },
+        match diag.code {
+            VhdlDiagnosticCode::DIAG_SYNTAX => "syntax",
+            VhdlDiagnosticCode::DIAG_LEXICAL => "lexical",
+            VhdlDiagnosticCode::DIAG_IO => "io",
+            VhdlDiagnosticCode::DIAG_PARSER_LIMIT => "parser_limit",
+        },
+        json::quote(diag.format().trim_end()), diag.line).unwrap();
+    match diag.bytes {
+        Some((first, last)) => write!(s, "[{}, {}]", first, last).unwrap(),
+        None => s.push_str("null"),
+    }
+    s.push_str(", \"args\": [");
+    for (i, arg) in diag.args.iter().enumerate() {
+        write!(s, "{}{}", if i == 0 {""} else {", "}, json::quote(arg))
+            .unwrap();
+    }
+    s.push_str("]}");
+    s
+}
+
+// One line of output (without the newline)
+pub fn batch_result_line(filename: &OsStr, pt: Option<&VhdlParseTreeNode>,
+    diagnostics: &[Diagnostic], trees: bool) -> String {
+
+    let mut s = String::new();
+    write!(s, "{{\"file\": {}, \"ok\": {}, \"diagnostics\": [",
+        json::quote(&filename.to_string_lossy()), pt.is_some()).unwrap();
+    for (i, diag) in diagnostics.iter().enumerate() {
+        if i != 0 {
+            s.push_str(", ");
+        }
+        s.push_str(&diagnostic_json(diag));
+    }
+    s.push(']');
+    if trees {
+        if let Some(pt) = pt {
+            s.push_str(", \"tree\": ");
+            s.push_str(&pt.debug_string());
+        }
+    }
+    s.push('}');
+    s
+}
+
+fn parse_one(session: &mut ParseSession, files: &[OsString], i: usize,
+    trees: bool) -> (String, bool) {
+
+    let (pt, diagnostics) = session.parse_file(&files[i], i as i32);
+    let line = batch_result_line(&files[i], pt.as_ref(), &diagnostics, trees);
+    (line, pt.is_some())
+}
+
+// Parses every file and writes one line per file to out. Returns how many
+// files failed to parse.
+pub fn parse_batch<W: Write>(files: &[OsString], options: &BatchOptions,
+    out: &mut W) -> io::Result<usize> {
+
+    let mut failures = 0;
+
+    if options.jobs <= 1 {
+        let mut session = ParseSession::new(false);
+        for i in 0..files.len() {
+            let (line, ok) = parse_one(&mut session, files, i, options.trees);
+            writeln!(out, "{}", line)?;
+            if !ok {
+                failures += 1;
+            }
+        }
+        return Ok(failures);
+    }
+
+    // Each worker has its own session and takes the next file that nobody
+    // has started on yet. Lines are held back until everything before them
+    // has been written.
+    let files = Arc::new(files.to_vec());
+    let next_file = Arc::new(AtomicUsize::new(0));
+    let (tx, rx) = mpsc::channel();
+    let mut workers = Vec::new();
+    for _ in 0..options.jobs.min(files.len()) {
+        let files = files.clone();
+        let next_file = next_file.clone();
+        let tx = tx.clone();
+        let trees = options.trees;
+        workers.push(thread::spawn(move || {
+            let mut session = ParseSession::new(false);
+            loop {
+                let i = next_file.fetch_add(1, Ordering::SeqCst);
+                if i >= files.len() {
+                    break;
+                }
+                let (line, ok) = parse_one(&mut session, &files, i, trees);
+                if tx.send((i, line, ok)).is_err() {
+                    break;
+                }
+            }
+        }));
+    }
+    drop(tx);
+
+    let mut pending = BTreeMap::new();
+    let mut next_line = 0;
+    for (i, line, ok) in rx {
+        if !ok {
+            failures += 1;
+        }
+        pending.insert(i, line);
+        while let Some(line) = pending.remove(&next_line) {
+            writeln!(out, "{}", line)?;
+            next_line += 1;
+        }
+    }
+    for worker in workers {
+        worker.join().expect("Parser thread panicked");
+    }
+
+    Ok(failures)
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use std::env;
+    use std::fs;
+    use std::process;
+
+    #[test]
+    fn batch_output_is_ordered() {
+        let dir = env::temp_dir().join(
+            format!("yavhdl-batch-test-{}", process::id()));
+        fs::create_dir_all(&dir).unwrap();
+        let mut files = Vec::new();
+        for i in 0..20 {
+            let path = dir.join(format!("f{}.vhd", i));
+            let text = if i % 7 == 3 {
+                format!("\nentity {} is end;\n", i)
+            } else {
+                format!("entity e{} is\nend;\n", i)
+            };
+            fs::write(&path, text).unwrap();
+            files.push(path.into_os_string());
+        }
+        files.push(dir.join("missing.vhd").into_os_string());
+
+        let mut serial = Vec::new();
+        let failures = parse_batch(&files,
+            &BatchOptions { jobs: 1, trees: true }, &mut serial).unwrap();
+        let mut parallel = Vec::new();
+        parse_batch(&files, &BatchOptions { jobs: 4, trees: true },
+            &mut parallel).unwrap();
+        fs::remove_dir_all(&dir).unwrap();
+
+        assert!(serial == parallel);
+        assert_eq!(failures, 4);
+        let serial = String::from_utf8(serial).unwrap();
+        let lines: Vec<_> = serial.lines().collect();
+        assert_eq!(lines.len(), 21);
+        assert!(lines[0].contains("f0.vhd\", \"ok\": true"));
+        assert!(lines[0].contains("\"str\": \"e0\""));
+        assert!(lines[3].contains("\"ok\": false, \"diagnostics\": \
+            [{\"severity\": \"error\", \"code\": \"syntax\""));
+        assert!(lines[3].contains("\"line\": 2, \"bytes\": [8, 8], \
+            \"args\": [\"TOK_DECIMAL\", \"TOK_BASIC_ID\", \"TOK_EXT_ID\"]"));
+        assert!(!lines[3].contains("\"tree\""));
+        assert!(lines[20].contains("\"code\": \"io\""));
+    }
+}
@@ -0,0 +1,337 @@
+/*
+Copyright (c) 2016-2017, Robert Ou <rqou@robertou.com>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice,
+   this list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+// Microbenchmarks for the hot C++ parts of the parser, each run on its own:
+// the lexer (including unescaping, on text that is mostly strings), node
+// allocation and freeing, printing and serialization. Built separately by
+// build-microbench.sh.
+//
+// Each benchmark is first run with more and more iterations until one batch
+// takes at least the minimum time. That batch size is then used for the
+// warm-up and for every timed sample, so that samples can be compared
+// directly.
+
+#define VHDL_PARSER_IN_MICROBENCH
+#include "vhdl_parser_glue.h"
+#include "util.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <vector>
+
+using namespace YaVHDL::Util;
+
+struct Options {
+    double min_time_ms;
+    int warmup;
+    int samples;
+    const char *filter;
+};
+
+// Keeps the compiler from throwing away the work being measured
+static volatile size_t sink;
+
+// f(iters) does the work iters times and returns the number of items (bytes,
+// tokens, nodes...) processed in one iteration
+template<typename F>
+static void run_bench(const Options &opts, const char *name,
+    const char *unit, F f) {
+
+    if (opts.filter && !strstr(name, opts.filter)) {
+        return;
+    }
+
+    auto time_batch = [&](size_t iters, size_t &items) {
+        auto start = std::chrono::steady_clock::now();
+        items = f(iters);
+        return std::chrono::duration<double, std::nano>(
+            std::chrono::steady_clock::now() - start).count();
+    };
+
+    size_t items = 0;
+    size_t iters = 1;
+    while (time_batch(iters, items) < opts.min_time_ms * 1e6) {
+        iters *= 2;
+    }
+
+    for (int i = 0; i < opts.warmup; i++) {
+        time_batch(iters, items);
+    }
+
+    std::vector<double> ns_per_iter;
+    for (int i = 0; i < opts.samples; i++) {
+        ns_per_iter.push_back(time_batch(iters, items) / iters);
+    }
+    std::sort(ns_per_iter.begin(), ns_per_iter.end());
+    double median = ns_per_iter[ns_per_iter.size() / 2];
+
+    printf("%-32s %10zu iters %12.1f ns/iter (min %.1f, max %.1f) "
+        "%12.0f %s/s\n", name, iters, median, ns_per_iter.front(),
+        ns_per_iter.back(), items / median * 1e9, unit);
+}
+
+// Swallows output so that printing can be timed without the terminal
+class NullBuf : public std::streambuf {
+protected:
+    int overflow(int c) override {
+        return c;
+    }
+    std::streamsize xsputn(const char *, std::streamsize n) override {
+        return n;
+    }
+};
+
+// Lexes the whole buffer, reusing the scanner the same way a parse session
+// does, freeing each token's value. Returns the number of tokens.
+static size_t lex_buffer(yyscan_t scanner, const std::string &text,
+    VhdlParserDiagnostics &diagnostics,
+    std::set<VhdlParseTreeNode *> &to_delete_queue) {
+
+    YY_BUFFER_STATE buf = frontend_vhdl_yy_scan_bytes(text.data(),
+        text.size(), scanner);
+    frontend_vhdl_yyreset_state(scanner);
+    frontend_vhdl_yyset_lineno(1, scanner);
+
+    size_t tokens = 0;
+    YYSTYPE value;
+    YYLTYPE loc;
+    while (true) {
+        value = nullptr;
+        if (!frontend_vhdl_scan(&value, &loc, scanner, diagnostics,
+            to_delete_queue)) {
+            break;
+        }
+        if (value) {
+            value->delete_self();
+        }
+        tokens++;
+    }
+
+    frontend_vhdl_yy_delete_buffer(buf, scanner);
+    diagnostics.clear();
+    return tokens;
+}
+
+// Text used when no file is given: a bit of everything the lexer handles,
+// repeated
+static std::string default_input() {
+    const char *chunk =
+        "-- A comment that goes on for a while\n"
+        "library ieee;\nuse ieee.std_logic_1164.all;\n"
+        "entity counter is\n"
+        "    generic (WIDTH : integer := 16#10#);\n"
+        "    port (clk, rst : in std_logic;\n"
+        "          \\odd name\\ : out std_logic_vector(WIDTH - 1 downto 0));\n"
+        "end entity;\n"
+        "architecture rtl of counter is\n"
+        "    constant MSG : string := \"say \"\"hi\"\"\";\n"
+        "    constant ROM : word_array := (x\"DEAD\", x\"BEEF\", "
+        "12UB\"0000_1111_0000\", o\"777\");\n"
+        "    signal count : unsigned(WIDTH - 1 downto 0);\n"
+        "begin\n"
+        "    process (clk) begin\n"
+        "        if rising_edge(clk) then\n"
+        "            if rst = '1' then count <= (others => '0');\n"
+        "            else count <= count + 1.5e3; end if;\n"
+        "        end if;\n"
+        "    end process;\n"
+        "end architecture;\n";
+
+    std::string ret;
+    while (ret.size() < 256 * 1024) {
+        ret += chunk;
+    }
+    return ret;
+}
+
+static void usage(const char *argv0) {
+    fprintf(stderr, "Usage: %s [--min-time ms] [--warmup n] [--samples n] "
+        "[--filter substring] [file.vhd]\n", argv0);
+    exit(-1);
+}
+
+int main(int argc, char **argv) {
+    Options opts;
+    opts.min_time_ms = 50;
+    opts.warmup = 2;
+    opts.samples = 9;
+    opts.filter = nullptr;
+    const char *input_fn = nullptr;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--min-time") == 0 && i + 1 < argc) {
+            opts.min_time_ms = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--warmup") == 0 && i + 1 < argc) {
+            opts.warmup = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--samples") == 0 && i + 1 < argc) {
+            opts.samples = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--filter") == 0 && i + 1 < argc) {
+            opts.filter = argv[++i];
+        } else if (argv[i][0] != '-' && !input_fn) {
+            input_fn = argv[i];
+        } else {
+            usage(argv[0]);
+        }
+    }
+    if (opts.samples < 1 || opts.min_time_ms <= 0) {
+        usage(argv[0]);
+    }
+
+    std::string input;
+    if (input_fn) {
+        std::ifstream f(input_fn, std::ios::binary);
+        if (!f) {
+            fprintf(stderr, "Error opening file \"%s\"\n", input_fn);
+            return 1;
+        }
+        std::stringstream ss;
+        ss << f.rdbuf();
+        input = ss.str();
+    } else {
+        input = default_input();
+    }
+
+    // Lexer
+
+    VhdlParserDiagnostics diagnostics;
+    diagnostics.clear();
+    std::set<VhdlParseTreeNode *> to_delete_queue;
+    yyscan_t scanner;
+    frontend_vhdl_yylex_init(&scanner);
+
+    run_bench(opts, "lex", "bytes", [&](size_t iters) {
+        for (size_t i = 0; i < iters; i++) {
+            sink = lex_buffer(scanner, input, diagnostics, to_delete_queue);
+        }
+        return input.size();
+    });
+
+    // Strings and extended identifiers, which need their doubled quotes and
+    // backslashes undone
+    std::string strings;
+    while (strings.size() < 64 * 1024) {
+        strings += "\"a \"\"quoted\"\" string\" x\"0F_\"\"F0\" "
+            "\\ext\\\\id\\ ";
+    }
+    run_bench(opts, "lex/strings", "bytes", [&](size_t iters) {
+        for (size_t i = 0; i < iters; i++) {
+            sink = lex_buffer(scanner, strings, diagnostics, to_delete_queue);
+        }
+        return strings.size();
+    });
+
+    frontend_vhdl_yylex_destroy(scanner);
+
+    // Node allocation
+
+    const size_t chain_len = 4096;
+    run_bench(opts, "node/new_delete", "nodes", [&](size_t iters) {
+        for (size_t i = 0; i < iters; i++) {
+            VhdlParseTreeNode *root = new VhdlParseTreeNode(PT_BASIC_ID);
+            for (size_t j = 1; j < chain_len; j++) {
+                VhdlParseTreeNode *x = new VhdlParseTreeNode(PT_BASIC_ID);
+                x->pieces[0] = root;
+                root = x;
+            }
+            root->delete_self();
+        }
+        return chain_len;
+    });
+
+    run_bench(opts, "node/new_delete_strings", "nodes", [&](size_t iters) {
+        for (size_t i = 0; i < iters; i++) {
+            VhdlParseTreeNode *root = new VhdlParseTreeNode(PT_BASIC_ID);
+            root->str = new std::string("identifier");
+            for (size_t j = 1; j < chain_len; j++) {
+                VhdlParseTreeNode *x = new VhdlParseTreeNode(PT_BASIC_ID);
+                x->str = new std::string("identifier");
+                x->pieces[0] = root;
+                root = x;
+            }
+            root->delete_self();
+        }
+        return chain_len;
+    });
+
+    // Printing and serialization need a real tree
+
+    VhdlParserSession *session = VhdlParserNewSession(false);
+    VhdlParseTreeNode *pt = VhdlParserSessionParseBuffer(session,
+        input.data(), input.size(), 0, 1, 1);
+    VhdlParserFreeSession(session);
+    if (!pt) {
+        fprintf(stderr, "The input does not parse, so printing and "
+            "serialization are skipped\n");
+        return 0;
+    }
+
+    NullBuf null_buf;
+    std::ostream null_out(&null_buf);
+
+    run_bench(opts, "print/debug_print", "bytes", [&](size_t iters) {
+        for (size_t i = 0; i < iters; i++) {
+            pt->debug_print(null_out);
+        }
+        return input.size();
+    });
+
+    std::string escaped;
+    while (escaped.size() < 4096) {
+        escaped += "some text with \"quotes\" in it ";
+    }
+    run_bench(opts, "print/string_escaped", "bytes", [&](size_t iters) {
+        for (size_t i = 0; i < iters; i++) {
+            print_string_escaped(null_out, &escaped);
+        }
+        return escaped.size();
+    });
+
+    std::string packed;
+    run_bench(opts, "serialize", "bytes", [&](size_t iters) {
+        for (size_t i = 0; i < iters; i++) {
+            packed.clear();
+            pt->serialize(packed);
+        }
+        return packed.size();
+    });
+
+    run_bench(opts, "deserialize", "bytes", [&](size_t iters) {
+        for (size_t i = 0; i < iters; i++) {
+            VhdlParseTreeNode *x = VhdlParseTreeNode::deserialize(
+                packed.data(), packed.size());
+            x->delete_self();
+        }
+        return packed.size();
+    });
+
+    pt->delete_self();
+    return 0;
+}
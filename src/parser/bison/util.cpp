@@ -32,18 +32,18 @@ namespace YaVHDL::Util
 {
 
 // Escape values for JSON output
-void print_chr_escaped(char c) {
+void print_chr_escaped(std::ostream &out, char c) {
     if (c >= 0x20 && c <= 0x7E && c != '"' && c != '\\') {
-        std::cout << c;
+        out << c;
     } else {
-        std::cout << "\\u00" << std::hex << (+c & 0xFF) << std::dec;
+        out << "\\u00" << std::hex << (+c & 0xFF) << std::dec;
     }
 }
 
-void print_string_escaped(std::string *s) {
+void print_string_escaped(std::ostream &out, std::string *s) {
     for (size_t i = 0; i < s->length(); i++) {
         char c = (*s)[i];
-        print_chr_escaped(c);
+        print_chr_escaped(out, c);
     }
 }
 
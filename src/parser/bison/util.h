@@ -26,14 +26,15 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #ifndef UTIL_H
 #define UTIL_H
 
+#include <iosfwd>
 #include <string>
 
 namespace YaVHDL::Util
 {
 
 // Debugging "pretty-much-JSON" stuff
-void print_chr_escaped(char c);
-void print_string_escaped(std::string *s);
+void print_chr_escaped(std::ostream &out, char c);
+void print_string_escaped(std::ostream &out, std::string *s);
 
 }
 
@@ -26,7 +26,10 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "vhdl_parse_tree.h"
 
 #include <iostream>
+#include <cstdint>
 #include <cstring>
+#include <unordered_map>
+#include <vector>
 #include "util.h"
 using namespace std;
 using namespace YaVHDL::Parser;
@@ -82,8 +85,11 @@ const char * const parse_tree_types[] = {
 
     "PT_UNARY_OPERATOR",
     "PT_BINARY_OPERATOR",
+    "PT_NARY_OPERATOR",
+    "PT_NARY_OPERATOR_GROUP",
 
     "PT_AGGREGATE",
+    "PT_LITERAL_AGGREGATE",
     "PT_ELEMENT_ASSOCIATION",
     "PT_CHOICES",
     "PT_CHOICES_OTHER",
@@ -191,6 +197,7 @@ const char * const parse_tree_types[] = {
     "PT_PORT_MAP_ASPECT",
     "PT_ASSOCIATION_LIST",
     "PT_ASSOCIATION_ELEMENT",
+    "PT_SIMPLE_ASSOCIATION_LIST",
     "PT_INERTIAL_EXPRESSION",
 
     "PT_SUBPROGRAM_INSTANTIATION_DECLARATION",
@@ -300,6 +307,12 @@ const char * const parse_tree_types[] = {
     "PT_DESIGN_UNIT",
     "PT_DESIGN_FILE",
 };
+static_assert(sizeof(parse_tree_types) / sizeof(parse_tree_types[0]) ==
+    NUM_PARSE_TREE_NODE_TYPES, "NUM_PARSE_TREE_NODE_TYPES is out of date");
+// Rust sees the refcount as a plain int
+static_assert(sizeof(std::atomic<int>) == sizeof(int) &&
+    alignof(std::atomic<int>) == alignof(int),
+    "std::atomic<int> does not have the layout of int");
 
 const char * const parse_operators[] = {
     "??",
@@ -412,50 +425,686 @@ VhdlParseTreeNode::VhdlParseTreeNode(enum ParseTreeNodeType type) {
     this->boolean2 = false;
     this->boolean3 = false;
     memset(this->pieces, 0, sizeof(this->pieces));
+    this->op_type = OP_COND;
+    this->range_dir = RANGE_DOWN;
+    this->force_mode = FORCE_UNSPEC;
+    this->purity = PURITY_UNSPEC;
+    this->interface_mode = MODE_UNSPEC;
+    this->subprogram_kind = SUBPROGRAM_UNSPEC;
+    this->entity_class = ENTITY_ENTITY;
+    this->signal_kind = SIGKIND_UNSPEC;
 
     // Default (unset) location information
     this->first_line = -1;
     this->first_column = -1;
     this->last_line = -1;
     this->last_column = -1;
+
+    this->refcount = 1;
+
+    this->accounted_type = type;
+    this->accounted_bytes = 0;
+    this->recount();
 }
 
 // Destroy a parse tree node and free associated data
 void VhdlParseTreeNode::delete_self() {
-    // Destroy contents
-    delete this->str;
-    delete this->str2;
-    // Destroy all pieces for nodes
-    // Just in case nodes don't track their count, free the maximum rather than
-    // the stored count. This is safe because freeing null is safe.
+    // Lists nest one level per element, so this uses an explicit stack
+    // rather than recursion. Netlists can have millions of statements.
+    std::vector<VhdlParseTreeNode *> to_delete;
+    to_delete.push_back(this);
+    while (!to_delete.empty()) {
+        VhdlParseTreeNode *x = to_delete.back();
+        to_delete.pop_back();
+
+        // Shared nodes are only destroyed when the last owner lets go
+        if (--x->refcount > 0) {
+            continue;
+        }
+
+        if (memory_stats) {
+            x->unaccount_memory();
+        }
+
+        // Destroy contents
+        delete x->str;
+        delete x->str2;
+        // Destroy all pieces for nodes
+        // Just in case nodes don't track their count, free the maximum rather
+        // than the stored count. This is safe because freeing null is safe.
+        for (int i = 0; i < NUM_FIXED_PIECES; i++) {
+            if (x->pieces[i]) {
+                to_delete.push_back(x->pieces[i]);
+            }
+        }
+
+        delete x;
+    }
+}
+
+void VhdlParseTreeNode::shift_lines(int delta) {
+    // Unset locations stay unset
+    if (this->first_line >= 0) {
+        this->first_line += delta;
+    }
+    if (this->last_line >= 0) {
+        this->last_line += delta;
+    }
+
     for (int i = 0; i < NUM_FIXED_PIECES; i++) {
         if (this->pieces[i]) {
-            this->pieces[i]->delete_self();
+            this->pieces[i]->shift_lines(delta);
+        }
+    }
+}
+
+static size_t node_bytes(const VhdlParseTreeNode *x) {
+    size_t ret = sizeof(VhdlParseTreeNode);
+    if (x->str) {
+        ret += sizeof(std::string) + x->str->capacity();
+    }
+    if (x->str2) {
+        ret += sizeof(std::string) + x->str2->capacity();
+    }
+    return ret;
+}
+
+const char *VhdlParseTreeNode::type_name(enum ParseTreeNodeType type) {
+    return parse_tree_types[type];
+}
+
+thread_local VhdlParseTreeMemoryStats *VhdlParseTreeNode::memory_stats;
+
+void VhdlParseTreeNode::account_memory() {
+    size_t bytes = node_bytes(this);
+    if (this->accounted_bytes == bytes && this->accounted_type == this->type) {
+        return;
+    }
+
+    this->unaccount_memory();
+    int type = this->type;
+    memory_stats->live_nodes[type]++;
+    memory_stats->live_bytes[type] += bytes;
+    if (memory_stats->live_nodes[type] > memory_stats->peak_nodes[type]) {
+        memory_stats->peak_nodes[type] = memory_stats->live_nodes[type];
+    }
+    if (memory_stats->live_bytes[type] > memory_stats->peak_bytes[type]) {
+        memory_stats->peak_bytes[type] = memory_stats->live_bytes[type];
+    }
+    this->accounted_type = type;
+    this->accounted_bytes = bytes;
+}
+
+void VhdlParseTreeNode::unaccount_memory() {
+    // Nodes created while accounting was off were never counted
+    if (!this->accounted_bytes) {
+        return;
+    }
+
+    memory_stats->live_nodes[this->accounted_type]--;
+    memory_stats->live_bytes[this->accounted_type] -= this->accounted_bytes;
+    this->accounted_bytes = 0;
+}
+
+void VhdlParseTreeNode::count_nodes(unsigned long long *by_type,
+    unsigned long long &bytes) {
+
+    std::vector<VhdlParseTreeNode *> stack;
+    stack.push_back(this);
+    while (!stack.empty()) {
+        VhdlParseTreeNode *x = stack.back();
+        stack.pop_back();
+        by_type[x->type]++;
+        bytes += node_bytes(x);
+        for (int i = 0; i < NUM_FIXED_PIECES; i++) {
+            if (x->pieces[i]) {
+                stack.push_back(x->pieces[i]);
+            }
+        }
+    }
+}
+
+static bool has_location(const VhdlParseTreeNode *x) {
+    return x->first_line >= 0 || x->first_column >= 0 ||
+        x->last_line >= 0 || x->last_column >= 0;
+}
+
+// Pieces are already interned by the time a node is looked up, so identical
+// subtrees have identical piece pointers and only this node needs to be
+// looked at.
+size_t VhdlParseTreeInterner::NodeHash::operator()(
+    const VhdlParseTreeNode *x) const {
+    size_t h = std::hash<int>()(x->type);
+    auto mix = [&h](size_t v) {
+        h ^= v + 0x9e3779b9 + (h << 6) + (h >> 2);
+    };
+    if (x->str) {
+        mix(std::hash<std::string>()(*x->str));
+    }
+    if (x->str2) {
+        mix(std::hash<std::string>()(*x->str2));
+    }
+    mix(x->chr);
+    mix(x->integer);
+    mix(x->boolean | (x->boolean2 << 1) | (x->boolean3 << 2));
+    mix(x->op_type);
+    mix(x->range_dir);
+    mix(x->force_mode);
+    mix(x->purity);
+    mix(x->interface_mode);
+    mix(x->subprogram_kind);
+    mix(x->entity_class);
+    mix(x->signal_kind);
+    for (int i = 0; i < NUM_FIXED_PIECES; i++) {
+        mix(std::hash<const VhdlParseTreeNode *>()(x->pieces[i]));
+    }
+    return h;
+}
+
+static bool same_str(const std::string *a, const std::string *b) {
+    if (!a || !b) {
+        return a == b;
+    }
+    return *a == *b;
+}
+
+bool VhdlParseTreeInterner::NodeEqual::operator()(
+    const VhdlParseTreeNode *a, const VhdlParseTreeNode *b) const {
+    if (a->type != b->type ||
+        !same_str(a->str, b->str) ||
+        !same_str(a->str2, b->str2) ||
+        a->chr != b->chr ||
+        a->integer != b->integer ||
+        a->boolean != b->boolean ||
+        a->boolean2 != b->boolean2 ||
+        a->boolean3 != b->boolean3 ||
+        a->op_type != b->op_type ||
+        a->range_dir != b->range_dir ||
+        a->force_mode != b->force_mode ||
+        a->purity != b->purity ||
+        a->interface_mode != b->interface_mode ||
+        a->subprogram_kind != b->subprogram_kind ||
+        a->entity_class != b->entity_class ||
+        a->signal_kind != b->signal_kind) {
+        return false;
+    }
+    for (int i = 0; i < NUM_FIXED_PIECES; i++) {
+        if (a->pieces[i] != b->pieces[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+VhdlParseTreeInterner::~VhdlParseTreeInterner() {
+    // Drop our references. Nodes still used by a tree stay alive.
+    for (auto x = this->table.begin(); x != this->table.end(); x++) {
+        (*x)->delete_self();
+    }
+}
+
+VhdlParseTreeNode *VhdlParseTreeInterner::intern(VhdlParseTreeNode *node) {
+    this->stats.nodes++;
+    this->stats.bytes_before += node_bytes(node);
+
+    // A node can only be shared if everything under it is shared too
+    bool shareable = !has_location(node);
+    for (int i = 0; i < NUM_FIXED_PIECES; i++) {
+        if (node->pieces[i]) {
+            node->pieces[i] = this->intern(node->pieces[i]);
+            auto piece = this->table.find(node->pieces[i]);
+            if (piece == this->table.end() || *piece != node->pieces[i]) {
+                shareable = false;
+            }
+        }
+    }
+
+    if (!shareable) {
+        return node;
+    }
+
+    auto existing = this->table.find(node);
+    if (existing != this->table.end() && *existing == node) {
+        // Already shared (this tree was interned before)
+        return node;
+    }
+    if (existing != this->table.end()) {
+        VhdlParseTreeNode *ret = *existing;
+        ret->refcount++;
+        this->stats.shared_nodes++;
+        this->stats.bytes_saved += node_bytes(node);
+        // The pieces are shared, so this only frees the node itself
+        node->delete_self();
+        return ret;
+    }
+
+    node->refcount++;
+    this->table.insert(node);
+    return node;
+}
+
+static int num_pieces(const VhdlParseTreeNode *x) {
+    int ret = 0;
+    while (ret < NUM_FIXED_PIECES && x->pieces[ret]) {
+        ret++;
+    }
+    return ret;
+}
+
+// Adds an operand at the end of a PT_NARY_OPERATOR or group, keeping all
+// operands at the same depth. If the node is full, the operand goes into a
+// new group of the same depth, which is returned for the caller to add.
+static VhdlParseTreeNode *nary_append(VhdlParseTreeNode *node,
+    VhdlParseTreeNode *y) {
+    int count = num_pieces(node);
+
+    VhdlParseTreeNode *to_add = y;
+    if (node->pieces[0]->type == PT_NARY_OPERATOR_GROUP) {
+        to_add = nary_append(node->pieces[count - 1], y);
+        if (!to_add) {
+            node->integer++;
+            return nullptr;
+        }
+    }
+
+    if (count < NUM_FIXED_PIECES) {
+        node->pieces[count] = to_add;
+        node->integer++;
+        return nullptr;
+    }
+
+    VhdlParseTreeNode *group = new VhdlParseTreeNode(PT_NARY_OPERATOR_GROUP);
+    group->op_type = node->op_type;
+    group->integer = 1;
+    group->pieces[0] = to_add;
+    return group;
+}
+
+VhdlParseTreeNode *VhdlParseTreeNode::associative_operator(
+    enum ParseTreeOperatorType op, VhdlParseTreeNode *x,
+    VhdlParseTreeNode *y) {
+
+    if (x->type == PT_NARY_OPERATOR && x->op_type == op) {
+        VhdlParseTreeNode *overflow = nary_append(x, y);
+        if (!overflow) {
+            return x;
         }
+
+        // The run outgrew its top node, so add a level above it
+        VhdlParseTreeNode *ret = new VhdlParseTreeNode(PT_NARY_OPERATOR);
+        ret->op_type = op;
+        x->type = PT_NARY_OPERATOR_GROUP;
+        x->recount();
+        ret->pieces[0] = x;
+        ret->pieces[1] = overflow;
+        ret->integer = x->integer + 1;
+        return ret;
+    }
+
+    if (x->type == PT_BINARY_OPERATOR && x->op_type == op) {
+        // Third operand, so switch over to the flat form
+        x->type = PT_NARY_OPERATOR;
+        x->recount();
+        x->pieces[2] = y;
+        x->integer = 3;
+        return x;
     }
 
-    delete this;
+    VhdlParseTreeNode *ret = new VhdlParseTreeNode(PT_BINARY_OPERATOR);
+    ret->op_type = op;
+    ret->pieces[0] = x;
+    ret->pieces[1] = y;
+    return ret;
+}
+
+void VhdlParseTreeNode::nary_operands(std::vector<VhdlParseTreeNode *> &out) {
+    for (int i = 0; i < NUM_FIXED_PIECES && this->pieces[i]; i++) {
+        if (this->pieces[i]->type == PT_NARY_OPERATOR_GROUP) {
+            this->pieces[i]->nary_operands(out);
+        } else {
+            out.push_back(this->pieces[i]);
+        }
+    }
+}
+
+// Returns the literal in an element association if it can be stored in a
+// PT_LITERAL_AGGREGATE
+static VhdlParseTreeNode *dense_literal(VhdlParseTreeNode *x) {
+    if (x->type != PT_ELEMENT_ASSOCIATION || x->pieces[1]) {
+        return nullptr;
+    }
+
+    VhdlParseTreeNode *lit = x->pieces[0];
+    switch (lit->type) {
+        case PT_LIT_CHAR:
+        case PT_LIT_STRING:
+        case PT_LIT_BITSTRING:
+        case PT_LIT_DECIMAL:
+        case PT_LIT_BASED:
+            return lit;
+
+        default:
+            return nullptr;
+    }
+}
+
+static bool fits_literal_template(const VhdlParseTreeNode *tmpl,
+    const VhdlParseTreeNode *lit) {
+    if (tmpl->type != lit->type) {
+        return false;
+    }
+    if (tmpl->type == PT_LIT_CHAR) {
+        return true;
+    }
+    return tmpl->str->size() == lit->str->size() &&
+        same_str(tmpl->str2, lit->str2);
+}
+
+static void append_literal_text(std::string &out,
+    const VhdlParseTreeNode *lit) {
+    if (lit->type == PT_LIT_CHAR) {
+        out += lit->chr;
+    } else {
+        out += *lit->str;
+    }
+}
+
+// Turns out into element i of a PT_LITERAL_AGGREGATE. out can be reused for
+// every element of the same aggregate.
+static void fill_literal_element(const VhdlParseTreeNode *agg, int i,
+    VhdlParseTreeNode *out) {
+    const VhdlParseTreeNode *tmpl = agg->pieces[0];
+    out->type = tmpl->type;
+    if (tmpl->type == PT_LIT_CHAR) {
+        out->chr = (*agg->str)[i];
+        out->recount();
+        return;
+    }
+
+    size_t width = tmpl->str->size();
+    if (!out->str) {
+        out->str = new std::string();
+    }
+    out->str->assign(*agg->str, i * width, width);
+    if (tmpl->str2 && !out->str2) {
+        out->str2 = new std::string(*tmpl->str2);
+    }
+    out->recount();
+}
+
+static VhdlParseTreeNode *literal_element_association(
+    const VhdlParseTreeNode *agg, int i) {
+    VhdlParseTreeNode *lit = new VhdlParseTreeNode(agg->pieces[0]->type);
+    fill_literal_element(agg, i, lit);
+    VhdlParseTreeNode *ret = new VhdlParseTreeNode(PT_ELEMENT_ASSOCIATION);
+    ret->pieces[0] = lit;
+    return ret;
+}
+
+// Lets go of an argument of aggregate_append or association_append that the
+// result doesn't use
+static void discard_node(VhdlParseTreeNode *x, bool owned,
+    std::set<VhdlParseTreeNode *> &discarded) {
+    if (owned) {
+        x->delete_self();
+    } else {
+        discarded.insert(x);
+    }
+}
+
+// A new node with the same contents as a literal, so that a template doesn't
+// have to be taken from a node the parser still holds
+static VhdlParseTreeNode *copy_literal(const VhdlParseTreeNode *lit) {
+    VhdlParseTreeNode *ret = new VhdlParseTreeNode(lit->type);
+    ret->chr = lit->chr;
+    if (lit->str) {
+        ret->str = new std::string(*lit->str);
+    }
+    if (lit->str2) {
+        ret->str2 = new std::string(*lit->str2);
+    }
+    ret->first_line = lit->first_line;
+    ret->first_column = lit->first_column;
+    ret->last_line = lit->last_line;
+    ret->last_column = lit->last_column;
+    ret->recount();
+    return ret;
+}
+
+VhdlParseTreeNode *VhdlParseTreeNode::aggregate_append(VhdlParseTreeNode *x,
+    VhdlParseTreeNode *y, bool owned,
+    std::set<VhdlParseTreeNode *> &discarded) {
+
+    VhdlParseTreeNode *y_lit = dense_literal(y);
+
+    if (x->type == PT_LITERAL_AGGREGATE) {
+        if (y_lit && fits_literal_template(x->pieces[0], y_lit)) {
+            VhdlParseTreeNode *ret = x;
+            if (!owned) {
+                ret = new VhdlParseTreeNode(PT_LITERAL_AGGREGATE);
+                ret->str = new std::string(*x->str);
+                ret->integer = x->integer;
+                ret->pieces[0] = copy_literal(x->pieces[0]);
+                discarded.insert(x);
+            }
+            append_literal_text(*ret->str, y_lit);
+            ret->integer++;
+            ret->recount();
+            discard_node(y, owned, discarded);
+            return ret;
+        }
+
+        // Doesn't fit, so continue with the ordinary form
+        VhdlParseTreeNode *expanded = x->expand_literal_aggregate();
+        discard_node(x, owned, discarded);
+        x = expanded;
+    } else if (x->type == PT_ELEMENT_ASSOCIATION) {
+        VhdlParseTreeNode *x_lit = dense_literal(x);
+        if (x_lit && y_lit && fits_literal_template(x_lit, y_lit)) {
+            VhdlParseTreeNode *ret =
+                new VhdlParseTreeNode(PT_LITERAL_AGGREGATE);
+            ret->str = new std::string();
+            append_literal_text(*ret->str, x_lit);
+            append_literal_text(*ret->str, y_lit);
+            ret->integer = 2;
+            ret->recount();
+            if (owned) {
+                ret->pieces[0] = x_lit;
+                x->pieces[0] = nullptr;
+            } else {
+                ret->pieces[0] = copy_literal(x_lit);
+            }
+            discard_node(x, owned, discarded);
+            discard_node(y, owned, discarded);
+            return ret;
+        }
+    }
+
+    VhdlParseTreeNode *ret = new VhdlParseTreeNode(PT_AGGREGATE);
+    ret->pieces[0] = x;
+    ret->pieces[1] = y;
+    return ret;
+}
+
+VhdlParseTreeNode *VhdlParseTreeNode::expand_literal_aggregate() {
+    VhdlParseTreeNode *ret = literal_element_association(this, 0);
+    for (int i = 1; i < this->integer; i++) {
+        VhdlParseTreeNode *agg = new VhdlParseTreeNode(PT_AGGREGATE);
+        agg->pieces[0] = ret;
+        agg->pieces[1] = literal_element_association(this, i);
+        ret = agg;
+    }
+    return ret;
+}
+
+// Returns the formal and actual names of a "formal => actual" association if
+// it can be stored in a PT_SIMPLE_ASSOCIATION_LIST
+static bool simple_association(VhdlParseTreeNode *x,
+    VhdlParseTreeNode **formal, VhdlParseTreeNode **actual) {
+    if (x->type != PT_ASSOCIATION_ELEMENT || !x->pieces[1] ||
+        x->pieces[0]->type != PT_BASIC_ID ||
+        x->pieces[1]->type != PT_BASIC_ID) {
+        return false;
+    }
+
+    *actual = x->pieces[0];
+    *formal = x->pieces[1];
+    return true;
+}
+
+static void append_simple_association(std::string &out,
+    const VhdlParseTreeNode *formal, const VhdlParseTreeNode *actual) {
+    if (!out.empty()) {
+        out += ' ';
+    }
+    out += *formal->str;
+    out += ' ';
+    out += *actual->str;
+}
+
+// Reads the name starting at pos in a PT_SIMPLE_ASSOCIATION_LIST and moves
+// pos to the start of the next one. Basic identifiers can't contain spaces.
+static void next_simple_name(const std::string &names, size_t &pos,
+    std::string &out) {
+    size_t end = names.find(' ', pos);
+    if (end == std::string::npos) {
+        end = names.size();
+    }
+    out.assign(names, pos, end - pos);
+    pos = end + 1;
+}
+
+VhdlParseTreeNode *VhdlParseTreeNode::association_append(
+    VhdlParseTreeNode *x, VhdlParseTreeNode *y, bool owned,
+    std::set<VhdlParseTreeNode *> &discarded) {
+
+    VhdlParseTreeNode *y_formal, *y_actual;
+    bool y_simple = simple_association(y, &y_formal, &y_actual);
+
+    if (x->type == PT_SIMPLE_ASSOCIATION_LIST) {
+        if (y_simple) {
+            VhdlParseTreeNode *ret = x;
+            if (!owned) {
+                ret = new VhdlParseTreeNode(PT_SIMPLE_ASSOCIATION_LIST);
+                ret->str = new std::string(*x->str);
+                ret->integer = x->integer;
+                discarded.insert(x);
+            }
+            append_simple_association(*ret->str, y_formal, y_actual);
+            ret->integer++;
+            ret->recount();
+            discard_node(y, owned, discarded);
+            return ret;
+        }
+
+        // Doesn't fit, so continue with the ordinary form
+        VhdlParseTreeNode *expanded = x->expand_simple_associations();
+        discard_node(x, owned, discarded);
+        x = expanded;
+    } else {
+        VhdlParseTreeNode *x_formal, *x_actual;
+        if (y_simple && simple_association(x, &x_formal, &x_actual)) {
+            VhdlParseTreeNode *ret =
+                new VhdlParseTreeNode(PT_SIMPLE_ASSOCIATION_LIST);
+            ret->str = new std::string();
+            append_simple_association(*ret->str, x_formal, x_actual);
+            append_simple_association(*ret->str, y_formal, y_actual);
+            ret->integer = 2;
+            ret->recount();
+            discard_node(x, owned, discarded);
+            discard_node(y, owned, discarded);
+            return ret;
+        }
+    }
+
+    VhdlParseTreeNode *ret = new VhdlParseTreeNode(PT_ASSOCIATION_LIST);
+    ret->pieces[0] = x;
+    ret->pieces[1] = y;
+    return ret;
+}
+
+VhdlParseTreeNode *VhdlParseTreeNode::expand_simple_associations() {
+    VhdlParseTreeNode *ret = nullptr;
+    size_t pos = 0;
+    for (int i = 0; i < this->integer; i++) {
+        VhdlParseTreeNode *element =
+            new VhdlParseTreeNode(PT_ASSOCIATION_ELEMENT);
+        element->pieces[1] = new VhdlParseTreeNode(PT_BASIC_ID);
+        element->pieces[1]->str = new std::string();
+        next_simple_name(*this->str, pos, *element->pieces[1]->str);
+        element->pieces[1]->recount();
+        element->pieces[0] = new VhdlParseTreeNode(PT_BASIC_ID);
+        element->pieces[0]->str = new std::string();
+        next_simple_name(*this->str, pos, *element->pieces[0]->str);
+        element->pieces[0]->recount();
+
+        if (!ret) {
+            ret = element;
+        } else {
+            VhdlParseTreeNode *list =
+                new VhdlParseTreeNode(PT_ASSOCIATION_LIST);
+            list->pieces[0] = ret;
+            list->pieces[1] = element;
+            ret = list;
+        }
+    }
+    return ret;
+}
+
+// Prints the rest of a left-nested list of count elements the same way as a
+// chain of list nodes of the given type would be printed. The dense node
+// types use this because they can be very long, so it doesn't recurse.
+template <typename F>
+static void print_dense_list(std::ostream &out, const char *list_type,
+    int count, F print_element) {
+    out << ", \"rest\": ";
+    for (int i = 2; i < count; i++) {
+        out << "{\"type\": \"" << list_type << "\", \"rest\": ";
+    }
+    for (int i = 0; i < count; i++) {
+        if (i != 0) {
+            out << ", \"this_piece\": ";
+        }
+        print_element(i);
+        if (i != 0 && i != count - 1) {
+            out << "}";
+        }
+    }
 }
 
 // Pretty-print the node into a JSON-like format
 void VhdlParseTreeNode::debug_print() {
-    cout << "{\"type\": \"" << parse_tree_types[this->type] << "\"";
+    debug_print(cout);
+}
+
+void VhdlParseTreeNode::debug_print(std::ostream &out) {
+    // Flattened operators and dense aggregates print the same as the nested
+    // form they replace
+    if (this->type == PT_NARY_OPERATOR) {
+        out << "{\"type\": \"PT_BINARY_OPERATOR\"";
+    } else if (this->type == PT_LITERAL_AGGREGATE) {
+        out << "{\"type\": \"PT_AGGREGATE\"";
+    } else if (this->type == PT_SIMPLE_ASSOCIATION_LIST) {
+        out << "{\"type\": \"PT_ASSOCIATION_LIST\"";
+    } else {
+        out << "{\"type\": \"" << parse_tree_types[this->type] << "\"";
+    }
 
     if (this->first_line >= 0) {
-        cout << ", \"first_line\": ";
-        cout << this->first_line;
+        out << ", \"first_line\": ";
+        out << this->first_line;
     }
     if (this->first_column >= 0) {
-        cout << ", \"first_column\": ";
-        cout << this->first_column;
+        out << ", \"first_column\": ";
+        out << this->first_column;
     }
     if (this->last_line >= 0) {
-        cout << ", \"last_line\": ";
-        cout << this->last_line;
+        out << ", \"last_line\": ";
+        out << this->last_line;
     }
     if (this->last_column >= 0) {
-        cout << ", \"last_column\": ";
-        cout << this->last_column;
+        out << ", \"last_column\": ";
+        out << this->last_column;
     }
 
     switch (this->type) {
@@ -464,1414 +1113,1414 @@ void VhdlParseTreeNode::debug_print() {
         case PT_LIT_BASED:
         case PT_BASIC_ID:
         case PT_EXT_ID:
-            cout << ", \"str\": \"";
-            print_string_escaped(this->str);
-            cout << "\"";
+            out << ", \"str\": \"";
+            print_string_escaped(out, this->str);
+            out << "\"";
             break;
 
         case PT_LIT_CHAR:
-            cout << ", \"char\": \"";
-            print_chr_escaped(this->chr);
-            cout << "\"";
+            out << ", \"char\": \"";
+            print_chr_escaped(out, this->chr);
+            out << "\"";
             break;
 
         case PT_LIT_BITSTRING:
-            cout << ", \"str\": \"";
-            print_string_escaped(this->str);
-            cout << "\"";
-            cout << ", \"base_str\": \"";
-            print_string_escaped(this->str2);
-            cout << "\"";
+            out << ", \"str\": \"";
+            print_string_escaped(out, this->str);
+            out << "\"";
+            out << ", \"base_str\": \"";
+            print_string_escaped(out, this->str2);
+            out << "\"";
             break;
 
         case PT_LIT_PHYS:
-            cout << ", \"unit\": ";
-            this->pieces[0]->debug_print();
+            out << ", \"unit\": ";
+            this->pieces[0]->debug_print(out);
             if (this->pieces[1]) {
-                cout << ", \"val\": ";
-                this->pieces[1]->debug_print();
+                out << ", \"val\": ";
+                this->pieces[1]->debug_print(out);
             }
             break;
 
         case PT_NAME_SELECTED:
-            cout << ", \"name\": ";
-            this->pieces[0]->debug_print();
-            cout << ", \"suffix\": ";
-            this->pieces[1]->debug_print();
+            out << ", \"name\": ";
+            this->pieces[0]->debug_print(out);
+            out << ", \"suffix\": ";
+            this->pieces[1]->debug_print(out);
             break;
 
         case PT_NAME_AMBIG_PARENS:
         case PT_NAME_SLICE:
-            cout << ", \"name\": ";
-            this->pieces[0]->debug_print();
-            cout << ", \"parens\": ";
-            this->pieces[1]->debug_print();
+            out << ", \"name\": ";
+            this->pieces[0]->debug_print(out);
+            out << ", \"parens\": ";
+            this->pieces[1]->debug_print(out);
             break;
 
         case PT_NAME_ATTRIBUTE:
-            cout << ", \"name\": ";
-            this->pieces[0]->debug_print();
-            cout << ", \"attribute\": ";
-            this->pieces[1]->debug_print();
+            out << ", \"name\": ";
+            this->pieces[0]->debug_print(out);
+            out << ", \"attribute\": ";
+            this->pieces[1]->debug_print(out);
             if (this->pieces[2]) {
-                cout << ", \"signature\": ";
-                this->pieces[2]->debug_print();
+                out << ", \"signature\": ";
+                this->pieces[2]->debug_print(out);
             }
             if (this->pieces[3]) {
-                cout << ", \"expression\": ";
-                this->pieces[3]->debug_print();
+                out << ", \"expression\": ";
+                this->pieces[3]->debug_print(out);
             }
             break;
 
         case PT_NAME_EXT_CONST:
         case PT_NAME_EXT_SIG:
         case PT_NAME_EXT_VAR:
-            cout << ", \"pathname\": ";
-            this->pieces[0]->debug_print();
-            cout << ", \"subtype_indication\": ";
-            this->pieces[1]->debug_print();
+            out << ", \"pathname\": ";
+            this->pieces[0]->debug_print(out);
+            out << ", \"subtype_indication\": ";
+            this->pieces[1]->debug_print(out);
             break;
 
         case PT_PACKAGE_PATHNAME:
-            cout << ", \"library\": ";
-            this->pieces[0]->debug_print();
-            cout << ", \"package\": ";
-            this->pieces[1]->debug_print();
-            cout << ", \"object\": ";
-            this->pieces[2]->debug_print();
+            out << ", \"library\": ";
+            this->pieces[0]->debug_print(out);
+            out << ", \"package\": ";
+            this->pieces[1]->debug_print(out);
+            out << ", \"object\": ";
+            this->pieces[2]->debug_print(out);
             break;
 
         case PT_ABSOLUTE_PATHNAME:
-            cout << ", \"pathname\": ";
-            this->pieces[0]->debug_print();
+            out << ", \"pathname\": ";
+            this->pieces[0]->debug_print(out);
             break;
 
         case PT_RELATIVE_PATHNAME:
-            cout << ", \"pathname\": ";
-            this->pieces[0]->debug_print();
-            cout << ", \"up_count\": ";
-            cout << this->integer;
+            out << ", \"pathname\": ";
+            this->pieces[0]->debug_print(out);
+            out << ", \"up_count\": ";
+            out << this->integer;
             break;
 
         case PT_PARTIAL_PATHNAME:
-            cout << ", \"object\": ";
-            this->pieces[0]->debug_print();
+            out << ", \"object\": ";
+            this->pieces[0]->debug_print(out);
             if (this->pieces[1]) {
-                cout << ", \"pathname_element\": ";
-                this->pieces[1]->debug_print();
+                out << ", \"pathname_element\": ";
+                this->pieces[1]->debug_print(out);
             }
             break;
 
         case PT_PATHNAME_ELEMENT_GENERATE_LABEL:
-            cout << ", \"label\": ";
-            this->pieces[0]->debug_print();
-            cout << ", \"expression\": ";
-            this->pieces[1]->debug_print();
+            out << ", \"label\": ";
+            this->pieces[0]->debug_print(out);
+            out << ", \"expression\": ";
+            this->pieces[1]->debug_print(out);
             break;
 
         case PT_SIGNATURE:
             if (this->pieces[0]) {
-                cout << ", \"args\": ";
-                this->pieces[0]->debug_print();
+                out << ", \"args\": ";
+                this->pieces[0]->debug_print(out);
             }
             if (this->pieces[1]) {
-                cout << ", \"ret\": ";
-                this->pieces[1]->debug_print();
+                out << ", \"ret\": ";
+                this->pieces[1]->debug_print(out);
             }
             break;
 
         case PT_SUBTYPE_INDICATION:
-            cout << ", \"type_mark\": ";
-            this->pieces[0]->debug_print();
+            out << ", \"type_mark\": ";
+            this->pieces[0]->debug_print(out);
             if (this->pieces[1]) {
-                cout << ", \"resolution_indication\": ";
-                this->pieces[1]->debug_print();
+                out << ", \"resolution_indication\": ";
+                this->pieces[1]->debug_print(out);
             }
             if (this->pieces[2]) {
-                cout << ", \"constraint\": ";
-                this->pieces[2]->debug_print();
+                out << ", \"constraint\": ";
+                this->pieces[2]->debug_print(out);
             }
             break;
 
         case PT_RECORD_ELEMENT_RESOLUTION:
-            cout << ", \"element_name\": ";
-            this->pieces[0]->debug_print();
-            cout << ", \"resolution_indication\": ";
-            this->pieces[1]->debug_print();
+            out << ", \"element_name\": ";
+            this->pieces[0]->debug_print(out);
+            out << ", \"resolution_indication\": ";
+            this->pieces[1]->debug_print(out);
             break;
 
         case PT_RANGE:
-            cout << ", \"dir\": \"" << range_direction[this->range_dir];
-            cout << "\", \"x\": ";
-            this->pieces[0]->debug_print();
-            cout << ", \"y\": ";
-            this->pieces[1]->debug_print();
+            out << ", \"dir\": \"" << range_direction[this->range_dir];
+            out << "\", \"x\": ";
+            this->pieces[0]->debug_print(out);
+            out << ", \"y\": ";
+            this->pieces[1]->debug_print(out);
             break;
 
         case PT_ARRAY_CONSTRAINT:
-            cout << ", \"index_constraint\": ";
+            out << ", \"index_constraint\": ";
             if (this->pieces[0]) {
-                this->pieces[0]->debug_print();
+                this->pieces[0]->debug_print(out);
             } else {
-                cout << "\"open\"";
+                out << "\"open\"";
             }
             if (this->pieces[1]) {
-                cout << ", \"element_constraint\": ";
-                this->pieces[1]->debug_print();
+                out << ", \"element_constraint\": ";
+                this->pieces[1]->debug_print(out);
             }
             break;
 
         case PT_RECORD_ELEMENT_CONSTRAINT:
-            cout << ", \"element_name\": ";
-            this->pieces[0]->debug_print();
-            cout << ", \"element_constraint\": ";
-            this->pieces[1]->debug_print();
+            out << ", \"element_name\": ";
+            this->pieces[0]->debug_print(out);
+            out << ", \"element_constraint\": ";
+            this->pieces[1]->debug_print(out);
             break;
 
         case PT_ELEMENT_ASSOCIATION:
-            cout << ", \"expression\": ";
-            this->pieces[0]->debug_print();
+            out << ", \"expression\": ";
+            this->pieces[0]->debug_print(out);
             if (this->pieces[1]) {
-                cout << ", \"choices\": ";
-                this->pieces[1]->debug_print();
+                out << ", \"choices\": ";
+                this->pieces[1]->debug_print(out);
             }
             break;
 
         case PT_QUALIFIED_EXPRESSION:
-            cout << ", \"qualify_type\": ";
-            this->pieces[0]->debug_print();
-            cout << ", \"expression\": ";
-            this->pieces[1]->debug_print();
+            out << ", \"qualify_type\": ";
+            this->pieces[0]->debug_print(out);
+            out << ", \"expression\": ";
+            this->pieces[1]->debug_print(out);
             break;
 
         case PT_ALLOCATOR:
-            cout << ", \"alloc\": ";
-            this->pieces[0]->debug_print();
+            out << ", \"alloc\": ";
+            this->pieces[0]->debug_print(out);
             break;
 
         case PT_FUNCTION_CALL:
-            cout << ", \"name\": ";
-            this->pieces[0]->debug_print();
-            cout << ", \"params\": ";
-            this->pieces[1]->debug_print();
+            out << ", \"name\": ";
+            this->pieces[0]->debug_print(out);
+            out << ", \"params\": ";
+            this->pieces[1]->debug_print(out);
             break;
 
         case PT_PARAMETER_ASSOCIATION_ELEMENT:
         case PT_ASSOCIATION_ELEMENT:
-            cout << ", \"actual_part\": ";
-            this->pieces[0]->debug_print();
+            out << ", \"actual_part\": ";
+            this->pieces[0]->debug_print(out);
             if (this->pieces[1]) {
-                cout << ", \"formal_part\": ";
-                this->pieces[1]->debug_print();
+                out << ", \"formal_part\": ";
+                this->pieces[1]->debug_print(out);
             }
             break;
 
         case PT_STATEMENT_LABEL:
-            cout << ", \"label\": ";
-            this->pieces[0]->debug_print();
-            cout << ", \"statement\": ";
-            this->pieces[1]->debug_print();
+            out << ", \"label\": ";
+            this->pieces[0]->debug_print(out);
+            out << ", \"statement\": ";
+            this->pieces[1]->debug_print(out);
             break;
 
         case PT_RETURN_STATEMENT:
             if (this->pieces[0]) {
-                cout << ", \"expression\": ";
-                this->pieces[0]->debug_print();
+                out << ", \"expression\": ";
+                this->pieces[0]->debug_print(out);
             }
             break;
 
         case PT_ASSERTION_STATEMENT:
-            cout << ", \"condition\": ";
-            this->pieces[0]->debug_print();
+            out << ", \"condition\": ";
+            this->pieces[0]->debug_print(out);
             if (this->pieces[1]) {
-                cout << ", \"report\": ";
-                this->pieces[1]->debug_print();
+                out << ", \"report\": ";
+                this->pieces[1]->debug_print(out);
             }
             if (this->pieces[2]) {
-                cout << ", \"severity\": ";
-                this->pieces[2]->debug_print();
+                out << ", \"severity\": ";
+                this->pieces[2]->debug_print(out);
             }
             break;
 
         case PT_REPORT_STATEMENT:
-            cout << ", \"report\": ";
-            this->pieces[0]->debug_print();
+            out << ", \"report\": ";
+            this->pieces[0]->debug_print(out);
             if (this->pieces[1]) {
-                cout << ", \"severity\": ";
-                this->pieces[1]->debug_print();
+                out << ", \"severity\": ";
+                this->pieces[1]->debug_print(out);
             }
             break;
 
         case PT_NEXT_STATEMENT:
         case PT_EXIT_STATEMENT:
             if (this->pieces[0]) {
-                cout << ", \"label\": ";
-                this->pieces[0]->debug_print();
+                out << ", \"label\": ";
+                this->pieces[0]->debug_print(out);
             }
             if (this->pieces[1]) {
-                cout << ", \"condition\": ";
-                this->pieces[1]->debug_print();
+                out << ", \"condition\": ";
+                this->pieces[1]->debug_print(out);
             }
             break;
 
         case PT_IF_STATEMENT:
-            cout << ", \"condition\": ";
-            this->pieces[0]->debug_print();
+            out << ", \"condition\": ";
+            this->pieces[0]->debug_print(out);
             if (this->pieces[1]) {
-                cout << ", \"if_arm\": ";
-                this->pieces[1]->debug_print();
+                out << ", \"if_arm\": ";
+                this->pieces[1]->debug_print(out);
             }
             if (this->pieces[2]) {
-                cout << ", \"elsif_arms\": ";
-                this->pieces[2]->debug_print();
+                out << ", \"elsif_arms\": ";
+                this->pieces[2]->debug_print(out);
             }
             if (this->pieces[3]) {
-                cout << ", \"else_arms\": ";
-                this->pieces[3]->debug_print();
+                out << ", \"else_arms\": ";
+                this->pieces[3]->debug_print(out);
             }
             if (this->pieces[4]) {
-                cout << ", \"end_label\": ";
-                this->pieces[4]->debug_print();
+                out << ", \"end_label\": ";
+                this->pieces[4]->debug_print(out);
             }
             break;
 
         case PT_ELSIF:
-            cout << ", \"condition\": ";
-            this->pieces[0]->debug_print();
+            out << ", \"condition\": ";
+            this->pieces[0]->debug_print(out);
             if (this->pieces[1]) {
-                cout << ", \"statements\": ";
-                this->pieces[1]->debug_print();
+                out << ", \"statements\": ";
+                this->pieces[1]->debug_print(out);
             }
             break;
 
         case PT_CASE_STATEMENT:
-            cout << ", \"expression\": ";
-            this->pieces[0]->debug_print();
-            cout << ", \"alternatives\": ";
-            this->pieces[1]->debug_print();
-            cout << ", \"matching\": ";
-            cout << (this->boolean ? "true" : "false");
+            out << ", \"expression\": ";
+            this->pieces[0]->debug_print(out);
+            out << ", \"alternatives\": ";
+            this->pieces[1]->debug_print(out);
+            out << ", \"matching\": ";
+            out << (this->boolean ? "true" : "false");
             if (this->pieces[2]) {
-                cout << ", \"end_label\": ";
-                this->pieces[2]->debug_print();
+                out << ", \"end_label\": ";
+                this->pieces[2]->debug_print(out);
             }
             break;
 
         case PT_CASE_STATEMENT_ALTERNATIVE:
-            cout << ", \"choices\": ";
-            this->pieces[0]->debug_print();
+            out << ", \"choices\": ";
+            this->pieces[0]->debug_print(out);
             if (this->pieces[1]) {
-                cout << ", \"statements\": ";
-                this->pieces[1]->debug_print();
+                out << ", \"statements\": ";
+                this->pieces[1]->debug_print(out);
             }
             break;
 
         case PT_LOOP_STATEMENT:
             if (this->pieces[0]) {
-                cout << ", \"statements\": ";
-                this->pieces[0]->debug_print();
+                out << ", \"statements\": ";
+                this->pieces[0]->debug_print(out);
             }
             if (this->pieces[1]) {
-                cout << ", \"scheme\": ";
-                this->pieces[1]->debug_print();
+                out << ", \"scheme\": ";
+                this->pieces[1]->debug_print(out);
             }
             if (this->pieces[2]) {
-                cout << ", \"end_label\": ";
-                this->pieces[2]->debug_print();
+                out << ", \"end_label\": ";
+                this->pieces[2]->debug_print(out);
             }
             break;
 
         case PT_ITERATION_WHILE:
-            cout << ", \"condition\": ";
-            this->pieces[0]->debug_print();
+            out << ", \"condition\": ";
+            this->pieces[0]->debug_print(out);
             break;
 
         case PT_ITERATION_FOR:
-            cout << ", \"parameter_specification\": ";
-            this->pieces[0]->debug_print();
+            out << ", \"parameter_specification\": ";
+            this->pieces[0]->debug_print(out);
             break;
 
         case PT_PARAMETER_SPECIFICATION:
-            cout << ", \"identifier\": ";
-            this->pieces[0]->debug_print();
-            cout << ", \"range\": ";
-            this->pieces[1]->debug_print();
+            out << ", \"identifier\": ";
+            this->pieces[0]->debug_print(out);
+            out << ", \"range\": ";
+            this->pieces[1]->debug_print(out);
             break;
 
         case PT_WAIT_STATEMENT:
             if (this->pieces[0]) {
-                cout << ", \"sensitivity\": ";
-                this->pieces[0]->debug_print();
+                out << ", \"sensitivity\": ";
+                this->pieces[0]->debug_print(out);
             }
             if (this->pieces[1]) {
-                cout << ", \"condition\": ";
-                this->pieces[1]->debug_print();
+                out << ", \"condition\": ";
+                this->pieces[1]->debug_print(out);
             }
             if (this->pieces[2]) {
-                cout << ", \"timeout\": ";
-                this->pieces[2]->debug_print();
+                out << ", \"timeout\": ";
+                this->pieces[2]->debug_print(out);
             }
             break;
 
         case PT_SIMPLE_WAVEFORM_ASSIGNMENT:
         case PT_CONDITIONAL_WAVEFORM_ASSIGNMENT:
-            cout << ", \"target\": ";
-            this->pieces[0]->debug_print();
-            cout << ", \"waveform\": ";
-            this->pieces[1]->debug_print();
+            out << ", \"target\": ";
+            this->pieces[0]->debug_print(out);
+            out << ", \"waveform\": ";
+            this->pieces[1]->debug_print(out);
             if (this->pieces[2]) {
-                cout << ", \"delay_mechanism\": ";
-                this->pieces[2]->debug_print();
+                out << ", \"delay_mechanism\": ";
+                this->pieces[2]->debug_print(out);
             }
             break;
 
         case PT_WAVEFORM_ELEMENT:
-            cout << ", \"value\": ";
-            this->pieces[0]->debug_print();
+            out << ", \"value\": ";
+            this->pieces[0]->debug_print(out);
             if (this->pieces[1]) {
-                cout << ", \"time\": ";
-                this->pieces[1]->debug_print();
+                out << ", \"time\": ";
+                this->pieces[1]->debug_print(out);
             }
             break;
 
         case PT_DELAY_INERTIAL:
             if (this->pieces[0]) {
-                cout << ", \"reject\": ";
-                this->pieces[0]->debug_print();
+                out << ", \"reject\": ";
+                this->pieces[0]->debug_print(out);
             }
             break;
 
         case PT_SIMPLE_FORCE_ASSIGNMENT:
         case PT_CONDITIONAL_FORCE_ASSIGNMENT:
-            cout << ", \"target\": ";
-            this->pieces[0]->debug_print();
-            cout << ", \"expression\": ";
-            this->pieces[1]->debug_print();
+            out << ", \"target\": ";
+            this->pieces[0]->debug_print(out);
+            out << ", \"expression\": ";
+            this->pieces[1]->debug_print(out);
             if (this->force_mode != FORCE_UNSPEC) {
-                cout << ", \"force_mode\": \"";
-                cout << force_modes[this->force_mode];
-                cout << "\"";
+                out << ", \"force_mode\": \"";
+                out << force_modes[this->force_mode];
+                out << "\"";
             }
             break;
 
         case PT_SIMPLE_RELEASE_ASSIGNMENT:
-            cout << ", \"target\": ";
-            this->pieces[0]->debug_print();
+            out << ", \"target\": ";
+            this->pieces[0]->debug_print(out);
             if (this->force_mode != FORCE_UNSPEC) {
-                cout << ", \"force_mode\": \"";
-                cout << force_modes[this->force_mode];
-                cout << "\"";
+                out << ", \"force_mode\": \"";
+                out << force_modes[this->force_mode];
+                out << "\"";
             }
             break;
 
         case PT_CONDITIONAL_WAVEFORMS:
         case PT_CONDITIONAL_EXPRESSIONS:
-            cout << ", \"main_value\": ";
-            this->pieces[0]->debug_print();
-            cout << ", \"main_condition\": ";
-            this->pieces[1]->debug_print();
+            out << ", \"main_value\": ";
+            this->pieces[0]->debug_print(out);
+            out << ", \"main_condition\": ";
+            this->pieces[1]->debug_print(out);
             if (this->pieces[2]) {
-                cout << ", \"elses\": ";
-                this->pieces[2]->debug_print();
+                out << ", \"elses\": ";
+                this->pieces[2]->debug_print(out);
             }
             if (this->pieces[3]) {
-                cout << ", \"else_value\": ";
-                this->pieces[3]->debug_print();
+                out << ", \"else_value\": ";
+                this->pieces[3]->debug_print(out);
             }
             break;
 
         case PT_CONDITIONAL_WAVEFORM_ELSE:
         case PT_CONDITIONAL_EXPRESSION_ELSE:
-            cout << ", \"value\": ";
-            this->pieces[0]->debug_print();
-            cout << ", \"condition\": ";
-            this->pieces[1]->debug_print();
+            out << ", \"value\": ";
+            this->pieces[0]->debug_print(out);
+            out << ", \"condition\": ";
+            this->pieces[1]->debug_print(out);
             break;
 
         case PT_SELECTED_WAVEFORM_ASSIGNMENT:
-            cout << ", \"expression\": ";
-            this->pieces[0]->debug_print();
-            cout << ", \"target\": ";
-            this->pieces[1]->debug_print();
-            cout << ", \"waveform\": ";
-            this->pieces[2]->debug_print();
+            out << ", \"expression\": ";
+            this->pieces[0]->debug_print(out);
+            out << ", \"target\": ";
+            this->pieces[1]->debug_print(out);
+            out << ", \"waveform\": ";
+            this->pieces[2]->debug_print(out);
             if (this->pieces[3]) {
-                cout << ", \"delay_mechanism\": ";
-                this->pieces[3]->debug_print();
+                out << ", \"delay_mechanism\": ";
+                this->pieces[3]->debug_print(out);
             }
-            cout << ", \"matching\": ";
-            cout << (this->boolean ? "true" : "false");
+            out << ", \"matching\": ";
+            out << (this->boolean ? "true" : "false");
             break;
 
         case PT_SELECTED_FORCE_ASSIGNMENT:
-            cout << ", \"expression\": ";
-            this->pieces[0]->debug_print();
-            cout << ", \"target\": ";
-            this->pieces[1]->debug_print();
-            cout << ", \"selected_expression\": ";
-            this->pieces[2]->debug_print();
+            out << ", \"expression\": ";
+            this->pieces[0]->debug_print(out);
+            out << ", \"target\": ";
+            this->pieces[1]->debug_print(out);
+            out << ", \"selected_expression\": ";
+            this->pieces[2]->debug_print(out);
             if (this->force_mode != FORCE_UNSPEC) {
-                cout << ", \"force_mode\": \"";
-                cout << force_modes[this->force_mode];
-                cout << "\"";
+                out << ", \"force_mode\": \"";
+                out << force_modes[this->force_mode];
+                out << "\"";
             }
-            cout << ", \"matching\": ";
-            cout << (this->boolean ? "true" : "false");
+            out << ", \"matching\": ";
+            out << (this->boolean ? "true" : "false");
             break;
 
         case PT_SELECTED_WAVEFORM:
         case PT_SELECTED_EXPRESSION:
-            cout << ", \"waveform\": ";
-            this->pieces[0]->debug_print();
-            cout << ", \"choices\": ";
-            this->pieces[1]->debug_print();
+            out << ", \"waveform\": ";
+            this->pieces[0]->debug_print(out);
+            out << ", \"choices\": ";
+            this->pieces[1]->debug_print(out);
             break;
 
         case PT_SIMPLE_VARIABLE_ASSIGNMENT:
         case PT_CONDITIONAL_VARIABLE_ASSIGNMENT:
-            cout << ", \"target\": ";
-            this->pieces[0]->debug_print();
-            cout << ", \"expression\": ";
-            this->pieces[1]->debug_print();
+            out << ", \"target\": ";
+            this->pieces[0]->debug_print(out);
+            out << ", \"expression\": ";
+            this->pieces[1]->debug_print(out);
             break;
 
         case PT_SELECTED_VARIABLE_ASSIGNMENT:
-            cout << ", \"expression\": ";
-            this->pieces[0]->debug_print();
-            cout << ", \"target\": ";
-            this->pieces[1]->debug_print();
-            cout << ", \"selected_expression\": ";
-            this->pieces[2]->debug_print();
-            cout << ", \"matching\": ";
-            cout << (this->boolean ? "true" : "false");
+            out << ", \"expression\": ";
+            this->pieces[0]->debug_print(out);
+            out << ", \"target\": ";
+            this->pieces[1]->debug_print(out);
+            out << ", \"selected_expression\": ";
+            this->pieces[2]->debug_print(out);
+            out << ", \"matching\": ";
+            out << (this->boolean ? "true" : "false");
             break;
 
         case PT_FULL_TYPE_DECLARATION:
-            cout << ", \"identifier\": ";
-            this->pieces[0]->debug_print();
-            cout << ", \"definition\": ";
-            this->pieces[1]->debug_print();
+            out << ", \"identifier\": ";
+            this->pieces[0]->debug_print(out);
+            out << ", \"definition\": ";
+            this->pieces[1]->debug_print(out);
             break;
 
         case PT_ENUMERATION_TYPE_DEFINITION:
-            cout << ", \"literals\": ";
-            this->pieces[0]->debug_print();
+            out << ", \"literals\": ";
+            this->pieces[0]->debug_print(out);
             break;
 
         case PT_INTEGER_FLOAT_TYPE_DEFINITION:
-            cout << ", \"range\": ";
-            this->pieces[0]->debug_print();
+            out << ", \"range\": ";
+            this->pieces[0]->debug_print(out);
             break;
 
         case PT_PHYSICAL_TYPE_DEFINITION:
-            cout << ", \"range\": ";
-            this->pieces[0]->debug_print();
-            cout << ", \"primary\": ";
-            this->pieces[1]->debug_print();
+            out << ", \"range\": ";
+            this->pieces[0]->debug_print(out);
+            out << ", \"primary\": ";
+            this->pieces[1]->debug_print(out);
             if (this->pieces[2]) {
-                cout << ", \"secondaries\": ";
-                this->pieces[2]->debug_print();
+                out << ", \"secondaries\": ";
+                this->pieces[2]->debug_print(out);
             }
             if (this->pieces[3]) {
-                cout << ", \"end_label\": ";
-                this->pieces[3]->debug_print();
+                out << ", \"end_label\": ";
+                this->pieces[3]->debug_print(out);
             }
             break;
 
         case PT_SECONDARY_UNIT_DECLARATION:
-            cout << ", \"identifier\": ";
-            this->pieces[0]->debug_print();
-            cout << ", \"literal\": ";
-            this->pieces[1]->debug_print();
+            out << ", \"identifier\": ";
+            this->pieces[0]->debug_print(out);
+            out << ", \"literal\": ";
+            this->pieces[1]->debug_print(out);
             break;
 
         case PT_CONSTRAINED_ARRAY_DEFINITION:
         case PT_UNBOUNDED_ARRAY_DEFINITION:
-            cout << ", \"index_constraint\": ";
-            this->pieces[0]->debug_print();
-            cout << ", \"element\": ";
-            this->pieces[1]->debug_print();
+            out << ", \"index_constraint\": ";
+            this->pieces[0]->debug_print(out);
+            out << ", \"element\": ";
+            this->pieces[1]->debug_print(out);
             break;
 
         case PT_RECORD_TYPE_DEFINITION:
-            cout << ", \"elements\": ";
-            this->pieces[0]->debug_print();
+            out << ", \"elements\": ";
+            this->pieces[0]->debug_print(out);
             if (this->pieces[1]) {
-                cout << ", \"end_label\": ";
-                this->pieces[1]->debug_print();
+                out << ", \"end_label\": ";
+                this->pieces[1]->debug_print(out);
             }
             break;
 
         case PT_ELEMENT_DECLARATION:
-            cout << ", \"identifiers\": ";
-            this->pieces[0]->debug_print();
-            cout << ", \"subtype\": ";
-            this->pieces[1]->debug_print();
+            out << ", \"identifiers\": ";
+            this->pieces[0]->debug_print(out);
+            out << ", \"subtype\": ";
+            this->pieces[1]->debug_print(out);
             break;
 
         case PT_ACCESS_TYPE_DEFINITION:
-            cout << ", \"subtype\": ";
-            this->pieces[0]->debug_print();
+            out << ", \"subtype\": ";
+            this->pieces[0]->debug_print(out);
             break;
 
         case PT_INCOMPLETE_TYPE_DECLARATION:
         case PT_INTERFACE_TYPE_DECLARATION:
-            cout << ", \"identifier\": ";
-            this->pieces[0]->debug_print();
+            out << ", \"identifier\": ";
+            this->pieces[0]->debug_print(out);
             break;
 
         case PT_FILE_TYPE_DEFINITION:
-            cout << ", \"type_mark\": ";
-            this->pieces[0]->debug_print();
+            out << ", \"type_mark\": ";
+            this->pieces[0]->debug_print(out);
             break;
 
         case PT_PROCESS:
             if (this->pieces[0]) {
-                cout << ", \"label\": ";
-                this->pieces[0]->debug_print();
+                out << ", \"label\": ";
+                this->pieces[0]->debug_print(out);
             }
             if (this->pieces[1]) {
-                cout << ", \"declarations\": ";
-                this->pieces[1]->debug_print();
+                out << ", \"declarations\": ";
+                this->pieces[1]->debug_print(out);
             }
             if (this->pieces[2]) {
-                cout << ", \"statements\": ";
-                this->pieces[2]->debug_print();
+                out << ", \"statements\": ";
+                this->pieces[2]->debug_print(out);
             }
             if (this->pieces[3]) {
-                cout << ", \"end_label\": ";
-                this->pieces[3]->debug_print();
+                out << ", \"end_label\": ";
+                this->pieces[3]->debug_print(out);
             }
             if (this->pieces[4]) {
-                cout << ", \"sensitivity_list\": ";
-                this->pieces[4]->debug_print();
+                out << ", \"sensitivity_list\": ";
+                this->pieces[4]->debug_print(out);
             }
-            cout << ", \"postponed\": ";
-            cout << (this->boolean ? "true" : "false");
+            out << ", \"postponed\": ";
+            out << (this->boolean ? "true" : "false");
             break;
 
         case PT_SUBTYPE_DECLARATION:
-            cout << ", \"identifier\": ";
-            this->pieces[0]->debug_print();
-            cout << ", \"subtype\": ";
-            this->pieces[1]->debug_print();
+            out << ", \"identifier\": ";
+            this->pieces[0]->debug_print(out);
+            out << ", \"subtype\": ";
+            this->pieces[1]->debug_print(out);
             break;
 
         case PT_CONSTANT_DECLARATION:
-            cout << ", \"identifiers\": ";
-            this->pieces[0]->debug_print();
-            cout << ", \"subtype\": ";
-            this->pieces[1]->debug_print();
+            out << ", \"identifiers\": ";
+            this->pieces[0]->debug_print(out);
+            out << ", \"subtype\": ";
+            this->pieces[1]->debug_print(out);
             if (this->pieces[2]) {
-                cout << ", \"expression\": ";
-                this->pieces[2]->debug_print();
+                out << ", \"expression\": ";
+                this->pieces[2]->debug_print(out);
             }
             break;
 
         case PT_VARIABLE_DECLARATION:
-            cout << ", \"identifiers\": ";
-            this->pieces[0]->debug_print();
-            cout << ", \"subtype\": ";
-            this->pieces[1]->debug_print();
+            out << ", \"identifiers\": ";
+            this->pieces[0]->debug_print(out);
+            out << ", \"subtype\": ";
+            this->pieces[1]->debug_print(out);
             if (this->pieces[2]) {
-                cout << ", \"expression\": ";
-                this->pieces[2]->debug_print();
+                out << ", \"expression\": ";
+                this->pieces[2]->debug_print(out);
             }
-            cout << ", \"shared\": ";
-            cout << (this->boolean ? "true" : "false");
+            out << ", \"shared\": ";
+            out << (this->boolean ? "true" : "false");
             break;
 
         case PT_FILE_DECLARATION:
         case PT_INTERFACE_FILE_DECLARATION:
-            cout << ", \"identifiers\": ";
-            this->pieces[0]->debug_print();
-            cout << ", \"subtype\": ";
-            this->pieces[1]->debug_print();
+            out << ", \"identifiers\": ";
+            this->pieces[0]->debug_print(out);
+            out << ", \"subtype\": ";
+            this->pieces[1]->debug_print(out);
             if (this->pieces[2]) {
-                cout << ", \"open_information\": ";
-                this->pieces[2]->debug_print();
+                out << ", \"open_information\": ";
+                this->pieces[2]->debug_print(out);
             }
             break;
 
         case PT_FILE_OPEN_INFORMATION:
-            cout << ", \"logical_name\": ";
-            this->pieces[0]->debug_print();
+            out << ", \"logical_name\": ";
+            this->pieces[0]->debug_print(out);
             if (this->pieces[1]) {
-                cout << ", \"open_kind\": ";
-                this->pieces[1]->debug_print();
+                out << ", \"open_kind\": ";
+                this->pieces[1]->debug_print(out);
             }
             break;
 
         case PT_ALIAS_DECLARATION:
-            cout << ", \"designator\": ";
-            this->pieces[0]->debug_print();
-            cout << ", \"name\": ";
-            this->pieces[1]->debug_print();
+            out << ", \"designator\": ";
+            this->pieces[0]->debug_print(out);
+            out << ", \"name\": ";
+            this->pieces[1]->debug_print(out);
             if (this->pieces[2]) {
-                cout << ", \"subtype\": ";
-                this->pieces[2]->debug_print();
+                out << ", \"subtype\": ";
+                this->pieces[2]->debug_print(out);
             }
             if (this->pieces[3]) {
-                cout << ", \"signature\": ";
-                this->pieces[3]->debug_print();
+                out << ", \"signature\": ";
+                this->pieces[3]->debug_print(out);
             }
             break;
 
         case PT_ATTRIBUTE_DECLARATION:
-            cout << ", \"identifier\": ";
-            this->pieces[0]->debug_print();
-            cout << ", \"type_mark\": ";
-            this->pieces[1]->debug_print();
+            out << ", \"identifier\": ";
+            this->pieces[0]->debug_print(out);
+            out << ", \"type_mark\": ";
+            this->pieces[1]->debug_print(out);
             break;
 
         case PT_SUBPROGRAM_DECLARATION:
-            cout << ", \"specification\": ";
-            this->pieces[0]->debug_print();
+            out << ", \"specification\": ";
+            this->pieces[0]->debug_print(out);
             break;
 
         case PT_PROCEDURE_SPECIFICATION:
-            cout << ", \"designator\": ";
-            this->pieces[0]->debug_print();
+            out << ", \"designator\": ";
+            this->pieces[0]->debug_print(out);
             if (this->pieces[1]) {
-                cout << ", \"header\": ";
-                this->pieces[1]->debug_print();
+                out << ", \"header\": ";
+                this->pieces[1]->debug_print(out);
             }
             if (this->pieces[2]) {
-                cout << ", \"parameters\": ";
-                this->pieces[2]->debug_print();
+                out << ", \"parameters\": ";
+                this->pieces[2]->debug_print(out);
             }
             break;
 
         case PT_FUNCTION_SPECIFICATION:
-            cout << ", \"designator\": ";
-            this->pieces[0]->debug_print();
-            cout << ", \"return\": ";
-            this->pieces[1]->debug_print();
+            out << ", \"designator\": ";
+            this->pieces[0]->debug_print(out);
+            out << ", \"return\": ";
+            this->pieces[1]->debug_print(out);
             if (this->pieces[2]) {
-                cout << ", \"header\": ";
-                this->pieces[2]->debug_print();
+                out << ", \"header\": ";
+                this->pieces[2]->debug_print(out);
             }
             if (this->pieces[3]) {
-                cout << ", \"parameters\": ";
-                this->pieces[3]->debug_print();
+                out << ", \"parameters\": ";
+                this->pieces[3]->debug_print(out);
             }
             if (this->purity != PURITY_UNSPEC) {
-                cout << ", \"purity\": \"";
-                cout << func_purity[this->purity];
-                cout << "\"";
+                out << ", \"purity\": \"";
+                out << func_purity[this->purity];
+                out << "\"";
             }
             break;
 
         case PT_SUBPROGRAM_HEADER:
         case PT_PACKAGE_HEADER:
             if (this->pieces[0]) {
-                cout << ", \"generic\": ";
-                this->pieces[0]->debug_print();
+                out << ", \"generic\": ";
+                this->pieces[0]->debug_print(out);
             }
             if (this->pieces[1]) {
-                cout << ", \"generic_map\": ";
-                this->pieces[1]->debug_print();
+                out << ", \"generic_map\": ";
+                this->pieces[1]->debug_print(out);
             }
             break;
 
         case PT_INTERFACE_SIGNAL_DECLARATION:
-            cout << ", \"is_bus\": ";
-            cout << (this->boolean ? "true" : "false");
+            out << ", \"is_bus\": ";
+            out << (this->boolean ? "true" : "false");
         case PT_INTERFACE_AMBIG_OBJ_DECLARATION:
         case PT_INTERFACE_CONSTANT_DECLARATION:
         case PT_INTERFACE_VARIABLE_DECLARATION:
-            cout << ", \"identifiers\": ";
-            this->pieces[0]->debug_print();
-            cout << ", \"subtype\": ";
-            this->pieces[1]->debug_print();
+            out << ", \"identifiers\": ";
+            this->pieces[0]->debug_print(out);
+            out << ", \"subtype\": ";
+            this->pieces[1]->debug_print(out);
             if (this->pieces[2]) {
-                cout << ", \"expression\": ";
-                this->pieces[2]->debug_print();
+                out << ", \"expression\": ";
+                this->pieces[2]->debug_print(out);
             }
             if (this->pieces[3]) {
-                cout << ", \"mode\": ";
-                this->pieces[3]->debug_print();
+                out << ", \"mode\": ";
+                this->pieces[3]->debug_print(out);
             }
             break;
 
         case PT_INTERFACE_MODE:
             if (this->interface_mode != MODE_UNSPEC) {
-                cout << ", \"mode\": \"";
-                cout << interface_modes[this->interface_mode];
-                cout << "\"";
+                out << ", \"mode\": \"";
+                out << interface_modes[this->interface_mode];
+                out << "\"";
             }
             break;
 
         case PT_INTERFACE_SUBPROGRAM_DECLARATION:
-            cout << ", \"specification\": ";
-            this->pieces[0]->debug_print();
+            out << ", \"specification\": ";
+            this->pieces[0]->debug_print(out);
             if (this->pieces[1]) {
-                cout << ", \"default\": ";
-                this->pieces[1]->debug_print();
+                out << ", \"default\": ";
+                this->pieces[1]->debug_print(out);
             }
             break;
 
         case PT_INTERFACE_PROCEDURE_SPECIFICATION:
-            cout << ", \"designator\": ";
-            this->pieces[0]->debug_print();
+            out << ", \"designator\": ";
+            this->pieces[0]->debug_print(out);
             if (this->pieces[1]) {
-                cout << ", \"parameters\": ";
-                this->pieces[1]->debug_print();
+                out << ", \"parameters\": ";
+                this->pieces[1]->debug_print(out);
             }
             break;
 
         case PT_INTERFACE_FUNCTION_SPECIFICATION:
-            cout << ", \"designator\": ";
-            this->pieces[0]->debug_print();
-            cout << ", \"return\": ";
-            this->pieces[1]->debug_print();
+            out << ", \"designator\": ";
+            this->pieces[0]->debug_print(out);
+            out << ", \"return\": ";
+            this->pieces[1]->debug_print(out);
             if (this->pieces[2]) {
-                cout << ", \"parameters\": ";
-                this->pieces[2]->debug_print();
+                out << ", \"parameters\": ";
+                this->pieces[2]->debug_print(out);
             }
             if (this->purity != PURITY_UNSPEC) {
-                cout << ", \"purity\": \"";
-                cout << func_purity[this->purity];
-                cout << "\"";
+                out << ", \"purity\": \"";
+                out << func_purity[this->purity];
+                out << "\"";
             }
             break;
 
         case PT_GENERIC_MAP_ASPECT:
         case PT_PORT_MAP_ASPECT:
-            cout << ", \"association_list\": ";
-            this->pieces[0]->debug_print();
+            out << ", \"association_list\": ";
+            this->pieces[0]->debug_print(out);
             break;
 
         case PT_INERTIAL_EXPRESSION:
-            cout << ", \"expression\": ";
-            this->pieces[0]->debug_print();
+            out << ", \"expression\": ";
+            this->pieces[0]->debug_print(out);
             break;
 
         case PT_SUBPROGRAM_INSTANTIATION_DECLARATION:
-            cout << ", \"kind\": \"";
-            cout << subprogram_kinds[this->subprogram_kind];
-            cout << "\"";
-            cout << ", \"designator\": ";
-            this->pieces[0]->debug_print();
-            cout << ", \"uninstantiated_name\": ";
-            this->pieces[1]->debug_print();
+            out << ", \"kind\": \"";
+            out << subprogram_kinds[this->subprogram_kind];
+            out << "\"";
+            out << ", \"designator\": ";
+            this->pieces[0]->debug_print(out);
+            out << ", \"uninstantiated_name\": ";
+            this->pieces[1]->debug_print(out);
             if (this->pieces[2]) {
-                cout << ", \"signature\": ";
-                this->pieces[2]->debug_print();
+                out << ", \"signature\": ";
+                this->pieces[2]->debug_print(out);
             }
             if (this->pieces[3]) {
-                cout << ", \"generic_map\": ";
-                this->pieces[3]->debug_print();
+                out << ", \"generic_map\": ";
+                this->pieces[3]->debug_print(out);
             }
             break;
 
         case PT_SUBPROGRAM_BODY:
-            cout << ", \"specification\": ";
-            this->pieces[0]->debug_print();
+            out << ", \"specification\": ";
+            this->pieces[0]->debug_print(out);
             if (this->pieces[1]) {
-                cout << ", \"declarations\": ";
-                this->pieces[1]->debug_print();
+                out << ", \"declarations\": ";
+                this->pieces[1]->debug_print(out);
             }
             if (this->pieces[2]) {
-                cout << ", \"statements\": ";
-                this->pieces[2]->debug_print();
+                out << ", \"statements\": ";
+                this->pieces[2]->debug_print(out);
             }
             if (this->pieces[3]) {
-                cout << ", \"end_label\": ";
-                this->pieces[3]->debug_print();
+                out << ", \"end_label\": ";
+                this->pieces[3]->debug_print(out);
             }
             if (this->subprogram_kind != SUBPROGRAM_UNSPEC) {
-                cout << ", \"end_kind\": \"";
-                cout << subprogram_kinds[this->subprogram_kind];
-                cout << "\"";
+                out << ", \"end_kind\": \"";
+                out << subprogram_kinds[this->subprogram_kind];
+                out << "\"";
             }
             break;
 
         case PT_SUBTYPE_INDICATION_AMBIG_WTF:
-            cout << ", \"fixup_needed\": ";
-            this->pieces[0]->debug_print();
+            out << ", \"fixup_needed\": ";
+            this->pieces[0]->debug_print(out);
             break;
 
         case PT_ELEMENT_RESOLUTION_NEST:
-            cout << ", \"inner\": ";
-            this->pieces[0]->debug_print();
+            out << ", \"inner\": ";
+            this->pieces[0]->debug_print(out);
             break;
 
         case PT_USE_CLAUSE:
-            cout << ", \"used_names\": ";
-            this->pieces[0]->debug_print();
+            out << ", \"used_names\": ";
+            this->pieces[0]->debug_print(out);
             break;
 
         case PT_ATTRIBUTE_SPECIFICATION:
-            cout << ", \"designator\": ";
-            this->pieces[0]->debug_print();
-            cout << ", \"specification\": ";
-            this->pieces[1]->debug_print();
-            cout << ", \"expression\": ";
-            this->pieces[2]->debug_print();
+            out << ", \"designator\": ";
+            this->pieces[0]->debug_print(out);
+            out << ", \"specification\": ";
+            this->pieces[1]->debug_print(out);
+            out << ", \"expression\": ";
+            this->pieces[2]->debug_print(out);
             break;
 
         case PT_ENTITY_SPECIFICATION:
-            cout << ", \"name_list\": ";
-            this->pieces[0]->debug_print();
-            cout << ", \"entity_class\": ";
-            this->pieces[1]->debug_print();
+            out << ", \"name_list\": ";
+            this->pieces[0]->debug_print(out);
+            out << ", \"entity_class\": ";
+            this->pieces[1]->debug_print(out);
             break;
 
         case PT_ENTITY_CLASS:
-            cout << ", \"entity_class\": \"";
-            cout << entity_classes[this->entity_class];
-            cout << "\"";
+            out << ", \"entity_class\": \"";
+            out << entity_classes[this->entity_class];
+            out << "\"";
             break;
 
         case PT_ENTITY_DESIGNATOR:
-            cout << ", \"tag\": ";
-            this->pieces[0]->debug_print();
+            out << ", \"tag\": ";
+            this->pieces[0]->debug_print(out);
             if (this->pieces[1]) {
-                cout << ", \"signature\": ";
-                this->pieces[1]->debug_print();
+                out << ", \"signature\": ";
+                this->pieces[1]->debug_print(out);
             }
             break;
 
         case PT_GROUP_TEMPLATE_DECLARATION:
-            cout << ", \"identifier\": ";
-            this->pieces[0]->debug_print();
-            cout << ", \"entity_class_entry_list\": ";
-            this->pieces[1]->debug_print();
+            out << ", \"identifier\": ";
+            this->pieces[0]->debug_print(out);
+            out << ", \"entity_class_entry_list\": ";
+            this->pieces[1]->debug_print(out);
             break;
 
         case PT_ENTITY_CLASS_ENTRY:
-            cout << ", \"designator\": ";
-            this->pieces[0]->debug_print();
-            cout << ", \"has_box\": ";
-            cout << (this->boolean ? "true" : "false");
+            out << ", \"designator\": ";
+            this->pieces[0]->debug_print(out);
+            out << ", \"has_box\": ";
+            out << (this->boolean ? "true" : "false");
             break;
 
         case PT_GROUP_DECLARATION:
-            cout << ", \"identifier\": ";
-            this->pieces[0]->debug_print();
-            cout << ", \"template\": ";
-            this->pieces[1]->debug_print();
-            cout << ", \"constituent\": ";
-            this->pieces[2]->debug_print();
+            out << ", \"identifier\": ";
+            this->pieces[0]->debug_print(out);
+            out << ", \"template\": ";
+            this->pieces[1]->debug_print(out);
+            out << ", \"constituent\": ";
+            this->pieces[2]->debug_print(out);
             break;
 
         case PT_PACKAGE_DECLARATION:
-            cout << ", \"identifier\": ";
-            this->pieces[0]->debug_print();
+            out << ", \"identifier\": ";
+            this->pieces[0]->debug_print(out);
             if (this->pieces[1]) {
-                cout << ", \"header\": ";
-                this->pieces[1]->debug_print();
+                out << ", \"header\": ";
+                this->pieces[1]->debug_print(out);
             }
             if (this->pieces[2]) {
-                cout << ", \"declarations\": ";
-                this->pieces[2]->debug_print();
+                out << ", \"declarations\": ";
+                this->pieces[2]->debug_print(out);
             }
             if (this->pieces[3]) {
-                cout << ", \"end_label\": ";
-                this->pieces[3]->debug_print();
+                out << ", \"end_label\": ";
+                this->pieces[3]->debug_print(out);
             }
             break;
 
         case PT_SIGNAL_DECLARATION:
-            cout << ", \"identifiers\": ";
-            this->pieces[0]->debug_print();
-            cout << ", \"subtype\": ";
-            this->pieces[1]->debug_print();
+            out << ", \"identifiers\": ";
+            this->pieces[0]->debug_print(out);
+            out << ", \"subtype\": ";
+            this->pieces[1]->debug_print(out);
             if (this->pieces[2]) {
-                cout << ", \"kind\": ";
-                this->pieces[2]->debug_print();
+                out << ", \"kind\": ";
+                this->pieces[2]->debug_print(out);
             }
             if (this->pieces[3]) {
-                cout << ", \"expression\": ";
-                this->pieces[3]->debug_print();
+                out << ", \"expression\": ";
+                this->pieces[3]->debug_print(out);
             }
             break;
 
         case PT_SIGNAL_KIND:
             if (this->signal_kind != SIGKIND_UNSPEC) {
-                cout << ", \"kind\": \"";
-                cout << signal_kinds[this->signal_kind];
-                cout << "\"";
+                out << ", \"kind\": \"";
+                out << signal_kinds[this->signal_kind];
+                out << "\"";
             }
             break;
 
         case PT_PACKAGE_BODY:
-            cout << ", \"identifier\": ";
-            this->pieces[0]->debug_print();
+            out << ", \"identifier\": ";
+            this->pieces[0]->debug_print(out);
             if (this->pieces[1]) {
-                cout << ", \"declarations\": ";
-                this->pieces[1]->debug_print();
+                out << ", \"declarations\": ";
+                this->pieces[1]->debug_print(out);
             }
             if (this->pieces[2]) {
-                cout << ", \"end_label\": ";
-                this->pieces[2]->debug_print();
+                out << ", \"end_label\": ";
+                this->pieces[2]->debug_print(out);
             }
             break;
 
         case PT_PACKAGE_INSTANTIATION_DECLARATION:
-            cout << ", \"identifier\": ";
-            this->pieces[0]->debug_print();
-            cout << ", \"uninstantiated_name\": ";
-            this->pieces[1]->debug_print();
+            out << ", \"identifier\": ";
+            this->pieces[0]->debug_print(out);
+            out << ", \"uninstantiated_name\": ";
+            this->pieces[1]->debug_print(out);
             if (this->pieces[2]) {
-                cout << ", \"generic_map\": ";
-                this->pieces[2]->debug_print();
+                out << ", \"generic_map\": ";
+                this->pieces[2]->debug_print(out);
             }
             break;
 
         case PT_INTERFACE_PACKAGE_DECLARATION:
-            cout << ", \"identifier\": ";
-            this->pieces[0]->debug_print();
-            cout << ", \"uninstantiated_name\": ";
-            this->pieces[1]->debug_print();
-            cout << ", \"generic_map\": ";
-            this->pieces[2]->debug_print();
+            out << ", \"identifier\": ";
+            this->pieces[0]->debug_print(out);
+            out << ", \"uninstantiated_name\": ";
+            this->pieces[1]->debug_print(out);
+            out << ", \"generic_map\": ";
+            this->pieces[2]->debug_print(out);
             break;
 
         case PT_PROTECTED_TYPE_DECLARATION:
         case PT_PROTECTED_TYPE_BODY:
             if (this->pieces[0]) {
-                cout << ", \"declarations\": ";
-                this->pieces[0]->debug_print();
+                out << ", \"declarations\": ";
+                this->pieces[0]->debug_print(out);
             }
             if (this->pieces[1]) {
-                cout << ", \"end_label\": ";
-                this->pieces[1]->debug_print();
+                out << ", \"end_label\": ";
+                this->pieces[1]->debug_print(out);
             }
             break;
 
         case PT_COMPONENT_DECLARATION:
-            cout << ", \"identifier\": ";
-            this->pieces[0]->debug_print();
+            out << ", \"identifier\": ";
+            this->pieces[0]->debug_print(out);
             if (this->pieces[1]) {
-                cout << ", \"generic\": ";
-                this->pieces[1]->debug_print();
+                out << ", \"generic\": ";
+                this->pieces[1]->debug_print(out);
             }
             if (this->pieces[2]) {
-                cout << ", \"port\": ";
-                this->pieces[2]->debug_print();
+                out << ", \"port\": ";
+                this->pieces[2]->debug_print(out);
             }
             if (this->pieces[3]) {
-                cout << ", \"end_label\": ";
-                this->pieces[3]->debug_print();
+                out << ", \"end_label\": ";
+                this->pieces[3]->debug_print(out);
             }
             break;
 
         case PT_DISCONNECTION_SPECIFICATION:
-            cout << ", \"signal_specification\": ";
-            this->pieces[0]->debug_print();
-            cout << ", \"time\": ";
-            this->pieces[1]->debug_print();
+            out << ", \"signal_specification\": ";
+            this->pieces[0]->debug_print(out);
+            out << ", \"time\": ";
+            this->pieces[1]->debug_print(out);
             break;
 
         case PT_GUARDED_SIGNAL_SPECIFICATION:
-            cout << ", \"signal_list\": ";
-            this->pieces[0]->debug_print();
-            cout << ", \"type_mark\": ";
-            this->pieces[1]->debug_print();
+            out << ", \"signal_list\": ";
+            this->pieces[0]->debug_print(out);
+            out << ", \"type_mark\": ";
+            this->pieces[1]->debug_print(out);
             break;
 
         case PT_CONCURRENT_PROCEDURE_CALL:
         case PT_CONCURRENT_ASSERTION_STATEMENT:
-            cout << ", \"inner\": ";
-            this->pieces[0]->debug_print();
+            out << ", \"inner\": ";
+            this->pieces[0]->debug_print(out);
             if (this->pieces[1]) {
-                cout << ", \"label\": ";
-                this->pieces[1]->debug_print();
+                out << ", \"label\": ";
+                this->pieces[1]->debug_print(out);
             }
-            cout << ", \"postponed\": ";
-            cout << (this->boolean ? "true" : "false");
+            out << ", \"postponed\": ";
+            out << (this->boolean ? "true" : "false");
             break;
 
         case PT_COMPONENT_INSTANTIATION:
-            cout << ", \"label\": ";
-            this->pieces[0]->debug_print();
-            cout << ", \"instantiated_unit\": ";
-            this->pieces[1]->debug_print();
+            out << ", \"label\": ";
+            this->pieces[0]->debug_print(out);
+            out << ", \"instantiated_unit\": ";
+            this->pieces[1]->debug_print(out);
             if (this->pieces[2]) {
-                cout << ", \"generic_map\": ";
-                this->pieces[2]->debug_print();
+                out << ", \"generic_map\": ";
+                this->pieces[2]->debug_print(out);
             }
             if (this->pieces[3]) {
-                cout << ", \"port_map\": ";
-                this->pieces[3]->debug_print();
+                out << ", \"port_map\": ";
+                this->pieces[3]->debug_print(out);
             }
             break;
 
         case PT_INSTANTIATED_UNIT_ENTITY:
             if (this->pieces[1]) {
-                cout << ", \"architecture\": ";
-                this->pieces[1]->debug_print();
+                out << ", \"architecture\": ";
+                this->pieces[1]->debug_print(out);
             }
         case PT_INSTANTIATED_UNIT_COMPONENT:
         case PT_INSTANTIATED_UNIT_CONFIGURATION:
-            cout << ", \"name\": ";
-            this->pieces[0]->debug_print();
+            out << ", \"name\": ";
+            this->pieces[0]->debug_print(out);
             break;
 
         case PT_CONCURRENT_SELECTED_SIGNAL_ASSIGNMENT:
-            cout << ", \"select_expression\": ";
-            this->pieces[4]->debug_print();
-            cout << ", \"matching\": ";
-            cout << (this->boolean3 ? "true" : "false");
+            out << ", \"select_expression\": ";
+            this->pieces[4]->debug_print(out);
+            out << ", \"matching\": ";
+            out << (this->boolean3 ? "true" : "false");
         case PT_CONCURRENT_SIMPLE_SIGNAL_ASSIGNMENT:
         case PT_CONCURRENT_CONDITIONAL_SIGNAL_ASSIGNMENT:
-            cout << ", \"target\": ";
-            this->pieces[0]->debug_print();
-            cout << ", \"waveform\": ";
-            this->pieces[1]->debug_print();
+            out << ", \"target\": ";
+            this->pieces[0]->debug_print(out);
+            out << ", \"waveform\": ";
+            this->pieces[1]->debug_print(out);
             if (this->pieces[2]) {
-                cout << ", \"delay\": ";
-                this->pieces[2]->debug_print();
+                out << ", \"delay\": ";
+                this->pieces[2]->debug_print(out);
             }
             if (this->pieces[3]) {
-                cout << ", \"label\": ";
-                this->pieces[3]->debug_print();
+                out << ", \"label\": ";
+                this->pieces[3]->debug_print(out);
             }
-            cout << ", \"postponed\": ";
-            cout << (this->boolean ? "true" : "false");
-            cout << ", \"guarded\": ";
-            cout << (this->boolean2 ? "true" : "false");
+            out << ", \"postponed\": ";
+            out << (this->boolean ? "true" : "false");
+            out << ", \"guarded\": ";
+            out << (this->boolean2 ? "true" : "false");
             break;
 
         case PT_BLOCK:
-            cout << ", \"label\": ";
-            this->pieces[0]->debug_print();
+            out << ", \"label\": ";
+            this->pieces[0]->debug_print(out);
             if (this->pieces[1]) {
-                cout << ", \"header\": ";
-                this->pieces[1]->debug_print();
+                out << ", \"header\": ";
+                this->pieces[1]->debug_print(out);
             }
             if (this->pieces[2]) {
-                cout << ", \"guard\": ";
-                this->pieces[2]->debug_print();
+                out << ", \"guard\": ";
+                this->pieces[2]->debug_print(out);
             }
             if (this->pieces[3]) {
-                cout << ", \"declarations\": ";
-                this->pieces[3]->debug_print();
+                out << ", \"declarations\": ";
+                this->pieces[3]->debug_print(out);
             }
             if (this->pieces[4]) {
-                cout << ", \"statements\": ";
-                this->pieces[4]->debug_print();
+                out << ", \"statements\": ";
+                this->pieces[4]->debug_print(out);
             }
             if (this->pieces[5]) {
-                cout << ", \"end_label\": ";
-                this->pieces[5]->debug_print();
+                out << ", \"end_label\": ";
+                this->pieces[5]->debug_print(out);
             }
             break;
 
         case PT_BLOCK_HEADER:
             if (this->pieces[0]) {
-                cout << ", \"generic\": ";
-                this->pieces[0]->debug_print();
+                out << ", \"generic\": ";
+                this->pieces[0]->debug_print(out);
             }
             if (this->pieces[1]) {
-                cout << ", \"generic_map\": ";
-                this->pieces[1]->debug_print();
+                out << ", \"generic_map\": ";
+                this->pieces[1]->debug_print(out);
             }
             if (this->pieces[2]) {
-                cout << ", \"port\": ";
-                this->pieces[2]->debug_print();
+                out << ", \"port\": ";
+                this->pieces[2]->debug_print(out);
             }
             if (this->pieces[3]) {
-                cout << ", \"port_map\": ";
-                this->pieces[3]->debug_print();
+                out << ", \"port_map\": ";
+                this->pieces[3]->debug_print(out);
             }
             break;
 
         case PT_FOR_GENERATE:
-            cout << ", \"label\": ";
-            this->pieces[0]->debug_print();
-            cout << ", \"parameter_specification\": ";
-            this->pieces[1]->debug_print();
-            cout << ", \"body\": ";
-            this->pieces[2]->debug_print();
+            out << ", \"label\": ";
+            this->pieces[0]->debug_print(out);
+            out << ", \"parameter_specification\": ";
+            this->pieces[1]->debug_print(out);
+            out << ", \"body\": ";
+            this->pieces[2]->debug_print(out);
             if (this->pieces[3]) {
-                cout << ", \"end_label\": ";
-                this->pieces[3]->debug_print();
+                out << ", \"end_label\": ";
+                this->pieces[3]->debug_print(out);
             }
             break;
 
         case PT_IF_GENERATE:
-            cout << ", \"generate_label\": ";
-            this->pieces[0]->debug_print();
-            cout << ", \"condition\": ";
-            this->pieces[1]->debug_print();
-            cout << ", \"if_body\": ";
-            this->pieces[2]->debug_print();
+            out << ", \"generate_label\": ";
+            this->pieces[0]->debug_print(out);
+            out << ", \"condition\": ";
+            this->pieces[1]->debug_print(out);
+            out << ", \"if_body\": ";
+            this->pieces[2]->debug_print(out);
             if (this->pieces[3]) {
-                cout << ", \"if_label\": ";
-                this->pieces[3]->debug_print();
+                out << ", \"if_label\": ";
+                this->pieces[3]->debug_print(out);
             }
             if (this->pieces[4]) {
-                cout << ", \"elsif_arms\": ";
-                this->pieces[4]->debug_print();
+                out << ", \"elsif_arms\": ";
+                this->pieces[4]->debug_print(out);
             }
             if (this->pieces[5]) {
-                cout << ", \"else_body\": ";
-                this->pieces[5]->debug_print();
+                out << ", \"else_body\": ";
+                this->pieces[5]->debug_print(out);
             }
             if (this->pieces[6]) {
-                cout << ", \"else_label\": ";
-                this->pieces[6]->debug_print();
+                out << ", \"else_label\": ";
+                this->pieces[6]->debug_print(out);
             }
             if (this->pieces[7]) {
-                cout << ", \"end_label\": ";
-                this->pieces[7]->debug_print();
+                out << ", \"end_label\": ";
+                this->pieces[7]->debug_print(out);
             }
             break;
 
         case PT_CASE_GENERATE:
-            cout << ", \"generate_label\": ";
-            this->pieces[0]->debug_print();
-            cout << ", \"expression\": ";
-            this->pieces[1]->debug_print();
-            cout << ", \"alternatives\": ";
-            this->pieces[2]->debug_print();
+            out << ", \"generate_label\": ";
+            this->pieces[0]->debug_print(out);
+            out << ", \"expression\": ";
+            this->pieces[1]->debug_print(out);
+            out << ", \"alternatives\": ";
+            this->pieces[2]->debug_print(out);
             if (this->pieces[3]) {
-                cout << ", \"end_label\": ";
-                this->pieces[3]->debug_print();
+                out << ", \"end_label\": ";
+                this->pieces[3]->debug_print(out);
             }
             break;
 
         case PT_GENERATE_BODY:
             if (this->pieces[0]) {
-                cout << ", \"declarations\": ";
-                this->pieces[0]->debug_print();
+                out << ", \"declarations\": ";
+                this->pieces[0]->debug_print(out);
             }
             if (this->pieces[1]) {
-                cout << ", \"statements\": ";
-                this->pieces[1]->debug_print();
+                out << ", \"statements\": ";
+                this->pieces[1]->debug_print(out);
             }
             if (this->pieces[2]) {
-                cout << ", \"end_label\": ";
-                this->pieces[2]->debug_print();
+                out << ", \"end_label\": ";
+                this->pieces[2]->debug_print(out);
             }
             break;
 
         case PT_IF_GENERATE_ELSIF:
-            cout << ", \"condition\": ";
-            this->pieces[0]->debug_print();
-            cout << ", \"body\": ";
-            this->pieces[1]->debug_print();
+            out << ", \"condition\": ";
+            this->pieces[0]->debug_print(out);
+            out << ", \"body\": ";
+            this->pieces[1]->debug_print(out);
             if (this->pieces[2]) {
-                cout << ", \"label\": ";
-                this->pieces[2]->debug_print();
+                out << ", \"label\": ";
+                this->pieces[2]->debug_print(out);
             }
             break;
 
         case PT_CASE_GENERATE_ALTERNATIVE:
-            cout << ", \"choices\": ";
-            this->pieces[0]->debug_print();
-            cout << ", \"body\": ";
-            this->pieces[1]->debug_print();
+            out << ", \"choices\": ";
+            this->pieces[0]->debug_print(out);
+            out << ", \"body\": ";
+            this->pieces[1]->debug_print(out);
             if (this->pieces[2]) {
-                cout << ", \"label\": ";
-                this->pieces[2]->debug_print();
+                out << ", \"label\": ";
+                this->pieces[2]->debug_print(out);
             }
             break;
 
         case PT_SIMPLE_CONFIGURATION_SPECIFICATION:
-            cout << ", \"component\": ";
-            this->pieces[0]->debug_print();
-            cout << ", \"binding\": ";
-            this->pieces[1]->debug_print();
+            out << ", \"component\": ";
+            this->pieces[0]->debug_print(out);
+            out << ", \"binding\": ";
+            this->pieces[1]->debug_print(out);
             break;
 
         case PT_COMPONENT_SPECIFICATION:
-            cout << ", \"instantiation_list\": ";
-            this->pieces[0]->debug_print();
-            cout << ", \"name\": ";
-            this->pieces[1]->debug_print();
+            out << ", \"instantiation_list\": ";
+            this->pieces[0]->debug_print(out);
+            out << ", \"name\": ";
+            this->pieces[1]->debug_print(out);
             break;
 
         case PT_BINDING_INDICATION:
             if (this->pieces[0]) {
-                cout << ", \"entity_aspect\": ";
-                this->pieces[0]->debug_print();
+                out << ", \"entity_aspect\": ";
+                this->pieces[0]->debug_print(out);
             }
             if (this->pieces[1]) {
-                cout << ", \"generic_map\": ";
-                this->pieces[1]->debug_print();
+                out << ", \"generic_map\": ";
+                this->pieces[1]->debug_print(out);
             }
             if (this->pieces[2]) {
-                cout << ", \"port_map\": ";
-                this->pieces[2]->debug_print();
+                out << ", \"port_map\": ";
+                this->pieces[2]->debug_print(out);
             }
             break;
 
         case PT_ENTITY_ASPECT_ENTITY:
-            cout << ", \"name\": ";
-            this->pieces[0]->debug_print();
+            out << ", \"name\": ";
+            this->pieces[0]->debug_print(out);
             if (this->pieces[1]) {
-                cout << ", \"architecture\": ";
-                this->pieces[1]->debug_print();
+                out << ", \"architecture\": ";
+                this->pieces[1]->debug_print(out);
             }
             break;
 
         case PT_ENTITY_ASPECT_CONFIGURATION:
-            cout << ", \"configuration\": ";
-            this->pieces[0]->debug_print();
+            out << ", \"configuration\": ";
+            this->pieces[0]->debug_print(out);
             break;
 
         case PT_VERIFICATION_UNIT_BINDING_INDICATION:
-            cout << ", \"vunits\": ";
-            this->pieces[0]->debug_print();
+            out << ", \"vunits\": ";
+            this->pieces[0]->debug_print(out);
             break;
 
         case PT_COMPOUND_CONFIGURATION_SPECIFICATION:
-            cout << ", \"component\": ";
-            this->pieces[0]->debug_print();
-            cout << ", \"binding\": ";
-            this->pieces[1]->debug_print();
-            cout << ", \"vunits\": ";
-            this->pieces[2]->debug_print();
+            out << ", \"component\": ";
+            this->pieces[0]->debug_print(out);
+            out << ", \"binding\": ";
+            this->pieces[1]->debug_print(out);
+            out << ", \"vunits\": ";
+            this->pieces[2]->debug_print(out);
             break;
 
         case PT_ENTITY:
-            cout << ", \"identifier\": ";
-            this->pieces[0]->debug_print();
+            out << ", \"identifier\": ";
+            this->pieces[0]->debug_print(out);
             if (this->pieces[1]) {
-                cout << ", \"header\": ";
-                this->pieces[1]->debug_print();
+                out << ", \"header\": ";
+                this->pieces[1]->debug_print(out);
             }
             if (this->pieces[2]) {
-                cout << ", \"declarations\": ";
-                this->pieces[2]->debug_print();
+                out << ", \"declarations\": ";
+                this->pieces[2]->debug_print(out);
             }
             if (this->pieces[3]) {
-                cout << ", \"statements\": ";
-                this->pieces[3]->debug_print();
+                out << ", \"statements\": ";
+                this->pieces[3]->debug_print(out);
             }
             if (this->pieces[4]) {
-                cout << ", \"end_label\": ";
-                this->pieces[4]->debug_print();
+                out << ", \"end_label\": ";
+                this->pieces[4]->debug_print(out);
             }
             break;
 
         case PT_ENTITY_HEADER:
             if (this->pieces[0]) {
-                cout << ", \"generic\": ";
-                this->pieces[0]->debug_print();
+                out << ", \"generic\": ";
+                this->pieces[0]->debug_print(out);
             }
             if (this->pieces[1]) {
-                cout << ", \"port\": ";
-                this->pieces[1]->debug_print();
+                out << ", \"port\": ";
+                this->pieces[1]->debug_print(out);
             }
             break;
 
         case PT_CONTEXT_DECLARATION:
-            cout << ", \"identifier\": ";
-            this->pieces[0]->debug_print();
+            out << ", \"identifier\": ";
+            this->pieces[0]->debug_print(out);
             if (this->pieces[1]) {
-                cout << ", \"context\": ";
-                this->pieces[1]->debug_print();
+                out << ", \"context\": ";
+                this->pieces[1]->debug_print(out);
             }
             if (this->pieces[2]) {
-                cout << ", \"end_label\": ";
-                this->pieces[2]->debug_print();
+                out << ", \"end_label\": ";
+                this->pieces[2]->debug_print(out);
             }
             break;
 
         case PT_LIBRARY_CLAUSE:
-            cout << ", \"names\": ";
-            this->pieces[0]->debug_print();
+            out << ", \"names\": ";
+            this->pieces[0]->debug_print(out);
             break;
 
         case PT_CONTEXT_REFERENCE:
-            cout << ", \"names\": ";
-            this->pieces[0]->debug_print();
+            out << ", \"names\": ";
+            this->pieces[0]->debug_print(out);
             break;
 
         case PT_CONFIGURATION_DECLARATION:
-            cout << ", \"identifier\": ";
-            this->pieces[0]->debug_print();
+            out << ", \"identifier\": ";
+            this->pieces[0]->debug_print(out);
             if (this->pieces[1]) {
-                cout << ", \"name\": ";
-                this->pieces[1]->debug_print();
+                out << ", \"name\": ";
+                this->pieces[1]->debug_print(out);
             }
             if (this->pieces[2]) {
-                cout << ", \"declarations\": ";
-                this->pieces[2]->debug_print();
+                out << ", \"declarations\": ";
+                this->pieces[2]->debug_print(out);
             }
             if (this->pieces[3]) {
-                cout << ", \"vunits\": ";
-                this->pieces[3]->debug_print();
+                out << ", \"vunits\": ";
+                this->pieces[3]->debug_print(out);
             }
             if (this->pieces[4]) {
-                cout << ", \"block_configuration\": ";
-                this->pieces[4]->debug_print();
+                out << ", \"block_configuration\": ";
+                this->pieces[4]->debug_print(out);
             }
             if (this->pieces[5]) {
-                cout << ", \"end_label\": ";
-                this->pieces[5]->debug_print();
+                out << ", \"end_label\": ";
+                this->pieces[5]->debug_print(out);
             }
             break;
 
         case PT_BLOCK_CONFIGURATION:
-            cout << ", \"specification\": ";
-            this->pieces[0]->debug_print();
+            out << ", \"specification\": ";
+            this->pieces[0]->debug_print(out);
             if (this->pieces[1]) {
-                cout << ", \"use_clauses\": ";
-                this->pieces[1]->debug_print();
+                out << ", \"use_clauses\": ";
+                this->pieces[1]->debug_print(out);
             }
             if (this->pieces[2]) {
-                cout << ", \"configuration_items\": ";
-                this->pieces[2]->debug_print();
+                out << ", \"configuration_items\": ";
+                this->pieces[2]->debug_print(out);
             }
             break;
 
         case PT_BLOCK_SPECIFICATION:
-            cout << ", \"name\": ";
-            this->pieces[0]->debug_print();
+            out << ", \"name\": ";
+            this->pieces[0]->debug_print(out);
             if (this->pieces[1]) {
-                cout << ", \"generate_specification\": ";
-                this->pieces[1]->debug_print();
+                out << ", \"generate_specification\": ";
+                this->pieces[1]->debug_print(out);
             }
             break;
 
         case PT_COMPONENT_CONFIGURATION:
-            cout << ", \"specification\": ";
-            this->pieces[0]->debug_print();
+            out << ", \"specification\": ";
+            this->pieces[0]->debug_print(out);
             if (this->pieces[1]) {
-                cout << ", \"binding_indication\": ";
-                this->pieces[1]->debug_print();
+                out << ", \"binding_indication\": ";
+                this->pieces[1]->debug_print(out);
             }
             if (this->pieces[2]) {
-                cout << ", \"vunits\": ";
-                this->pieces[2]->debug_print();
+                out << ", \"vunits\": ";
+                this->pieces[2]->debug_print(out);
             }
             if (this->pieces[3]) {
-                cout << ", \"block_configuration\": ";
-                this->pieces[3]->debug_print();
+                out << ", \"block_configuration\": ";
+                this->pieces[3]->debug_print(out);
             }
             break;
 
         case PT_ARCHITECTURE:
-            cout << ", \"identifier\": ";
-            this->pieces[0]->debug_print();
-            cout << ", \"name\": ";
-            this->pieces[1]->debug_print();
+            out << ", \"identifier\": ";
+            this->pieces[0]->debug_print(out);
+            out << ", \"name\": ";
+            this->pieces[1]->debug_print(out);
             if (this->pieces[2]) {
-                cout << ", \"declarations\": ";
-                this->pieces[2]->debug_print();
+                out << ", \"declarations\": ";
+                this->pieces[2]->debug_print(out);
             }
             if (this->pieces[3]) {
-                cout << ", \"statements\": ";
-                this->pieces[3]->debug_print();
+                out << ", \"statements\": ";
+                this->pieces[3]->debug_print(out);
             }
             if (this->pieces[4]) {
-                cout << ", \"end_label\": ";
-                this->pieces[4]->debug_print();
+                out << ", \"end_label\": ";
+                this->pieces[4]->debug_print(out);
             }
             break;
 
         case PT_DESIGN_UNIT:
-            cout << ", \"library_unit\": ";
-            this->pieces[0]->debug_print();
+            out << ", \"library_unit\": ";
+            this->pieces[0]->debug_print(out);
             if (this->pieces[1]) {
-                cout << ", \"context_clause\": ";
-                this->pieces[1]->debug_print();
+                out << ", \"context_clause\": ";
+                this->pieces[1]->debug_print(out);
             }
             break;
 
@@ -1913,30 +2562,326 @@ void VhdlParseTreeNode::debug_print() {
         case PT_CONFIGURATION_ITEM_LIST:
         case PT_DESIGN_FILE:
             if (this->pieces[0]) {
-                cout << ", \"rest\": ";
-                this->pieces[0]->debug_print();
-            }
-            cout << ", \"this_piece\": ";
-            this->pieces[1]->debug_print();
+                out << ", \"rest\": ";
+                this->pieces[0]->debug_print(out);
+            }
+            out << ", \"this_piece\": ";
+            this->pieces[1]->debug_print(out);
+            break;
+
+        case PT_LITERAL_AGGREGATE: {
+            // One node is reused for printing all the elements
+            VhdlParseTreeNode *element =
+                new VhdlParseTreeNode(this->pieces[0]->type);
+            print_dense_list(out, "PT_AGGREGATE", this->integer, [&](int i) {
+                fill_literal_element(this, i, element);
+                out << "{\"type\": \"PT_ELEMENT_ASSOCIATION\", ";
+                out << "\"expression\": ";
+                element->debug_print(out);
+                out << "}";
+            });
+            element->delete_self();
             break;
+        }
+
+        case PT_SIMPLE_ASSOCIATION_LIST: {
+            VhdlParseTreeNode *formal = new VhdlParseTreeNode(PT_BASIC_ID);
+            VhdlParseTreeNode *actual = new VhdlParseTreeNode(PT_BASIC_ID);
+            formal->str = new std::string();
+            actual->str = new std::string();
+            size_t pos = 0;
+            print_dense_list(out, "PT_ASSOCIATION_LIST", this->integer, [&](int) {
+                next_simple_name(*this->str, pos, *formal->str);
+                next_simple_name(*this->str, pos, *actual->str);
+                out << "{\"type\": \"PT_ASSOCIATION_ELEMENT\", ";
+                out << "\"actual_part\": ";
+                actual->debug_print(out);
+                out << ", \"formal_part\": ";
+                formal->debug_print(out);
+                out << "}";
+            });
+            formal->delete_self();
+            actual->delete_self();
+            break;
+        }
 
         case PT_UNARY_OPERATOR:
-            cout << ", \"op\": \"" << parse_operators[this->op_type];
-            cout << "\", \"x\": ";
-            this->pieces[0]->debug_print();
+            out << ", \"op\": \"" << parse_operators[this->op_type];
+            out << "\", \"x\": ";
+            this->pieces[0]->debug_print(out);
             break;
 
         case PT_BINARY_OPERATOR:
-            cout << ", \"op\": \"" << parse_operators[this->op_type];
-            cout << "\", \"x\": ";
-            this->pieces[0]->debug_print();
-            cout << ", \"y\": ";
-            this->pieces[1]->debug_print();
+            out << ", \"op\": \"" << parse_operators[this->op_type];
+            out << "\", \"x\": ";
+            this->pieces[0]->debug_print(out);
+            out << ", \"y\": ";
+            this->pieces[1]->debug_print(out);
+            break;
+
+        case PT_NARY_OPERATOR: {
+            // Printed as the equivalent left-nested PT_BINARY_OPERATOR nodes.
+            // This is done without recursion because runs can be very long.
+            std::vector<VhdlParseTreeNode *> operands;
+            this->nary_operands(operands);
+            out << ", \"op\": \"" << parse_operators[this->op_type];
+            out << "\", \"x\": ";
+            for (size_t i = 2; i < operands.size(); i++) {
+                out << "{\"type\": \"PT_BINARY_OPERATOR\", \"op\": \"";
+                out << parse_operators[this->op_type] << "\", \"x\": ";
+            }
+            operands[0]->debug_print(out);
+            for (size_t i = 1; i < operands.size(); i++) {
+                out << ", \"y\": ";
+                operands[i]->debug_print(out);
+                if (i != operands.size() - 1) {
+                    out << "}";
+                }
+            }
             break;
+        }
 
         default:
             break;
     }
 
-    cout << "}";
+    out << "}";
+}
+
+// Packed serialization, see the description of the format in the header.
+// The writer lays nodes out in pre-order, so every child has a larger index
+// than its parent. Readers rely on this to reject cycles.
+static void set_u16(std::string &out, size_t pos, uint16_t x) {
+    out[pos + 0] = (char)(x & 0xFF);
+    out[pos + 1] = (char)((x >> 8) & 0xFF);
+}
+
+static void set_u32(std::string &out, size_t pos, uint32_t x) {
+    for (int i = 0; i < 4; i++) {
+        out[pos + i] = (char)((x >> (i * 8)) & 0xFF);
+    }
+}
+
+static uint16_t get_u16(const char *buf) {
+    return ((uint16_t)(unsigned char)buf[0]) |
+           ((uint16_t)(unsigned char)buf[1] << 8);
+}
+
+static uint32_t get_u32(const char *buf) {
+    uint32_t x = 0;
+    for (int i = 0; i < 4; i++) {
+        x |= ((uint32_t)(unsigned char)buf[i]) << (i * 8);
+    }
+    return x;
+}
+
+namespace {
+
+struct PackedTreeWriter {
+    std::string nodes;
+    std::string strings;
+    std::unordered_map<std::string, uint32_t> interned_strings;
+    uint32_t node_count = 0;
+
+    uint32_t intern(std::string *s) {
+        auto existing = interned_strings.find(*s);
+        if (existing != interned_strings.end()) {
+            return existing->second;
+        }
+
+        uint32_t off = strings.length();
+        strings.append(*s);
+        interned_strings[*s] = off;
+        return off;
+    }
+
+    uint32_t pack(VhdlParseTreeNode *node) {
+        uint32_t idx = node_count++;
+        size_t pos = nodes.length();
+        nodes.append(PACKED_NODE_SIZE, '\0');
+
+        set_u16(nodes, pos + 0, node->type);
+        nodes[pos + 2] = node->chr;
+        nodes[pos + 3] = (node->boolean ? PACKED_FLAG_BOOLEAN : 0) |
+                         (node->boolean2 ? PACKED_FLAG_BOOLEAN2 : 0) |
+                         (node->boolean3 ? PACKED_FLAG_BOOLEAN3 : 0) |
+                         (node->str ? PACKED_FLAG_HAS_STR : 0) |
+                         (node->str2 ? PACKED_FLAG_HAS_STR2 : 0);
+        nodes[pos + 4] = node->op_type;
+        nodes[pos + 5] = node->range_dir;
+        nodes[pos + 6] = node->force_mode;
+        nodes[pos + 7] = node->purity;
+        nodes[pos + 8] = node->interface_mode;
+        nodes[pos + 9] = node->subprogram_kind;
+        nodes[pos + 10] = node->entity_class;
+        nodes[pos + 11] = node->signal_kind;
+        set_u32(nodes, pos + 12, node->integer);
+        set_u32(nodes, pos + 16, node->first_line);
+        set_u32(nodes, pos + 20, node->first_column);
+        set_u32(nodes, pos + 24, node->last_line);
+        set_u32(nodes, pos + 28, node->last_column);
+        if (node->str) {
+            set_u32(nodes, pos + 32, intern(node->str));
+            set_u32(nodes, pos + 36, node->str->length());
+        }
+        if (node->str2) {
+            set_u32(nodes, pos + 40, intern(node->str2));
+            set_u32(nodes, pos + 44, node->str2->length());
+        }
+
+        for (int i = 0; i < NUM_FIXED_PIECES; i++) {
+            uint32_t child_idx = PACKED_NO_NODE;
+            if (node->pieces[i]) {
+                child_idx = pack(node->pieces[i]);
+            }
+            set_u32(nodes, pos + 48 + i * 4, child_idx);
+        }
+
+        return idx;
+    }
+};
+
+}
+
+void VhdlParseTreeNode::serialize(std::string &out) {
+    PackedTreeWriter w;
+    w.pack(this);
+
+    out.append(PACKED_TREE_HEADER_SIZE, '\0');
+    out[0] = PACKED_TREE_MAGIC[0];
+    out[1] = PACKED_TREE_MAGIC[1];
+    out[2] = PACKED_TREE_MAGIC[2];
+    out[3] = PACKED_TREE_MAGIC[3];
+    set_u32(out, 4, PACKED_TREE_VERSION);
+    set_u32(out, 8, w.node_count);
+    set_u32(out, 12, 0);
+    set_u32(out, 16, PACKED_TREE_HEADER_SIZE);
+    set_u32(out, 20, PACKED_TREE_HEADER_SIZE + w.nodes.length());
+    set_u32(out, 24, w.strings.length());
+    set_u32(out, 28, 0);
+    out.append(w.nodes);
+    out.append(w.strings);
+}
+
+static bool packed_str_ok(const char *node, int off, uint32_t strings_len) {
+    uint32_t str_off = get_u32(node + off);
+    uint32_t str_len = get_u32(node + off + 4);
+    return str_off <= strings_len && str_len <= strings_len - str_off;
+}
+
+// has_parent marks the nodes that are already some node's child. A node that
+// is used twice is rejected, as otherwise a small image could stand for a
+// huge tree.
+static VhdlParseTreeNode *unpack(const char *nodes, uint32_t node_count,
+    const char *strings, uint32_t strings_len, uint32_t idx,
+    std::vector<bool> &has_parent) {
+
+    const char *rec = nodes + (size_t)idx * PACKED_NODE_SIZE;
+
+    uint16_t type = get_u16(rec + 0);
+    unsigned char flags = rec[3];
+    if (type >= sizeof(parse_tree_types) / sizeof(parse_tree_types[0]) ||
+        (unsigned char)rec[4] >=
+            sizeof(parse_operators) / sizeof(parse_operators[0]) ||
+        (unsigned char)rec[5] >=
+            sizeof(range_direction) / sizeof(range_direction[0]) ||
+        (unsigned char)rec[6] >=
+            sizeof(force_modes) / sizeof(force_modes[0]) ||
+        (unsigned char)rec[7] >=
+            sizeof(func_purity) / sizeof(func_purity[0]) ||
+        (unsigned char)rec[8] >=
+            sizeof(interface_modes) / sizeof(interface_modes[0]) ||
+        (unsigned char)rec[9] >=
+            sizeof(subprogram_kinds) / sizeof(subprogram_kinds[0]) ||
+        (unsigned char)rec[10] >=
+            sizeof(entity_classes) / sizeof(entity_classes[0]) ||
+        (unsigned char)rec[11] >=
+            sizeof(signal_kinds) / sizeof(signal_kinds[0])) {
+        return nullptr;
+    }
+    if (((flags & PACKED_FLAG_HAS_STR) &&
+            !packed_str_ok(rec, 32, strings_len)) ||
+        ((flags & PACKED_FLAG_HAS_STR2) &&
+            !packed_str_ok(rec, 40, strings_len))) {
+        return nullptr;
+    }
+
+    VhdlParseTreeNode *node =
+        new VhdlParseTreeNode((enum ParseTreeNodeType)type);
+    node->chr = rec[2];
+    node->boolean = flags & PACKED_FLAG_BOOLEAN;
+    node->boolean2 = flags & PACKED_FLAG_BOOLEAN2;
+    node->boolean3 = flags & PACKED_FLAG_BOOLEAN3;
+    node->op_type = (ParseTreeOperatorType)rec[4];
+    node->range_dir = (ParseTreeRangeDirection)rec[5];
+    node->force_mode = (ParseTreeForceMode)rec[6];
+    node->purity = (ParseTreeFunctionPurity)rec[7];
+    node->interface_mode = (ParseTreeInterfaceObjectMode)rec[8];
+    node->subprogram_kind = (ParseTreeSubprogramKind)rec[9];
+    node->entity_class = (ParseTreeEntityClass)rec[10];
+    node->signal_kind = (ParseTreeSignalKind)rec[11];
+    node->integer = get_u32(rec + 12);
+    node->first_line = get_u32(rec + 16);
+    node->first_column = get_u32(rec + 20);
+    node->last_line = get_u32(rec + 24);
+    node->last_column = get_u32(rec + 28);
+    if (flags & PACKED_FLAG_HAS_STR) {
+        node->str = new std::string(
+            strings + get_u32(rec + 32), get_u32(rec + 36));
+    }
+    if (flags & PACKED_FLAG_HAS_STR2) {
+        node->str2 = new std::string(
+            strings + get_u32(rec + 40), get_u32(rec + 44));
+    }
+
+    for (int i = 0; i < NUM_FIXED_PIECES; i++) {
+        uint32_t child_idx = get_u32(rec + 48 + i * 4);
+        if (child_idx == PACKED_NO_NODE) {
+            continue;
+        }
+
+        if (child_idx <= idx || child_idx >= node_count ||
+            has_parent[child_idx]) {
+            node->delete_self();
+            return nullptr;
+        }
+        has_parent[child_idx] = true;
+        if (!(node->pieces[i] = unpack(nodes, node_count,
+                strings, strings_len, child_idx, has_parent))) {
+            node->delete_self();
+            return nullptr;
+        }
+    }
+
+    return node;
+}
+
+// Inverse of serialize(). Returns nullptr if the input is truncated or
+// otherwise malformed.
+VhdlParseTreeNode *VhdlParseTreeNode::deserialize(
+    const char *buf, size_t len) {
+
+    if (len < PACKED_TREE_HEADER_SIZE ||
+        memcmp(buf, PACKED_TREE_MAGIC, 4) != 0 ||
+        get_u32(buf + 4) != PACKED_TREE_VERSION) {
+        return nullptr;
+    }
+
+    uint32_t node_count = get_u32(buf + 8);
+    uint32_t root = get_u32(buf + 12);
+    uint32_t nodes_off = get_u32(buf + 16);
+    uint32_t strings_off = get_u32(buf + 20);
+    uint32_t strings_len = get_u32(buf + 24);
+    if (root >= node_count ||
+        nodes_off < PACKED_TREE_HEADER_SIZE ||
+        nodes_off > len ||
+        (len - nodes_off) / PACKED_NODE_SIZE < node_count ||
+        strings_off > len ||
+        strings_len > len - strings_off) {
+        return nullptr;
+    }
+
+    std::vector<bool> has_parent(node_count);
+    return unpack(buf + nodes_off, node_count,
+        buf + strings_off, strings_len, root, has_parent);
 }
@@ -27,7 +27,13 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #define VHDL_PARSE_TREE_H
 
 #ifndef RUNNING_RUST_BINDGEN
+#include <atomic>
+#include <cstddef>
+#include <iosfwd>
+#include <set>
 #include <string>
+#include <unordered_set>
+#include <vector>
 #endif
 
 #ifndef RUNNING_RUST_BINDGEN
@@ -87,8 +93,22 @@ enum ParseTreeNodeType
     // Expressions, section 9
     PT_UNARY_OPERATOR,
     PT_BINARY_OPERATOR,
+    // Three or more operands joined by the same associative operator (and,
+    // or, xor, &, +). The pieces are either all operands or, once there are
+    // more than NUM_FIXED_PIECES operands, all PT_NARY_OPERATOR_GROUP nodes
+    // which in turn hold consecutive operands or groups. All operands are at
+    // the same depth. integer is the number of operands under the node.
+    PT_NARY_OPERATOR,
+    PT_NARY_OPERATOR_GROUP,
 
     PT_AGGREGATE,
+    // Positional aggregate whose elements are all literals of the same kind
+    // and length, such as a ROM initializer. pieces[0] is the first element
+    // and is the template for the others. str holds the text (or chr) of
+    // every element back to back, all the same number of bytes, and integer
+    // is the number of elements. This prints the same as the PT_AGGREGATE
+    // list it stands for, which expand_literal_aggregate() can build.
+    PT_LITERAL_AGGREGATE,
     PT_ELEMENT_ASSOCIATION,
     PT_CHOICES,
     PT_CHOICES_OTHER,
@@ -199,6 +219,12 @@ enum ParseTreeNodeType
     PT_PORT_MAP_ASPECT,
     PT_ASSOCIATION_LIST,
     PT_ASSOCIATION_ELEMENT,
+    // Association list made up only of "formal => actual" pairs where both
+    // sides are simple names, as in netlists. str holds the names of each
+    // formal and its actual, all separated by single spaces, and integer is
+    // the number of pairs. This prints the same as the PT_ASSOCIATION_LIST it
+    // stands for, which expand_simple_associations() can build.
+    PT_SIMPLE_ASSOCIATION_LIST,
     PT_INERTIAL_EXPRESSION,
 
     PT_SUBPROGRAM_INSTANTIATION_DECLARATION,
@@ -309,6 +335,9 @@ enum ParseTreeNodeType
     PT_DESIGN_FILE,
 };
 
+// Must be kept in sync with the above
+#define NUM_PARSE_TREE_NODE_TYPES 221
+
 // Operators, section 9.2
 enum ParseTreeOperatorType
 {
@@ -419,8 +448,72 @@ enum ParseTreeSignalKind
 // Definition of a parse tree node
 #define NUM_FIXED_PIECES 8
 
+// Packed (serialized) tree format. This is position-independent so that it
+// can be written to disk and then mapped back in and read in place. All
+// integers are little-endian and all offsets are relative to the start of
+// the image.
+//
+// Header:
+//   0  magic "YVPT"
+//   4  u32 format version
+//   8  u32 number of nodes
+//   12 u32 index of the root node
+//   16 u32 offset of the node records
+//   20 u32 offset of the string table
+//   24 u32 length of the string table
+//   28 u32 reserved (zero)
+//
+// Node record (fixed size, nodes are stored in pre-order):
+//   0  u16 node type
+//   2  u8 chr
+//   3  u8 flags (PACKED_FLAG_*)
+//   4  u8 each: op_type, range_dir, force_mode, purity, interface_mode,
+//      subprogram_kind, entity_class, signal_kind
+//   12 i32 integer
+//   16 i32 first_line, first_column, last_line, last_column
+//   32 u32 str offset (into the string table), u32 str length
+//   40 u32 str2 offset, u32 str2 length
+//   48 u32 index of each of the pieces, or PACKED_NO_NODE
+//
+// Identical strings are only stored once in the string table.
+#define PACKED_TREE_MAGIC "YVPT"
+#define PACKED_TREE_VERSION 4
+#define PACKED_TREE_HEADER_SIZE 32
+#define PACKED_NODE_SIZE 80
+#define PACKED_NO_NODE 0xFFFFFFFFU
+#define PACKED_FLAG_BOOLEAN 1
+#define PACKED_FLAG_BOOLEAN2 2
+#define PACKED_FLAG_BOOLEAN3 4
+#define PACKED_FLAG_HAS_STR 8
+#define PACKED_FLAG_HAS_STR2 16
+
+// Counters filled in by VhdlParseTreeInterner. Byte counts cover the nodes
+// and their strings but not any malloc overhead.
+struct VhdlParseTreeInternStats {
+    unsigned long nodes;
+    unsigned long shared_nodes;
+    unsigned long bytes_before;
+    unsigned long bytes_saved;
+};
+
+// Memory use by node type, from the optional accounting in the node
+// allocation path (see VhdlParseTreeNode::memory_stats). Arrays are indexed by
+// node type. Bytes are counted the same way as in VhdlParseTreeInternStats.
+struct VhdlParseTreeMemoryStats {
+    unsigned long long live_nodes[NUM_PARSE_TREE_NODE_TYPES];
+    unsigned long long peak_nodes[NUM_PARSE_TREE_NODE_TYPES];
+    unsigned long long live_bytes[NUM_PARSE_TREE_NODE_TYPES];
+    unsigned long long peak_bytes[NUM_PARSE_TREE_NODE_TYPES];
+    // Values the GLR parser threw away, which are freed after the parse
+    unsigned long long discarded_nodes[NUM_PARSE_TREE_NODE_TYPES];
+    unsigned long long discarded_bytes[NUM_PARSE_TREE_NODE_TYPES];
+};
+
 struct VhdlParseTreeNode {
     enum ParseTreeNodeType type;
+    // Type this node is currently counted under by the memory accounting.
+    // This fits in what would otherwise be padding.
+    int accounted_type;
 
     // Contents
 #ifndef RUNNING_RUST_BINDGEN
@@ -452,14 +545,131 @@ struct VhdlParseTreeNode {
     int last_line;
     int last_column;
 
+    // Number of owners of this node. This is only ever more than 1 for nodes
+    // that have been shared by VhdlParseTreeInterner. Trees that share nodes
+    // can be freed on different threads, so this is atomic.
+#ifndef RUNNING_RUST_BINDGEN
+    std::atomic<int> refcount;
+#else
+    int refcount;
+#endif
+
+    // Size this node is currently counted with by the memory accounting, or
+    // 0 if it isn't counted. Also fits in padding.
+    unsigned int accounted_bytes;
+
     VhdlParseTreeNode(enum ParseTreeNodeType type);
 
     // Force POD
     void delete_self();
 
     void debug_print();
+
+    // Moves the node and everything under it up or down by some lines
+    void shift_lines(int delta);
+
+#ifndef RUNNING_RUST_BINDGEN
+    // Same as debug_print, but to any stream rather than stdout
+    void debug_print(std::ostream &out);
+
+    // Builds "x op y" for one of the associative operators. If x is already
+    // a run of the same operator, y is appended to it rather than creating
+    // another level of nesting.
+    static VhdlParseTreeNode *associative_operator(
+        enum ParseTreeOperatorType op, VhdlParseTreeNode *x,
+        VhdlParseTreeNode *y);
+
+    // Operands of a PT_NARY_OPERATOR, in order
+    void nary_operands(std::vector<VhdlParseTreeNode *> &out);
+
+    // Builds a positional aggregate out of two element associations, or adds
+    // an element association to the end of one. Aggregates of literals are
+    // stored as a PT_LITERAL_AGGREGATE for as long as possible.
+    // If owned is set, nothing else refers to x and y, so they are reused or
+    // freed here. Otherwise they are left as they are, the ones the result
+    // doesn't use are added to discarded, and the result doesn't share any
+    // nodes with them.
+    static VhdlParseTreeNode *aggregate_append(VhdlParseTreeNode *x,
+        VhdlParseTreeNode *y, bool owned,
+        std::set<VhdlParseTreeNode *> &discarded);
+
+    // Builds the ordinary PT_AGGREGATE form of a PT_LITERAL_AGGREGATE. The
+    // result is a new tree and this node is not changed.
+    VhdlParseTreeNode *expand_literal_aggregate();
+
+    // Same as aggregate_append, but for association lists, which are stored
+    // as a PT_SIMPLE_ASSOCIATION_LIST for as long as possible
+    static VhdlParseTreeNode *association_append(VhdlParseTreeNode *x,
+        VhdlParseTreeNode *y, bool owned,
+        std::set<VhdlParseTreeNode *> &discarded);
+
+    // Builds the ordinary PT_ASSOCIATION_LIST form of a
+    // PT_SIMPLE_ASSOCIATION_LIST. The result is a new tree and this node is
+    // not changed.
+    VhdlParseTreeNode *expand_simple_associations();
+
+    // Adds every node in the tree to by_type (indexed by node type) and
+    // their sizes (counted the same way as VhdlParseTreeInternStats) to
+    // bytes. Dense nodes count as one node.
+    void count_nodes(unsigned long long *by_type, unsigned long long &bytes);
+
+    // Name of a node type as printed by debug_print
+    static const char *type_name(enum ParseTreeNodeType type);
+
+    // Memory accounting for nodes created and freed on this thread, or null
+    // if accounting is off. Nodes are counted when they are created and
+    // uncounted when they are freed.
+    static thread_local VhdlParseTreeMemoryStats *memory_stats;
+
+    // Brings the accounting up to date after the node's type or strings
+    // have changed
+    void recount() {
+        if (memory_stats) {
+            account_memory();
+        }
+    }
+    void account_memory();
+    void unaccount_memory();
+#endif
+
+#ifndef RUNNING_RUST_BINDGEN
+    // Flat byte stream form of a whole tree (used by the parse cache)
+    void serialize(std::string &out);
+    static VhdlParseTreeNode *deserialize(const char *buf, size_t len);
+#endif
 };
 
+#ifndef RUNNING_RUST_BINDGEN
+// Hash-consing for finished parse trees. Subtrees without any location
+// information (names, expressions, subtype indications, literals, etc.) are
+// never modified after parsing, so identical copies of them can all be
+// replaced by one shared copy. Shared nodes are reference counted, and the
+// interner itself holds a reference to everything in its table, so trees and
+// the interner can be freed in any order.
+class VhdlParseTreeInterner {
+public:
+    ~VhdlParseTreeInterner();
+
+    // Returns the node to use in place of the given one. This is either the
+    // same node (with its pieces interned) or an identical shared node, in
+    // which case the given node has been freed.
+    VhdlParseTreeNode *intern(VhdlParseTreeNode *node);
+
+    VhdlParseTreeInternStats stats = {};
+
+private:
+    struct NodeHash {
+        size_t operator()(const VhdlParseTreeNode *x) const;
+    };
+    struct NodeEqual {
+        bool operator()(const VhdlParseTreeNode *a,
+            const VhdlParseTreeNode *b) const;
+    };
+
+    std::unordered_set<VhdlParseTreeNode *, NodeHash, NodeEqual> table;
+};
+#endif
+
 #ifndef RUNNING_RUST_BINDGEN
 }
 #endif
@@ -55,16 +55,26 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
     lval->last_column = lloc.last_column + 1;   \
 } while(0)
 
+// Whether an action owns its $n values, and so can change or free them. With
+// a single parser stack, actions run as soon as their rule is reduced, on
+// values that were just popped off it. While the GLR parser is split, actions
+// are deferred until the split is resolved, and their values stay in states
+// that the parser can still destroy, so they have to be left alone and
+// anything not kept goes to to_delete_queue. yystackp is the GLR skeleton's
+// own stack.
+#define VALUES_ARE_OWNED (yystackp->yysplitPoint == YY_NULLPTR)
+
 %}
 
 %name-prefix "frontend_vhdl_yy"
 
 // Make the parser reentrant
 %define api.pure
-%lex-param {void *scanner} {std::string &errors}
-    {std::set<VhdlParseTreeNode *> &to_delete_queue}
+%lex-param {void *scanner} {VhdlParserDiagnostics &diagnostics}
+    {std::set<VhdlParseTreeNode *> &to_delete_queue} {VhdlParserStats *stats}
 %parse-param {void *scanner} {VhdlParseTreeNode **parse_output}
-    {std::string &errors} {std::set<VhdlParseTreeNode *> &to_delete_queue}
+    {VhdlParserDiagnostics &diagnostics}
+    {std::set<VhdlParseTreeNode *> &to_delete_queue} {VhdlParserStats *stats}
 %locations
 
 %glr-parser
@@ -74,7 +84,8 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 // conflicts significantly.
 // FIXME: Explain where exactly conflicts come from.
 %define lr.type ielr
-%define parse.error verbose
+// Syntax errors are reported by yyreport_syntax_error below
+%define parse.error custom
 %debug
 
 %define api.value.type {struct VhdlParseTreeNode *}
@@ -1725,6 +1736,7 @@ _definitely_interface_constant_declaration:
     KW_CONSTANT _interface_ambig_obj_declaration {
         $$ = $2;
         $$->type = PT_INTERFACE_CONSTANT_DECLARATION;
+        $$->recount();
     }
 
 _definitely_interface_signal_declaration:
@@ -1732,6 +1744,7 @@ _definitely_interface_signal_declaration:
         $$ = $2;
         $$->boolean = false;
         $$->type = PT_INTERFACE_SIGNAL_DECLARATION;
+        $$->recount();
     }
     | _interface_signal_bus_declaration
     | KW_SIGNAL _interface_signal_bus_declaration {
@@ -1742,6 +1755,7 @@ _definitely_interface_variable_declaration:
     KW_VARIABLE _interface_ambig_obj_declaration {
         $$ = $2;
         $$->type = PT_INTERFACE_VARIABLE_DECLARATION;
+        $$->recount();
     }
 
 // Handles all the cases where there is no explicit type
@@ -1999,9 +2013,8 @@ _function_actual_part:
 association_list:
     association_element
     | association_list ',' association_element {
-        $$ = new VhdlParseTreeNode(PT_ASSOCIATION_LIST);
-        $$->pieces[0] = $1;
-        $$->pieces[1] = $3;
+        $$ = VhdlParseTreeNode::association_append($1, $3,
+            VALUES_ARE_OWNED, to_delete_queue);
     }
 
 association_element:
@@ -2556,10 +2569,12 @@ __attribute_kw_identifier_hack:
     | KW_RANGE {
         $$ = new VhdlParseTreeNode(PT_BASIC_ID);
         $$->str = new std::string("range");
+        $$->recount();
     }
     | KW_SUBTYPE{
         $$ = new VhdlParseTreeNode(PT_BASIC_ID);
         $$->str = new std::string("subtype");
+        $$->recount();
     }
 
 // We need the actual attribute_name for range constraints. This introduces a
@@ -2692,22 +2707,13 @@ expression:
 logical_expression:
     relation
     | logical_expression KW_AND relation {
-        $$ = new VhdlParseTreeNode(PT_BINARY_OPERATOR);
-        $$->op_type = OP_AND;
-        $$->pieces[0] = $1;
-        $$->pieces[1] = $3;
+        $$ = VhdlParseTreeNode::associative_operator(OP_AND, $1, $3);
     }
     | logical_expression KW_OR relation {
-        $$ = new VhdlParseTreeNode(PT_BINARY_OPERATOR);
-        $$->op_type = OP_OR;
-        $$->pieces[0] = $1;
-        $$->pieces[1] = $3;
+        $$ = VhdlParseTreeNode::associative_operator(OP_OR, $1, $3);
     }
     | logical_expression KW_XOR relation {
-        $$ = new VhdlParseTreeNode(PT_BINARY_OPERATOR);
-        $$->op_type = OP_XOR;
-        $$->pieces[0] = $1;
-        $$->pieces[1] = $3;
+        $$ = VhdlParseTreeNode::associative_operator(OP_XOR, $1, $3);
     }
     | relation KW_NAND relation {
         $$ = new VhdlParseTreeNode(PT_BINARY_OPERATOR);
@@ -2858,10 +2864,7 @@ shift_expression:
 simple_expression:
     _term_with_sign
     | simple_expression '+' term {
-        $$ = new VhdlParseTreeNode(PT_BINARY_OPERATOR);
-        $$->op_type = OP_ADD;
-        $$->pieces[0] = $1;
-        $$->pieces[1] = $3;
+        $$ = VhdlParseTreeNode::associative_operator(OP_ADD, $1, $3);
     }
     | simple_expression '-' term {
         $$ = new VhdlParseTreeNode(PT_BINARY_OPERATOR);
@@ -2870,10 +2873,7 @@ simple_expression:
         $$->pieces[1] = $3;
     }
     | simple_expression '&' term {
-        $$ = new VhdlParseTreeNode(PT_BINARY_OPERATOR);
-        $$->op_type = OP_CONCAT;
-        $$->pieces[0] = $1;
-        $$->pieces[1] = $3;
+        $$ = VhdlParseTreeNode::associative_operator(OP_CONCAT, $1, $3);
     }
 
 /// Section 9.2.6
@@ -3007,14 +3007,12 @@ aggregate:
 
 _two_or_more_element_association:
     element_association ',' element_association {
-        $$ = new VhdlParseTreeNode(PT_AGGREGATE);
-        $$->pieces[0] = $1;
-        $$->pieces[1] = $3;
+        $$ = VhdlParseTreeNode::aggregate_append($1, $3, VALUES_ARE_OWNED,
+            to_delete_queue);
     }
     | _two_or_more_element_association ',' element_association {
-        $$ = new VhdlParseTreeNode(PT_AGGREGATE);
-        $$->pieces[0] = $1;
-        $$->pieces[1] = $3;
+        $$ = VhdlParseTreeNode::aggregate_append($1, $3, VALUES_ARE_OWNED,
+            to_delete_queue);
     }
 
 element_association:
@@ -4625,3 +4623,27 @@ string_literal: TOK_STRING
 bit_string_literal: TOK_BITSTRING
 
 %%
+
+// Hands the names of the unexpected token and of the expected ones to the
+// glue. Like parse.error verbose, the expected tokens are only listed if
+// there are at most four of them.
+static int yyreport_syntax_error(const yypcontext_t *ctx, void *scanner,
+    VhdlParseTreeNode **, VhdlParserDiagnostics &diagnostics,
+    std::set<VhdlParseTreeNode *> &, VhdlParserStats *) {
+
+    const char *names[5];
+    int num_names = 0;
+    yysymbol_kind_t token = yypcontext_token(ctx);
+    if (token != YYSYMBOL_YYEMPTY) {
+        names[num_names++] = yysymbol_name(token);
+
+        yysymbol_kind_t expected[4];
+        int num_expected = yypcontext_expected_tokens(ctx, expected, 4);
+        for (int i = 0; i < num_expected; i++) {
+            names[num_names++] = yysymbol_name(expected[i]);
+        }
+    }
+
+    frontend_vhdl_syntax_error(scanner, diagnostics, names, num_names);
+    return 0;
+}
@@ -26,67 +26,518 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #define VHDL_PARSER_IN_GLUE
 #include "vhdl_parser_glue.h"
 
+#include <chrono>
 #include <cstring>
+#include <sstream>
+#include <unordered_set>
+#include <vector>
 
-void frontend_vhdl_yyerror(YYLTYPE *locp, yyscan_t scanner,
-    VhdlParseTreeNode **, std::string &errors, 
-    std::set<VhdlParseTreeNode *> &to_delete_queueconst, const char *msg) {
-    errors += "Error ";
-    errors += msg;
-    errors += " on line ";
-    errors += std::to_string(frontend_vhdl_yyget_lineno(scanner));
-    errors += "\n";
+#include <sys/resource.h>
+
+void VhdlParserDiagnostics::clear() {
+    has_errors = false;
+    diagnostics.clear();
+    arg_offsets.clear();
+    arg_text.clear();
 }
 
-VhdlParseTreeNode *VhdlParserParseFile(
-    const char *fn, char **errors) {
-    yyscan_t myscanner;
-    VhdlParseTreeNode *parse_output = nullptr;
+void VhdlParserDiagnostics::add(VhdlDiagnosticSeverity severity,
+    VhdlDiagnosticCode code, VhdlDiagnosticMessage message, int line,
+    long first_byte, long last_byte) {
+
+    VhdlDiagnostic diag;
+    diag.severity = severity;
+    diag.code = code;
+    diag.message = message;
+    diag.file_id = file_id;
+    diag.line = line;
+    diag.first_byte = first_byte;
+    diag.last_byte = last_byte;
+    diag.first_arg = arg_offsets.size();
+    diag.num_args = 0;
+    diagnostics.push_back(diag);
+
+    if (severity == DIAG_ERROR) {
+        has_errors = true;
+    }
+}
+
+void VhdlParserDiagnostics::add_arg(const char *arg, size_t len) {
+    arg_offsets.push_back(arg_text.size());
+    arg_text.append(arg, len);
+    arg_text.push_back('\0');
+    diagnostics.back().num_args++;
+}
 
-    std::string errors_cpp;
+void VhdlParserDiagnostics::get_list(VhdlDiagnosticList *list) {
+    list->diagnostics = diagnostics.data();
+    list->num_diagnostics = diagnostics.size();
+    list->arg_text = arg_text.data();
+    list->arg_offsets = arg_offsets.data();
+}
+
+// Everything that can be kept from one parse to the next
+struct VhdlParserSession {
+    yyscan_t scanner;
+    VhdlParserDiagnostics diagnostics;
     std::set<VhdlParseTreeNode *> to_delete_queue;
+    bool intern;
+    VhdlParseTreeInterner interner;
+    // Null if stats are turned off
+    VhdlParserStats *stats;
+    // Null if memory accounting is turned off
+    VhdlParseTreeMemoryStats *memory_stats;
+    // The text being parsed, followed by the two NULs that flex wants at the
+    // end of a buffer it scans in place. Kept so that its memory is reused.
+    std::vector<char> input;
+};
 
-    FILE *f = fopen(fn, "rb");
-    if (!f) {
-        errors_cpp += "Error opening file \"";
-        errors_cpp += fn;
-        errors_cpp += "\"\n";
-        *errors = strdup(errors_cpp.c_str());
+// The byte span of the scanner's current token within session->input, or -1
+// if there is none (e.g. at the end of the input). flex scans the input in
+// place, so yytext points into it.
+static void token_bytes(yyscan_t scanner, long &first_byte,
+    long &last_byte) {
+    VhdlParserSession *session =
+        (VhdlParserSession *)frontend_vhdl_yyget_extra(scanner);
+    const char *text = frontend_vhdl_yyget_text(scanner);
+    long leng = frontend_vhdl_yyget_leng(scanner);
+
+    first_byte = last_byte = -1;
+    // Scanners made outside of a session (e.g. by microbench) have no extra
+    if (!session || !text || leng <= 0) {
+        return;
+    }
+    // Not counting the two NULs at the end
+    long input_len = session->input.size() - 2;
+    long offset = text - session->input.data();
+    if (offset < 0 || offset >= input_len) {
+        return;
+    }
+    first_byte = offset;
+    last_byte = offset + leng - 1;
+}
+
+void frontend_vhdl_syntax_error(yyscan_t scanner,
+    VhdlParserDiagnostics &diagnostics, const char *const *names,
+    int num_names) {
+    long first_byte, last_byte;
+    token_bytes(scanner, first_byte, last_byte);
+    diagnostics.add(DIAG_ERROR, DIAG_SYNTAX, MSG_SYNTAX_ERROR,
+        frontend_vhdl_yyget_lineno(scanner), first_byte, last_byte);
+    for (int i = 0; i < num_names; i++) {
+        diagnostics.add_arg(names[i], strlen(names[i]));
+    }
+}
+
+// Syntax errors go through frontend_vhdl_syntax_error, so all that is left
+// are the two fixed messages that the GLR parser passes here
+void frontend_vhdl_yyerror(YYLTYPE *, yyscan_t scanner,
+    VhdlParseTreeNode **, VhdlParserDiagnostics &diagnostics,
+    std::set<VhdlParseTreeNode *> &, VhdlParserStats *, const char *msg) {
+    int line = frontend_vhdl_yyget_lineno(scanner);
+    long first_byte, last_byte;
+    token_bytes(scanner, first_byte, last_byte);
+
+    if (strcmp(msg, "syntax is ambiguous") == 0) {
+        diagnostics.add(DIAG_ERROR, DIAG_SYNTAX, MSG_SYNTAX_AMBIGUOUS, line,
+            first_byte, last_byte);
+    } else if (strcmp(msg, "memory exhausted") == 0) {
+        diagnostics.add(DIAG_ERROR, DIAG_PARSER_LIMIT, MSG_MEMORY_EXHAUSTED,
+            line, first_byte, last_byte);
+    } else {
+        diagnostics.add(DIAG_ERROR, DIAG_PARSER_LIMIT,
+            MSG_OTHER_PARSER_ERROR, line, first_byte, last_byte);
+        diagnostics.add_arg(msg, strlen(msg));
+    }
+}
+
+// The messages the lexer passes to frontend_vhdl_yyerror
+static const struct {
+    const char *text;
+    VhdlDiagnosticMessage message;
+} lexer_messages[] = {
+    {"Illegal newline in extended identifier", MSG_NEWLINE_IN_EXT_ID},
+    {"Illegal extended identifier contents", MSG_BAD_EXT_ID_CONTENTS},
+    {"Illegal newline in string", MSG_NEWLINE_IN_STRING},
+    {"Illegal string contents", MSG_BAD_STRING_CONTENTS},
+};
+
+void frontend_vhdl_yyerror(YYLTYPE *, yyscan_t scanner,
+    VhdlParseTreeNode **, VhdlParserDiagnostics &diagnostics,
+    std::set<VhdlParseTreeNode *> &, const char *msg) {
+    long first_byte, last_byte;
+    token_bytes(scanner, first_byte, last_byte);
+
+    for (size_t i = 0; i < sizeof(lexer_messages) / sizeof(lexer_messages[0]);
+        i++) {
+        if (strcmp(msg, lexer_messages[i].text) == 0) {
+            diagnostics.add(DIAG_ERROR, DIAG_LEXICAL,
+                lexer_messages[i].message,
+                frontend_vhdl_yyget_lineno(scanner), first_byte, last_byte);
+            return;
+        }
+    }
+
+    // Not one of the lexer's messages
+    diagnostics.add(DIAG_ERROR, DIAG_LEXICAL, MSG_OTHER_PARSER_ERROR,
+        frontend_vhdl_yyget_lineno(scanner), first_byte, last_byte);
+    diagnostics.add_arg(msg, strlen(msg));
+}
+
+static unsigned long long elapsed_ns(
+    std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - start).count();
+}
+
+int frontend_vhdl_yylex_counted(YYSTYPE *yylval_param,
+    YYLTYPE *yylloc_param, yyscan_t yyscanner,
+    VhdlParserDiagnostics &diagnostics,
+    std::set<VhdlParseTreeNode *> &to_delete_queue, VhdlParserStats *stats) {
+
+    // The lexer fills in the strings after creating a node, so the node
+    // gets counted again once it is finished. yylval was cleared by
+    // frontend_vhdl_yylex, so this is null for tokens without a value.
+    auto start = std::chrono::steady_clock::now();
+    int ret = frontend_vhdl_scan(yylval_param, yylloc_param, yyscanner,
+        diagnostics, to_delete_queue);
+    stats->lex_ns += elapsed_ns(start);
+    stats->tokens++;
+    if (*yylval_param) {
+        (*yylval_param)->recount();
+    }
+    return ret;
+}
+
+// Frees the values that the parser discarded. When the GLR parser gives up
+// on a stack (or on the whole parse), the values it throws away can share
+// nodes with each other (and, in principle, with the final tree), so the
+// nodes are collected first and each one is freed exactly once.
+static void free_discarded_nodes(std::set<VhdlParseTreeNode *> &discarded,
+    VhdlParseTreeNode *parse_output) {
+    if (discarded.empty()) {
+        return;
+    }
+
+    std::unordered_set<VhdlParseTreeNode *> keep;
+    std::vector<VhdlParseTreeNode *> stack;
+    if (parse_output) {
+        stack.push_back(parse_output);
+    }
+    while (!stack.empty()) {
+        VhdlParseTreeNode *x = stack.back();
+        stack.pop_back();
+        if (!keep.insert(x).second) {
+            continue;
+        }
+        for (int i = 0; i < NUM_FIXED_PIECES; i++) {
+            if (x->pieces[i]) {
+                stack.push_back(x->pieces[i]);
+            }
+        }
+    }
+
+    std::unordered_set<VhdlParseTreeNode *> to_free;
+    stack.assign(discarded.begin(), discarded.end());
+    while (!stack.empty()) {
+        VhdlParseTreeNode *x = stack.back();
+        stack.pop_back();
+        if (keep.count(x) || !to_free.insert(x).second) {
+            continue;
+        }
+        for (int i = 0; i < NUM_FIXED_PIECES; i++) {
+            if (x->pieces[i]) {
+                stack.push_back(x->pieces[i]);
+            }
+        }
+    }
+
+    VhdlParseTreeMemoryStats *memory_stats = VhdlParseTreeNode::memory_stats;
+    for (auto x = to_free.begin(); x != to_free.end(); x++) {
+        if (memory_stats && (*x)->accounted_bytes) {
+            memory_stats->discarded_nodes[(*x)->accounted_type]++;
+            memory_stats->discarded_bytes[(*x)->accounted_type] +=
+                (*x)->accounted_bytes;
+            (*x)->unaccount_memory();
+        }
+        delete (*x)->str;
+        delete (*x)->str2;
+        delete *x;
+    }
+}
+
+VhdlParserSession *VhdlParserNewSession(bool intern) {
+    VhdlParserSession *session = new VhdlParserSession;
+    // yyextra lets diagnostics find the input that the scanner's text points
+    // into
+    if (frontend_vhdl_yylex_init_extra(session, &session->scanner) != 0) {
+        delete session;
         return nullptr;
     }
+    session->intern = intern;
+    session->stats = nullptr;
+    session->memory_stats = nullptr;
+    session->diagnostics.clear();
+    return session;
+}
 
-    int ret = frontend_vhdl_yylex_init(&myscanner);
-    if (ret != 0) {
-        errors_cpp += "yylex_init error!\n";
-        *errors = strdup(errors_cpp.c_str());
+void VhdlParserFreeSession(VhdlParserSession *session) {
+    frontend_vhdl_yylex_destroy(session->scanner);
+    delete session->stats;
+    delete session->memory_stats;
+    delete session;
+}
+
+void VhdlParserSessionInternStats(VhdlParserSession *session,
+    YaVHDL::Parser::VhdlParseTreeInternStats *stats) {
+    *stats = session->interner.stats;
+}
+
+void VhdlParserSessionEnableStats(VhdlParserSession *session) {
+    if (!session->stats) {
+        session->stats = new VhdlParserStats();
+    }
+}
+
+void VhdlParserSessionStats(VhdlParserSession *session,
+    VhdlParserStats *stats) {
+    if (session->stats) {
+        *stats = *session->stats;
+    } else {
+        *stats = VhdlParserStats();
+    }
+}
+
+void VhdlParserSessionEnableMemoryStats(VhdlParserSession *session) {
+    if (!session->memory_stats) {
+        session->memory_stats = new VhdlParseTreeMemoryStats();
+    }
+}
+
+void VhdlParserSessionMemoryStats(VhdlParserSession *session,
+    VhdlParseTreeMemoryStats *stats) {
+    if (session->memory_stats) {
+        *stats = *session->memory_stats;
+    } else {
+        *stats = VhdlParseTreeMemoryStats();
+    }
+}
+
+const char *VhdlParserNodeTypeName(int type) {
+    if (type < 0 || type >= NUM_PARSE_TREE_NODE_TYPES) {
         return nullptr;
     }
+    return VhdlParseTreeNode::type_name((enum ParseTreeNodeType)type);
+}
+
+unsigned long long VhdlParserPeakRSS() {
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) {
+        return 0;
+    }
+    // Linux reports this in kilobytes
+    return (unsigned long long)usage.ru_maxrss * 1024;
+}
+
+void VhdlParserSessionDiagnostics(VhdlParserSession *session,
+    VhdlDiagnosticList *list) {
+    session->diagnostics.get_list(list);
+}
+
+// Stops counting the nodes of a finished tree. They are freed outside of the
+// parse (or kept by the interner), so the memory accounting lets go of them
+// here and only counts what is live while parsing. Nodes that have already
+// been let go of (and so everything under them) are skipped.
+static void hand_off_nodes(VhdlParseTreeNode *pt) {
+    std::vector<VhdlParseTreeNode *> stack;
+    stack.push_back(pt);
+    while (!stack.empty()) {
+        VhdlParseTreeNode *x = stack.back();
+        stack.pop_back();
+        if (!x->accounted_bytes) {
+            continue;
+        }
+        x->unaccount_memory();
+        for (int i = 0; i < NUM_FIXED_PIECES; i++) {
+            if (x->pieces[i]) {
+                stack.push_back(x->pieces[i]);
+            }
+        }
+    }
+}
+
+// Runs the parser on the session's scanner, whose input has already been set
+// up
+static VhdlParseTreeNode *run_parser(VhdlParserSession *session) {
+    VhdlParseTreeNode *parse_output = nullptr;
+    VhdlParserStats *stats = session->stats;
+
+    // The lexer only needs to do anything extra if it is given stats. With
+    // just memory stats on, those are thrown away.
+    VhdlParserStats unused_stats;
+    VhdlParserStats *lex_stats = stats;
+    if (!lex_stats && session->memory_stats) {
+        lex_stats = &unused_stats;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    unsigned long long lex_ns_before = stats ? stats->lex_ns : 0;
+    int ret = frontend_vhdl_yyparse(session->scanner, &parse_output,
+        session->diagnostics, session->to_delete_queue, lex_stats);
+    if (stats) {
+        stats->parse_ns += elapsed_ns(start) - (stats->lex_ns - lex_ns_before);
+        start = std::chrono::steady_clock::now();
+    }
 
-    frontend_vhdl_yyset_in(f, myscanner);
-    ret = frontend_vhdl_yyparse(myscanner, &parse_output, errors_cpp,
-        to_delete_queue);
-    frontend_vhdl_yylex_destroy(myscanner);
-    for (auto x = to_delete_queue.begin(); x != to_delete_queue.end(); x++) {
-        (*x)->delete_self();
+    free_discarded_nodes(session->to_delete_queue,
+        ret == 0 ? parse_output : nullptr);
+    session->to_delete_queue.clear();
+    if (stats) {
+        stats->cleanup_ns += elapsed_ns(start);
     }
-    fclose(f);
 
     if (ret != 0) {
-        errors_cpp += "Parse error!\n";
-        *errors = strdup(errors_cpp.c_str());
+        session->diagnostics.add(DIAG_ERROR, DIAG_SYNTAX, MSG_PARSE_FAILED,
+            frontend_vhdl_yyget_lineno(session->scanner), -1, -1);
         return nullptr;
     }
 
-    *errors = strdup(errors_cpp.c_str());
+    if (stats) {
+        parse_output->count_nodes(stats->nodes_by_type, stats->tree_bytes);
+        stats->nodes = 0;
+        for (int i = 0; i < NUM_PARSE_TREE_NODE_TYPES; i++) {
+            stats->nodes += stats->nodes_by_type[i];
+        }
+    }
+
+    if (session->intern) {
+        parse_output = session->interner.intern(parse_output);
+    }
+
+    return parse_output;
+}
+
+// Same as run_parser, but with the session's memory accounting (if any)
+// turned on
+static VhdlParseTreeNode *run_parser_accounted(VhdlParserSession *session) {
+    if (!session->memory_stats) {
+        return run_parser(session);
+    }
+
+    VhdlParseTreeNode::memory_stats = session->memory_stats;
+    VhdlParseTreeNode *parse_output = run_parser(session);
+    if (parse_output) {
+        hand_off_nodes(parse_output);
+    }
+    VhdlParseTreeNode::memory_stats = nullptr;
+    return parse_output;
+}
+
+// Parses session->input, which flex scans in place. first_line and
+// first_column are where the input starts.
+static VhdlParseTreeNode *parse_input(VhdlParserSession *session,
+    int first_line, int first_column) {
+    // A parse can stop in the middle of a comment or a string, so the
+    // scanner's start condition is put back before it is reused
+    frontend_vhdl_yyreset_state(session->scanner);
+    YY_BUFFER_STATE flex_buf = frontend_vhdl_yy_scan_buffer(
+        session->input.data(), session->input.size(), session->scanner);
+    // The lexer counts columns from 0
+    frontend_vhdl_yyset_lineno(first_line, session->scanner);
+    frontend_vhdl_yyset_column(first_column - 1, session->scanner);
+
+    VhdlParseTreeNode *parse_output = run_parser_accounted(session);
+
+    // Only the buffer's bookkeeping goes, the input is ours
+    frontend_vhdl_yy_delete_buffer(flex_buf, session->scanner);
     return parse_output;
 }
 
+VhdlParseTreeNode *VhdlParserSessionParseFile(VhdlParserSession *session,
+    const char *fn, int file_id) {
+    session->diagnostics.clear();
+    session->diagnostics.file_id = file_id;
+
+    // The whole file is read in first, so the scanner never holds on to
+    // the FILE
+    std::vector<char> &input = session->input;
+    input.clear();
+    FILE *f = fopen(fn, "rb");
+    bool read_ok = f != nullptr;
+    while (read_ok) {
+        size_t len = input.size();
+        input.resize(len + 65536);
+        size_t got = fread(input.data() + len, 1, 65536, f);
+        input.resize(len + got);
+        if (got < 65536) {
+            read_ok = !ferror(f);
+            break;
+        }
+    }
+    if (f) {
+        fclose(f);
+    }
+    if (!read_ok) {
+        session->diagnostics.add(DIAG_ERROR, DIAG_IO, MSG_CANNOT_OPEN_FILE,
+            0, -1, -1);
+        session->diagnostics.add_arg(fn, strlen(fn));
+        return nullptr;
+    }
+
+    input.push_back('\0');
+    input.push_back('\0');
+    return parse_input(session, 1, 1);
+}
+
+VhdlParseTreeNode *VhdlParserSessionParseBuffer(VhdlParserSession *session,
+    const char *buf, size_t len, int file_id, int first_line,
+    int first_column) {
+    session->diagnostics.clear();
+    session->diagnostics.file_id = file_id;
+
+    session->input.assign(buf, buf + len);
+    session->input.push_back('\0');
+    session->input.push_back('\0');
+    // Allows parsing a piece of a larger file with correct locations
+    return parse_input(session, first_line, first_column);
+}
+
+YaVHDL::Parser::VhdlParseTreeNode *VhdlParserDetachPiece(
+    YaVHDL::Parser::VhdlParseTreeNode *pt, int i) {
+    VhdlParseTreeNode *ret = pt->pieces[i];
+    pt->pieces[i] = nullptr;
+    return ret;
+}
+
+void VhdlParserShiftLines(YaVHDL::Parser::VhdlParseTreeNode *pt, int delta) {
+    pt->shift_lines(delta);
+}
+
+YaVHDL::Parser::VhdlParseTreeNode *VhdlParserInternPT(
+    YaVHDL::Parser::VhdlParseTreeNode *pt,
+    YaVHDL::Parser::VhdlParseTreeInternStats *stats) {
+    VhdlParseTreeInterner interner;
+    VhdlParseTreeNode *ret = interner.intern(pt);
+    *stats = interner.stats;
+    return ret;
+}
+
+YaVHDL::Parser::VhdlParseTreeNode *VhdlParserExpandLiteralAggregate(
+    YaVHDL::Parser::VhdlParseTreeNode *pt) {
+    return pt->expand_literal_aggregate();
+}
+
+YaVHDL::Parser::VhdlParseTreeNode *VhdlParserExpandSimpleAssociations(
+    YaVHDL::Parser::VhdlParseTreeNode *pt) {
+    return pt->expand_simple_associations();
+}
+
 void VhdlParserFreePT(YaVHDL::Parser::VhdlParseTreeNode *pt) {
     pt->delete_self();
 }
 
-void VhdlParserFreeString(char *errors) {
-    free(errors);
+void VhdlParserFreeString(char *str) {
+    free(str);
 }
 
 char *VhdlParserCifyString(std::string *str) {
@@ -96,3 +547,31 @@ char *VhdlParserCifyString(std::string *str) {
 void VhdlParseTreeNodeDebugPrint(YaVHDL::Parser::VhdlParseTreeNode *pt) {
     pt->debug_print();
 }
+
+char *VhdlParserSerializePT(YaVHDL::Parser::VhdlParseTreeNode *pt,
+    size_t *len) {
+    std::string out;
+    pt->serialize(out);
+
+    char *ret = (char *)malloc(out.length());
+    memcpy(ret, out.data(), out.length());
+    *len = out.length();
+    return ret;
+}
+
+char *VhdlParserDebugPrintPT(YaVHDL::Parser::VhdlParseTreeNode *pt,
+    size_t *len) {
+    std::ostringstream out;
+    pt->debug_print(out);
+    std::string text = out.str();
+
+    char *ret = (char *)malloc(text.length());
+    memcpy(ret, text.data(), text.length());
+    *len = text.length();
+    return ret;
+}
+
+YaVHDL::Parser::VhdlParseTreeNode *VhdlParserDeserializePT(
+    const char *buf, size_t len) {
+    return VhdlParseTreeNode::deserialize(buf, len);
+}
@@ -32,27 +32,220 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #ifndef RUNNING_RUST_BINDGEN
 #include <set>
 #include <string>
+#include <vector>
 #endif
 
+#include <stddef.h>
+
 #include "vhdl_parse_tree.h"
 
+// A session holds the scanner, buffers and (optionally) the table of shared
+// subtrees so that they can be reused for many parses. Each parse still
+// starts from a clean state. Trees may outlive the session they came from.
+struct VhdlParserSession;
+
+// Problems found while parsing. These are stored without being formatted so
+// that tools can count, filter and sort them cheaply. The message text (if
+// wanted) is built from the message template and its arguments.
+enum VhdlDiagnosticSeverity {
+    DIAG_ERROR,
+    DIAG_WARNING,
+};
+
+enum VhdlDiagnosticCode {
+    // The parser could not make sense of the tokens
+    DIAG_SYNTAX,
+    // Malformed token
+    DIAG_LEXICAL,
+    // Could not read the input
+    DIAG_IO,
+    // The parser itself gave up (e.g. out of memory)
+    DIAG_PARSER_LIMIT,
+};
+
+enum VhdlDiagnosticMessage {
+    // "syntax error, unexpected %0, expecting %1 or %2 or ...". The
+    // "unexpected" and "expecting" parts are left out if there are not
+    // enough arguments.
+    MSG_SYNTAX_ERROR,
+    MSG_SYNTAX_AMBIGUOUS,
+    MSG_MEMORY_EXHAUSTED,
+    // Any other message from the parser, as %0
+    MSG_OTHER_PARSER_ERROR,
+    MSG_NEWLINE_IN_EXT_ID,
+    MSG_BAD_EXT_ID_CONTENTS,
+    MSG_NEWLINE_IN_STRING,
+    MSG_BAD_STRING_CONTENTS,
+    // Summary added after everything else when the parse failed
+    MSG_PARSE_FAILED,
+    // "Error opening file "%0""
+    MSG_CANNOT_OPEN_FILE,
+};
+
+struct VhdlDiagnostic {
+    enum VhdlDiagnosticSeverity severity;
+    enum VhdlDiagnosticCode code;
+    enum VhdlDiagnosticMessage message;
+    // Whatever the caller passed in when starting the parse
+    int file_id;
+    // Line the lexer was on when the problem was found
+    int line;
+    // Bytes of the offending token (inclusive), counted from the start of
+    // the text that was parsed. Both are -1 if there is no token.
+    long first_byte;
+    long last_byte;
+    // Arguments are VhdlDiagnosticList::arg_offsets[first_arg] onwards
+    int first_arg;
+    int num_args;
+};
+
+// Diagnostics from the last parse in a session. Owned by the session and
+// only valid until the next parse.
+struct VhdlDiagnosticList {
+    const struct VhdlDiagnostic *diagnostics;
+    size_t num_diagnostics;
+    // Each argument is a NUL-terminated string at arg_text + offset
+    const char *arg_text;
+    const size_t *arg_offsets;
+};
+
+// Where the time goes in a session with stats turned on. Everything adds up
+// over all of the session's parses. Times are in nanoseconds. Parse time
+// does not include lexing, which happens inside the parser.
+struct VhdlParserStats {
+    unsigned long long lex_ns;
+    unsigned long long parse_ns;
+    // Freeing what the GLR parser threw away
+    unsigned long long cleanup_ns;
+    unsigned long long tokens;
+    // Nodes and their sizes (see VhdlParseTreeInternStats) in the trees that
+    // were returned, before any interning
+    unsigned long long nodes;
+    unsigned long long tree_bytes;
+    unsigned long long nodes_by_type[NUM_PARSE_TREE_NODE_TYPES];
+};
+
+#ifndef RUNNING_RUST_BINDGEN
+// Collects diagnostics during a parse. Arguments are appended to one buffer
+// so that adding a diagnostic does not allocate once the buffers have grown.
+class VhdlParserDiagnostics {
+public:
+    void clear();
+    // The last two are the offending token's byte span, or -1 if none
+    void add(VhdlDiagnosticSeverity severity, VhdlDiagnosticCode code,
+        VhdlDiagnosticMessage message, int line, long first_byte,
+        long last_byte);
+    // Adds an argument to the most recently added diagnostic
+    void add_arg(const char *arg, size_t len);
+    void get_list(VhdlDiagnosticList *list);
+
+    int file_id;
+    bool has_errors;
+    std::vector<VhdlDiagnostic> diagnostics;
+    std::vector<size_t> arg_offsets;
+    std::string arg_text;
+};
+#endif
+
 // Main wrapper for low-level parser function. Memory needs to be freed using
 // the below functions (present just to ensure we have a pure C interface).
 #ifndef RUNNING_RUST_BINDGEN
-extern "C" YaVHDL::Parser::VhdlParseTreeNode *VhdlParserParseFile(
-    const char *fn, char **errors);
+// If intern is set, identical location-free subtrees are shared between all
+// the trees parsed by the session (see VhdlParseTreeInterner)
+extern "C" VhdlParserSession *VhdlParserNewSession(bool intern);
+extern "C" void VhdlParserFreeSession(VhdlParserSession *session);
+// These return nullptr if the parse failed. Either way, the diagnostics can
+// be fetched afterwards with VhdlParserSessionDiagnostics.
+extern "C" YaVHDL::Parser::VhdlParseTreeNode *VhdlParserSessionParseFile(
+    VhdlParserSession *session, const char *fn, int file_id);
+extern "C" YaVHDL::Parser::VhdlParseTreeNode *VhdlParserSessionParseBuffer(
+    VhdlParserSession *session, const char *buf, size_t len, int file_id,
+    int first_line, int first_column);
+extern "C" void VhdlParserSessionDiagnostics(VhdlParserSession *session,
+    VhdlDiagnosticList *list);
+extern "C" void VhdlParserSessionInternStats(VhdlParserSession *session,
+    YaVHDL::Parser::VhdlParseTreeInternStats *stats);
+// Stats are off by default because they need a clock read for every token
+extern "C" void VhdlParserSessionEnableStats(VhdlParserSession *session);
+extern "C" void VhdlParserSessionStats(VhdlParserSession *session,
+    VhdlParserStats *stats);
+// Memory accounting by node type, summed over every parse in the session.
+// This is off by default because it runs on every node allocation.
+extern "C" void VhdlParserSessionEnableMemoryStats(
+    VhdlParserSession *session);
+extern "C" void VhdlParserSessionMemoryStats(VhdlParserSession *session,
+    YaVHDL::Parser::VhdlParseTreeMemoryStats *stats);
+extern "C" const char *VhdlParserNodeTypeName(int type);
+// Largest resident set size of the process so far, in bytes
+extern "C" unsigned long long VhdlParserPeakRSS();
+// Removes a piece from a node and returns it so that it can be owned (and
+// freed) separately
+extern "C" YaVHDL::Parser::VhdlParseTreeNode *VhdlParserDetachPiece(
+    YaVHDL::Parser::VhdlParseTreeNode *pt, int i);
+extern "C" void VhdlParserShiftLines(
+    YaVHDL::Parser::VhdlParseTreeNode *pt, int delta);
+// Shares identical subtrees within a tree (see VhdlParseTreeInterner).
+// Returns the new root, which is still freed with VhdlParserFreePT.
+extern "C" YaVHDL::Parser::VhdlParseTreeNode *VhdlParserInternPT(
+    YaVHDL::Parser::VhdlParseTreeNode *pt,
+    YaVHDL::Parser::VhdlParseTreeInternStats *stats);
+// Returns a new tree that must be freed separately
+extern "C" YaVHDL::Parser::VhdlParseTreeNode *VhdlParserExpandLiteralAggregate(
+    YaVHDL::Parser::VhdlParseTreeNode *pt);
+extern "C" YaVHDL::Parser::VhdlParseTreeNode *
+    VhdlParserExpandSimpleAssociations(YaVHDL::Parser::VhdlParseTreeNode *pt);
 extern "C" void VhdlParserFreePT(YaVHDL::Parser::VhdlParseTreeNode *pt);
-extern "C" void VhdlParserFreeString(char *errors);
+extern "C" void VhdlParserFreeString(char *str);
 extern "C" char *VhdlParserCifyString(std::string *str);
 extern "C" void VhdlParseTreeNodeDebugPrint(
     YaVHDL::Parser::VhdlParseTreeNode *pt);
+// Serialized trees are malloc'd and can be freed with VhdlParserFreeString
+extern "C" char *VhdlParserSerializePT(
+    YaVHDL::Parser::VhdlParseTreeNode *pt, size_t *len);
+// Same text as VhdlParseTreeNodeDebugPrint, also freed with
+// VhdlParserFreeString
+extern "C" char *VhdlParserDebugPrintPT(
+    YaVHDL::Parser::VhdlParseTreeNode *pt, size_t *len);
+extern "C" YaVHDL::Parser::VhdlParseTreeNode *VhdlParserDeserializePT(
+    const char *buf, size_t len);
 #else
-extern "C" VhdlParseTreeNode *VhdlParserParseFile(
-    const char *fn, char **errors);
+extern "C" VhdlParserSession *VhdlParserNewSession(bool intern);
+extern "C" void VhdlParserFreeSession(VhdlParserSession *session);
+extern "C" VhdlParseTreeNode *VhdlParserSessionParseFile(
+    VhdlParserSession *session, const char *fn, int file_id);
+extern "C" VhdlParseTreeNode *VhdlParserSessionParseBuffer(
+    VhdlParserSession *session, const char *buf, size_t len, int file_id,
+    int first_line, int first_column);
+extern "C" void VhdlParserSessionDiagnostics(VhdlParserSession *session,
+    VhdlDiagnosticList *list);
+extern "C" void VhdlParserSessionInternStats(VhdlParserSession *session,
+    VhdlParseTreeInternStats *stats);
+extern "C" void VhdlParserSessionEnableStats(VhdlParserSession *session);
+extern "C" void VhdlParserSessionStats(VhdlParserSession *session,
+    VhdlParserStats *stats);
+extern "C" void VhdlParserSessionEnableMemoryStats(
+    VhdlParserSession *session);
+extern "C" void VhdlParserSessionMemoryStats(VhdlParserSession *session,
+    VhdlParseTreeMemoryStats *stats);
+extern "C" const char *VhdlParserNodeTypeName(int type);
+extern "C" unsigned long long VhdlParserPeakRSS();
+extern "C" VhdlParseTreeNode *VhdlParserDetachPiece(
+    VhdlParseTreeNode *pt, int i);
+extern "C" void VhdlParserShiftLines(VhdlParseTreeNode *pt, int delta);
+extern "C" VhdlParseTreeNode *VhdlParserInternPT(
+    VhdlParseTreeNode *pt, VhdlParseTreeInternStats *stats);
+extern "C" VhdlParseTreeNode *VhdlParserExpandLiteralAggregate(
+    VhdlParseTreeNode *pt);
+extern "C" VhdlParseTreeNode *VhdlParserExpandSimpleAssociations(
+    VhdlParseTreeNode *pt);
 extern "C" void VhdlParserFreePT(VhdlParseTreeNode *pt);
-extern "C" void VhdlParserFreeString(char *errors);
+extern "C" void VhdlParserFreeString(char *str);
 extern "C" char *VhdlParserCifyString(void *str);
 extern "C" void VhdlParseTreeNodeDebugPrint(VhdlParseTreeNode *pt);
+extern "C" char *VhdlParserSerializePT(VhdlParseTreeNode *pt, size_t *len);
+extern "C" char *VhdlParserDebugPrintPT(VhdlParseTreeNode *pt, size_t *len);
+extern "C" VhdlParseTreeNode *VhdlParserDeserializePT(
+    const char *buf, size_t len);
 #endif
 
 #ifndef RUNNING_RUST_BINDGEN
@@ -60,36 +253,93 @@ extern "C" void VhdlParseTreeNodeDebugPrint(VhdlParseTreeNode *pt);
 // to talk to each other correctly.
 #if defined(VHDL_PARSER_IN_LEXER) || \
     defined(VHDL_PARSER_IN_BISON) || \
-    defined(VHDL_PARSER_IN_GLUE)
+    defined(VHDL_PARSER_IN_GLUE) || \
+    defined(VHDL_PARSER_IN_MICROBENCH)
 using namespace YaVHDL::Parser;
 #endif
 
+// The parser calls frontend_vhdl_yylex below, which times the actual lexer if
+// needed
 #if defined(VHDL_PARSER_IN_LEXER)
-#define YY_DECL int frontend_vhdl_yylex \
+#define YY_DECL int frontend_vhdl_scan \
     (YYSTYPE * yylval_param, YYLTYPE * yylloc_param , yyscan_t yyscanner, \
-     std::string &errors, std::set<VhdlParseTreeNode *> &to_delete_queue)
+     VhdlParserDiagnostics &errors, \
+     std::set<VhdlParseTreeNode *> &to_delete_queue)
 
 #include "vhdl_parser_yy.hpp"
 #endif
 
 #if defined(VHDL_PARSER_IN_BISON) || \
-    defined(VHDL_PARSER_IN_GLUE)
+    defined(VHDL_PARSER_IN_GLUE) || \
+    defined(VHDL_PARSER_IN_MICROBENCH)
 #include "vhdl_parser_yy.hpp"
 #include "lex.frontend_vhdl_yy.h"
 #endif
 
-#if defined(VHDL_PARSER_IN_BISON)
-int frontend_vhdl_yylex
+#if defined(VHDL_PARSER_IN_BISON) || \
+    defined(VHDL_PARSER_IN_GLUE) || \
+    defined(VHDL_PARSER_IN_MICROBENCH)
+int frontend_vhdl_scan
+    (YYSTYPE * yylval_param, YYLTYPE * yylloc_param , yyscan_t yyscanner,
+     VhdlParserDiagnostics &diagnostics,
+     std::set<VhdlParseTreeNode *> &to_delete_queue);
+#endif
+
+#if defined(VHDL_PARSER_IN_BISON) || \
+    defined(VHDL_PARSER_IN_GLUE)
+// Times the scanner and counts its node, for when stats or memory stats are
+// on
+int frontend_vhdl_yylex_counted
+    (YYSTYPE * yylval_param, YYLTYPE * yylloc_param , yyscan_t yyscanner,
+     VhdlParserDiagnostics &diagnostics,
+     std::set<VhdlParseTreeNode *> &to_delete_queue, VhdlParserStats *stats);
+
+// stats is null unless stats or memory stats are on (see run_parser), so that
+// otherwise the only cost per token is this check.
+// Tokens without a value (such as '(') leave yylval alone, and the parser
+// destroys it along with the token if it has to discard one. It is cleared
+// first so that it can't still point to an earlier token's value, which
+// grammar actions may have freed by then.
+static inline int frontend_vhdl_yylex
     (YYSTYPE * yylval_param, YYLTYPE * yylloc_param , yyscan_t yyscanner,
-     std::string &errors, std::set<VhdlParseTreeNode *> &to_delete_queue);
+     VhdlParserDiagnostics &diagnostics,
+     std::set<VhdlParseTreeNode *> &to_delete_queue, VhdlParserStats *stats) {
+    *yylval_param = nullptr;
+    if (!stats) {
+        return frontend_vhdl_scan(yylval_param, yylloc_param, yyscanner,
+            diagnostics, to_delete_queue);
+    }
+    return frontend_vhdl_yylex_counted(yylval_param, yylloc_param, yyscanner,
+        diagnostics, to_delete_queue, stats);
+}
 #endif
 
 #if defined(VHDL_PARSER_IN_LEXER) || \
-    defined(VHDL_PARSER_IN_BISON) || \
+    defined(VHDL_PARSER_IN_GLUE) || \
+    defined(VHDL_PARSER_IN_MICROBENCH)
+void frontend_vhdl_yyreset_state(yyscan_t yyscanner);
+#endif
+
+// Errors found by the lexer. msg is one of the lexer's own messages.
+#if defined(VHDL_PARSER_IN_LEXER) || \
+    defined(VHDL_PARSER_IN_GLUE)
+void frontend_vhdl_yyerror(YYLTYPE *locp, yyscan_t scanner,
+    VhdlParseTreeNode **, VhdlParserDiagnostics &diagnostics,
+    std::set<VhdlParseTreeNode *> &to_delete_queue, const char *msg);
+#endif
+
+#if defined(VHDL_PARSER_IN_BISON) || \
     defined(VHDL_PARSER_IN_GLUE)
+// Syntax errors. names are the unexpected token followed by the expected
+// ones, as the arguments of MSG_SYNTAX_ERROR.
+void frontend_vhdl_syntax_error(yyscan_t scanner,
+    VhdlParserDiagnostics &diagnostics, const char *const *names,
+    int num_names);
+// Everything else the parser reports
 void frontend_vhdl_yyerror(YYLTYPE *locp, yyscan_t scanner,
-    VhdlParseTreeNode **, std::string &errors,
-    std::set<VhdlParseTreeNode *> &to_delete_queueconst, const char *msg);
+    VhdlParseTreeNode **, VhdlParserDiagnostics &diagnostics,
+    std::set<VhdlParseTreeNode *> &to_delete_queue, VhdlParserStats *stats,
+    const char *msg);
 #endif
 #endif
 
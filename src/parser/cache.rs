@@ -0,0 +1,458 @@
+/*
+Copyright (c) 2016-2017, Robert Ou <rqou@robertou.com>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice,
+   this list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+// Persistent on-disk cache of parse trees, keyed by a hash of the source
+// text and of the parser itself. Intended for libraries that are parsed over
+// and over again without changing (vendor libraries in CI, etc.)
+//
+// Every entry is its own file named after its key. Entries are written to a
+// temporary file and then renamed into place, so any number of processes can
+// share one cache directory: readers see either a complete entry or nothing,
+// and concurrent writers of the same key write identical data. Entries are
+// also checksummed, so a damaged entry is treated as a miss.
+//
+// When the cache gets too big, the least recently used entries are deleted.
+// An entry's mtime is when it was last written or hit.
+
+use std::fmt::Write as FmtWrite;
+use std::fs;
+use std::fs::File;
+use std::io;
+use std::io::Write;
+use std::path::{Path, PathBuf};
+use std::process;
+use std::time::{Duration, Instant, SystemTime, UNIX_EPOCH};
+
+use parser::{deserialize, MappedFile, VhdlParseTreeNode};
+
+const CACHE_MAGIC: &'static [u8; 8] = b"YAVHDLPC";
+// Bump this whenever the layout of a cache entry changes
+const CACHE_FORMAT_VERSION: u32 = 2;
+// Hash of the C++ parser sources, so that entries written by a different
+// grammar or tree layout are never picked up
+const PARSER_HASH: &'static str = env!("YAVHDL_PARSER_HASH");
+
+pub const DEFAULT_CACHE_MAX_BYTES: u64 = 256 * 1024 * 1024;
+// Eviction goes down to this much of the limit, so that it doesn't have to
+// happen again on the very next store
+const EVICT_TO_PERCENT: u64 = 90;
+
+// 64-bit FNV-1a. Not cryptographic, but fast and plenty for a cache key.
+pub struct Fnv1a64 {
+    state: u64,
+}
+
+impl Fnv1a64 {
+    pub fn new() -> Fnv1a64 {
+        Fnv1a64 {state: 0xcbf29ce484222325}
+    }
+
+    pub fn write(&mut self, bytes: &[u8]) {
+        for &b in bytes {
+            self.state ^= b as u64;
+            self.state = self.state.wrapping_mul(0x100000001b3);
+        }
+    }
+
+    pub fn finish(&self) -> u64 {
+        self.state
+    }
+}
+
+pub fn fnv1a64(bytes: &[u8]) -> u64 {
+    let mut h = Fnv1a64::new();
+    h.write(bytes);
+    h.finish()
+}
+
+fn cache_key(source: &[u8]) -> u64 {
+    let mut h = Fnv1a64::new();
+    h.write(PARSER_HASH.as_bytes());
+    h.write(&CACHE_FORMAT_VERSION.to_le_bytes());
+    h.write(&(source.len() as u64).to_le_bytes());
+    h.write(source);
+    h.finish()
+}
+
+#[derive(Default, Debug, Clone)]
+pub struct ParseCacheStats {
+    pub hits: u64,
+    pub misses: u64,
+    pub stores: u64,
+    pub evictions: u64,
+    // Entries that existed but could not be used (corrupt, truncated, ...)
+    pub bad_entries: u64,
+    pub load_time: Duration,
+    pub parse_time: Duration,
+}
+
+fn duration_us(d: Duration) -> f64 {
+    d.as_secs() as f64 * 1e6 + d.subsec_nanos() as f64 / 1e3
+}
+
+impl ParseCacheStats {
+    pub fn hit_rate(&self) -> f64 {
+        let total = self.hits + self.misses;
+        if total == 0 {
+            0.0
+        } else {
+            self.hits as f64 / total as f64
+        }
+    }
+
+    pub fn report(&self) -> String {
+        let mut s = String::new();
+        write!(s, "Parse cache: {} hits, {} misses ({:.1}% hit rate), \
+                   {} stores, {} evictions, {} bad entries\n",
+            self.hits, self.misses, self.hit_rate() * 100.0,
+            self.stores, self.evictions, self.bad_entries).unwrap();
+        if self.hits > 0 {
+            write!(s, "Parse cache: average load time {:.1} us\n",
+                duration_us(self.load_time) / self.hits as f64).unwrap();
+        }
+        if self.misses > 0 {
+            write!(s, "Parse cache: average parse time {:.1} us\n",
+                duration_us(self.parse_time) / self.misses as f64).unwrap();
+        }
+        s
+    }
+}
+
+pub struct ParseCache {
+    dir: PathBuf,
+    max_bytes: u64,
+    // Size of the entries when the directory was last looked at, plus what
+    // has been stored since. None until the first store. What other
+    // processes store isn't seen until the next look, which is when this
+    // goes over max_bytes.
+    total_bytes: Option<u64>,
+    pub stats: ParseCacheStats,
+}
+
+fn put_u32(out: &mut Vec<u8>, x: u32) {
+    out.extend_from_slice(&x.to_le_bytes());
+}
+
+fn put_u64(out: &mut Vec<u8>, x: u64) {
+    out.extend_from_slice(&x.to_le_bytes());
+}
+
+fn get_u32(buf: &[u8], pos: &mut usize) -> Option<u32> {
+    if buf.len() < *pos + 4 {
+        return None;
+    }
+    let mut x = [0u8; 4];
+    x.copy_from_slice(&buf[*pos..*pos + 4]);
+    *pos += 4;
+    Some(u32::from_le_bytes(x))
+}
+
+fn get_u64(buf: &[u8], pos: &mut usize) -> Option<u64> {
+    if buf.len() < *pos + 8 {
+        return None;
+    }
+    let mut x = [0u8; 8];
+    x.copy_from_slice(&buf[*pos..*pos + 8]);
+    *pos += 8;
+    Some(u64::from_le_bytes(x))
+}
+
+fn get_bytes<'a>(buf: &'a [u8], pos: &mut usize, len: usize)
+    -> Option<&'a [u8]> {
+
+    if buf.len() - *pos < len {
+        return None;
+    }
+    let ret = &buf[*pos..*pos + len];
+    *pos += len;
+    Some(ret)
+}
+
+// Layout of an entry:
+//   magic, format version (u32), key (u64), source length (u64),
+//   messages length (u32), messages,
+//   tree length (u64), tree checksum (u64), packed tree
+fn encode_entry(key: u64, source_len: u64, tree: &[u8], messages: &str)
+    -> Vec<u8> {
+
+    let mut out = Vec::with_capacity(tree.len() + messages.len() + 48);
+    out.extend_from_slice(CACHE_MAGIC);
+    put_u32(&mut out, CACHE_FORMAT_VERSION);
+    put_u64(&mut out, key);
+    put_u64(&mut out, source_len);
+    put_u32(&mut out, messages.len() as u32);
+    out.extend_from_slice(messages.as_bytes());
+    put_u64(&mut out, tree.len() as u64);
+    put_u64(&mut out, fnv1a64(tree));
+    out.extend_from_slice(tree);
+    out
+}
+
+// Returns the (serialized tree, messages) stored in an entry, or None if the
+// entry is not a valid entry for the given key
+fn decode_entry(buf: &[u8], key: u64, source_len: u64)
+    -> Option<(&[u8], String)> {
+
+    let mut pos = 0;
+    if get_bytes(buf, &mut pos, CACHE_MAGIC.len())? != CACHE_MAGIC {
+        return None;
+    }
+    if get_u32(buf, &mut pos)? != CACHE_FORMAT_VERSION {
+        return None;
+    }
+    if get_u64(buf, &mut pos)? != key {
+        return None;
+    }
+    if get_u64(buf, &mut pos)? != source_len {
+        return None;
+    }
+    let messages_len = get_u32(buf, &mut pos)? as usize;
+    let messages = get_bytes(buf, &mut pos, messages_len)?;
+    let messages = String::from_utf8(messages.to_vec()).ok()?;
+    let tree_len = get_u64(buf, &mut pos)? as usize;
+    let tree_hash = get_u64(buf, &mut pos)?;
+    let tree = get_bytes(buf, &mut pos, tree_len)?;
+    if pos != buf.len() || fnv1a64(tree) != tree_hash {
+        return None;
+    }
+
+    Some((tree, messages))
+}
+
+impl ParseCache {
+    pub fn new(dir: &Path, max_bytes: u64) -> io::Result<ParseCache> {
+        fs::create_dir_all(dir)?;
+
+        Ok(ParseCache {
+            dir: dir.to_path_buf(),
+            max_bytes: max_bytes,
+            total_bytes: None,
+            stats: ParseCacheStats::default(),
+        })
+    }
+
+    fn entry_path(&self, key: u64) -> PathBuf {
+        self.dir.join(format!("{:016x}.ptc", key))
+    }
+
+    // Looks up the tree for the given source text. Counts a miss (but does
+    // not parse anything) if there is no usable entry.
+    pub fn load(&mut self, source: &[u8])
+        -> Option<(Option<VhdlParseTreeNode>, String)> {
+
+        let load_start = Instant::now();
+        let key = cache_key(source);
+        let path = self.entry_path(key);
+
+        let entry = match MappedFile::open(&path) {
+            Ok(x) => x,
+            Err(_) => {
+                self.stats.misses += 1;
+                return None;
+            }
+        };
+
+        let ret = decode_entry(entry.bytes(), key, source.len() as u64)
+            .and_then(|(tree, messages)|
+                deserialize(tree).map(|pt| (Some(pt), messages)));
+
+        if ret.is_some() {
+            // Marks the entry as recently used. If this fails (e.g. the
+            // entry belongs to somebody else), it is just evicted sooner.
+            let _ = File::open(&path)
+                .and_then(|f| f.set_modified(SystemTime::now()));
+            self.stats.hits += 1;
+            self.stats.load_time += load_start.elapsed();
+        } else {
+            self.stats.bad_entries += 1;
+            self.stats.misses += 1;
+        }
+        ret
+    }
+
+    pub fn note_parse_time(&mut self, t: Duration) {
+        self.stats.parse_time += t;
+    }
+
+    // Adds an entry. Failing to write to the cache is never fatal; the only
+    // consequence is that the file will have to be parsed again next time.
+    pub fn store(&mut self, source: &[u8], pt: &VhdlParseTreeNode,
+        messages: &str) {
+
+        let key = cache_key(source);
+        let entry = encode_entry(key, source.len() as u64,
+            &pt.serialize(), messages);
+        let path = self.entry_path(key);
+        // Another process may have stored the same entry already
+        let replaced_bytes = fs::metadata(&path).map(|x| x.len()).unwrap_or(0);
+
+        // The temporary name must be unique across processes and threads
+        let nonce = SystemTime::now().duration_since(UNIX_EPOCH)
+            .map(|d| d.subsec_nanos()).unwrap_or(0);
+        let tmp_path = self.dir.join(format!("{:016x}.tmp.{}.{}",
+            key, process::id(), nonce));
+
+        let write_ok = File::create(&tmp_path)
+            .and_then(|mut f| f.write_all(&entry))
+            .and_then(|_| fs::rename(&tmp_path, &path));
+        if write_ok.is_err() {
+            let _ = fs::remove_file(&tmp_path);
+            return;
+        }
+        self.stats.stores += 1;
+
+        match self.total_bytes {
+            Some(total) => {
+                let total = (total + entry.len() as u64)
+                    .saturating_sub(replaced_bytes);
+                self.total_bytes = Some(total);
+                if total > self.max_bytes {
+                    self.enforce_size_limit();
+                }
+            },
+            None => self.enforce_size_limit(),
+        }
+    }
+
+    // Looks at every entry and, if they don't fit in max_bytes, deletes the
+    // least recently used ones until they fit in EVICT_TO_PERCENT of it.
+    // Other processes may be doing the same thing at the same time, so
+    // entries that have already disappeared are silently skipped.
+    fn enforce_size_limit(&mut self) {
+        let dir_iter = match fs::read_dir(&self.dir) {
+            Ok(x) => x,
+            Err(_) => return,
+        };
+
+        let mut entries = Vec::new();
+        let mut total_bytes = 0;
+        for dirent in dir_iter {
+            let dirent = match dirent {
+                Ok(x) => x,
+                Err(_) => continue,
+            };
+            let path = dirent.path();
+            if path.extension().map_or(true, |ext| ext != "ptc") {
+                continue;
+            }
+            if let Ok(metadata) = dirent.metadata() {
+                let mtime = metadata.modified().unwrap_or(UNIX_EPOCH);
+                total_bytes += metadata.len();
+                entries.push((mtime, metadata.len(), path));
+            }
+        }
+
+        if total_bytes > self.max_bytes {
+            let target = self.max_bytes / 100 * EVICT_TO_PERCENT;
+            entries.sort();
+            for (_, len, path) in entries {
+                if total_bytes <= target {
+                    break;
+                }
+                if fs::remove_file(&path).is_ok() {
+                    self.stats.evictions += 1;
+                }
+                total_bytes -= len;
+            }
+        }
+        self.total_bytes = Some(total_bytes);
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn fnv1a64_known_values() {
+        assert_eq!(fnv1a64(b""), 0xcbf29ce484222325);
+        assert_eq!(fnv1a64(b"a"), 0xaf63dc4c8601ec8c);
+        assert_eq!(fnv1a64(b"foobar"), 0x85944171f73967e8);
+    }
+
+    #[test]
+    fn cache_entry_round_trips() {
+        let entry = encode_entry(0x1234, 42, b"tree data", "a warning\n");
+        let (tree, messages) = decode_entry(&entry, 0x1234, 42).unwrap();
+        assert_eq!(tree, b"tree data");
+        assert_eq!(messages, "a warning\n");
+    }
+
+    #[test]
+    fn cache_entry_rejects_mismatches() {
+        let entry = encode_entry(0x1234, 42, b"tree data", "");
+        assert!(decode_entry(&entry, 0x1235, 42).is_none());
+        assert!(decode_entry(&entry, 0x1234, 43).is_none());
+        assert!(decode_entry(&entry[..entry.len() - 1], 0x1234, 42).is_none());
+
+        let mut corrupted = entry.clone();
+        let last = corrupted.len() - 1;
+        corrupted[last] ^= 1;
+        assert!(decode_entry(&corrupted, 0x1234, 42).is_none());
+    }
+
+    #[test]
+    fn cache_evicts_least_recently_used() {
+        use parser::ParseSession;
+        use std::env;
+
+        let dir = env::temp_dir().join(
+            format!("yavhdl-cache-test-{}", process::id()));
+        let _ = fs::remove_dir_all(&dir);
+        let sources: Vec<Vec<u8>> = ["a", "b", "c", "d"].iter()
+            .map(|x| format!("entity {} is end;\n", x).into_bytes())
+            .collect();
+        let mut session = ParseSession::new(false);
+        let trees: Vec<_> = sources.iter()
+            .map(|x| session.parse_buffer(x, 0).0.unwrap()).collect();
+
+        // All the entries are the same size. Three and a half of them fit.
+        let mut cache = ParseCache::new(&dir, DEFAULT_CACHE_MAX_BYTES)
+            .unwrap();
+        cache.store(&sources[0], &trees[0], "");
+        let entry_bytes = fs::metadata(cache.entry_path(
+            cache_key(&sources[0]))).unwrap().len();
+        cache.max_bytes = entry_bytes * 7 / 2;
+        cache.store(&sources[1], &trees[1], "");
+        cache.store(&sources[2], &trees[2], "");
+        // Stored in order, a long time ago
+        let long_ago = SystemTime::now() - Duration::from_secs(100);
+        for i in 0..3 {
+            File::open(cache.entry_path(cache_key(&sources[i]))).unwrap()
+                .set_modified(long_ago + Duration::from_secs(i as u64))
+                .unwrap();
+        }
+
+        // a is the oldest, but using it makes b the least recently used
+        assert!(cache.load(&sources[0]).is_some());
+        cache.store(&sources[3], &trees[3], "");
+        assert_eq!(cache.stats.evictions, 1);
+        assert!(cache.load(&sources[1]).is_none());
+        assert!(cache.load(&sources[0]).is_some());
+        assert!(cache.load(&sources[2]).is_some());
+        assert!(cache.load(&sources[3]).is_some());
+        fs::remove_dir_all(&dir).unwrap();
+    }
+}
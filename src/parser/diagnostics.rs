@@ -0,0 +1,105 @@
+/*
+Copyright (c) 2016-2017, Robert Ou <rqou@robertou.com>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice,
+   this list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+// Parser diagnostics in structured form (see VhdlDiagnostic in
+// vhdl_parser_glue.h). The text is only built when it is asked for.
+
+use std::fmt::Write;
+
+pub use parser::ffi::VhdlDiagnosticSeverity;
+pub use parser::ffi::VhdlDiagnosticCode;
+pub use parser::ffi::VhdlDiagnosticMessage;
+
+#[derive(Debug, Clone)]
+pub struct Diagnostic {
+    pub severity: VhdlDiagnosticSeverity,
+    pub code: VhdlDiagnosticCode,
+    pub message: VhdlDiagnosticMessage,
+    pub file_id: i32,
+    pub line: i32,
+    // Byte span of the offending token (inclusive), from the start of the
+    // text that was parsed
+    pub bytes: Option<(usize, usize)>,
+    pub args: Vec<String>,
+}
+
+impl Diagnostic {
+    // Same text as the parser used to produce, including the newline
+    pub fn format(&self) -> String {
+        let mut s = String::new();
+        match self.message {
+            VhdlDiagnosticMessage::MSG_PARSE_FAILED => {
+                s.push_str("Parse error!\n");
+                return s;
+            },
+            VhdlDiagnosticMessage::MSG_CANNOT_OPEN_FILE => {
+                write!(s, "Error opening file \"{}\"\n", self.args[0])
+                    .unwrap();
+                return s;
+            },
+            _ => {},
+        }
+
+        s.push_str("Error ");
+        match self.message {
+            VhdlDiagnosticMessage::MSG_SYNTAX_ERROR => {
+                s.push_str("syntax error");
+                if self.args.len() > 0 {
+                    write!(s, ", unexpected {}", self.args[0]).unwrap();
+                }
+                if self.args.len() > 1 {
+                    write!(s, ", expecting {}", self.args[1..].join(" or "))
+                        .unwrap();
+                }
+            },
+            VhdlDiagnosticMessage::MSG_SYNTAX_AMBIGUOUS =>
+                s.push_str("syntax is ambiguous"),
+            VhdlDiagnosticMessage::MSG_MEMORY_EXHAUSTED =>
+                s.push_str("memory exhausted"),
+            VhdlDiagnosticMessage::MSG_OTHER_PARSER_ERROR =>
+                s.push_str(&self.args[0]),
+            VhdlDiagnosticMessage::MSG_NEWLINE_IN_EXT_ID =>
+                s.push_str("Illegal newline in extended identifier"),
+            VhdlDiagnosticMessage::MSG_BAD_EXT_ID_CONTENTS =>
+                s.push_str("Illegal extended identifier contents"),
+            VhdlDiagnosticMessage::MSG_NEWLINE_IN_STRING =>
+                s.push_str("Illegal newline in string"),
+            VhdlDiagnosticMessage::MSG_BAD_STRING_CONTENTS =>
+                s.push_str("Illegal string contents"),
+            VhdlDiagnosticMessage::MSG_PARSE_FAILED |
+            VhdlDiagnosticMessage::MSG_CANNOT_OPEN_FILE => unreachable!(),
+        }
+        write!(s, " on line {}\n", self.line).unwrap();
+        s
+    }
+}
+
+pub fn format_diagnostics(diagnostics: &[Diagnostic]) -> String {
+    let mut s = String::new();
+    for diag in diagnostics {
+        s.push_str(&diag.format());
+    }
+    s
+}
@@ -0,0 +1,461 @@
+/*
+Copyright (c) 2016-2017, Robert Ou <rqou@robertou.com>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice,
+   this list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+// Incremental reparsing of a design file. The file is kept as a list of
+// design units, each of which owns the region of the source from the end of
+// the previous library unit up to and including the end of its own library
+// unit (so a unit's context clause and any comments in front of it belong to
+// it). When the source changes, only the units whose regions overlap the
+// change are parsed again. All other units are kept as-is (the same tree
+// objects), with only their line numbers adjusted.
+
+use std::collections::HashSet;
+use std::ops::Range;
+
+use parser::*;
+
+pub struct ParsedUnit {
+    // PT_DESIGN_UNIT. Boxed so that the tree does not move when units are
+    // added or removed around it.
+    pub tree: Box<VhdlParseTreeNode>,
+    // Byte range of the source owned by this unit
+    pub start: usize,
+    pub end: usize,
+}
+
+pub struct IncrementalParse {
+    source: Vec<u8>,
+    // Byte offset at which each line starts
+    line_starts: Vec<usize>,
+    units: Vec<ParsedUnit>,
+}
+
+// Describes one update. The units in old_units (indices before the update)
+// were replaced by the units in new_units (indices after the update); every
+// other unit is unchanged apart from possibly its line numbers.
+#[derive(Debug, Clone, PartialEq, Eq)]
+pub struct ReparseResult {
+    pub old_units: Range<usize>,
+    pub new_units: Range<usize>,
+    // The units in new_units whose fingerprint does not match any of the
+    // units they replaced. Units that were only re-parsed because of
+    // whitespace or comment changes are not in here.
+    pub changed: Vec<usize>,
+    // Set if the whole file had to be parsed again
+    pub full_reparse: bool,
+}
+
+impl ReparseResult {
+    pub fn changed_units(&self) -> &[usize] {
+        &self.changed
+    }
+}
+
+fn compute_line_starts(source: &[u8]) -> Vec<usize> {
+    let mut line_starts = vec![0];
+    for (i, &c) in source.iter().enumerate() {
+        if c == b'\n' {
+            line_starts.push(i + 1);
+        }
+    }
+    line_starts
+}
+
+// Index of the last line that starts at or before offset
+fn line_of(line_starts: &[usize], offset: usize) -> usize {
+    match line_starts.binary_search(&offset) {
+        Ok(i) => i,
+        Err(i) => i - 1,
+    }
+}
+
+// Byte offset just past the end of the library unit of a PT_DESIGN_UNIT
+fn unit_end_offset(line_starts: &[usize], unit: &VhdlParseTreeNode)
+    -> Option<usize> {
+
+    let library_unit = unit.pieces[0].as_ref()?;
+    if library_unit.last_line < 1 ||
+        library_unit.last_line as usize > line_starts.len() {
+        return None;
+    }
+
+    // last_column is 1-based and inclusive
+    Some(line_starts[library_unit.last_line as usize - 1] +
+         library_unit.last_column as usize)
+}
+
+// Turns freshly-parsed units into ParsedUnits. The first one starts at the
+// given offset. Fails if the locations don't make sense.
+fn make_units(line_starts: &[usize], trees: Vec<VhdlParseTreeNode>,
+    start: usize) -> Option<Vec<ParsedUnit>> {
+
+    let mut units = Vec::with_capacity(trees.len());
+    let mut unit_start = start;
+    for tree in trees {
+        let unit_end = unit_end_offset(line_starts, &tree)?;
+        if unit_end <= unit_start {
+            return None;
+        }
+        units.push(ParsedUnit {
+            tree: Box::new(tree),
+            start: unit_start,
+            end: unit_end,
+        });
+        unit_start = unit_end;
+    }
+    Some(units)
+}
+
+// Indices (offset by base) of the new units that don't have an identical
+// counterpart among the old ones
+fn changed_units(old_units: &[ParsedUnit], new_units: &[ParsedUnit],
+    base: usize) -> Vec<usize> {
+
+    let old_fingerprints: HashSet<u64> =
+        old_units.iter().map(|x| x.tree.fingerprint).collect();
+    new_units.iter().enumerate()
+        .filter(|&(_, x)| !old_fingerprints.contains(&x.tree.fingerprint))
+        .map(|(i, _)| base + i)
+        .collect()
+}
+
+impl IncrementalParse {
+    // Parses the whole file. Returns the parser's messages on failure.
+    pub fn new(source: Vec<u8>) -> Result<IncrementalParse, String> {
+        let line_starts = compute_line_starts(&source);
+
+        let (trees, messages) = parse_buffer_units(&source, 1, 1);
+        let trees = match trees {
+            Some(x) => x,
+            None => return Err(messages),
+        };
+        let units = match make_units(&line_starts, trees, 0) {
+            Some(x) => x,
+            None => return Err(String::from("Bad design unit locations\n")),
+        };
+
+        Ok(IncrementalParse {
+            source: source,
+            line_starts: line_starts,
+            units: units,
+        })
+    }
+
+    pub fn source(&self) -> &[u8] {
+        &self.source
+    }
+
+    pub fn units(&self) -> &[ParsedUnit] {
+        &self.units
+    }
+
+    fn region_start(&self, i: usize) -> usize {
+        if i == 0 {
+            0
+        } else {
+            self.units[i - 1].end
+        }
+    }
+
+    // The "unit" one past the end is the trailing whitespace and comments
+    fn region_end(&self, i: usize) -> usize {
+        if i == self.units.len() {
+            self.source.len()
+        } else {
+            self.units[i].end
+        }
+    }
+
+    // Replaces the bytes in [start, end) of the current source
+    pub fn edit(&mut self, start: usize, end: usize, replacement: &[u8])
+        -> Result<ReparseResult, String> {
+
+        let mut new_source = Vec::with_capacity(
+            self.source.len() - (end - start) + replacement.len());
+        new_source.extend_from_slice(&self.source[..start]);
+        new_source.extend_from_slice(replacement);
+        new_source.extend_from_slice(&self.source[end..]);
+        self.update(new_source)
+    }
+
+    // Switches to a new version of the source. On a parse error the previous
+    // state is kept (so the next update is compared against the last source
+    // that parsed) and the parser's messages are returned.
+    pub fn update(&mut self, new_source: Vec<u8>)
+        -> Result<ReparseResult, String> {
+
+        let old_len = self.source.len();
+        let new_len = new_source.len();
+
+        // Find the changed range by trimming the common prefix and suffix
+        let mut prefix = 0;
+        while prefix < old_len && prefix < new_len &&
+            self.source[prefix] == new_source[prefix] {
+            prefix += 1;
+        }
+        if prefix == old_len && prefix == new_len {
+            return Ok(ReparseResult {
+                old_units: 0..0,
+                new_units: 0..0,
+                changed: vec![],
+                full_reparse: false,
+            });
+        }
+        let mut suffix = 0;
+        while suffix < old_len - prefix && suffix < new_len - prefix &&
+            self.source[old_len - 1 - suffix] ==
+                new_source[new_len - 1 - suffix] {
+            suffix += 1;
+        }
+        let change_start = prefix;
+        let change_end = old_len - suffix;
+
+        // Find the affected regions. Regions that only touch the change are
+        // included too, since the change may join tokens across the boundary.
+        let num_units = self.units.len();
+        let mut first = 0;
+        while self.region_end(first) < change_start {
+            first += 1;
+        }
+        // The trailing whitespace and comments can't be parsed on their own
+        if first == num_units {
+            first -= 1;
+        }
+        let mut last = first;
+        while last < num_units && self.region_start(last + 1) <= change_end {
+            last += 1;
+        }
+        // Anything else on the line where the change ends moves sideways, so
+        // units with text on that line have to be redone too
+        let next_line = line_of(&self.line_starts, change_end) + 1;
+        let next_line_start = if next_line < self.line_starts.len() {
+            self.line_starts[next_line]
+        } else {
+            old_len
+        };
+        while last < num_units &&
+            self.region_end(last) < next_line_start &&
+            self.source[self.region_end(last)..next_line_start].iter()
+                .any(|&c| c != b' ' && c != b'\t' && c != b'\r' && c != b'\n') {
+            last += 1;
+        }
+
+        let old_start = self.region_start(first);
+        let old_end = self.region_end(last);
+        let new_end = old_end + new_len - old_len;
+
+        // The beginning of the region is before the change, so its location
+        // is the same in both versions
+        let first_line = line_of(&self.line_starts, old_start);
+        let first_column = old_start - self.line_starts[first_line];
+
+        let new_line_starts = compute_line_starts(&new_source);
+        let (trees, _) = parse_buffer_units(&new_source[old_start..new_end],
+            first_line as i32 + 1, first_column as i32 + 1);
+        let new_units = trees.and_then(|trees|
+            make_units(&new_line_starts, trees, old_start));
+
+        // The new units must exactly cover the region. If the last unit ends
+        // early, something (e.g. an unterminated comment) swallowed the end
+        // of the region and the rest of the file might parse differently.
+        let new_units = new_units.and_then(|units| {
+            let covered = units.last().map_or(false, |x| x.end == new_end);
+            if covered || last == num_units {
+                Some(units)
+            } else {
+                None
+            }
+        });
+
+        let new_units = match new_units {
+            Some(x) => x,
+            None => return self.full_reparse(new_source),
+        };
+
+        // Fix up the units after the region
+        let line_delta = line_of(&new_line_starts, new_end) as i32 -
+            line_of(&self.line_starts, old_end) as i32;
+        let replaced_end = if last == num_units {num_units} else {last + 1};
+        for unit in &mut self.units[replaced_end..] {
+            if line_delta != 0 {
+                unit.tree.shift_lines(line_delta);
+            }
+            unit.start = unit.start + new_len - old_len;
+            unit.end = unit.end + new_len - old_len;
+        }
+
+        let num_new_units = new_units.len();
+        let changed = changed_units(&self.units[first..replaced_end],
+            &new_units, first);
+        let tail: Vec<_> = self.units.drain(replaced_end..).collect();
+        self.units.truncate(first);
+        self.units.extend(new_units);
+        self.units.extend(tail);
+        self.source = new_source;
+        self.line_starts = new_line_starts;
+
+        Ok(ReparseResult {
+            old_units: first..replaced_end,
+            new_units: first..first + num_new_units,
+            changed: changed,
+            full_reparse: false,
+        })
+    }
+
+    fn full_reparse(&mut self, new_source: Vec<u8>)
+        -> Result<ReparseResult, String> {
+
+        let old_num_units = self.units.len();
+        let new_state = IncrementalParse::new(new_source)?;
+        let changed = changed_units(&self.units, &new_state.units, 0);
+        *self = new_state;
+
+        Ok(ReparseResult {
+            old_units: 0..old_num_units,
+            new_units: 0..self.units.len(),
+            changed: changed,
+            full_reparse: true,
+        })
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    const SOURCE: &'static [u8] = b"entity a is
+end;
+
+-- comment
+entity b is
+end;
+architecture x of b is begin end;
+";
+
+    fn unit_ptr(inc: &IncrementalParse, i: usize) -> *const VhdlParseTreeNode {
+        &*inc.units()[i].tree
+    }
+
+    fn check_matches_full_parse(inc: &IncrementalParse) {
+        let (trees, _) = parse_buffer_units(inc.source(), 1, 1);
+        let trees = trees.unwrap();
+        assert_eq!(trees.len(), inc.units().len());
+        for (x, y) in trees.iter().zip(inc.units()) {
+            assert_eq!(x.serialize(), y.tree.serialize());
+        }
+    }
+
+    #[test]
+    fn incremental_reparses_only_changed_unit() {
+        let mut inc = IncrementalParse::new(SOURCE.to_vec()).unwrap();
+        assert_eq!(inc.units().len(), 3);
+        let a = unit_ptr(&inc, 0);
+        let x = unit_ptr(&inc, 2);
+
+        // Rename entity b
+        let pos = SOURCE.windows(8).position(|w| w == b"entity b").unwrap();
+        let ret = inc.edit(pos + 7, pos + 8, b"bbb").unwrap();
+        assert_eq!(ret, ReparseResult {
+            old_units: 1..2,
+            new_units: 1..2,
+            changed: vec![1],
+            full_reparse: false,
+        });
+        assert_eq!(unit_ptr(&inc, 0), a);
+        assert_eq!(unit_ptr(&inc, 2), x);
+        check_matches_full_parse(&inc);
+    }
+
+    #[test]
+    fn incremental_shifts_following_units() {
+        let mut inc = IncrementalParse::new(SOURCE.to_vec()).unwrap();
+        let x = unit_ptr(&inc, 2);
+
+        let ret = inc.edit(11, 11, b"\n\n\n").unwrap();
+        assert_eq!(ret.new_units, 0..1);
+        assert_eq!(ret.changed_units(), &[]);
+        assert!(!ret.full_reparse);
+        assert_eq!(unit_ptr(&inc, 2), x);
+        check_matches_full_parse(&inc);
+
+        // Adding a unit in the middle
+        let pos = inc.units()[0].end;
+        let ret = inc.edit(pos, pos, b" entity c is end;").unwrap();
+        assert_eq!(ret.old_units, 0..2);
+        assert_eq!(ret.new_units, 0..3);
+        assert_eq!(ret.changed_units(), &[1]);
+        assert_eq!(unit_ptr(&inc, 3), x);
+        check_matches_full_parse(&inc);
+    }
+
+    #[test]
+    fn incremental_ignores_comment_only_changes() {
+        let mut inc = IncrementalParse::new(SOURCE.to_vec()).unwrap();
+        let fingerprint = inc.units()[1].tree.fingerprint;
+
+        let pos = SOURCE.windows(11).position(|w| w == b"entity b is").unwrap();
+        let ret = inc.edit(pos + 11, pos + 11, b" -- note\n   ").unwrap();
+        assert_eq!(ret.new_units, 1..2);
+        assert_eq!(ret.changed_units(), &[]);
+        assert_eq!(inc.units()[1].tree.fingerprint, fingerprint);
+        check_matches_full_parse(&inc);
+
+        let ret = inc.edit(pos + 7, pos + 8, b"c").unwrap();
+        assert_eq!(ret.changed_units(), &[1]);
+        assert!(inc.units()[1].tree.fingerprint != fingerprint);
+    }
+
+    #[test]
+    fn incremental_trailing_comment() {
+        let mut inc = IncrementalParse::new(SOURCE.to_vec()).unwrap();
+        let len = SOURCE.len();
+        let ret = inc.edit(len, len, b"-- trailing\n").unwrap();
+        assert_eq!(ret.new_units, 2..3);
+        assert_eq!(ret.changed_units(), &[]);
+        assert!(!ret.full_reparse);
+        check_matches_full_parse(&inc);
+    }
+
+    #[test]
+    fn incremental_keeps_state_on_error() {
+        let mut inc = IncrementalParse::new(SOURCE.to_vec()).unwrap();
+        assert!(inc.edit(0, 6, b"entitz").is_err());
+        assert_eq!(inc.source(), SOURCE);
+        assert_eq!(inc.units().len(), 3);
+    }
+
+    #[test]
+    fn incremental_falls_back_on_unterminated_comment() {
+        let mut inc = IncrementalParse::new(SOURCE.to_vec()).unwrap();
+
+        // Everything after the comment start disappears, including units
+        // that were not inside the edited region
+        let pos = inc.units()[0].end;
+        let ret = inc.edit(pos, pos, b" entity c is end; /*").unwrap();
+        assert!(ret.full_reparse);
+        assert_eq!(inc.units().len(), 2);
+        check_matches_full_parse(&inc);
+    }
+}
@@ -30,12 +30,29 @@ mod ffi {
 include!(concat!(env!("OUT_DIR"), "/bindings.rs"));
 }
 
-use std::ptr;
+mod batch;
+mod cache;
+mod diagnostics;
+mod incremental;
+mod packed;
+
+pub use self::batch::*;
+pub use self::cache::*;
+pub use self::diagnostics::*;
+pub use self::incremental::*;
+pub use self::packed::*;
+
+use std::slice;
 use std::ffi::{CStr, CString};
 use std::ffi::OsStr;
+use std::fmt::Write;
+use std::fs::File;
+use std::io::Read;
 use std::os::unix::ffi::OsStrExt;
 use std::os::raw::*;
+use std::time::{Duration, Instant};
 
+pub use self::ffi::NUM_FIXED_PIECES;
 pub use self::ffi::ParseTreeNodeType;
 pub use self::ffi::ParseTreeOperatorType;
 pub use self::ffi::ParseTreeRangeDirection;
@@ -70,19 +87,55 @@ pub struct VhdlParseTreeNode {
     pub last_line: i32,
     pub last_column: i32,
 
+    // Hash of everything in this subtree except for locations. Two subtrees
+    // with the same fingerprint are (barring collisions) the same code, even
+    // if whitespace or comments around or inside them differ.
+    pub fingerprint: u64,
+
     raw_node: *mut ffi::VhdlParseTreeNode,
     // We only want to call free on the root
     is_root: bool,
 }
 
-unsafe fn rustify_str(input: *mut c_char) -> String {
-    // Get the string into something Rust can handle
-    let string_rs = CStr::from_ptr(input);
-    let string_rs = String::from(string_rs.to_str().unwrap());
-    // Free the C string
-    ffi::VhdlParserFreeString(input);
+// Copies the diagnostics out of the session, which reuses its buffers on the
+// next parse
+unsafe fn rustify_diagnostics(session: *mut ffi::VhdlParserSession)
+    -> Vec<Diagnostic> {
 
-    string_rs
+    let mut list = ffi::VhdlDiagnosticList {
+        diagnostics: 0 as *const ffi::VhdlDiagnostic,
+        num_diagnostics: 0,
+        arg_text: 0 as *const c_char,
+        arg_offsets: 0 as *const ffi::size_t,
+    };
+    ffi::VhdlParserSessionDiagnostics(session, &mut list);
+    if list.num_diagnostics == 0 {
+        return Vec::new();
+    }
+
+    let diagnostics =
+        slice::from_raw_parts(list.diagnostics, list.num_diagnostics as usize);
+    diagnostics.iter().map(|x| {
+        let args = (x.first_arg..x.first_arg + x.num_args).map(|i| {
+            let offset = *list.arg_offsets.offset(i as isize);
+            CStr::from_ptr(list.arg_text.offset(offset as isize))
+                .to_string_lossy().into_owned()
+        }).collect();
+
+        Diagnostic {
+            severity: x.severity,
+            code: x.code,
+            message: x.message,
+            file_id: x.file_id,
+            line: x.line,
+            bytes: if x.first_byte < 0 {
+                None
+            } else {
+                Some((x.first_byte as usize, x.last_byte as usize))
+            },
+            args: args,
+        }
+    }).collect()
 }
 
 unsafe fn rustify_stdstring(input: *mut c_void) -> Vec<u8> {
@@ -116,7 +169,7 @@ unsafe fn rustify_node(
         });
     }
 
-    VhdlParseTreeNode {
+    let mut node = VhdlParseTreeNode {
         node_type: (*input).type_,
         chr: (*input).chr as u8,
         integer: (*input).integer,
@@ -141,29 +194,434 @@ unsafe fn rustify_node(
 
         pieces: inner_nodes,
 
+        fingerprint: 0,
+
         raw_node: input,
         is_root: is_root,
-    }
+    };
+    // The children were converted first, so this doesn't need another walk
+    node.fingerprint = node.compute_fingerprint();
+
+    node
 }
 
 pub fn parse_file(filename: &OsStr) -> (Option<VhdlParseTreeNode>, String) {
+    let (pt, diagnostics) = ParseSession::new(false).parse_file(filename, 0);
+    (pt, format_diagnostics(&diagnostics))
+}
+
+// Counters from parse_file_interned. These add up over every file parsed
+// with the same InternStats. Byte counts are only for the C++ tree; the Rust
+// copy of a tree does not share nodes.
+#[derive(Default, Debug, Clone)]
+pub struct InternStats {
+    pub nodes: u64,
+    pub shared_nodes: u64,
+    pub bytes_before: u64,
+    pub bytes_saved: u64,
+}
+
+impl InternStats {
+    fn add(&mut self, x: &InternStats) {
+        self.nodes += x.nodes;
+        self.shared_nodes += x.shared_nodes;
+        self.bytes_before += x.bytes_before;
+        self.bytes_saved += x.bytes_saved;
+    }
+
+    pub fn report(&self) -> String {
+        let mut s = String::new();
+        let saved_pct = if self.bytes_before == 0 {
+            0.0
+        } else {
+            self.bytes_saved as f64 / self.bytes_before as f64 * 100.0
+        };
+        write!(s, "Interning: {} of {} nodes shared, {} of {} bytes saved \
+                   ({:.1}%)\n",
+            self.shared_nodes, self.nodes, self.bytes_saved,
+            self.bytes_before, saved_pct).unwrap();
+        s
+    }
+}
+
+// Same as parse_file, but identical subtrees without locations (names,
+// literals, expressions, subtype indications, ...) are shared in the
+// underlying C++ tree
+pub fn parse_file_interned(filename: &OsStr, stats: &mut InternStats)
+    -> (Option<VhdlParseTreeNode>, String) {
+
+    let mut session = ParseSession::new(true);
+    let (pt, diagnostics) = session.parse_file(filename, 0);
+    stats.add(&session.intern_stats());
+
+    (pt, format_diagnostics(&diagnostics))
+}
+
+// Where the time went in a ParseSession (see VhdlParserStats). Everything
+// adds up over all of the session's parses.
+#[derive(Default, Debug, Clone)]
+pub struct ParseStats {
+    pub lex_time: Duration,
+    // Not including lexing
+    pub parse_time: Duration,
+    // Freeing what the GLR parser threw away
+    pub cleanup_time: Duration,
+    // Copying the C++ tree into VhdlParseTreeNode
+    pub rustify_time: Duration,
+    pub tokens: u64,
+    pub nodes: u64,
+    pub tree_bytes: u64,
+    // Only types that were seen, in node type order
+    pub nodes_by_type: Vec<(String, u64)>,
+}
+
+// Memory used by one node type in a ParseSession (see
+// VhdlParseTreeMemoryStats). Bytes include the strings. Nodes only count
+// while the parser holds them, so between parses live_nodes and live_bytes
+// are only non-zero if something leaked.
+#[derive(Default, Debug, Clone, PartialEq, Eq)]
+pub struct NodeTypeMemory {
+    pub node_type: String,
+    pub live_nodes: u64,
+    pub live_bytes: u64,
+    pub peak_nodes: u64,
+    pub peak_bytes: u64,
+    // Values the GLR parser threw away
+    pub discarded_nodes: u64,
+    pub discarded_bytes: u64,
+}
+
+// One line per node type, biggest peak first
+pub fn memory_report(memory: &[NodeTypeMemory]) -> String {
+    let mut sorted: Vec<&NodeTypeMemory> = memory.iter().collect();
+    sorted.sort_by(|a, b| b.peak_bytes.cmp(&a.peak_bytes)
+        .then_with(|| a.node_type.cmp(&b.node_type)));
+
+    let mut ret = format!("{:<44} {:>10} {:>12} {:>10} {:>12} {:>8}\n",
+        "node type", "peak nodes", "peak bytes", "discarded", "disc. bytes",
+        "live");
+    for x in sorted {
+        ret += &format!("{:<44} {:>10} {:>12} {:>10} {:>12} {:>8}\n",
+            x.node_type, x.peak_nodes, x.peak_bytes, x.discarded_nodes,
+            x.discarded_bytes, x.live_nodes);
+    }
+    ret
+}
+
+// Largest resident set size of the process so far
+pub fn peak_rss_bytes() -> u64 {
+    unsafe { ffi::VhdlParserPeakRSS() as u64 }
+}
+
+fn duration_from_ns(ns: u64) -> Duration {
+    Duration::new(ns / 1000000000, (ns % 1000000000) as u32)
+}
+
+// Keeps the scanner (and, if asked for, the table of shared subtrees) alive
+// across many parses. Each parse starts from a clean state, so the result is
+// the same as calling parse_file/parse_buffer. Trees stay valid after the
+// session is dropped.
+pub struct ParseSession {
+    raw_session: *mut ffi::VhdlParserSession,
+    stats_enabled: bool,
+    rustify_time: Duration,
+}
+
+impl ParseSession {
+    // If intern is set, identical subtrees without locations are shared
+    // between every tree parsed in this session (see parse_file_interned)
+    pub fn new(intern: bool) -> ParseSession {
+        let raw_session = unsafe { ffi::VhdlParserNewSession(intern) };
+        if raw_session.is_null() {
+            panic!("Could not create parser session");
+        }
+
+        ParseSession {
+            raw_session: raw_session,
+            stats_enabled: false,
+            rustify_time: Duration::new(0, 0),
+        }
+    }
+
+    // Stats are off by default because collecting them costs a clock read
+    // for every token
+    pub fn enable_stats(&mut self) {
+        unsafe {
+            ffi::VhdlParserSessionEnableStats(self.raw_session);
+        }
+        self.stats_enabled = true;
+    }
+
+    pub fn stats(&self) -> ParseStats {
+        let mut raw_stats = ffi::VhdlParserStats {
+            lex_ns: 0,
+            parse_ns: 0,
+            cleanup_ns: 0,
+            tokens: 0,
+            nodes: 0,
+            tree_bytes: 0,
+            nodes_by_type: [0; ffi::NUM_PARSE_TREE_NODE_TYPES as usize],
+        };
+        unsafe {
+            ffi::VhdlParserSessionStats(self.raw_session, &mut raw_stats);
+        }
+
+        let mut nodes_by_type = Vec::new();
+        for (i, &count) in raw_stats.nodes_by_type.iter().enumerate() {
+            if count != 0 {
+                let name = unsafe {
+                    CStr::from_ptr(ffi::VhdlParserNodeTypeName(i as i32))
+                };
+                nodes_by_type.push(
+                    (name.to_string_lossy().into_owned(), count as u64));
+            }
+        }
+
+        ParseStats {
+            lex_time: duration_from_ns(raw_stats.lex_ns as u64),
+            parse_time: duration_from_ns(raw_stats.parse_ns as u64),
+            cleanup_time: duration_from_ns(raw_stats.cleanup_ns as u64),
+            rustify_time: self.rustify_time,
+            tokens: raw_stats.tokens as u64,
+            nodes: raw_stats.nodes as u64,
+            tree_bytes: raw_stats.tree_bytes as u64,
+            nodes_by_type: nodes_by_type,
+        }
+    }
+
+    // Memory accounting is off by default because it runs on every node
+    // allocation
+    pub fn enable_memory_stats(&mut self) {
+        unsafe {
+            ffi::VhdlParserSessionEnableMemoryStats(self.raw_session);
+        }
+    }
+
+    // Only types that were seen, in node type order
+    pub fn memory_stats(&self) -> Vec<NodeTypeMemory> {
+        let n = ffi::NUM_PARSE_TREE_NODE_TYPES as usize;
+        let mut raw_stats = ffi::VhdlParseTreeMemoryStats {
+            live_nodes: [0; ffi::NUM_PARSE_TREE_NODE_TYPES as usize],
+            peak_nodes: [0; ffi::NUM_PARSE_TREE_NODE_TYPES as usize],
+            live_bytes: [0; ffi::NUM_PARSE_TREE_NODE_TYPES as usize],
+            peak_bytes: [0; ffi::NUM_PARSE_TREE_NODE_TYPES as usize],
+            discarded_nodes: [0; ffi::NUM_PARSE_TREE_NODE_TYPES as usize],
+            discarded_bytes: [0; ffi::NUM_PARSE_TREE_NODE_TYPES as usize],
+        };
+        unsafe {
+            ffi::VhdlParserSessionMemoryStats(self.raw_session,
+                &mut raw_stats);
+        }
+
+        let mut ret = Vec::new();
+        for i in 0..n {
+            if raw_stats.peak_nodes[i] == 0 &&
+                raw_stats.discarded_nodes[i] == 0 {
+                continue;
+            }
+
+            let name = unsafe {
+                CStr::from_ptr(ffi::VhdlParserNodeTypeName(i as i32))
+            };
+            ret.push(NodeTypeMemory {
+                node_type: name.to_string_lossy().into_owned(),
+                live_nodes: raw_stats.live_nodes[i] as u64,
+                live_bytes: raw_stats.live_bytes[i] as u64,
+                peak_nodes: raw_stats.peak_nodes[i] as u64,
+                peak_bytes: raw_stats.peak_bytes[i] as u64,
+                discarded_nodes: raw_stats.discarded_nodes[i] as u64,
+                discarded_bytes: raw_stats.discarded_bytes[i] as u64,
+            });
+        }
+        ret
+    }
+
+    unsafe fn rustify_tree(&mut self, raw_node: *mut ffi::VhdlParseTreeNode)
+        -> VhdlParseTreeNode {
+
+        if !self.stats_enabled {
+            return rustify_node(raw_node, true);
+        }
+
+        let start = Instant::now();
+        let ret = rustify_node(raw_node, true);
+        self.rustify_time += start.elapsed();
+        ret
+    }
+
+    // file_id is copied into the diagnostics so that they can be told apart
+    // once collected from many files
+    pub fn parse_file(&mut self, filename: &OsStr, file_id: i32)
+        -> (Option<VhdlParseTreeNode>, Vec<Diagnostic>) {
+
+        unsafe {
+            let ret = ffi::VhdlParserSessionParseFile(self.raw_session,
+                CString::new(filename.as_bytes()).unwrap().as_ptr()
+                    as *const i8,
+                file_id);
+
+            let diagnostics = rustify_diagnostics(self.raw_session);
+
+            if ret.is_null() {
+                (None, diagnostics)
+            } else {
+                // Need to Rust-ify the struct
+                (Some(self.rustify_tree(ret)), diagnostics)
+            }
+        }
+    }
+
+    pub fn parse_buffer(&mut self, buf: &[u8], file_id: i32)
+        -> (Option<VhdlParseTreeNode>, Vec<Diagnostic>) {
+
+        unsafe {
+            let (ret, diagnostics) = self.parse_buffer_raw(buf, file_id, 1, 1);
+
+            if ret.is_null() {
+                (None, diagnostics)
+            } else {
+                (Some(self.rustify_tree(ret)), diagnostics)
+            }
+        }
+    }
+
+    unsafe fn parse_buffer_raw(&mut self, buf: &[u8], file_id: i32,
+        first_line: i32, first_column: i32)
+        -> (*mut ffi::VhdlParseTreeNode, Vec<Diagnostic>) {
+
+        let ret = ffi::VhdlParserSessionParseBuffer(self.raw_session,
+            buf.as_ptr() as *const c_char, buf.len() as ffi::size_t,
+            file_id, first_line, first_column);
+
+        (ret, rustify_diagnostics(self.raw_session))
+    }
+
+    // Totals over every tree parsed so far in this session
+    pub fn intern_stats(&self) -> InternStats {
+        let mut raw_stats = ffi::VhdlParseTreeInternStats {
+            nodes: 0,
+            shared_nodes: 0,
+            bytes_before: 0,
+            bytes_saved: 0,
+        };
+        unsafe {
+            ffi::VhdlParserSessionInternStats(self.raw_session,
+                &mut raw_stats);
+        }
+
+        InternStats {
+            nodes: raw_stats.nodes as u64,
+            shared_nodes: raw_stats.shared_nodes as u64,
+            bytes_before: raw_stats.bytes_before as u64,
+            bytes_saved: raw_stats.bytes_saved as u64,
+        }
+    }
+}
+
+impl Drop for ParseSession {
+    fn drop(&mut self) {
+        unsafe {
+            ffi::VhdlParserFreeSession(self.raw_session);
+        }
+    }
+}
+
+// Same as parse_file, but for source text that is already in memory
+pub fn parse_buffer(buf: &[u8]) -> (Option<VhdlParseTreeNode>, String) {
+    let (pt, diagnostics) = ParseSession::new(false).parse_buffer(buf, 0);
+    (pt, format_diagnostics(&diagnostics))
+}
+
+// Parses a piece of a file that starts at the given (1-based) line and
+// column, and splits the result into its PT_DESIGN_UNIT nodes, each of which
+// becomes its own tree.
+pub fn parse_buffer_units(buf: &[u8], first_line: i32, first_column: i32)
+    -> (Option<Vec<VhdlParseTreeNode>>, String) {
+
     unsafe {
-        let mut errors = ptr::null_mut::<c_char>();
-        let ret = ffi::VhdlParserParseFile(
-            CString::new(filename.as_bytes()).unwrap().as_ptr() as *const i8,
-            &mut errors);
+        let (ret, diagnostics) = ParseSession::new(false)
+            .parse_buffer_raw(buf, 0, first_line, first_column);
+
+        let errors_rs = format_diagnostics(&diagnostics);
+
+        if ret.is_null() {
+            return (None, errors_rs);
+        }
+
+        // The design file is a left-nested list, so the units come out
+        // backwards
+        let mut units = Vec::new();
+        let mut node = ret;
+        while (*node).type_ == ParseTreeNodeType::PT_DESIGN_FILE {
+            units.push(rustify_node(ffi::VhdlParserDetachPiece(node, 1), true));
+            let rest = ffi::VhdlParserDetachPiece(node, 0);
+            ffi::VhdlParserFreePT(node);
+            node = rest;
+        }
+        units.push(rustify_node(node, true));
+        units.reverse();
+
+        (Some(units), errors_rs)
+    }
+}
+
+// Same as parse_file, but consults (and fills) the given parse cache. The
+// file is read only once so that the cache key always matches the text
+// that was actually parsed.
+pub fn parse_file_cached(filename: &OsStr, cache: &mut ParseCache)
+    -> (Option<VhdlParseTreeNode>, String) {
+
+    let contents = match File::open(filename) {
+        Ok(mut f) => {
+            let mut contents = Vec::new();
+            match f.read_to_end(&mut contents) {
+                Ok(_) => contents,
+                // Let the normal path produce the error message
+                Err(_) => return parse_file(filename),
+            }
+        },
+        Err(_) => return parse_file(filename),
+    };
+
+    if let Some(hit) = cache.load(&contents) {
+        return hit;
+    }
+
+    let parse_start = Instant::now();
+    let (parse_output, parse_messages) = parse_buffer(&contents);
+    cache.note_parse_time(parse_start.elapsed());
+
+    // Failed parses are cheap to redo and we never want to get stuck on a
+    // stale error, so only successes are cached.
+    if let Some(ref pt) = parse_output {
+        cache.store(&contents, pt, &parse_messages);
+    }
+
+    (parse_output, parse_messages)
+}
 
-        let errors_rs = rustify_str(errors);
+// Turns a packed tree (see VhdlParseTreeNode::serialize) back into an
+// ordinary tree. Returns None if the data is malformed. Use PackedTree
+// instead to read the data in place.
+pub fn deserialize(buf: &[u8]) -> Option<VhdlParseTreeNode> {
+    unsafe {
+        let ret = ffi::VhdlParserDeserializePT(
+            buf.as_ptr() as *const c_char, buf.len() as ffi::size_t);
 
         if ret.is_null() {
-            (None, errors_rs)
+            None
         } else {
-            // Need to Rust-ify the struct
-            (Some(rustify_node(ret, true)), errors_rs)
+            Some(rustify_node(ret, true))
         }
     }
 }
 
+// The C++ tree belongs to the root. Trees from an interning session can
+// share nodes with each other and with the session, but shared nodes are
+// never changed and their refcount is atomic, so a whole tree can be handed
+// to another thread and dropped there.
+unsafe impl Send for VhdlParseTreeNode {}
+
 impl Drop for VhdlParseTreeNode {
     fn drop(&mut self) {
         unsafe {
@@ -180,4 +638,406 @@ impl VhdlParseTreeNode {
             ffi::VhdlParseTreeNodeDebugPrint(self.raw_node);
         }
     }
+
+    // Only looks at this node; the pieces must already have fingerprints
+    fn compute_fingerprint(&self) -> u64 {
+        let mut h = Fnv1a64::new();
+        h.write(&(self.node_type as u32).to_le_bytes());
+        h.write(&(self.str1.len() as u64).to_le_bytes());
+        h.write(&self.str1);
+        h.write(&(self.str2.len() as u64).to_le_bytes());
+        h.write(&self.str2);
+        h.write(&[self.chr,
+                  self.boolean as u8,
+                  self.boolean2 as u8,
+                  self.boolean3 as u8,
+                  self.op_type as u8,
+                  self.range_dir as u8,
+                  self.force_mode as u8,
+                  self.purity as u8,
+                  self.interface_mode as u8,
+                  self.subprogram_kind as u8,
+                  self.entity_class as u8,
+                  self.signal_kind as u8]);
+        h.write(&self.integer.to_le_bytes());
+        for piece in &self.pieces {
+            match *piece {
+                Some(ref piece) => {
+                    h.write(&[1]);
+                    h.write(&piece.fingerprint.to_le_bytes());
+                },
+                None => h.write(&[0]),
+            }
+        }
+        h.finish()
+    }
+
+    // Operands of a PT_NARY_OPERATOR, in order
+    pub fn nary_operands(&self) -> Vec<&VhdlParseTreeNode> {
+        let mut ret = Vec::with_capacity(self.integer as usize);
+        self.nary_operands_into(&mut ret);
+        ret
+    }
+
+    fn nary_operands_into<'a>(&'a self, out: &mut Vec<&'a VhdlParseTreeNode>) {
+        for piece in &self.pieces {
+            match *piece {
+                Some(ref piece) if piece.node_type ==
+                    ParseTreeNodeType::PT_NARY_OPERATOR_GROUP =>
+                    piece.nary_operands_into(out),
+                Some(ref piece) => out.push(piece),
+                None => break,
+            }
+        }
+    }
+
+    // Element i of a PT_LITERAL_AGGREGATE. This is the text of a string, bit
+    // string or abstract literal, or the character of a character literal.
+    pub fn literal_aggregate_value(&self, i: usize) -> &[u8] {
+        let template = self.pieces[0].as_ref().unwrap();
+        let width = if template.node_type == ParseTreeNodeType::PT_LIT_CHAR {
+            1
+        } else {
+            template.str1.len()
+        };
+        &self.str1[i * width..(i + 1) * width]
+    }
+
+    // The ordinary PT_AGGREGATE form of a PT_LITERAL_AGGREGATE, as a new tree
+    pub fn expand_literal_aggregate(&self) -> VhdlParseTreeNode {
+        unsafe {
+            rustify_node(
+                ffi::VhdlParserExpandLiteralAggregate(self.raw_node), true)
+        }
+    }
+
+    // (formal, actual) names of each pair in a PT_SIMPLE_ASSOCIATION_LIST
+    pub fn simple_associations(&self) -> Vec<(&[u8], &[u8])> {
+        let mut names = self.str1.split(|&x| x == b' ');
+        let mut ret = Vec::with_capacity(self.integer as usize);
+        while let (Some(formal), Some(actual)) = (names.next(), names.next()) {
+            ret.push((formal, actual));
+        }
+        ret
+    }
+
+    // The ordinary PT_ASSOCIATION_LIST form of a PT_SIMPLE_ASSOCIATION_LIST,
+    // as a new tree
+    pub fn expand_simple_associations(&self) -> VhdlParseTreeNode {
+        unsafe {
+            rustify_node(
+                ffi::VhdlParserExpandSimpleAssociations(self.raw_node), true)
+        }
+    }
+
+    pub fn shift_lines(&mut self, delta: i32) {
+        unsafe {
+            ffi::VhdlParserShiftLines(self.raw_node, delta);
+        }
+        self.shift_lines_rust(delta);
+    }
+
+    // The C++ side does its own recursion, so this only updates our copy
+    fn shift_lines_rust(&mut self, delta: i32) {
+        if self.first_line >= 0 {
+            self.first_line += delta;
+        }
+        if self.last_line >= 0 {
+            self.last_line += delta;
+        }
+
+        for piece in self.pieces.iter_mut() {
+            if let Some(ref mut piece) = *piece {
+                piece.shift_lines_rust(delta);
+            }
+        }
+    }
+
+    // Same text as debug_print
+    pub fn debug_string(&self) -> String {
+        unsafe {
+            let mut len: ffi::size_t = 0;
+            let buf = ffi::VhdlParserDebugPrintPT(self.raw_node, &mut len);
+            // Anything outside of printable ASCII is escaped
+            let ret = String::from_utf8_lossy(slice::from_raw_parts(
+                buf as *const u8, len as usize)).into_owned();
+            ffi::VhdlParserFreeString(buf);
+
+            ret
+        }
+    }
+
+    // Packed binary form of this node and everything under it. The result
+    // can be read in place with PackedTree.
+    pub fn serialize(&self) -> Vec<u8> {
+        unsafe {
+            let mut len: ffi::size_t = 0;
+            let buf = ffi::VhdlParserSerializePT(self.raw_node, &mut len);
+            let ret = slice::from_raw_parts(
+                buf as *const u8, len as usize).to_vec();
+            ffi::VhdlParserFreeString(buf);
+
+            ret
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use std::env;
+    use std::fs;
+    use std::process;
+
+    const SOURCE: &'static str = "\
+library ieee;
+use ieee.std_logic_1164.all;
+
+entity a is
+    port (x : in std_logic_vector(7 downto 0);
+          y : out std_logic_vector(7 downto 0));
+end;
+
+architecture b of a is
+    signal z : std_logic_vector(7 downto 0) := (others => '0');
+begin
+    y <= x when z = x else (others => '0');
+end;
+";
+
+    #[test]
+    fn interned_tree_is_unchanged() {
+        let filename = env::temp_dir().join(
+            format!("yavhdl-intern-test-{}.vhd", process::id()));
+        fs::write(&filename, SOURCE).unwrap();
+
+        let (plain, _) = parse_file(filename.as_os_str());
+        let mut stats = InternStats::default();
+        let (interned, _) =
+            parse_file_interned(filename.as_os_str(), &mut stats);
+        fs::remove_file(&filename).unwrap();
+
+        let plain = plain.unwrap();
+        let interned = interned.unwrap();
+        assert_eq!(plain.fingerprint, interned.fingerprint);
+        assert!(plain.serialize() == interned.serialize());
+        assert!(stats.shared_nodes > 0);
+        assert!(stats.bytes_saved > 0 && stats.bytes_saved < stats.bytes_before);
+    }
+
+    #[test]
+    fn session_starts_each_parse_clean() {
+        let (plain, _) = parse_buffer(SOURCE.as_bytes());
+        let plain = plain.unwrap();
+
+        let mut session = ParseSession::new(true);
+        let (first, _) = session.parse_buffer(SOURCE.as_bytes(), 0);
+        let first_stats = session.intern_stats();
+
+        // Leaves the scanner inside a comment
+        let (pt, diagnostics) =
+            session.parse_buffer(b"entity a is\nend; /* no end", 1);
+        assert!(pt.is_some(), "{}", format_diagnostics(&diagnostics));
+        let (bad, diagnostics) = session.parse_buffer(b"\nentity 1", 2);
+        assert!(bad.is_none());
+        assert_eq!(diagnostics[0].line, 2);
+
+        let (second, diagnostics) = session.parse_buffer(SOURCE.as_bytes(), 3);
+        let stats = session.intern_stats();
+        drop(session);
+
+        let first = first.unwrap();
+        let second = second.expect(&format_diagnostics(&diagnostics));
+        assert!(first.serialize() == plain.serialize());
+        assert!(second.serialize() == plain.serialize());
+        // The second copy also shares with the first one, not just with
+        // itself
+        assert!(stats.shared_nodes - first_stats.shared_nodes >
+            first_stats.shared_nodes);
+    }
+
+    #[test]
+    fn interned_trees_can_be_dropped_anywhere() {
+        use std::thread;
+
+        let (plain, _) = parse_buffer(SOURCE.as_bytes());
+        let mut session = ParseSession::new(true);
+        // These all share nodes with each other and with the session
+        let threads: Vec<_> = (0..8).map(|i| {
+            let pt = session.parse_buffer(SOURCE.as_bytes(), i).0.unwrap();
+            thread::spawn(move || drop(pt))
+        }).collect();
+        for t in threads {
+            t.join().unwrap();
+        }
+
+        let (pt, _) = session.parse_buffer(SOURCE.as_bytes(), 8);
+        assert!(pt.unwrap().serialize() == plain.unwrap().serialize());
+    }
+
+    #[test]
+    fn diagnostics_are_structured() {
+        let mut session = ParseSession::new(false);
+        let (pt, diagnostics) = session.parse_buffer(b"\nentity 1", 7);
+        assert!(pt.is_none());
+        assert_eq!(diagnostics.len(), 2);
+
+        let syntax = &diagnostics[0];
+        assert_eq!(syntax.severity, VhdlDiagnosticSeverity::DIAG_ERROR);
+        assert_eq!(syntax.code, VhdlDiagnosticCode::DIAG_SYNTAX);
+        assert_eq!(syntax.message, VhdlDiagnosticMessage::MSG_SYNTAX_ERROR);
+        assert_eq!(syntax.file_id, 7);
+        assert_eq!(syntax.line, 2);
+        assert_eq!(syntax.bytes, Some((8, 8)));
+        assert_eq!(syntax.args, ["TOK_DECIMAL", "TOK_BASIC_ID", "TOK_EXT_ID"]);
+        assert_eq!(diagnostics[1].message,
+            VhdlDiagnosticMessage::MSG_PARSE_FAILED);
+        assert_eq!(format_diagnostics(&diagnostics),
+            "Error syntax error, unexpected TOK_DECIMAL, expecting \
+             TOK_BASIC_ID or TOK_EXT_ID on line 2\nParse error!\n");
+
+        let (_, diagnostics) =
+            session.parse_buffer(b"entity a is\nend; \"ab\ncd\"", 8);
+        assert_eq!(diagnostics[0].code, VhdlDiagnosticCode::DIAG_LEXICAL);
+        assert_eq!(diagnostics[0].message,
+            VhdlDiagnosticMessage::MSG_NEWLINE_IN_STRING);
+        // The string so far, from after the opening quote
+        assert_eq!(diagnostics[0].bytes, Some((18, 20)));
+
+        // There is no token at the end of the input
+        let (_, diagnostics) = session.parse_buffer(b"entity a is\n", 8);
+        assert_eq!(diagnostics[0].message,
+            VhdlDiagnosticMessage::MSG_SYNTAX_ERROR);
+        assert_eq!(diagnostics[0].bytes, None);
+        assert_eq!(diagnostics[0].args,
+            ["end of file", "KW_BEGIN", "KW_END"]);
+
+        let (_, diagnostics) = session.parse_file(
+            OsStr::new("/nonexistent/a.vhd"), 9);
+        assert_eq!(diagnostics.len(), 1);
+        assert_eq!(diagnostics[0].code, VhdlDiagnosticCode::DIAG_IO);
+        assert_eq!(diagnostics[0].bytes, None);
+        assert_eq!(format_diagnostics(&diagnostics),
+            "Error opening file \"/nonexistent/a.vhd\"\n");
+    }
+
+    #[test]
+    fn memory_stats_balance() {
+        let mut session = ParseSession::new(true);
+        session.enable_memory_stats();
+        let (pt, _) = session.parse_buffer(SOURCE.as_bytes(), 0);
+        assert!(pt.is_some());
+        // Everything on the parser's stacks is thrown away
+        let (pt, _) = session.parse_buffer(b"entity a is\nend; entity 1", 1);
+        assert!(pt.is_none());
+
+        let memory = session.memory_stats();
+        assert!(memory.iter().any(|x| x.node_type == "PT_BASIC_ID" &&
+            x.peak_bytes > 0 && x.discarded_nodes > 0));
+        for x in &memory {
+            assert_eq!((x.live_nodes, x.live_bytes), (0, 0), "{}", x.node_type);
+            assert!(x.peak_bytes >= x.peak_nodes * 100);
+        }
+
+        let report = memory_report(&memory);
+        let peaks: Vec<u64> = report.lines().skip(1)
+            .map(|x| x.split_whitespace().nth(2).unwrap().parse().unwrap())
+            .collect();
+        assert_eq!(peaks.len(), memory.len());
+        assert!(peaks.windows(2).all(|x| x[0] >= x[1]));
+    }
+
+    fn depth(node: &VhdlParseTreeNode) -> usize {
+        1 + node.pieces.iter().map(|x| match *x {
+            Some(ref x) => depth(x),
+            None => 0,
+        }).max().unwrap()
+    }
+
+    #[test]
+    fn long_operator_runs_are_flat() {
+        let terms: Vec<_> = (0..2000).map(|i| format!("x{}", i)).collect();
+        let source = format!("entity a is\n    constant b : c := {};\nend;\n",
+            terms.join(" & "));
+        let (pt, errors) = parse_buffer(source.as_bytes());
+        let pt = pt.expect(&errors);
+
+        // PT_DESIGN_UNIT -> PT_ENTITY -> PT_CONSTANT_DECLARATION -> expression
+        let expr = pt.pieces[0].as_ref().unwrap()
+            .pieces[2].as_ref().unwrap()
+            .pieces[2].as_ref().unwrap();
+        assert_eq!(expr.node_type, ParseTreeNodeType::PT_NARY_OPERATOR);
+        assert_eq!(expr.op_type, ParseTreeOperatorType::OP_CONCAT);
+        assert_eq!(expr.integer, 2000);
+        assert!(depth(expr) <= 6);
+
+        let operands = expr.nary_operands();
+        assert_eq!(operands.len(), 2000);
+        for (i, x) in operands.iter().enumerate() {
+            assert_eq!(x.str1, format!("x{}", i).into_bytes());
+        }
+    }
+
+    #[test]
+    fn literal_aggregates_are_dense() {
+        let values: Vec<_> = (0..1000).map(|i| format!("x\"{:02X}\"", i % 256))
+            .collect();
+        let source = format!("package a is\n    constant b : c := ({});\nend;\n",
+            values.join(", "));
+        let (pt, errors) = parse_buffer(source.as_bytes());
+        let pt = pt.expect(&errors);
+
+        // PT_DESIGN_UNIT -> PT_PACKAGE_DECLARATION -> PT_CONSTANT_DECLARATION
+        // -> aggregate
+        let agg = pt.pieces[0].as_ref().unwrap()
+            .pieces[2].as_ref().unwrap()
+            .pieces[2].as_ref().unwrap();
+        assert_eq!(agg.node_type, ParseTreeNodeType::PT_LITERAL_AGGREGATE);
+        assert_eq!(agg.integer, 1000);
+        assert_eq!(agg.literal_aggregate_value(0), b"00");
+        assert_eq!(agg.literal_aggregate_value(999),
+            format!("{:02X}", 999 % 256).as_bytes());
+
+        // The expanded list is nested with the last element on the outside
+        let expanded = agg.expand_literal_aggregate();
+        let mut node = &expanded;
+        for i in (1..1000).rev() {
+            assert_eq!(node.node_type, ParseTreeNodeType::PT_AGGREGATE);
+            let lit = node.pieces[1].as_ref().unwrap()
+                .pieces[0].as_ref().unwrap();
+            assert_eq!(lit.node_type, ParseTreeNodeType::PT_LIT_BITSTRING);
+            assert_eq!(lit.str1, format!("{:02X}", i % 256).into_bytes());
+            assert_eq!(lit.str2, b"x");
+            node = node.pieces[0].as_ref().unwrap();
+        }
+        assert_eq!(node.node_type, ParseTreeNodeType::PT_ELEMENT_ASSOCIATION);
+    }
+
+    #[test]
+    fn simple_port_maps_are_dense() {
+        let source = "architecture a of b is\nbegin\n    \
+            u0 : c port map (a => n1, b => n2, y => n3);\nend;\n";
+        let (pt, errors) = parse_buffer(source.as_bytes());
+        let pt = pt.expect(&errors);
+
+        // PT_DESIGN_UNIT -> PT_ARCHITECTURE -> PT_COMPONENT_INSTANTIATION
+        // -> PT_PORT_MAP_ASPECT -> association list
+        let list = pt.pieces[0].as_ref().unwrap()
+            .pieces[3].as_ref().unwrap()
+            .pieces[3].as_ref().unwrap()
+            .pieces[0].as_ref().unwrap();
+        assert_eq!(list.node_type,
+            ParseTreeNodeType::PT_SIMPLE_ASSOCIATION_LIST);
+        assert_eq!(list.simple_associations(), vec![
+            (&b"a"[..], &b"n1"[..]),
+            (&b"b"[..], &b"n2"[..]),
+            (&b"y"[..], &b"n3"[..])]);
+
+        let expanded = list.expand_simple_associations();
+        assert_eq!(expanded.node_type, ParseTreeNodeType::PT_ASSOCIATION_LIST);
+        let last = expanded.pieces[1].as_ref().unwrap();
+        assert_eq!(last.node_type, ParseTreeNodeType::PT_ASSOCIATION_ELEMENT);
+        assert_eq!(last.pieces[0].as_ref().unwrap().str1, b"n3");
+        assert_eq!(last.pieces[1].as_ref().unwrap().str1, b"y");
+    }
 }
@@ -0,0 +1,476 @@
+/*
+Copyright (c) 2016-2017, Robert Ou <rqou@robertou.com>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice,
+   this list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+// Zero-copy reader for the packed parse tree format (see the description in
+// vhdl_parse_tree.h). Nodes are read directly out of the underlying buffer,
+// which can be a memory-mapped file, without building any new objects.
+
+use std::fs::File;
+use std::io;
+use std::mem;
+use std::os::raw::*;
+use std::os::unix::io::AsRawFd;
+use std::path::Path;
+use std::ptr;
+use std::slice;
+
+use parser::ffi;
+use parser::*;
+
+const PACKED_TREE_MAGIC: &'static [u8; 4] = b"YVPT";
+
+fn get_u16(buf: &[u8], pos: usize) -> u16 {
+    (buf[pos] as u16) | ((buf[pos + 1] as u16) << 8)
+}
+
+fn get_u32(buf: &[u8], pos: usize) -> u32 {
+    (buf[pos] as u32) |
+    ((buf[pos + 1] as u32) << 8) |
+    ((buf[pos + 2] as u32) << 16) |
+    ((buf[pos + 3] as u32) << 24)
+}
+
+#[derive(Copy, Clone)]
+pub struct PackedTree<'a> {
+    nodes: &'a [u8],
+    strings: &'a [u8],
+    node_count: u32,
+    root: u32,
+}
+
+#[derive(Copy, Clone)]
+pub struct PackedNode<'a> {
+    tree: PackedTree<'a>,
+    idx: u32,
+    rec: &'a [u8],
+}
+
+impl<'a> PackedTree<'a> {
+    // Checks the header and every node record once up front (bounds, enum
+    // ranges, child ordering and that no node has two parents), so that the
+    // accessors below never have to and walking the tree never visits a node
+    // twice. The only thing allocated is one bit per node.
+    pub fn new(buf: &'a [u8]) -> Option<PackedTree<'a>> {
+        let header_size = ffi::PACKED_TREE_HEADER_SIZE as usize;
+        let node_size = ffi::PACKED_NODE_SIZE as usize;
+
+        if buf.len() < header_size ||
+            &buf[0..4] != PACKED_TREE_MAGIC ||
+            get_u32(buf, 4) != ffi::PACKED_TREE_VERSION {
+            return None;
+        }
+
+        let node_count = get_u32(buf, 8);
+        let root = get_u32(buf, 12);
+        let nodes_off = get_u32(buf, 16) as usize;
+        let strings_off = get_u32(buf, 20) as usize;
+        let strings_len = get_u32(buf, 24) as usize;
+        if root >= node_count ||
+            nodes_off < header_size ||
+            nodes_off > buf.len() ||
+            (buf.len() - nodes_off) / node_size < node_count as usize ||
+            strings_off > buf.len() ||
+            strings_len > buf.len() - strings_off {
+            return None;
+        }
+
+        let tree = PackedTree {
+            nodes: &buf[nodes_off..nodes_off + node_count as usize * node_size],
+            strings: &buf[strings_off..strings_off + strings_len],
+            node_count: node_count,
+            root: root,
+        };
+
+        let mut has_parent = vec![0u64; (node_count as usize + 63) / 64];
+        for idx in 0..node_count {
+            if !tree.record_ok(idx, &mut has_parent) {
+                return None;
+            }
+        }
+
+        Some(tree)
+    }
+
+    fn record_ok(&self, idx: u32, has_parent: &mut [u64]) -> bool {
+        let node_size = ffi::PACKED_NODE_SIZE as usize;
+        let rec = &self.nodes[idx as usize * node_size..][..node_size];
+
+        if get_u16(rec, 0) as u32 > ParseTreeNodeType::PT_DESIGN_FILE as u32 ||
+            rec[4] as u32 > ParseTreeOperatorType::OP_NOT as u32 ||
+            rec[5] as u32 > ParseTreeRangeDirection::RANGE_UP as u32 ||
+            rec[6] as u32 > ParseTreeForceMode::FORCE_OUT as u32 ||
+            rec[7] as u32 > ParseTreeFunctionPurity::PURITY_IMPURE as u32 ||
+            rec[8] as u32 >
+                ParseTreeInterfaceObjectMode::MODE_LINKAGE as u32 ||
+            rec[9] as u32 >
+                ParseTreeSubprogramKind::SUBPROGRAM_FUNCTION as u32 ||
+            rec[10] as u32 > ParseTreeEntityClass::ENTITY_SEQUENCE as u32 ||
+            rec[11] as u32 > ParseTreeSignalKind::SIGKIND_BUS as u32 {
+            return false;
+        }
+
+        let flags = rec[3] as u32;
+        for &(flag, off) in &[(ffi::PACKED_FLAG_HAS_STR, 32),
+                              (ffi::PACKED_FLAG_HAS_STR2, 40)] {
+            if flags & flag != 0 {
+                let str_off = get_u32(rec, off) as usize;
+                let str_len = get_u32(rec, off + 4) as usize;
+                if str_off > self.strings.len() ||
+                    str_len > self.strings.len() - str_off {
+                    return false;
+                }
+            }
+        }
+
+        for i in 0..ffi::NUM_FIXED_PIECES as usize {
+            let child_idx = get_u32(rec, 48 + i * 4);
+            // Children always come after their parents, so this also rules
+            // out cycles
+            if child_idx == ffi::PACKED_NO_NODE {
+                continue;
+            }
+            if child_idx <= idx || child_idx >= self.node_count {
+                return false;
+            }
+            // Otherwise a small image could stand for a huge tree
+            let (word, bit) = (child_idx as usize / 64, child_idx % 64);
+            if has_parent[word] & (1 << bit) != 0 {
+                return false;
+            }
+            has_parent[word] |= 1 << bit;
+        }
+
+        true
+    }
+
+    pub fn node_count(&self) -> u32 {
+        self.node_count
+    }
+
+    pub fn root(&self) -> PackedNode<'a> {
+        self.node(self.root)
+    }
+
+    fn node(&self, idx: u32) -> PackedNode<'a> {
+        let node_size = ffi::PACKED_NODE_SIZE as usize;
+        PackedNode {
+            tree: *self,
+            idx: idx,
+            rec: &self.nodes[idx as usize * node_size..][..node_size],
+        }
+    }
+}
+
+// The enum fields were range-checked in PackedTree::new, and all of these
+// enums are repr(u32) with contiguous values starting from zero.
+macro_rules! packed_enum_getter {
+    ($name:ident, $t:ty, $off:expr) => {
+        pub fn $name(&self) -> $t {
+            unsafe { mem::transmute::<u32, $t>(self.rec[$off] as u32) }
+        }
+    }
+}
+
+impl<'a> PackedNode<'a> {
+    pub fn index(&self) -> u32 {
+        self.idx
+    }
+
+    pub fn node_type(&self) -> ParseTreeNodeType {
+        unsafe {
+            mem::transmute::<u32, ParseTreeNodeType>(
+                get_u16(self.rec, 0) as u32)
+        }
+    }
+
+    fn get_str(&self, flag: u32, off: usize) -> &'a [u8] {
+        if (self.rec[3] as u32) & flag == 0 {
+            return &[];
+        }
+
+        let str_off = get_u32(self.rec, off) as usize;
+        let str_len = get_u32(self.rec, off + 4) as usize;
+        &self.tree.strings[str_off..str_off + str_len]
+    }
+
+    // Missing strings read as empty, same as in VhdlParseTreeNode
+    pub fn str1(&self) -> &'a [u8] {
+        self.get_str(ffi::PACKED_FLAG_HAS_STR, 32)
+    }
+
+    pub fn str2(&self) -> &'a [u8] {
+        self.get_str(ffi::PACKED_FLAG_HAS_STR2, 40)
+    }
+
+    pub fn chr(&self) -> u8 {
+        self.rec[2]
+    }
+
+    pub fn integer(&self) -> i32 {
+        get_u32(self.rec, 12) as i32
+    }
+
+    pub fn boolean(&self) -> bool {
+        (self.rec[3] as u32) & ffi::PACKED_FLAG_BOOLEAN != 0
+    }
+
+    pub fn boolean2(&self) -> bool {
+        (self.rec[3] as u32) & ffi::PACKED_FLAG_BOOLEAN2 != 0
+    }
+
+    pub fn boolean3(&self) -> bool {
+        (self.rec[3] as u32) & ffi::PACKED_FLAG_BOOLEAN3 != 0
+    }
+
+    packed_enum_getter!(op_type, ParseTreeOperatorType, 4);
+    packed_enum_getter!(range_dir, ParseTreeRangeDirection, 5);
+    packed_enum_getter!(force_mode, ParseTreeForceMode, 6);
+    packed_enum_getter!(purity, ParseTreeFunctionPurity, 7);
+    packed_enum_getter!(interface_mode, ParseTreeInterfaceObjectMode, 8);
+    packed_enum_getter!(subprogram_kind, ParseTreeSubprogramKind, 9);
+    packed_enum_getter!(entity_class, ParseTreeEntityClass, 10);
+    packed_enum_getter!(signal_kind, ParseTreeSignalKind, 11);
+
+    pub fn first_line(&self) -> i32 {
+        get_u32(self.rec, 16) as i32
+    }
+
+    pub fn first_column(&self) -> i32 {
+        get_u32(self.rec, 20) as i32
+    }
+
+    pub fn last_line(&self) -> i32 {
+        get_u32(self.rec, 24) as i32
+    }
+
+    pub fn last_column(&self) -> i32 {
+        get_u32(self.rec, 28) as i32
+    }
+
+    pub fn piece(&self, i: usize) -> Option<PackedNode<'a>> {
+        assert!(i < ffi::NUM_FIXED_PIECES as usize);
+        let child_idx = get_u32(self.rec, 48 + i * 4);
+        if child_idx == ffi::PACKED_NO_NODE {
+            None
+        } else {
+            Some(self.tree.node(child_idx))
+        }
+    }
+
+    // Compares against an ordinary tree, field by field
+    pub fn matches(&self, other: &VhdlParseTreeNode) -> bool {
+        if self.node_type() != other.node_type ||
+            self.str1() != &other.str1[..] ||
+            self.str2() != &other.str2[..] ||
+            self.chr() != other.chr ||
+            self.integer() != other.integer ||
+            self.boolean() != other.boolean ||
+            self.boolean2() != other.boolean2 ||
+            self.boolean3() != other.boolean3 ||
+            self.op_type() != other.op_type ||
+            self.range_dir() != other.range_dir ||
+            self.force_mode() != other.force_mode ||
+            self.purity() != other.purity ||
+            self.interface_mode() != other.interface_mode ||
+            self.subprogram_kind() != other.subprogram_kind ||
+            self.entity_class() != other.entity_class ||
+            self.signal_kind() != other.signal_kind ||
+            self.first_line() != other.first_line ||
+            self.first_column() != other.first_column ||
+            self.last_line() != other.last_line ||
+            self.last_column() != other.last_column {
+            return false;
+        }
+
+        for i in 0..ffi::NUM_FIXED_PIECES as usize {
+            match (self.piece(i), &other.pieces[i]) {
+                (None, &None) => {},
+                (Some(x), &Some(ref y)) => if !x.matches(y) {
+                    return false;
+                },
+                _ => return false,
+            }
+        }
+
+        true
+    }
+}
+
+// Read-only memory mapping of a whole file
+pub struct MappedFile {
+    ptr: *mut c_void,
+    len: usize,
+}
+
+extern "C" {
+    fn mmap(addr: *mut c_void, len: usize, prot: c_int, flags: c_int,
+        fd: c_int, offset: i64) -> *mut c_void;
+    fn munmap(addr: *mut c_void, len: usize) -> c_int;
+}
+
+const PROT_READ: c_int = 1;
+const MAP_PRIVATE: c_int = 2;
+
+impl MappedFile {
+    pub fn open(path: &Path) -> io::Result<MappedFile> {
+        let f = File::open(path)?;
+        let len = f.metadata()?.len() as usize;
+
+        // Mapping zero bytes is an error, but an empty file is not
+        if len == 0 {
+            return Ok(MappedFile {ptr: ptr::null_mut(), len: 0});
+        }
+
+        let ptr = unsafe {
+            mmap(ptr::null_mut(), len, PROT_READ, MAP_PRIVATE,
+                f.as_raw_fd(), 0)
+        };
+        if ptr as isize == -1 {
+            return Err(io::Error::last_os_error());
+        }
+
+        Ok(MappedFile {ptr: ptr, len: len})
+    }
+
+    pub fn bytes(&self) -> &[u8] {
+        if self.len == 0 {
+            &[]
+        } else {
+            unsafe { slice::from_raw_parts(self.ptr as *const u8, self.len) }
+        }
+    }
+}
+
+// The mapping is read-only, so it can be used from any thread
+unsafe impl Send for MappedFile {}
+unsafe impl Sync for MappedFile {}
+
+impl Drop for MappedFile {
+    fn drop(&mut self) {
+        if self.len != 0 {
+            unsafe {
+                munmap(self.ptr, self.len);
+            }
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn put_u32(out: &mut Vec<u8>, x: u32) {
+        out.push(x as u8);
+        out.push((x >> 8) as u8);
+        out.push((x >> 16) as u8);
+        out.push((x >> 24) as u8);
+    }
+
+    // A PT_NAME_SELECTED node with two PT_BASIC_ID children, both of which
+    // use the same interned string
+    fn make_image(child_idx: u32) -> Vec<u8> {
+        let mut img = Vec::new();
+        img.extend_from_slice(b"YVPT");
+        put_u32(&mut img, ffi::PACKED_TREE_VERSION);
+        put_u32(&mut img, 3);
+        put_u32(&mut img, 0);
+        put_u32(&mut img, ffi::PACKED_TREE_HEADER_SIZE);
+        put_u32(&mut img, ffi::PACKED_TREE_HEADER_SIZE +
+                          3 * ffi::PACKED_NODE_SIZE);
+        put_u32(&mut img, 3);
+        put_u32(&mut img, 0);
+
+        for &(node_type, children) in &[
+            (ParseTreeNodeType::PT_NAME_SELECTED, [1, child_idx]),
+            (ParseTreeNodeType::PT_BASIC_ID, [!0, !0]),
+            (ParseTreeNodeType::PT_BASIC_ID, [!0, !0])] {
+
+            let start = img.len();
+            img.push(node_type as u8);
+            img.push((node_type as u32 >> 8) as u8);
+            img.push(0);
+            img.push(if children[0] == !0 {
+                ffi::PACKED_FLAG_HAS_STR as u8
+            } else {
+                0
+            });
+            img.extend_from_slice(&[0; 8]);
+            put_u32(&mut img, 0);
+            for _ in 0..4 {
+                put_u32(&mut img, 1);
+            }
+            put_u32(&mut img, 0);
+            put_u32(&mut img, 3);
+            put_u32(&mut img, 0);
+            put_u32(&mut img, 0);
+            for i in 0..ffi::NUM_FIXED_PIECES as usize {
+                put_u32(&mut img, if i < 2 {children[i]} else {!0});
+            }
+            assert_eq!(img.len() - start, ffi::PACKED_NODE_SIZE as usize);
+        }
+
+        img.extend_from_slice(b"foo");
+        img
+    }
+
+    #[test]
+    fn packed_tree_reads_in_place() {
+        let img = make_image(2);
+        let tree = PackedTree::new(&img).unwrap();
+        assert_eq!(tree.node_count(), 3);
+
+        let root = tree.root();
+        assert_eq!(root.node_type(), ParseTreeNodeType::PT_NAME_SELECTED);
+        assert_eq!(root.str1(), b"");
+        assert_eq!(root.first_line(), 1);
+        let x = root.piece(0).unwrap();
+        let y = root.piece(1).unwrap();
+        assert!(root.piece(2).is_none());
+        assert_eq!(x.node_type(), ParseTreeNodeType::PT_BASIC_ID);
+        assert_eq!(x.str1(), b"foo");
+        assert_eq!(y.str1(), b"foo");
+        assert_eq!(x.str1().as_ptr(), y.str1().as_ptr());
+    }
+
+    #[test]
+    fn packed_tree_rejects_bad_images() {
+        let img = make_image(2);
+        assert!(PackedTree::new(&img[..img.len() - 1]).is_none());
+
+        // Children must come after their parents
+        assert!(PackedTree::new(&make_image(0)).is_none());
+        // Children must exist
+        assert!(PackedTree::new(&make_image(3)).is_none());
+        // No node can be the child of two nodes (or twice of the same one)
+        assert!(PackedTree::new(&make_image(1)).is_none());
+        assert!(deserialize(&make_image(1)).is_none());
+        assert!(deserialize(&img).is_some());
+
+        let mut bad_type = img.clone();
+        bad_type[ffi::PACKED_TREE_HEADER_SIZE as usize] = 0xff;
+        bad_type[ffi::PACKED_TREE_HEADER_SIZE as usize + 1] = 0xff;
+        assert!(PackedTree::new(&bad_type).is_none());
+    }
+}
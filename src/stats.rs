@@ -0,0 +1,196 @@
+/*
+Copyright (c) 2016-2017, Robert Ou <rqou@robertou.com>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice,
+   this list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+// Phase timings and counters for the --stats and --stats-json options of the
+// binaries. Nothing is measured unless stats were asked for.
+
+use std::fmt::Write;
+use std::time::{Duration, Instant};
+
+use parser::{peak_rss_bytes, ParseStats};
+
+fn duration_us(d: Duration) -> f64 {
+    d.as_secs() as f64 * 1e6 + d.subsec_nanos() as f64 / 1e3
+}
+
+pub struct RunStats {
+    enabled: bool,
+    // Both of these are kept in the order things were first added
+    phases: Vec<(&'static str, Duration)>,
+    counters: Vec<(&'static str, u64)>,
+    nodes_by_type: Vec<(String, u64)>,
+}
+
+impl RunStats {
+    pub fn new(enabled: bool) -> RunStats {
+        RunStats {
+            enabled: enabled,
+            phases: Vec::new(),
+            counters: Vec::new(),
+            nodes_by_type: Vec::new(),
+        }
+    }
+
+    pub fn enabled(&self) -> bool {
+        self.enabled
+    }
+
+    // Runs f, adding the time it took to the given phase
+    pub fn time<T, F: FnOnce() -> T>(&mut self, phase: &'static str, f: F)
+        -> T {
+
+        if !self.enabled {
+            return f();
+        }
+
+        let start = Instant::now();
+        let ret = f();
+        self.add_time(phase, start.elapsed());
+        ret
+    }
+
+    pub fn add_time(&mut self, phase: &'static str, d: Duration) {
+        if !self.enabled {
+            return;
+        }
+
+        match self.phases.iter_mut().find(|x| x.0 == phase) {
+            Some(x) => x.1 += d,
+            None => self.phases.push((phase, d)),
+        }
+    }
+
+    pub fn add_count(&mut self, name: &'static str, n: u64) {
+        if !self.enabled {
+            return;
+        }
+
+        match self.counters.iter_mut().find(|x| x.0 == name) {
+            Some(x) => x.1 += n,
+            None => self.counters.push((name, n)),
+        }
+    }
+
+    // Adds the stats of a whole ParseSession. This should only be done once
+    // per session because the session's stats are already totals.
+    pub fn add_parse_stats(&mut self, x: &ParseStats) {
+        if !self.enabled {
+            return;
+        }
+
+        self.add_time("lex", x.lex_time);
+        self.add_time("parse", x.parse_time);
+        self.add_time("glr cleanup", x.cleanup_time);
+        self.add_time("tree conversion", x.rustify_time);
+        self.add_count("tokens", x.tokens);
+        self.add_count("nodes", x.nodes);
+        self.add_count("tree bytes", x.tree_bytes);
+        for &(ref name, count) in &x.nodes_by_type {
+            match self.nodes_by_type.iter_mut().find(|y| &y.0 == name) {
+                Some(y) => y.1 += count,
+                None => self.nodes_by_type.push((name.clone(), count)),
+            }
+        }
+    }
+
+    fn sorted_nodes_by_type(&self) -> Vec<&(String, u64)> {
+        let mut ret: Vec<_> = self.nodes_by_type.iter().collect();
+        ret.sort_by(|a, b| b.1.cmp(&a.1).then(a.0.cmp(&b.0)));
+        ret
+    }
+
+    pub fn report(&self) -> String {
+        let mut s = String::new();
+        for &(name, d) in &self.phases {
+            write!(s, "Stats: {}: {:.1} us\n", name, duration_us(d)).unwrap();
+        }
+        for &(name, n) in &self.counters {
+            write!(s, "Stats: {}: {}\n", name, n).unwrap();
+        }
+        write!(s, "Stats: peak RSS: {} bytes\n", peak_rss_bytes()).unwrap();
+        if !self.nodes_by_type.is_empty() {
+            s.push_str("Stats: nodes by type:\n");
+            for &&(ref name, n) in &self.sorted_nodes_by_type() {
+                write!(s, "Stats:     {}: {}\n", name, n).unwrap();
+            }
+        }
+        s
+    }
+
+    // Same information as report, as a single line of JSON
+    pub fn report_json(&self) -> String {
+        let mut s = String::new();
+        s.push_str("{\"phases_us\": {");
+        for (i, &(name, d)) in self.phases.iter().enumerate() {
+            write!(s, "{}\"{}\": {:.1}", if i == 0 {""} else {", "}, name,
+                duration_us(d)).unwrap();
+        }
+        s.push_str("}, \"counters\": {");
+        for (i, &(name, n)) in self.counters.iter().enumerate() {
+            write!(s, "{}\"{}\": {}", if i == 0 {""} else {", "}, name, n)
+                .unwrap();
+        }
+        write!(s, "}}, \"peak_rss_bytes\": {}, \"nodes_by_type\": {{",
+            peak_rss_bytes()).unwrap();
+        for (i, &&(ref name, n)) in
+            self.sorted_nodes_by_type().iter().enumerate() {
+
+            write!(s, "{}\"{}\": {}", if i == 0 {""} else {", "}, name, n)
+                .unwrap();
+        }
+        s.push_str("}}\n");
+        s
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn disabled_stats_record_nothing() {
+        let mut stats = RunStats::new(false);
+        assert_eq!(stats.time("parse", || 1 + 1), 2);
+        stats.add_count("tokens", 5);
+        assert!(stats.phases.is_empty() && stats.counters.is_empty());
+    }
+
+    #[test]
+    fn stats_add_up() {
+        let mut stats = RunStats::new(true);
+        stats.add_time("parse", Duration::new(0, 1000));
+        stats.add_time("print", Duration::new(0, 500));
+        stats.add_time("parse", Duration::new(0, 1000));
+        stats.add_count("tokens", 5);
+        stats.add_count("tokens", 7);
+        assert_eq!(stats.phases,
+            [("parse", Duration::new(0, 2000)),
+             ("print", Duration::new(0, 500))]);
+        assert_eq!(stats.counters, [("tokens", 12)]);
+        assert!(stats.report_json().starts_with(
+            "{\"phases_us\": {\"parse\": 2.0, \"print\": 0.5}, \
+             \"counters\": {\"tokens\": 12}, \"peak_rss_bytes\": "));
+    }
+}
@@ -0,0 +1,351 @@
+/*
+Copyright (c) 2016-2017, Robert Ou <rqou@robertou.com>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice,
+   this list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+// Waits for files to change, for vhdl_analyzer --watch. This uses inotify
+// directly. The directories containing the files are watched rather than
+// the files themselves, because editors often save by writing a new file
+// and renaming it over the old one.
+
+use std::collections::{BTreeSet, HashMap};
+use std::ffi::{CString, OsStr, OsString};
+use std::fs::File;
+use std::io;
+use std::io::Read;
+use std::os::raw::{c_char, c_int, c_short, c_ulong};
+use std::os::unix::ffi::OsStrExt;
+use std::os::unix::io::{AsRawFd, FromRawFd};
+use std::path::Path;
+use std::time::{Duration, Instant};
+
+#[repr(C)]
+struct PollFd {
+    fd: c_int,
+    events: c_short,
+    revents: c_short,
+}
+
+extern "C" {
+    fn inotify_init1(flags: c_int) -> c_int;
+    fn inotify_add_watch(fd: c_int, pathname: *const c_char, mask: u32)
+        -> c_int;
+    fn poll(fds: *mut PollFd, nfds: c_ulong, timeout: c_int) -> c_int;
+}
+
+const IN_CLOEXEC: c_int = 0o2000000;
+const IN_MODIFY: u32 = 0x002;
+const IN_CLOSE_WRITE: u32 = 0x008;
+const IN_MOVED_TO: u32 = 0x080;
+const IN_CREATE: u32 = 0x100;
+const IN_DELETE: u32 = 0x200;
+const IN_Q_OVERFLOW: u32 = 0x4000;
+const IN_IGNORED: u32 = 0x8000;
+const WATCH_MASK: u32 =
+    IN_MODIFY | IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_DELETE;
+const POLLIN: c_short = 1;
+
+// Size of struct inotify_event without the name
+const EVENT_HEADER_SIZE: usize = 16;
+
+pub struct FileWatcher {
+    inotify: File,
+    // (watch descriptor, name in the directory) -> file name as it was given
+    files: HashMap<(i32, OsString), OsString>,
+    // Watch descriptor -> directory, for watching it again (see read_events)
+    dirs: HashMap<i32, OsString>,
+}
+
+fn add_dir_watch(fd: c_int, dir: &OsStr) -> io::Result<i32> {
+    let dir_c = CString::new(dir.as_bytes()).map_err(|_|
+        io::Error::new(io::ErrorKind::InvalidInput, "NUL in file name"))?;
+    let wd = unsafe { inotify_add_watch(fd, dir_c.as_ptr(), WATCH_MASK) };
+    if wd < 0 {
+        return Err(io::Error::last_os_error());
+    }
+    Ok(wd)
+}
+
+impl FileWatcher {
+    pub fn new(files: &[OsString]) -> io::Result<FileWatcher> {
+        let fd = unsafe { inotify_init1(IN_CLOEXEC) };
+        if fd < 0 {
+            return Err(io::Error::last_os_error());
+        }
+        let inotify = unsafe { File::from_raw_fd(fd) };
+
+        let mut dir_wds = HashMap::new();
+        let mut watched = HashMap::new();
+        for filename in files {
+            let path = Path::new(filename);
+            let name = match path.file_name() {
+                Some(x) => x.to_owned(),
+                None => return Err(io::Error::new(io::ErrorKind::InvalidInput,
+                    format!("\"{}\" is not a file name",
+                        filename.to_string_lossy()))),
+            };
+            let dir = match path.parent() {
+                Some(x) if x != Path::new("") => x.as_os_str().to_owned(),
+                _ => OsString::from("."),
+            };
+
+            let wd = match dir_wds.get(&dir) {
+                Some(&wd) => wd,
+                None => {
+                    let wd = add_dir_watch(fd, &dir)?;
+                    dir_wds.insert(dir, wd);
+                    wd
+                }
+            };
+            watched.insert((wd, name), filename.clone());
+        }
+
+        Ok(FileWatcher {
+            inotify: inotify,
+            files: watched,
+            dirs: dir_wds.into_iter().map(|(dir, wd)| (wd, dir)).collect(),
+        })
+    }
+
+    // Watches a directory again after the kernel dropped its watch. Its
+    // files are counted as changed, since the directory may have been
+    // deleted and made again.
+    fn rewatch_dir(&mut self, old_wd: i32, changed: &mut BTreeSet<OsString>)
+        -> io::Result<()> {
+
+        let dir = match self.dirs.remove(&old_wd) {
+            Some(x) => x,
+            // Already done, under another name for the same directory
+            None => return Ok(()),
+        };
+        let wd = add_dir_watch(self.inotify.as_raw_fd(), &dir).map_err(|e|
+            io::Error::new(e.kind(), format!("Could not watch \"{}\" again: \
+                {}", dir.to_string_lossy(), e)))?;
+        self.dirs.insert(wd, dir);
+
+        let moved: Vec<_> = self.files.keys()
+            .filter(|x| x.0 == old_wd).cloned().collect();
+        for key in moved {
+            let filename = self.files.remove(&key).unwrap();
+            changed.insert(filename.clone());
+            self.files.insert((wd, key.1), filename);
+        }
+        Ok(())
+    }
+
+    // Waits up to timeout (forever if None) for inotify to have something
+    fn wait_readable(&self, timeout: Option<Duration>) -> io::Result<bool> {
+        let timeout_ms = match timeout {
+            Some(x) => {
+                let ms = x.as_secs() * 1000 + (x.subsec_nanos() as u64 +
+                    999999) / 1000000;
+                if ms > c_int::max_value() as u64 {
+                    c_int::max_value()
+                } else {
+                    ms as c_int
+                }
+            },
+            None => -1,
+        };
+        let mut pfd = PollFd {
+            fd: self.inotify.as_raw_fd(),
+            events: POLLIN,
+            revents: 0,
+        };
+        loop {
+            let ret = unsafe { poll(&mut pfd, 1, timeout_ms) };
+            if ret >= 0 {
+                return Ok(ret > 0);
+            }
+            let err = io::Error::last_os_error();
+            if err.kind() != io::ErrorKind::Interrupted {
+                return Err(err);
+            }
+        }
+    }
+
+    // Reads the events that are ready, and adds the watched files they are
+    // about to the changed set. If the kernel's event queue overflowed, events
+    // were lost, so every file counts as changed. If a directory's watch was
+    // dropped (e.g. because the directory was deleted), it is watched
+    // again, or an error is returned if that isn't possible.
+    fn read_events(&mut self, changed: &mut BTreeSet<OsString>)
+        -> io::Result<()> {
+
+        let mut buf = [0u8; 16384];
+        let len = self.inotify.read(&mut buf)?;
+        let mut pos = 0;
+        while pos + EVENT_HEADER_SIZE <= len {
+            let mut word = [0u8; 4];
+            word.copy_from_slice(&buf[pos..pos + 4]);
+            let wd = i32::from_ne_bytes(word);
+            word.copy_from_slice(&buf[pos + 4..pos + 8]);
+            let mask = u32::from_ne_bytes(word);
+            word.copy_from_slice(&buf[pos + 12..pos + 16]);
+            let name_len = u32::from_ne_bytes(word) as usize;
+
+            // The name is padded with NULs
+            let name = &buf[pos + EVENT_HEADER_SIZE..
+                pos + EVENT_HEADER_SIZE + name_len];
+            let name = match name.iter().position(|&x| x == 0) {
+                Some(end) => &name[..end],
+                None => name,
+            };
+            pos += EVENT_HEADER_SIZE + name_len;
+
+            if mask & IN_Q_OVERFLOW != 0 {
+                changed.extend(self.files.values().cloned());
+                continue;
+            }
+            if mask & IN_IGNORED != 0 {
+                self.rewatch_dir(wd, changed)?;
+                continue;
+            }
+            let key = (wd, OsStr::from_bytes(name).to_owned());
+            if let Some(filename) = self.files.get(&key) {
+                changed.insert(filename.clone());
+            }
+        }
+        Ok(())
+    }
+
+    // Blocks until at least one watched file changes, then keeps collecting
+    // changes until there have been none for the debounce time. Returns the
+    // files that changed, and when the first change was seen.
+    pub fn wait(&mut self, debounce: Duration)
+        -> io::Result<(Vec<OsString>, Instant)> {
+
+        let mut changed = BTreeSet::new();
+        while changed.is_empty() {
+            self.wait_readable(None)?;
+            self.read_events(&mut changed)?;
+        }
+        let first_change = Instant::now();
+
+        while self.wait_readable(Some(debounce))? {
+            self.read_events(&mut changed)?;
+        }
+
+        Ok((changed.into_iter().collect(), first_change))
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use std::env;
+    use std::fs;
+    use std::process;
+    use std::thread;
+
+    #[test]
+    fn watcher_sees_saves() {
+        let dir = env::temp_dir().join(
+            format!("yavhdl-watch-test-{}", process::id()));
+        fs::create_dir_all(&dir).unwrap();
+        let a = dir.join("a.vhd");
+        let b = dir.join("b.vhd");
+        fs::write(&a, "").unwrap();
+        fs::write(&b, "").unwrap();
+
+        let files = vec![a.clone().into_os_string()];
+        let mut watcher = FileWatcher::new(&files).unwrap();
+
+        let writer = {
+            let a = a.clone();
+            let b = b.clone();
+            let tmp = dir.join("a.vhd.tmp");
+            thread::spawn(move || {
+                // Not watched
+                fs::write(&b, "x").unwrap();
+                // Saved in place, then saved by renaming over it
+                fs::write(&a, "x").unwrap();
+                fs::write(&tmp, "y").unwrap();
+                fs::rename(&tmp, &a).unwrap();
+            })
+        };
+
+        let (changed, _) = watcher.wait(Duration::from_millis(100)).unwrap();
+        writer.join().unwrap();
+        fs::remove_dir_all(&dir).unwrap();
+        assert_eq!(changed, files);
+    }
+
+    #[test]
+    fn watcher_follows_new_directory() {
+        let dir = env::temp_dir().join(
+            format!("yavhdl-watch-test-dir-{}", process::id()));
+        let sub = dir.join("sub");
+        fs::create_dir_all(&sub).unwrap();
+        let a = sub.join("a.vhd");
+        fs::write(&a, "").unwrap();
+
+        let files = vec![a.clone().into_os_string()];
+        let mut watcher = FileWatcher::new(&files).unwrap();
+        fs::remove_dir_all(&sub).unwrap();
+        fs::create_dir(&sub).unwrap();
+        fs::write(&a, "x").unwrap();
+        let (changed, _) = watcher.wait(Duration::from_millis(100)).unwrap();
+        assert_eq!(changed, files);
+
+        // Changes in the new directory are seen too
+        let writer = {
+            let a = a.clone();
+            thread::spawn(move || fs::write(&a, "y").unwrap())
+        };
+        let (changed, _) = watcher.wait(Duration::from_millis(100)).unwrap();
+        writer.join().unwrap();
+        assert_eq!(changed, files);
+
+        // Once the directory is gone for good, that is an error
+        fs::remove_dir_all(&sub).unwrap();
+        assert!(watcher.wait(Duration::from_millis(100)).is_err());
+        fs::remove_dir_all(&dir).unwrap();
+    }
+
+    #[test]
+    fn watcher_overflow_changes_everything() {
+        let dir = env::temp_dir().join(
+            format!("yavhdl-watch-test-overflow-{}", process::id()));
+        fs::create_dir_all(&dir).unwrap();
+        let a = dir.join("a.vhd");
+        let b = dir.join("b.vhd");
+        let c = dir.join("c.vhd");
+        fs::write(&a, "").unwrap();
+
+        let files = vec![a.clone().into_os_string()];
+        let mut watcher = FileWatcher::new(&files).unwrap();
+        // Alternating between two files keeps the kernel from merging
+        // events, so the queue fills up without a being touched
+        let max_events: usize = fs::read_to_string(
+            "/proc/sys/fs/inotify/max_queued_events").ok()
+            .and_then(|x| x.trim().parse().ok()).unwrap_or(16384);
+        for _ in 0..max_events / 2 + 1 {
+            fs::write(&b, "x").unwrap();
+            fs::write(&c, "x").unwrap();
+        }
+        let (changed, _) = watcher.wait(Duration::from_millis(100)).unwrap();
+        fs::remove_dir_all(&dir).unwrap();
+        assert_eq!(changed, files);
+    }
+}
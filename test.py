@@ -6,6 +6,7 @@ import os
 import os.path
 import subprocess
 import sys
+import tempfile
 import traceback
 
 
@@ -32,12 +33,7 @@ def do_set_hack(x):
         return x
 
 
-def do_parser_tests():
-    print("*" * 80)
-    print("Running parser tests...")
-    print("*" * 80)
-
-    # Gather tests
+def find_parser_tests():
     test_files = os.listdir("parser_tests")
     test_files_real = []
     test_files_set = set()
@@ -58,6 +54,17 @@ def do_parser_tests():
                 test_files_set.add(name)
 
     print("Found " + str(len(test_files_real)) + " tests")
+    return test_files_real
+
+
+def do_parser_tests(extra_args=[]):
+    print("*" * 80)
+    print("Running parser tests" +
+          (" (" + " ".join(extra_args) + ")" if extra_args else "") + "...")
+    print("*" * 80)
+
+    # Gather tests
+    test_files_real = find_parser_tests()
 
     # Run each test
     failures = False
@@ -68,7 +75,7 @@ def do_parser_tests():
             print(base_name + " (expect fail): ", end='')
 
         # Run parser
-        subp = subprocess.run(['./vhdl_parser', vhd_file],
+        subp = subprocess.run(['./vhdl_parser'] + extra_args + [vhd_file],
                               stdout=subprocess.PIPE,
                               stderr=subprocess.PIPE)
 
@@ -142,6 +149,62 @@ def do_parser_tests():
     return failures
 
 
+# The same tests, all parsed by one process in batch mode
+def do_parser_batch_tests():
+    print("*" * 80)
+    print("Running parser tests (--batch)...")
+    print("*" * 80)
+
+    test_files_real = find_parser_tests()
+    subp = subprocess.run(['./vhdl_parser', '--batch', '--jobs', '4',
+                           '--tree'] +
+                          [vhd_file for vhd_file, _, _ in test_files_real],
+                          stdout=subprocess.PIPE,
+                          stderr=subprocess.PIPE)
+    try:
+        results = [json.loads(x) for x in
+                   subp.stdout.decode('ascii').splitlines()]
+    except Exception:
+        results = []
+    if len(results) != len(test_files_real):
+        print("\x1b[31m✗")
+        print("Bad parser output!\x1b[0m")
+        print("\x1b[33m----- stdout -----\x1b[0m")
+        sys.stdout.buffer.write(subp.stdout)
+        print("\x1b[33m----- stderr -----\x1b[0m")
+        sys.stdout.buffer.write(subp.stderr)
+        return True
+
+    failures = False
+    for (vhd_file, json_file, base_name), result in zip(test_files_real,
+                                                          results):
+        print(base_name + ": ", end='')
+        if result["file"] != vhd_file:
+            failures = True
+            print("\x1b[31m✗")
+            print("Results are out of order!\x1b[0m")
+            continue
+
+        if json_file:
+            with open(json_file, 'r') as inf:
+                reference = json.load(inf)
+            if not result["ok"] or result["tree"] != reference:
+                failures = True
+                print("\x1b[31m✗")
+                print("Test output mismatch!\x1b[0m")
+                print(json.dumps(result, indent=4, sort_keys=True))
+                continue
+        elif result["ok"]:
+            failures = True
+            print("\x1b[31m✗")
+            print("Parsing succeeded when it should not!\x1b[0m")
+            continue
+
+        print("\x1b[32m✓\x1b[0m")
+
+    return failures
+
+
 # FIXME: Fix copypasta
 def do_analyser_json_tests():
     print("*" * 80)
@@ -254,6 +317,62 @@ def do_analyser_json_tests():
     return failures
 
 
+def do_analyser_compiled_library_tests():
+    print("*" * 80)
+    print("Running analyser compiled library tests...")
+    print("*" * 80)
+
+    # Each test that should pass is analyzed into a compiled library, and then
+    # the library is loaded again without analyzing anything. The second run
+    # must print the same design database as the reference.
+    failures = False
+    for f in sorted(os.listdir("analyser_json_tests")):
+        name, ext = f.rsplit(".", 1)
+        vhd_file = "analyser_json_tests/" + name + ".vhd"
+        json_file = "analyser_json_tests/" + name + ".json"
+        if ext != "json" or not os.path.isfile(vhd_file):
+            continue
+        print(name + ": ", end='')
+
+        with open(json_file, 'r') as inf:
+            reference = json.load(inf)
+
+        with tempfile.TemporaryDirectory() as lib_dir:
+            subp1 = subprocess.run(['./vhdl_analyzer', '--lib-dir', lib_dir,
+                                    'worklib', vhd_file],
+                                   stdout=subprocess.PIPE,
+                                   stderr=subprocess.PIPE)
+            subp2 = subprocess.run(['./vhdl_analyzer', '--lib-dir', lib_dir,
+                                    'worklib'],
+                                   stdout=subprocess.PIPE,
+                                   stderr=subprocess.PIPE)
+
+        try:
+            if subp1.returncode != 0 or subp2.returncode != 0:
+                raise Exception("vhdl_analyzer failed")
+            last_line = subp2.stdout.strip().split(b'\n')[-1]
+            prog_output = json.loads(last_line.decode('ascii'))
+        except Exception:
+            failures = True
+            print("\x1b[31m✗")
+            print("Bad analyzer output!\x1b[0m")
+            print("\x1b[33m----- stdout -----\x1b[0m")
+            sys.stdout.buffer.write(subp1.stdout + subp2.stdout)
+            print("\x1b[33m----- stderr -----\x1b[0m")
+            sys.stdout.buffer.write(subp1.stderr + subp2.stderr)
+            continue
+
+        if do_set_hack(prog_output) != do_set_hack(reference):
+            failures = True
+            print("\x1b[31m✗")
+            print("Test output mismatch after reloading!\x1b[0m")
+            print(json.dumps(prog_output, indent=4, sort_keys=True))
+        else:
+            print("\x1b[32m✓\x1b[0m")
+
+    return failures
+
+
 def main():
     # I have been burned too many times by this flakiness, so we first set our
     # CWD to "definitely where this file is" which also must be in the root
@@ -262,7 +381,13 @@ def main():
 
     failures = False
     failures = failures or do_parser_tests()
+    # Same tests again, but through the packed tree format and back
+    failures = failures or do_parser_tests(['--round-trip'])
+    # And with identical subtrees shared
+    failures = failures or do_parser_tests(['--intern'])
+    failures = failures or do_parser_batch_tests()
     failures = failures or do_analyser_json_tests()
+    failures = failures or do_analyser_compiled_library_tests()
 
     if failures:
         print("\x1b[31mThere were test failures!\x1b[0m")